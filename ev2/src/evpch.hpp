@@ -31,6 +31,7 @@
 #include <map>
 #include <list>
 #include <queue>
+#include <deque>
 #include <array>
 
 #include <cassert>
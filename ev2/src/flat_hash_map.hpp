@@ -0,0 +1,222 @@
+/**
+ * @file flat_hash_map.hpp
+ * @brief Open addressing hash map for 64 bit keys
+ * @date 2023-06-07
+ *
+ *
+ */
+#ifndef EV2_FLAT_HASH_MAP_HPP
+#define EV2_FLAT_HASH_MAP_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace ev2 {
+
+/**
+ * @brief splitmix64 finalizer, every input bit affects every output bit
+ *
+ * @param x
+ * @return std::uint64_t
+ */
+inline std::uint64_t mix64(std::uint64_t x) noexcept {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * @brief pack two 32 bit values into one key
+ *
+ * @param a high bits
+ * @param b low bits
+ * @return std::uint64_t
+ */
+inline std::uint64_t pack_key(std::int32_t a, std::int32_t b) noexcept {
+    return (std::uint64_t)(std::uint32_t)a << 32 | (std::uint32_t)b;
+}
+
+/**
+ * @brief Hash map from 64 bit keys to values, stored in one flat array with linear probing.
+ *  Keys are spread with mix64, so structured keys (packed coordinates, sequential ids) do not cluster.
+ *  Erase shifts the following entries back instead of leaving tombstones, so lookups stay short
+ *  under heavy insert and erase traffic.
+ *
+ *  Pointers to values are invalidated by any insert or erase. Value must be default constructible.
+ *
+ * @tparam Value
+ */
+template<typename Value>
+class FlatHashMap {
+public:
+    using key_type = std::uint64_t;
+
+    FlatHashMap() = default;
+    explicit FlatHashMap(std::size_t n) { reserve(n); }
+
+    Value* find(key_type key) noexcept {
+        return const_cast<Value*>(const_cast<const FlatHashMap*>(this)->find(key));
+    }
+
+    const Value* find(key_type key) const noexcept {
+        if (m_size == 0)
+            return nullptr;
+        for (std::size_t i = home(key);; i = (i + 1) & m_mask) {
+            if (!m_full[i])
+                return nullptr;
+            if (m_slots[i].key == key)
+                return &m_slots[i].value;
+        }
+    }
+
+    bool contains(key_type key) const noexcept {return find(key) != nullptr;}
+
+    /**
+     * @brief insert a value constructed from args if key is not in the map
+     *
+     * @param key
+     * @param args
+     * @return std::pair<Value*, bool> value for key, true if it was inserted
+     */
+    template<typename... Args>
+    std::pair<Value*, bool> try_emplace(key_type key, Args&&... args) {
+        if ((m_size + 1) * 4 > m_slots.size() * 3)
+            rehash(m_slots.empty() ? 16 : m_slots.size() * 2);
+
+        std::size_t i = home(key);
+        for (; m_full[i]; i = (i + 1) & m_mask) {
+            if (m_slots[i].key == key)
+                return {&m_slots[i].value, false};
+        }
+        m_slots[i].key = key;
+        m_slots[i].value = Value{std::forward<Args>(args)...};
+        m_full[i] = 1;
+        ++m_size;
+        return {&m_slots[i].value, true};
+    }
+
+    Value& operator[](key_type key) {
+        return *try_emplace(key).first;
+    }
+
+    /**
+     * @brief remove key
+     *
+     * @param key
+     * @return true if the key was in the map
+     */
+    bool erase(key_type key) {
+        if (m_size == 0)
+            return false;
+        std::size_t i = home(key);
+        for (;; i = (i + 1) & m_mask) {
+            if (!m_full[i])
+                return false;
+            if (m_slots[i].key == key)
+                break;
+        }
+
+        // shift back entries whose probe sequence passes through the hole
+        for (std::size_t j = i;;) {
+            j = (j + 1) & m_mask;
+            if (!m_full[j])
+                break;
+            const std::size_t k = home(m_slots[j].key);
+            const bool stays = i <= j ? (i < k && k <= j) : (i < k || k <= j);
+            if (stays)
+                continue;
+            m_slots[i] = std::move(m_slots[j]);
+            i = j;
+        }
+        m_slots[i].value = Value{};
+        m_full[i] = 0;
+        --m_size;
+        return true;
+    }
+
+    std::size_t size() const noexcept {return m_size;}
+    bool empty() const noexcept {return m_size == 0;}
+    std::size_t capacity() const noexcept {return m_slots.size();}
+
+    void clear() {
+        m_slots.assign(m_slots.size(), Slot{});
+        m_full.assign(m_full.size(), 0);
+        m_size = 0;
+    }
+
+    /**
+     * @brief make room for n entries without rehashing
+     *
+     * @param n
+     */
+    void reserve(std::size_t n) {
+        std::size_t cap = 16;
+        while (n * 4 > cap * 3)
+            cap *= 2;
+        if (cap > m_slots.size())
+            rehash(cap);
+    }
+
+    /**
+     * @brief call fn(key, value) for every entry, in slot order
+     *
+     * @param fn
+     */
+    template<typename Fn>
+    void for_each(Fn&& fn) {
+        for (std::size_t i = 0; i < m_slots.size(); ++i)
+            if (m_full[i])
+                fn(m_slots[i].key, m_slots[i].value);
+    }
+
+    template<typename Fn>
+    void for_each(Fn&& fn) const {
+        for (std::size_t i = 0; i < m_slots.size(); ++i)
+            if (m_full[i])
+                fn(m_slots[i].key, m_slots[i].value);
+    }
+
+private:
+    struct Slot {
+        key_type key = 0;
+        Value value{};
+    };
+
+    std::size_t home(key_type key) const noexcept {
+        return (std::size_t)mix64(key) & m_mask;
+    }
+
+    void rehash(std::size_t capacity) {
+        assert((capacity & (capacity - 1)) == 0);
+        std::vector<Slot> slots(capacity);
+        std::vector<std::uint8_t> full(capacity, 0);
+        std::swap(slots, m_slots);
+        std::swap(full, m_full);
+        m_mask = capacity - 1;
+
+        for (std::size_t s = 0; s < slots.size(); ++s) {
+            if (!full[s])
+                continue;
+            std::size_t i = home(slots[s].key);
+            while (m_full[i])
+                i = (i + 1) & m_mask;
+            m_slots[i] = std::move(slots[s]);
+            m_full[i] = 1;
+        }
+    }
+
+    std::vector<Slot> m_slots{};
+    std::vector<std::uint8_t> m_full{};
+    std::size_t m_size = 0;
+    std::size_t m_mask = 0;
+};
+
+} // namespace ev2
+
+#endif // EV2_FLAT_HASH_MAP_HPP
@@ -0,0 +1,120 @@
+/**
+ * @file thread_pool.hpp
+ * @brief
+ * @date 2023-06-06
+ *
+ *
+ */
+#ifndef EV2_THREAD_POOL_HPP
+#define EV2_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data parallel loops. The calling thread takes part in
+// every loop, so a pool of size 1 has no workers and runs everything inline.
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned n_threads = std::max(1u, std::thread::hardware_concurrency())) {
+        n_threads = std::max(1u, n_threads);
+        for (unsigned i = 1; i < n_threads; ++i)
+            m_workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            m_stop = true;
+        }
+        c_job.notify_all();
+        for (auto& t : m_workers)
+            t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // number of threads taking part in a loop, including the caller
+    unsigned size() const noexcept { return (unsigned)m_workers.size() + 1; }
+
+    // Call fn(begin, end, thread_index) over chunks of [0, n) and wait for all of them.
+    // thread_index is in [0, size()), 0 is the calling thread. Not reentrant.
+    void parallel_for(std::size_t n, const std::function<void(std::size_t, std::size_t, unsigned)>& fn, std::size_t grain = 0) {
+        if (n == 0)
+            return;
+        if (grain == 0)
+            grain = std::max<std::size_t>(1, n / (size() * 8));
+        if (m_workers.empty() || n <= grain) {
+            fn(0, n, 0);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m);
+            m_job = &fn;
+            m_n = n;
+            m_grain = grain;
+            m_next.store(0, std::memory_order_relaxed);
+            m_active = (unsigned)m_workers.size();
+            ++m_generation;
+        }
+        c_job.notify_all();
+
+        run_chunks(0);
+
+        std::unique_lock<std::mutex> lock(m);
+        c_done.wait(lock, [this] { return m_active == 0; });
+        m_job = nullptr;
+    }
+
+private:
+    void run_chunks(unsigned thread_index) {
+        const auto& fn = *m_job;
+        while (true) {
+            const std::size_t begin = m_next.fetch_add(m_grain, std::memory_order_relaxed);
+            if (begin >= m_n)
+                break;
+            fn(begin, std::min(begin + m_grain, m_n), thread_index);
+        }
+    }
+
+    void worker_loop(unsigned thread_index) {
+        std::uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m);
+                c_job.wait(lock, [&] { return m_stop || m_generation != seen; });
+                if (m_stop)
+                    return;
+                seen = m_generation;
+            }
+
+            run_chunks(thread_index);
+
+            std::lock_guard<std::mutex> lock(m);
+            if (--m_active == 0)
+                c_done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> m_workers;
+    std::mutex m;
+    std::condition_variable c_job;
+    std::condition_variable c_done;
+
+    const std::function<void(std::size_t, std::size_t, unsigned)>* m_job = nullptr;
+    std::size_t m_n = 0;
+    std::size_t m_grain = 1;
+    std::atomic<std::size_t> m_next{0};
+    unsigned m_active = 0;
+    std::uint64_t m_generation = 0;
+    bool m_stop = false;
+};
+
+#endif // EV2_THREAD_POOL_HPP
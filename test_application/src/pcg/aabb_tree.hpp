@@ -0,0 +1,569 @@
+/**
+ * @file aabb_tree.hpp
+ * @brief Dynamic bounding volume tree over spheres, for overlap, radius and nearest neighbor queries
+ * @date 2023-06-16
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef EV2_PCG_AABB_TREE_HPP
+#define EV2_PCG_AABB_TREE_HPP
+
+#include "evpch.hpp"
+
+#include <queue>
+
+#include <glm/glm.hpp>
+
+#include "flat_hash_map.hpp"
+
+namespace ev2::pcg {
+
+/**
+ * @brief Binary tree of axis aligned boxes with one sphere per leaf. Inner boxes bound their
+ *  children, leaves hold a loose box, the box of the sphere grown by a fraction of its radius.
+ *
+ *  Inserting walks down to the sibling that grows the surface area of the tree the least, then
+ *  rotates on the way back up to keep the heights of sibling subtrees within one of each other,
+ *  so the height stays logarithmic in the number of items whatever the insertion order.
+ *
+ *  Moving or resizing an item within its loose box only rewrites the leaf. Leaving it removes
+ *  and reinserts the leaf. Queries test the exact spheres at the leaves.
+ *
+ *  Every node also keeps the sum of the radii of its leaves and their radius weighted mean
+ *  center, for Barnes-Hut style far field sums, see for_each_far_field().
+ *
+ * @tparam T item, a pointer or an integer id
+ */
+template<typename T>
+class AABBTree {
+public:
+    /**
+     * @brief
+     *
+     * @param loose_fac leaf boxes are grown by loose_fac * radius on every side
+     */
+    explicit AABBTree(float loose_fac = 0.25f) : m_loose_fac{loose_fac} {
+        assert(loose_fac >= 0.f);
+    }
+
+    /**
+     * @brief insert an item, or refit an item that is already in the tree
+     *
+     * @param item
+     * @param center
+     * @param radius
+     */
+    void update(T item, const glm::vec3& center, float radius) {
+        auto [index, inserted] = m_item_index.try_emplace(item_key(item), Null);
+        if (inserted) {
+            const int leaf = allocate();
+            *index = leaf; // allocate() may not touch m_item_index, index is still valid
+            TreeNode& node = m_nodes[leaf];
+            node.item = item;
+            node.center = center;
+            node.radius = radius;
+            node.box = loose_box(center, radius);
+            node.set_leaf_weight();
+            insert_leaf(leaf);
+            return;
+        }
+
+        const int leaf = *index;
+        TreeNode& node = m_nodes[leaf];
+        node.center = center;
+        node.radius = radius;
+        node.set_leaf_weight();
+        if (encloses(node.box, sphere_box(center, radius))) {
+            refit_weights(node.parent);
+            return;
+        }
+        remove_leaf(leaf);
+        m_nodes[leaf].box = loose_box(center, radius);
+        insert_leaf(leaf);
+    }
+
+    /**
+     * @brief remove an item
+     *
+     * @param item
+     * @return true if the item was in the tree
+     */
+    bool remove(T item) {
+        const int* index = m_item_index.find(item_key(item));
+        if (!index)
+            return false;
+        const int leaf = *index;
+        m_item_index.erase(item_key(item));
+        remove_leaf(leaf);
+        release(leaf);
+        return true;
+    }
+
+    bool contains(T item) const noexcept {return m_item_index.find(item_key(item)) != nullptr;}
+
+    /**
+     * @brief call fn(item) for every item whose sphere intersects the sphere (center, radius),
+     *  that is whose center is closer than the sum of the radii
+     *
+     * @tparam Fn
+     * @param center
+     * @param radius
+     * @param fn
+     */
+    template<typename Fn>
+    void for_each_intersecting(const glm::vec3& center, float radius, Fn&& fn) const {
+        any_intersecting(center, radius, [&fn](T item) {fn(item); return false;});
+    }
+
+    /**
+     * @brief stop at the first item whose sphere intersects the sphere (center, radius) and for
+     *  which pred(item) is true
+     *
+     * @tparam Pred
+     * @param center
+     * @param radius
+     * @param pred
+     * @return true if there is such an item
+     */
+    template<typename Pred>
+    bool any_intersecting(const glm::vec3& center, float radius, Pred&& pred) const {
+        const Box query = sphere_box(center, radius);
+        return search(query, [&, this](const TreeNode& leaf) {
+            const glm::vec3 d = leaf.center - center;
+            const float r = radius + leaf.radius;
+            return glm::dot(d, d) < r * r && pred(leaf.item);
+        });
+    }
+
+    /**
+     * @brief call fn(item) for every item with its center closer than radius to center
+     *
+     * @tparam Fn
+     * @param center
+     * @param radius
+     * @param fn
+     */
+    template<typename Fn>
+    void for_each_within(const glm::vec3& center, float radius, Fn&& fn) const {
+        const Box query = sphere_box(center, radius);
+        search(query, [&](const TreeNode& leaf) {
+            const glm::vec3 d = leaf.center - center;
+            if (glm::dot(d, d) < radius * radius)
+                fn(leaf.item);
+            return false;
+        });
+    }
+
+    /**
+     * @brief the k items with centers nearest to p, nearest first. Subtrees are opened in order
+     *  of the distance to their box and skipped once they are further than the k-th best.
+     *
+     * @param p
+     * @param k
+     * @param out replaced with at most k items
+     */
+    void k_nearest(const glm::vec3& p, int k, std::vector<T>& out) const {
+        out.clear();
+        if (k <= 0 || m_root == Null)
+            return;
+
+        using Candidate = std::pair<float, int>; // squared distance, node
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> open{};
+        std::priority_queue<Candidate> best{};
+        open.push({box_distance2(m_nodes[m_root].box, p), m_root});
+        while (!open.empty()) {
+            const auto [d2, i] = open.top();
+            if ((int)best.size() == k && d2 >= best.top().first)
+                break;
+            open.pop();
+
+            const TreeNode& node = m_nodes[i];
+            if (node.is_leaf()) {
+                const glm::vec3 d = node.center - p;
+                const float c2 = glm::dot(d, d);
+                if ((int)best.size() < k) {
+                    best.push({c2, i});
+                } else if (c2 < best.top().first) {
+                    best.pop();
+                    best.push({c2, i});
+                }
+            } else {
+                open.push({box_distance2(m_nodes[node.left].box, p), node.left});
+                open.push({box_distance2(m_nodes[node.right].box, p), node.right});
+            }
+        }
+
+        out.resize(best.size());
+        for (int j = (int)best.size() - 1; j >= 0; --j) {
+            out[j] = m_nodes[best.top().second].item;
+            best.pop();
+        }
+    }
+
+    /**
+     * @brief Barnes-Hut traversal of the tree from p. A subtree whose box does not hold p and
+     *  whose largest box side is below opening_angle times the distance from p to its weighted
+     *  center is summarized by cluster_fn(weighted center, sum of radii), otherwise it is opened.
+     *  Leaves reached go to leaf_fn(item, center, radius). An opening angle of 0 opens every
+     *  subtree, every leaf is reached.
+     *
+     * @tparam LeafFn
+     * @tparam ClusterFn
+     * @param p
+     * @param opening_angle
+     * @param leaf_fn
+     * @param cluster_fn
+     */
+    template<typename LeafFn, typename ClusterFn>
+    void for_each_far_field(const glm::vec3& p, float opening_angle, LeafFn&& leaf_fn, ClusterFn&& cluster_fn) const {
+        const float angle2 = opening_angle * opening_angle;
+        traverse([&, this](const TreeNode& node) {
+            if (node.is_leaf()) {
+                leaf_fn(node.item, node.center, node.radius);
+                return false;
+            }
+            if (node.weight <= 0.f)
+                return false;
+            const glm::vec3 mean = node.moment / node.weight;
+            const glm::vec3 d = mean - p;
+            const glm::vec3 e = node.box.hi - node.box.lo;
+            const float side = std::max(e.x, std::max(e.y, e.z));
+            if (box_distance2(node.box, p) > 0.f && side * side < angle2 * glm::dot(d, d)) {
+                cluster_fn(mean, node.weight);
+                return false;
+            }
+            return true;
+        });
+    }
+
+    void clear() {
+        m_nodes.clear();
+        m_free = Null;
+        m_root = Null;
+        m_item_index.clear();
+    }
+
+    std::size_t size() const noexcept {return m_item_index.size();}
+
+    /**
+     * @brief height of the root, 0 for a single leaf and -1 when empty
+     *
+     * @return int
+     */
+    int height() const noexcept {return m_root == Null ? -1 : m_nodes[m_root].height;}
+
+private:
+    static constexpr int Null = -1;
+
+    struct Box {
+        glm::vec3 lo, hi;
+    };
+
+    struct TreeNode {
+        Box box{};
+        int parent = Null;      // next free node while on the free list
+        int left = Null;        // Null for leaves
+        int right = Null;
+        int height = 0;         // leaves are 0
+        T item{};               // leaves only
+        glm::vec3 center{};
+        float radius = 0.f;
+        float weight = 0.f;     // sum of the radii of the leaves below
+        glm::vec3 moment{};     // sum of radius * center of the leaves below
+
+        bool is_leaf() const noexcept {return left == Null;}
+
+        void set_leaf_weight() noexcept {
+            weight = radius;
+            moment = radius * center;
+        }
+    };
+
+    static std::uint64_t item_key(T item) noexcept {
+        if constexpr (std::is_pointer_v<T>)
+            return (std::uint64_t)reinterpret_cast<std::uintptr_t>(item);
+        else
+            return (std::uint64_t)item;
+    }
+
+    static Box sphere_box(const glm::vec3& center, float radius) noexcept {
+        return {center - glm::vec3{radius}, center + glm::vec3{radius}};
+    }
+
+    Box loose_box(const glm::vec3& center, float radius) const noexcept {
+        return sphere_box(center, radius * (1.f + m_loose_fac));
+    }
+
+    static Box merge(const Box& a, const Box& b) noexcept {
+        return {glm::min(a.lo, b.lo), glm::max(a.hi, b.hi)};
+    }
+
+    static bool encloses(const Box& outer, const Box& inner) noexcept {
+        return outer.lo.x <= inner.lo.x && outer.lo.y <= inner.lo.y && outer.lo.z <= inner.lo.z &&
+               inner.hi.x <= outer.hi.x && inner.hi.y <= outer.hi.y && inner.hi.z <= outer.hi.z;
+    }
+
+    static bool overlaps(const Box& a, const Box& b) noexcept {
+        return a.lo.x <= b.hi.x && b.lo.x <= a.hi.x && a.lo.y <= b.hi.y && b.lo.y <= a.hi.y &&
+               a.lo.z <= b.hi.z && b.lo.z <= a.hi.z;
+    }
+
+    static float area(const Box& b) noexcept {
+        const glm::vec3 e = b.hi - b.lo;
+        return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+
+    static float box_distance2(const Box& b, const glm::vec3& p) noexcept {
+        const glm::vec3 d = glm::max(glm::max(b.lo - p, p - b.hi), glm::vec3{0.f});
+        return glm::dot(d, d);
+    }
+
+    int allocate() {
+        if (m_free == Null) {
+            m_nodes.emplace_back();
+            return (int)m_nodes.size() - 1;
+        }
+        const int i = m_free;
+        m_free = m_nodes[i].parent;
+        m_nodes[i] = TreeNode{};
+        return i;
+    }
+
+    void release(int i) {
+        m_nodes[i].parent = m_free;
+        m_nodes[i].left = m_nodes[i].right = Null;
+        m_free = i;
+    }
+
+    void insert_leaf(int leaf) {
+        if (m_root == Null) {
+            m_root = leaf;
+            m_nodes[leaf].parent = Null;
+            return;
+        }
+
+        // descend to the sibling that adds the least surface area, counting the growth of the
+        // boxes above it that every choice below a node pays
+        const Box box = m_nodes[leaf].box;
+        int i = m_root;
+        while (!m_nodes[i].is_leaf()) {
+            const TreeNode& node = m_nodes[i];
+            const float node_area = area(node.box);
+            const float merged_area = area(merge(node.box, box));
+            const float here = 2.f * merged_area;
+            const float inherited = 2.f * (merged_area - node_area);
+            auto descend_cost = [&, this](int c) {
+                const Box& child = m_nodes[c].box;
+                const float grown = area(merge(child, box));
+                return m_nodes[c].is_leaf() ? grown + inherited : grown - area(child) + inherited;
+            };
+            const float left_cost = descend_cost(node.left);
+            const float right_cost = descend_cost(node.right);
+            if (here < left_cost && here < right_cost)
+                break;
+            i = left_cost < right_cost ? node.left : node.right;
+        }
+
+        const int sibling = i;
+        const int old_parent = m_nodes[sibling].parent;
+        const int parent = allocate();
+        m_nodes[parent].parent = old_parent;
+        m_nodes[parent].box = merge(box, m_nodes[sibling].box);
+        m_nodes[parent].height = m_nodes[sibling].height + 1;
+        set_inner_weight(parent, sibling, leaf);
+        m_nodes[parent].left = sibling;
+        m_nodes[parent].right = leaf;
+        m_nodes[sibling].parent = parent;
+        m_nodes[leaf].parent = parent;
+        if (old_parent == Null)
+            m_root = parent;
+        else
+            replace_child(old_parent, sibling, parent);
+
+        refit_ancestors(m_nodes[leaf].parent);
+    }
+
+    void remove_leaf(int leaf) {
+        if (leaf == m_root) {
+            m_root = Null;
+            return;
+        }
+        const int parent = m_nodes[leaf].parent;
+        const int grandparent = m_nodes[parent].parent;
+        const int sibling = m_nodes[parent].left == leaf ? m_nodes[parent].right : m_nodes[parent].left;
+        m_nodes[sibling].parent = grandparent;
+        release(parent);
+        if (grandparent == Null) {
+            m_root = sibling;
+        } else {
+            replace_child(grandparent, parent, sibling);
+            refit_ancestors(grandparent);
+        }
+    }
+
+    void replace_child(int parent, int old_child, int new_child) noexcept {
+        if (m_nodes[parent].left == old_child)
+            m_nodes[parent].left = new_child;
+        else
+            m_nodes[parent].right = new_child;
+    }
+
+    // rebalance, then recompute the box and height of i and every node above it
+    void refit_ancestors(int i) {
+        while (i != Null) {
+            i = balance(i);
+            TreeNode& node = m_nodes[i];
+            const TreeNode& left = m_nodes[node.left];
+            const TreeNode& right = m_nodes[node.right];
+            node.height = 1 + std::max(left.height, right.height);
+            node.box = merge(left.box, right.box);
+            set_inner_weight(i, node.left, node.right);
+            i = node.parent;
+        }
+    }
+
+    // recompute the weights of i and every node above it, when a leaf moved within its box
+    void refit_weights(int i) noexcept {
+        while (i != Null) {
+            set_inner_weight(i, m_nodes[i].left, m_nodes[i].right);
+            i = m_nodes[i].parent;
+        }
+    }
+
+    void set_inner_weight(int i, int left, int right) noexcept {
+        m_nodes[i].weight = m_nodes[left].weight + m_nodes[right].weight;
+        m_nodes[i].moment = m_nodes[left].moment + m_nodes[right].moment;
+    }
+
+    /**
+     * @brief rotate the taller child of a up when the heights of the children of a differ by more
+     *  than one
+     *
+     * @param a
+     * @return int the node now at the position of a
+     */
+    int balance(int a) {
+        if (m_nodes[a].is_leaf() || m_nodes[a].height < 2)
+            return a;
+        const int b = m_nodes[a].left;
+        const int c = m_nodes[a].right;
+        const int diff = m_nodes[c].height - m_nodes[b].height;
+        if (diff > 1)
+            return rotate_up(a, c, b, false);
+        if (diff < -1)
+            return rotate_up(a, b, c, true);
+        return a;
+    }
+
+    /**
+     * @brief make child the parent of a. The taller child of child stays under it, the shorter one
+     *  takes the place of child under a.
+     *
+     * @param a
+     * @param child the taller child of a
+     * @param other the other child of a
+     * @param child_is_left
+     * @return int child
+     */
+    int rotate_up(int a, int child, int other, bool child_is_left) {
+        const int f = m_nodes[child].left;
+        const int g = m_nodes[child].right;
+
+        m_nodes[child].left = a;
+        m_nodes[child].parent = m_nodes[a].parent;
+        m_nodes[a].parent = child;
+        if (m_nodes[child].parent == Null)
+            m_root = child;
+        else
+            replace_child(m_nodes[child].parent, a, child);
+
+        const bool f_taller = m_nodes[f].height > m_nodes[g].height;
+        const int keep = f_taller ? f : g;
+        const int move = f_taller ? g : f;
+        m_nodes[child].right = keep;
+        if (child_is_left)
+            m_nodes[a].left = move;
+        else
+            m_nodes[a].right = move;
+        m_nodes[move].parent = a;
+
+        m_nodes[a].box = merge(m_nodes[other].box, m_nodes[move].box);
+        m_nodes[a].height = 1 + std::max(m_nodes[other].height, m_nodes[move].height);
+        set_inner_weight(a, other, move);
+        m_nodes[child].box = merge(m_nodes[a].box, m_nodes[keep].box);
+        m_nodes[child].height = 1 + std::max(m_nodes[a].height, m_nodes[keep].height);
+        set_inner_weight(child, a, keep);
+        return child;
+    }
+
+    /**
+     * @brief depth first over the nodes whose boxes overlap query, stops when visit(leaf) is true
+     *
+     */
+    template<typename Visit>
+    bool search(const Box& query, Visit&& visit) const {
+        bool found = false;
+        traverse([&](const TreeNode& node) {
+            if (!overlaps(node.box, query))
+                return false;
+            if (node.is_leaf()) {
+                found = visit(node);
+                return false;
+            }
+            return true;
+        }, found);
+        return found;
+    }
+
+    /**
+     * @brief depth first from the root, the children of a node are visited when open(node) is
+     *  true. Stops early once stop is set.
+     *
+     */
+    template<typename Open>
+    void traverse(Open&& open, const bool& stop = false) const {
+        if (m_root == Null)
+            return;
+        // the height is logarithmic, the stack only grows past the inline part for huge trees
+        constexpr int inline_size = 64;
+        int inline_stack[inline_size];
+        std::vector<int> overflow{};
+        int top = 0;
+        auto push = [&](int i) {
+            if (top < inline_size)
+                inline_stack[top] = i;
+            else
+                overflow.push_back(i);
+            ++top;
+        };
+        auto pop = [&]() {
+            --top;
+            if (top < inline_size)
+                return inline_stack[top];
+            const int i = overflow.back();
+            overflow.pop_back();
+            return i;
+        };
+
+        push(m_root);
+        while (top > 0 && !stop) {
+            const TreeNode& node = m_nodes[pop()];
+            if (open(node)) {
+                push(node.left);
+                push(node.right);
+            }
+        }
+    }
+
+private:
+    float m_loose_fac;
+    int m_root = Null;
+    int m_free = Null;                      // head of the free list, linked through parent
+    std::vector<TreeNode> m_nodes{};
+    ev2::FlatHashMap<int> m_item_index{};   // item key -> leaf
+};
+
+} // namespace ev2::pcg
+
+#endif // EV2_PCG_AABB_TREE_HPP
@@ -28,6 +28,11 @@ public:
                 if (j > 0) m_sparse_graph.add_edge(node, m_grid[i * width + (j-1)].get(), 1.f);
                 if (i > 0) m_sparse_graph.add_edge(node, m_grid[(i-1) * width + j].get(), 1.f);
             }
+
+        std::vector<wfc::DGraphNode*> nodes{};
+        for (auto& n : m_grid)
+            nodes.push_back(n.get());
+        m_grid_graph = wfc::GridGraph<wfc::DGraphNode>{width, height, nodes};
     }
 
     ~NodeGrid() {
@@ -43,7 +48,7 @@ public:
         for (int y = 0; y < height; ++y) {
             for(int x = 0; x < width; ++x) {
                 auto* n = at(x, y);
-                n->domain = patterns;
+                n->set_domain(patterns);
             }
         }
     }
@@ -62,6 +67,13 @@ public:
 
     auto& get_graph() {return m_sparse_graph;}
 
+    /**
+     * @brief same topology as get_graph(), with neighbors found by index
+     *
+     * @return wfc::GridGraph<wfc::DGraphNode>&
+     */
+    auto& get_grid_graph() {return m_grid_graph;}
+
 private:
     friend std::string to_string(const NodeGrid& node_grid) {
         std::stringstream str;
@@ -99,6 +111,7 @@ public:
 private:
     std::vector<std::unique_ptr<wfc::DGraphNode>> m_grid;
     wfc::SparseGraph<wfc::DGraphNode> m_sparse_graph;
+    wfc::GridGraph<wfc::DGraphNode> m_grid_graph{};
 };
 
 }
@@ -0,0 +1,205 @@
+/**
+ * @file indexed_heap.hpp
+ * @brief Binary heap with a key -> position index, supporting priority updates and removal
+ * @date 2023-06-02
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef EV2_PCG_INDEXED_HEAP_HPP
+#define EV2_PCG_INDEXED_HEAP_HPP
+
+#include "evpch.hpp"
+
+namespace ev2::pcg {
+
+/**
+ * @brief Binary heap where each entry is identified by a key. The position of every key is
+ *  tracked so that its priority can be changed (in either direction) or the entry removed
+ *  in O(log n). The top is the entry ordered first by Compare, entries with equal priority
+ *  come out in insertion order.
+ *
+ * @tparam Key      identifies an entry, must be hashable
+ * @tparam Value    stored with the entry and returned by top() and pop()
+ * @tparam Priority
+ * @tparam Compare  std::less gives a min heap
+ */
+template<typename Key, typename Value, typename Priority = float, typename Compare = std::less<Priority>>
+class IndexedHeap {
+public:
+    IndexedHeap() = default;
+    explicit IndexedHeap(Compare compare) : m_compare{std::move(compare)} {}
+
+    /**
+     * @brief insert an entry, or update the value and priority of an existing key
+     *
+     * @param key
+     * @param value
+     * @param priority
+     * @return true if the key was inserted
+     */
+    bool push(const Key& key, const Value& value, Priority priority) {
+        if (auto itr = m_position.find(key); itr != m_position.end()) {
+            m_heap[itr->second].value = value;
+            set_priority(itr->second, priority);
+            return false;
+        }
+        const std::size_t pos = m_heap.size();
+        m_heap.push_back(Entry{key, value, priority, m_sequence++});
+        m_position.insert({key, pos});
+        sift_up(pos);
+        return true;
+    }
+
+    /**
+     * @brief change the priority of an existing key
+     *
+     * @param key
+     * @param priority
+     * @return true if the key was in the heap
+     */
+    bool update(const Key& key, Priority priority) {
+        auto itr = m_position.find(key);
+        if (itr == m_position.end())
+            return false;
+        set_priority(itr->second, priority);
+        return true;
+    }
+
+    /**
+     * @brief remove the entry for key
+     *
+     * @param key
+     * @return true if the key was in the heap
+     */
+    bool remove(const Key& key) {
+        auto itr = m_position.find(key);
+        if (itr == m_position.end())
+            return false;
+        const std::size_t pos = itr->second;
+        m_position.erase(itr);
+        remove_at(pos);
+        return true;
+    }
+
+    bool contains(const Key& key) const {
+        return m_position.find(key) != m_position.end();
+    }
+
+    const Value& top() const {
+        assert(!empty());
+        return m_heap.front().value;
+    }
+
+    Priority top_priority() const {
+        assert(!empty());
+        return m_heap.front().priority;
+    }
+
+    /**
+     * @brief remove the top entry
+     *
+     * @return Value
+     */
+    Value pop() {
+        assert(!empty());
+        Value top = std::move(m_heap.front().value);
+        m_position.erase(m_heap.front().key);
+        remove_at(0);
+        return top;
+    }
+
+    std::size_t size() const noexcept {return m_heap.size();}
+    bool empty() const noexcept {return m_heap.empty();}
+
+    void clear() {
+        m_heap.clear();
+        m_position.clear();
+    }
+
+    void reserve(std::size_t n) {
+        m_heap.reserve(n);
+        m_position.reserve(n);
+    }
+
+private:
+    struct Entry {
+        Key key;
+        Value value;
+        Priority priority;
+        std::uint64_t sequence; // insertion order, breaks ties
+    };
+
+    bool before(const Entry& a, const Entry& b) const {
+        if (m_compare(a.priority, b.priority))
+            return true;
+        if (m_compare(b.priority, a.priority))
+            return false;
+        return a.sequence < b.sequence;
+    }
+
+    void set_priority(std::size_t pos, Priority priority) {
+        m_heap[pos].priority = priority;
+        sift_up(pos);
+        sift_down(m_position[m_heap[pos].key]);
+    }
+
+    /**
+     * @brief remove the entry at pos, its key must already be erased from m_position
+     *
+     * @param pos
+     */
+    void remove_at(std::size_t pos) {
+        const std::size_t last = m_heap.size() - 1;
+        if (pos != last) {
+            m_heap[pos] = std::move(m_heap[last]);
+            m_position[m_heap[pos].key] = pos;
+            m_heap.pop_back();
+            sift_up(pos);
+            sift_down(m_position[m_heap[pos].key]);
+        } else
+            m_heap.pop_back();
+    }
+
+    void swap_entries(std::size_t a, std::size_t b) {
+        std::swap(m_heap[a], m_heap[b]);
+        m_position[m_heap[a].key] = a;
+        m_position[m_heap[b].key] = b;
+    }
+
+    void sift_up(std::size_t pos) {
+        while (pos > 0) {
+            const std::size_t parent = (pos - 1) / 2;
+            if (!before(m_heap[pos], m_heap[parent]))
+                break;
+            swap_entries(pos, parent);
+            pos = parent;
+        }
+    }
+
+    void sift_down(std::size_t pos) {
+        const std::size_t n = m_heap.size();
+        while (true) {
+            const std::size_t left = 2 * pos + 1;
+            const std::size_t right = left + 1;
+            std::size_t first = pos;
+            if (left < n && before(m_heap[left], m_heap[first]))
+                first = left;
+            if (right < n && before(m_heap[right], m_heap[first]))
+                first = right;
+            if (first == pos)
+                break;
+            swap_entries(pos, first);
+            pos = first;
+        }
+    }
+
+    std::vector<Entry> m_heap{};
+    std::unordered_map<Key, std::size_t> m_position{};
+    std::uint64_t m_sequence = 0;
+    Compare m_compare{};
+};
+
+} // namespace ev2::pcg
+
+#endif // EV2_PCG_INDEXED_HEAP_HPP
@@ -200,6 +200,15 @@ public:
         return pm;
     }
 
+    /**
+     * @brief patterns compiled into a table that solvers can share, a snapshot of the current patterns
+     *
+     * @return std::shared_ptr<const wfc::PatternTable>
+     */
+    std::shared_ptr<const wfc::PatternTable> make_pattern_table() const {
+        return std::make_shared<const wfc::PatternTable>(make_pattern_map());
+    }
+
     // Requirement Interface
 
     std::vector<int>::const_iterator pattern_erase_requirement(pattern_map_t::const_iterator cit, std::vector<int>::const_iterator rqit) {
@@ -0,0 +1,92 @@
+/**
+ * @file repulsion.hpp
+ * @brief Approximations of the repulsion sum of SCWFC over all nodes
+ * @date 2023-06-17
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef EV2_PCG_REPULSION_HPP
+#define EV2_PCG_REPULSION_HPP
+
+#include "evpch.hpp"
+
+#include <glm/glm.hpp>
+
+#include "pcg/aabb_tree.hpp"
+#include "pcg/spatial_hash.hpp"
+
+namespace ev2::pcg {
+
+enum class RepulsionMode : int {
+    Exact = 0,      // sum over every node
+    Cutoff,         // sum over the nodes with centers within cutoff_radius, from the spatial hash
+    BarnesHut       // far away groups of nodes summed as one, from the bounding volume tree
+};
+
+struct RepulsionArgs {
+    RepulsionMode mode = RepulsionMode::Exact;
+    float cutoff_radius = 16.f;     // Cutoff, in world units
+    float opening_angle = 0.5f;     // BarnesHut, 0 is exact, larger opens fewer groups
+};
+
+/**
+ * @brief repulsion on the sphere (center, radius) from a source of the given weight at
+ *  source_center, weight is the radius of the source sphere. A source at center adds nothing.
+ *
+ * @param center
+ * @param radius
+ * @param source_center
+ * @param source_weight
+ * @return glm::vec3
+ */
+inline glm::vec3 repulsion_term(const glm::vec3& center, float radius, const glm::vec3& source_center, float source_weight) noexcept {
+    const glm::vec3 c2c = center - source_center;
+    const float r2 = glm::dot(c2c, c2c);
+    if (r2 > std::numeric_limits<float>::epsilon())
+        return -glm::normalize(c2c) * (source_weight * radius) / (r2 + 1e-5f);
+    return {};
+}
+
+/**
+ * @brief repulsion_term() summed over the spheres of index with centers closer than cutoff_radius
+ *
+ * @tparam T
+ * @param index
+ * @param center
+ * @param radius
+ * @param cutoff_radius
+ * @return glm::vec3
+ */
+template<typename T>
+glm::vec3 repulsion_cutoff(const SpatialHash<T>& index, const glm::vec3& center, float radius, float cutoff_radius) {
+    glm::vec3 net{};
+    index.for_each_sphere_within(center, cutoff_radius, [&](T, const glm::vec3& c, float r) {
+        net += repulsion_term(center, radius, c, r);
+    });
+    return net;
+}
+
+/**
+ * @brief repulsion_term() summed over the spheres of tree, groups of spheres that appear smaller
+ *  than opening_angle from center are summed as a single source at their weighted mean center
+ *
+ * @tparam T
+ * @param tree
+ * @param center
+ * @param radius
+ * @param opening_angle
+ * @return glm::vec3
+ */
+template<typename T>
+glm::vec3 repulsion_barnes_hut(const AABBTree<T>& tree, const glm::vec3& center, float radius, float opening_angle) {
+    glm::vec3 net{};
+    tree.for_each_far_field(center, opening_angle,
+        [&](T, const glm::vec3& c, float r) {net += repulsion_term(center, radius, c, r);},
+        [&](const glm::vec3& c, float weight) {net += repulsion_term(center, radius, c, weight);});
+    return net;
+}
+
+} // namespace ev2::pcg
+
+#endif // EV2_PCG_REPULSION_HPP
@@ -2,12 +2,18 @@
 #include <cstddef>
 
 #include "pcg/sc_wfc.hpp"
+#include "pcg/aabb_tree.hpp"
+#include "pcg/spatial_hash.hpp"
 #include "timer.hpp"
 
 namespace ev2::pcg {
 
 struct SCWFC::Data {
     wfc::SparseGraph<wfc::DGraphNode> graph;
+    SpatialHash<SCWFCGraphNode*> spatial{};     // bounding spheres of the SCWFCGraphNode children
+    AABBTree<SCWFCGraphNode*> tree{};           // same spheres, for overlap and nearest queries of any radius
+    bool spatial_cell_size_set = false;
+    std::vector<wfc::DGraphNode*> adjacent{};   // update_all_adjacencies scratch
 };
 
 SCWFC::SCWFC(std::string name): 
@@ -43,6 +49,8 @@ void SCWFC::on_child_removed(Ref<Node> child) {
     if (auto n = child.ref_cast<SCWFCGraphNode>()) {
         // remove node from graph
         m_data->graph.remove_node(static_cast<wfc::DGraphNode*>(n.get()));
+        m_data->spatial.remove(n.get());
+        m_data->tree.remove(n.get());
         child_node_removed.notify(n.get());
     }
 }
@@ -50,41 +58,67 @@ void SCWFC::on_child_removed(Ref<Node> child) {
 void SCWFC::on_child_added(Ref<Node> child, int index) {
     if (auto n = child.ref_cast<SCWFCGraphNode>()) {
         // update_all_adjacencies(n);
+        update_spatial_index(n.get());
         child_node_added.notify(n.get());
     }
 }
 
 void SCWFC::update_all_adjacencies(Ref<SCWFCGraphNode> n) {
-    // Timer timer{__FUNCTION__, false};
+    ++m_adjacency_stats.updates;
+    wfc::PhaseTimer timer{m_timing_enabled ? &m_adjacency_stats.ms : nullptr};
     Sphere s = n->get_bounding_sphere();
     s.radius = n->get_neighborhood_radius();
-    for (auto& c : get_children()) {
-        auto c_wfc_node = c.ref_cast<SCWFCGraphNode>();
-        if (c_wfc_node && c_wfc_node != n) {
-            auto* n_graph_node = static_cast<wfc::DGraphNode*>(n.get());
-            auto* c_graph_node = static_cast<wfc::DGraphNode*>(c_wfc_node.get());
-            if (intersect(c_wfc_node->get_bounding_sphere(), s)) {
-                m_data->graph.add_edge(n_graph_node, c_graph_node, 1);
-            } else {
-                m_data->graph.remove_edge(n_graph_node, c_graph_node);
-            }
-        }
+    if (!m_data->spatial_cell_size_set && s.radius > 0.f) {
+        m_data->spatial.set_cell_size(s.radius);
+        m_data->spatial_cell_size_set = true;
     }
-    // timer.stop();
-    // std::cout << get_n_children() << "\t" << timer.elapsed_ms() << "ms" << "\n";
+    update_spatial_index(n.get());
+
+    auto* n_graph_node = static_cast<wfc::DGraphNode*>(n.get());
+    auto& graph = m_data->graph;
+
+    // drop the neighbors that left the neighborhood, copied since removing edges reorders the list
+    const auto adjacent = graph.adjacent_span(n_graph_node);
+    m_data->adjacent.assign(adjacent.begin(), adjacent.end());
+    for (auto* c : m_data->adjacent) {
+        if (!intersect(static_cast<SCWFCGraphNode*>(c)->get_bounding_sphere(), s))
+            graph.remove_edge(n_graph_node, c);
+    }
+
+    m_data->spatial.for_each_intersecting(s.center, s.radius, [&](SCWFCGraphNode* c) {
+        if (c != n.get())
+            graph.add_edge(n_graph_node, static_cast<wfc::DGraphNode*>(c), 1);
+    });
+}
+
+void SCWFC::update_spatial_index(SCWFCGraphNode* n) {
+    if (!m_data) // before on_init
+        return;
+    const Sphere& bounds = n->get_bounding_sphere();
+    m_data->spatial.update(n, bounds.center, bounds.radius);
+    m_data->tree.update(n, bounds.center, bounds.radius);
+}
+
+void SCWFC::set_spatial_cell_size(float cell_size) {
+    m_data->spatial.set_cell_size(cell_size);
+    m_data->spatial_cell_size_set = true;
 }
 
 glm::vec3 SCWFC::sphere_repulsion(const Sphere& sph) const {
+    switch (m_repulsion_args.mode) {
+        case RepulsionMode::Cutoff:
+            return repulsion_cutoff(m_data->spatial, sph.center, sph.radius, m_repulsion_args.cutoff_radius);
+        case RepulsionMode::BarnesHut:
+            return repulsion_barnes_hut(m_data->tree, sph.center, sph.radius, m_repulsion_args.opening_angle);
+        case RepulsionMode::Exact:
+            break;
+    }
     glm::vec3 net{};
     for (auto& c : get_children()) {
         auto graph_node = c.ref_cast<SCWFCGraphNode>();
         if (graph_node) {
             const Sphere& bounds = graph_node->get_bounding_sphere();
-            glm::vec3 c2c = sph.center - bounds.center;
-            float r2 = glm::dot(c2c, c2c);
-            if (r2 > std::numeric_limits<float>::epsilon()) {
-                net += -glm::normalize(c2c) * (bounds.radius * sph.radius) / (r2 + 1e-5f);
-            }
+            net += repulsion_term(sph.center, sph.radius, bounds.center, bounds.radius);
         }
     }
     return net;
@@ -93,47 +127,29 @@ glm::vec3 SCWFC::sphere_repulsion(const Sphere& sph) const {
 glm::vec3 SCWFC::node_repulsion(const SCWFCGraphNode* node ) const {
     if (!node)
         return {};
-    const Sphere& sph = node->get_bounding_sphere();
-    glm::vec3 net{};
-    for (auto& c : get_children()) {
-        auto graph_node = c.ref_cast<SCWFCGraphNode>();
-        if (graph_node && graph_node.get() != node) {
-            const Sphere& bounds = graph_node->get_bounding_sphere();
-            glm::vec3 c2c = sph.center - bounds.center;
-            float r2 = glm::dot(c2c, c2c);
-            if (r2 > std::numeric_limits<float>::epsilon()) {
-                net += -glm::normalize(c2c) * (bounds.radius * sph.radius) / (r2 + 1e-5f);
-            }
-        }
-    }
-    return net;
+    // the node is at the center of its own sphere, it adds nothing to the sum
+    return sphere_repulsion(node->get_bounding_sphere());
 }
 
 bool SCWFC::intersects_any_solved_neighbor(const Ref<SCWFCGraphNode>& n) {
-    // for every node that has been added as an adjacent one
-    for (auto& node : m_data->graph.adjacent_nodes(n.get())) {
-        auto sc_node = dynamic_cast<SCWFCGraphNode*>(node);
-        if (sc_node && sc_node->is_solved() && !sc_node->is_destroyed()) { // is it solved
-            const Sphere& bounds = sc_node->get_bounding_sphere();
-            if (intersect(bounds, n->get_bounding_sphere())) {
-                return true;
-            }
-        }
-    }
-    return false;
+    // every solved node overlapping n, not only the ones added as adjacent
+    const Sphere& sph = n->get_bounding_sphere();
+    return m_data->tree.any_intersecting(sph.center, sph.radius, [&n](SCWFCGraphNode* sc_node) {
+        return sc_node != n.get() && sc_node->is_solved() && !sc_node->is_destroyed();
+    });
 }
 
 bool SCWFC::intersects_any(const Sphere& n) {
-    for (auto& c : get_children()) {
-        auto sc_node = c.ref_cast<SCWFCGraphNode>();
-        if (sc_node) {
-            const Sphere& bounds = sc_node->get_bounding_sphere();
-            if (intersect(bounds, n)) {
-                return true;
-            }
-        }
-    }
-    return false;
+    return m_data->tree.any_intersecting(n.center, n.radius, [](SCWFCGraphNode*) {return true;});
+}
+
+void SCWFC::nearest_nodes(const glm::vec3& p, int k, std::vector<SCWFCGraphNode*>& out) const {
+    m_data->tree.k_nearest(p, k, out);
+}
+
+void SCWFC::nodes_intersecting(const Sphere& sph, std::vector<SCWFCGraphNode*>& out) const {
+    out.clear();
+    m_data->tree.for_each_intersecting(sph.center, sph.radius, [&out](SCWFCGraphNode* c) {out.push_back(c);});
 }
 
 wfc::SparseGraph<wfc::DGraphNode>* SCWFC::get_graph() {
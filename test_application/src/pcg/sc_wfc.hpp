@@ -17,6 +17,7 @@
 #include "geometry.hpp"
 
 #include "wfc.hpp"
+#include "pcg/repulsion.hpp"
 
 namespace ev2::pcg {
 
@@ -44,16 +45,59 @@ public:
 
     void on_child_added(Ref<Node> child, int index) override;
 
+    /**
+     * @brief connect n to every node whose bounding sphere intersects the neighborhood sphere of n,
+     *  and disconnect it from the nodes that left it. Candidates come from a spatial hash, so only
+     *  nodes in nearby cells are tested.
+     *
+     * @param n
+     */
     void update_all_adjacencies(Ref<SCWFCGraphNode> n);
 
+    /**
+     * @brief refresh the bounding sphere of n in the spatial hash and the bounding volume tree, called
+     *  when it moves or is resized
+     *
+     * @param n
+     */
+    void update_spatial_index(SCWFCGraphNode* n);
+
+    /**
+     * @brief cell size of the spatial hash. Set from the first neighborhood radius queried unless set here.
+     *
+     * @param cell_size
+     */
+    void set_spatial_cell_size(float cell_size);
+
+    struct AdjacencyStats {
+        std::uint64_t updates = 0;  // calls to update_all_adjacencies()
+        double ms = 0.0;            // time in update_all_adjacencies(), while timing is enabled
+    };
+
+    const AdjacencyStats& get_adjacency_stats() const noexcept {return m_adjacency_stats;}
+
+    void reset_adjacency_stats() noexcept {m_adjacency_stats = AdjacencyStats{};}
+
+    void set_timing_enabled(bool enabled) noexcept {m_timing_enabled = enabled;}
+
+    /**
+     * @brief repulsion of the SCWFCGraphNode children on sph, exact or approximated depending on
+     *  the repulsion mode
+     *
+     * @param sph
+     * @return glm::vec3
+     */
     glm::vec3 sphere_repulsion(const Sphere& sph) const;
 
     glm::vec3 node_repulsion(const SCWFCGraphNode* node) const;
 
+    const RepulsionArgs& get_repulsion_args() const noexcept {return m_repulsion_args;}
+    void set_repulsion_args(const RepulsionArgs& args) noexcept {m_repulsion_args = args;}
+
     /**
-     * @brief Check if a node intersects any of its adjacent nodes in the scene.
-     *  Note that this does not check for intersections among all children, only those nodes
-     *  added by update_all_adjacencies()
+     * @brief Check if a node intersects any solved node in the scene. Overlapping nodes come
+     *  from the bounding volume tree over all children, so nodes never connected to n by
+     *  update_all_adjacencies() are checked as well.
      * 
      * @param n 
      * @return true 
@@ -61,8 +105,32 @@ public:
      */
     bool intersects_any_solved_neighbor(const Ref<SCWFCGraphNode>& n);
 
+    /**
+     * @brief Check if a sphere intersects the bounding sphere of any SCWFCGraphNode child
+     *
+     * @param n
+     * @return true
+     * @return false
+     */
     bool intersects_any(const Sphere& n);
 
+    /**
+     * @brief the k SCWFCGraphNode children with bounding sphere centers nearest to p, nearest first
+     *
+     * @param p
+     * @param k
+     * @param out
+     */
+    void nearest_nodes(const glm::vec3& p, int k, std::vector<SCWFCGraphNode*>& out) const;
+
+    /**
+     * @brief the SCWFCGraphNode children whose bounding spheres intersect sph
+     *
+     * @param sph
+     * @param out
+     */
+    void nodes_intersecting(const Sphere& sph, std::vector<SCWFCGraphNode*>& out) const;
+
     wfc::SparseGraph<wfc::DGraphNode>* get_graph();
 
 public:
@@ -73,6 +141,10 @@ private:
     friend class SCWFCEditor;
     struct Data;
     std::shared_ptr<Data> m_data{};
+
+    AdjacencyStats m_adjacency_stats{};
+    bool m_timing_enabled = false;
+    RepulsionArgs m_repulsion_args{};
 };
 
 class SCWFCGraphNode : public VisualInstance, public wfc::DGraphNode {
@@ -84,6 +156,8 @@ public:
 
         m_bounding_sphere = Sphere{get_world_position(), 1.f};
         m_neighborhood_r = m_bounding_sphere.radius;
+        if (auto parent = get_parent().ref_cast<SCWFC>(); parent)
+            parent->update_spatial_index(this);
     }
 
     void on_transform_changed(Ref<ev2::Node> origin) override {
@@ -98,7 +172,11 @@ public:
 
     const Sphere& get_bounding_sphere() const noexcept {return m_bounding_sphere;}
 
-    void set_radius(float r) noexcept {m_bounding_sphere.radius = r;}
+    void set_radius(float r) {
+        m_bounding_sphere.radius = r;
+        if (auto parent = get_parent().ref_cast<SCWFC>(); parent)
+            parent->update_spatial_index(this);
+    }
     void set_neighborhood_radius(float r) noexcept {m_neighborhood_r = r;}
 
     float get_radius() noexcept {return m_bounding_sphere.radius;}
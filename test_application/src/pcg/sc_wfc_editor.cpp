@@ -65,7 +65,7 @@ void SCWFCGraphNodeEditor::show_editor(Node* node) {
         SCWFCGraphNode* s_adjacent_hovered = nullptr;
         if (auto s_node = node->get_parent().ref_cast<SCWFC>()) {
             ImGui::Indent(10);
-            for (const auto adjacent : s_node->get_graph()->adjacent_nodes(n)) {
+            for (const auto adjacent : s_node->get_graph()->adjacent_span(n)) {
                 SCWFCGraphNode* s_adjacent = dynamic_cast<SCWFCGraphNode*>(adjacent);
                 // need to push id to differentiate between different selections
                 ImGui::PushID(adjacent);
@@ -81,7 +81,7 @@ void SCWFCGraphNodeEditor::show_editor(Node* node) {
         // draw some lines to show adjacent nodes
         ImDrawList* background = ImGui::GetBackgroundDrawList();
         if (auto parent_node = node->get_parent().ref_cast<SCWFC>()) {
-            for (const auto adjacent : parent_node->get_graph()->adjacent_nodes(n)) {
+            for (const auto adjacent : parent_node->get_graph()->adjacent_span(n)) {
                 SCWFCGraphNode* s_adjacent = dynamic_cast<SCWFCGraphNode*>(adjacent);
 
                 glm::mat4 mat = m_editor->current_camera()->get_projection() *
@@ -156,11 +156,16 @@ void SCWFCEditor::show_editor_tool() {
             reset_solver();
         }
 
-        constexpr const char* ValidityModes[] = {"Correct", "Approximate"};
+        constexpr const char* ValidityModes[] = {"Correct", "Approximate", "Tiered"};
         if (ImGui::Combo("Solver Validity Mode", (int*)&m_solver_args.validity_mode, ValidityModes, IM_ARRAYSIZE(ValidityModes))) {
             reset_solver();
         }
 
+        constexpr const char* DomainRepresentations[] = {"Vector", "Bitset"};
+        if (ImGui::Combo("Domain Representation", (int*)&m_solver_args.domain_representation, DomainRepresentations, IM_ARRAYSIZE(DomainRepresentations))) {
+            reset_solver();
+        }
+
         constexpr const char* NeighborhoodRadiusModes[] = {"Never", "Always"};
         if (ImGui::Combo("Refresh Neighborhood Radius", (int*)&m_solver_args.node_neighborhood, NeighborhoodRadiusModes, IM_ARRAYSIZE(NeighborhoodRadiusModes))) {
             reset_solver();
@@ -170,6 +175,19 @@ void SCWFCEditor::show_editor_tool() {
             reset_solver();
         }
 
+        if (ImGui::Checkbox("Cache Validity", &m_solver_args.cache_validity)) {
+            reset_solver();
+        }
+
+        constexpr const char* RepulsionModes[] = {"Exact", "Cutoff", "BarnesHut"};
+        bool repulsion_changed = ImGui::Combo("Repulsion Mode", (int*)&m_solver_args.repulsion.mode, RepulsionModes, IM_ARRAYSIZE(RepulsionModes));
+        if (m_solver_args.repulsion.mode == RepulsionMode::Cutoff)
+            repulsion_changed |= ImGui::SliderFloat("Repulsion Cutoff", &m_solver_args.repulsion.cutoff_radius, 1.f, 100.f);
+        if (m_solver_args.repulsion.mode == RepulsionMode::BarnesHut)
+            repulsion_changed |= ImGui::SliderFloat("Opening Angle", &m_solver_args.repulsion.opening_angle, 0.f, 1.5f);
+        if (repulsion_changed && m_scwfc_node)
+            m_scwfc_node->set_repulsion_args(m_solver_args.repulsion);
+
         ImGui::Separator();
 
         struct SolverWork {
@@ -254,6 +272,20 @@ void SCWFCEditor::show_editor_tool() {
         if (m_scwfc_solver) {
             ImGui::Text("%lu boundary nodes", m_scwfc_solver->get_boundary_size());
             ImGui::Text("%lu discovered nodes", m_scwfc_solver->get_discovered_size());
+            if (m_solver_args.cache_validity) {
+                const auto cache_stats = m_scwfc_solver->get_validity_cache_stats();
+                ImGui::Text("validity cache %lu hits, %lu misses", cache_stats.hits, cache_stats.misses);
+            }
+            const auto stats = m_scwfc_solver->get_stats();
+            ImGui::Text("%lu propagations, %lu valid checks, %lu augmentations", stats.solver.propagations,
+                        stats.solver.valid_calls, stats.solver.flow_augmentations);
+            ImGui::Text("%lu destroyed by contradiction, %lu by intersection", stats.destroyed_contradiction,
+                        stats.destroyed_intersection);
+            bool log_stats = m_scwfc_solver->is_logging_stats();
+            if (ImGui::Checkbox("Log stats to scwfc_stats.tsv", &log_stats)) {
+                m_scwfc_solver->set_timing_enabled(log_stats);
+                m_scwfc_solver->set_stats_log(log_stats ? std::make_shared<std::ofstream>("scwfc_stats.tsv") : nullptr);
+            }
         }
     }
 
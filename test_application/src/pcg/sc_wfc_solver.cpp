@@ -11,33 +11,47 @@
 #include "core/reference_counted.hpp"
 #include "resource.hpp"
 #include "pcg/distributions.hpp"
+#include "pcg/indexed_heap.hpp"
 #include "pcg/object_database.hpp"
 #include "scene/node.hpp"
 #include "timer.hpp"
 
 namespace ev2::pcg {
 
+/**
+ * @brief lowest entropy first. Entropies are cached in the heap and refreshed through update()
+ *  whenever propagation changes a node domain, so the order is never stale.
+ *
+ */
 struct SCWFCSolver::BoundaryQueueEntropy : public SCWFCSolver::BoundaryQueue {
 
-    BoundaryQueueEntropy(wfc::WFCSolver* solver) : m_boundary{LessThanByEntropy{solver}} {
-
-    }
+    BoundaryQueueEntropy(GraphSolver* solver) : wfc_solver{solver} {}
 
     void push(Ref<SCWFCGraphNode> node) override {
-        m_boundary.push(node);
+        m_boundary.push(node.get(), node, wfc_solver->node_entropy(node.get()));
     }
 
     Ref<SCWFCGraphNode> pop_top() override {
-        auto top = m_boundary.top();
-        m_boundary.pop();
-        return top;
+        return m_boundary.pop();
     }
 
     std::size_t size() override {
         return m_boundary.size();
     }
 
-    std::priority_queue<Ref<SCWFCGraphNode>, std::vector<Ref<SCWFCGraphNode>>, LessThanByEntropy> m_boundary;
+    void update(SCWFCGraphNode* node) override {
+        if (node->is_destroyed())
+            m_boundary.remove(node);
+        else
+            m_boundary.update(node, wfc_solver->node_entropy(node));
+    }
+
+    void remove(SCWFCGraphNode* node) override {
+        m_boundary.remove(node);
+    }
+
+    GraphSolver* wfc_solver;
+    IndexedHeap<const SCWFCGraphNode*, Ref<SCWFCGraphNode>, float> m_boundary{};
 };
 
 struct SCWFCSolver::BoundaryQueueFIFO : public SCWFCSolver::BoundaryQueue {
@@ -65,7 +79,7 @@ SCWFCSolver::SCWFCSolver(SCWFC& scwfc_node,
                          std::shared_ptr<renderer::Mesh> unsolved_drawable,
                          const SCWFCSolverArgs& args,
                          std::unique_ptr<SCWFCSolver::BoundaryQueue> boundary_queue,
-                         std::unique_ptr<wfc::WFCSolver> wfc_solver)
+                         std::unique_ptr<GraphSolver> wfc_solver)
     : node_removed_listener{decltype(node_added_listener)::delegate_t::create<
           SCWFCSolver, &SCWFCSolver::notify_node_removed>(this)},
       node_added_listener{decltype(node_added_listener)::delegate_t::create<
@@ -78,20 +92,25 @@ SCWFCSolver::SCWFCSolver(SCWFC& scwfc_node,
       unsolved_drawable{unsolved_drawable},
       m_boundary{std::move(boundary_queue)},
       m_args{args}
-       {}
+       {
+    scwfc_node.set_repulsion_args(args.repulsion);
+}
 
 std::unique_ptr<SCWFCSolver> SCWFCSolver::make_solver(
     SCWFC& scwfc_node, std::shared_ptr<ObjectMetadataDB> obj_db,
     std::random_device& rd,
     std::shared_ptr<renderer::Mesh> unsolved_drawable,
-    const SCWFCSolverArgs& args) {
+    const SCWFCSolverArgs& args,
+    std::shared_ptr<const wfc::PatternTable> patterns) {
 
-    
+    if (!patterns)
+        patterns = obj_db->make_pattern_table();
     std::unique_ptr<BoundaryQueue> boundary_queue;
     auto mt = std::make_unique<std::mt19937>(rd());
-    auto wfc_solver = std::make_unique<wfc::WFCSolver>(
-        scwfc_node.get_graph(), obj_db->make_pattern_map(), *mt.get(),
-        args.allow_revisit_node, args.validity_mode);
+    auto wfc_solver = std::make_unique<GraphSolver>(
+        scwfc_node.get_graph(), std::move(patterns), *mt.get(),
+        args.allow_revisit_node, args.validity_mode, args.domain_representation);
+    wfc_solver->set_validity_cache_enabled(args.cache_validity);
 
     switch (args.solving_order) {
         case DiscoveryMode::EntropyOrder:
@@ -246,7 +265,7 @@ std::vector<Ref<SCWFCGraphNode>> SCWFCSolver::sc_propagate_from(SCWFCGraphNode*
         for (const auto& pos : spawn.positions) {
             auto nnode = scwfc_node.create_child_node<SCWFCGraphNode>("SGN " + std::to_string(scwfc_node.get_n_children()));
             // populate domain of new node
-            nnode->domain = {spawn.new_domain_vals.begin(), spawn.new_domain_vals.end()};
+            nnode->set_domain({spawn.new_domain_vals.begin(), spawn.new_domain_vals.end()});
             const float en_radius = spawn.en_radius;
 
             // get repulsion
@@ -280,26 +299,27 @@ std::vector<Ref<SCWFCGraphNode>> SCWFCSolver::sc_propagate_from(SCWFCGraphNode*
 }
 
 void SCWFCSolver::wfc_solve(int steps) {
-    wfc::WFCSolver::entropy_callback_t entropy_func =
+    GraphSolver::entropy_callback_t entropy_func =
         [this](auto* prop_node, auto* on_node) -> float {
+            // the SCWFC graph only holds SCWFCGraphNodes
             auto* prop_node_scene =
-                dynamic_cast<const SCWFCGraphNode*>(prop_node);
-            auto* on_node_scene = dynamic_cast<const SCWFCGraphNode*>(on_node);
+                static_cast<const SCWFCGraphNode*>(prop_node);
+            auto* on_node_scene = static_cast<const SCWFCGraphNode*>(on_node);
             return wfc_solver->node_entropy(on_node) -
                     1 / glm::length(prop_node_scene->get_position() -
                                     on_node_scene->get_position());
         };
 
-    wfc::WFCSolver::propagate_callback_t propagate_update = [this](auto* node) -> void {
-        auto* s_node = dynamic_cast<SCWFCGraphNode*>(node);
-        if (s_node)
-            node_check_and_update(s_node);
+    GraphSolver::propagate_callback_t propagate_update = [this](auto* node) -> void {
+        auto* s_node = static_cast<SCWFCGraphNode*>(node);
+        assert(s_node);
+        node_check_and_update(s_node);
+        m_boundary->update(s_node);
     };
 
     // wfc_solver->set_entropy_func(entropy_func);
     wfc_solver->set_propagate_callback_func(propagate_update);
     for (int cnt = 0; cnt < steps;) {
-        // Timer timer{"wfc_solve", false};
         if (m_boundary->size() < 1)
             break;
         auto n = m_boundary->pop_top();
@@ -308,13 +328,11 @@ void SCWFCSolver::wfc_solve(int steps) {
             continue;
 
         // add all adjacent nodes to the solver boundary
-        auto adjacent = scwfc_node.get_graph()->adjacent_nodes(n.get());
-        // int domain_size = n->domain.size();
-        // int adjacent_size = adjacent.size();
+        const auto adjacent = scwfc_node.get_graph()->adjacent_span(n.get());
         std::for_each(
             adjacent.begin(), adjacent.end(), [this](auto* dgn) -> void {
 
-                auto s_node = Ref{dynamic_cast<SCWFCGraphNode*>(dgn)};
+                auto s_node = Ref{static_cast<SCWFCGraphNode*>(dgn)};
                 const bool not_found = m_discovered.find(s_node) == m_discovered.end();
                 if (not_found) {
                     m_boundary->push(s_node);
@@ -328,10 +346,40 @@ void SCWFCSolver::wfc_solve(int steps) {
 
         // node_check_and_update(n.get());
         ++cnt;
+        ++m_stats.steps;
+
+        if (m_stats_log) {
+            get_stats().write_tsv(*m_stats_log);
+            *m_stats_log << '\n';
+        }
+    }
+}
 
-        // timer.stop();
-        // std::cout << domain_size << "\t" << adjacent_size << "\t" << timer.elapsed_ms() << "\n";
+wfc::PartitionedSolveStats SCWFCSolver::wfc_solve_partitioned(int max_part_nodes) {
+    if (!m_thread_pool)
+        m_thread_pool = std::make_shared<ThreadPool>();
+
+    wfc::CSRGraph<wfc::DGraphNode> snapshot{*scwfc_node.get_graph()};
+    wfc::PartitionedSolveArgs args{};
+    args.max_part_nodes = max_part_nodes;
+    args.validity_mode = m_args.validity_mode;
+    args.domain_mode = m_args.domain_representation;
+    args.constraint_prop_solved = m_args.allow_revisit_node;
+
+    // only the nodes open now are placed afterwards, solved ones already have their model and
+    // rotation. Updating a node can destroy it, hold references until every node is updated.
+    std::vector<Ref<SCWFCGraphNode>> nodes{};
+    for (int i = 0; i < snapshot.get_n_nodes(); ++i)
+        if (wfc_solver->domain_size(snapshot.node(i)) > 1)
+            nodes.push_back(Ref{static_cast<SCWFCGraphNode*>(snapshot.node(i))});
+
+    const auto stats = wfc::wfc_solve_partitioned(snapshot, wfc_solver->get_shared_pattern_table(), (*m_mt)(), *m_thread_pool, args);
+
+    for (const auto& s_node : nodes) {
+        node_check_and_update(s_node.get());
+        m_boundary->update(s_node.get());
     }
+    return stats;
 }
 
 void SCWFCSolver::reevaluate_validity() {
@@ -339,6 +387,7 @@ void SCWFCSolver::reevaluate_validity() {
     for (auto itr = m_discovered.begin(); itr != m_discovered.end();) {
         auto s_node = *(itr++);
         if (s_node && !s_node->is_finalized() && !wfc_solver->valid(s_node->domain[0], s_node.get())) {
+            ++m_stats.destroyed_invalid;
             s_node->destroy();
         }
     }
@@ -353,6 +402,7 @@ void SCWFCSolver::node_check_and_update(SCWFCGraphNode* s_node) {
     if (s_node->is_destroyed()) // node is already destroyed
         return;
 
+    wfc::PhaseTimer timer{m_timing_enabled ? &m_stats.placement_ms : nullptr};
     auto model = unsolved_drawable;
 
     glm::vec3 position = s_node->get_world_position() * glm::vec3{1, 0, 1};
@@ -361,6 +411,7 @@ void SCWFCSolver::node_check_and_update(SCWFCGraphNode* s_node) {
 
     if (s_node->domain.size() == 0) {
         // remove nodes with 0 valid objects in their domain from the scene
+        ++m_stats.destroyed_contradiction;
         s_node->destroy();
     } else if (s_node->domain.size() == 1) {
         float rotation_y = 0.f;
@@ -411,9 +462,11 @@ void SCWFCSolver::node_check_and_update(SCWFCGraphNode* s_node) {
                 s_node->rotate(glm::vec3{0, rotation_y, 0});
                 s_node->set_world_position(position);
                 s_node->set_solved();
+                ++m_stats.placements;
 
                 if (scwfc_node.intersects_any_solved_neighbor(Ref{ s_node })) {
                     // remove nodes whose final bounding volume intersects solved nodes
+                    ++m_stats.destroyed_intersection;
                     s_node->destroy();
                 }
 
@@ -452,7 +505,7 @@ Ref<SCWFCGraphNode> SCWFCSolver::spawn_unsolved_node() {
 
     auto nnode = scwfc_node.create_child_node<SCWFCGraphNode>("SGN " + std::to_string(scwfc_node.get_n_children()));
     // populate domain of new node
-    nnode->domain = {domain.begin(), domain.end()};
+    nnode->set_domain({domain.begin(), domain.end()});
 
     float en_radius = glm::length(weighted_average_diagonal(nnode->domain)) / 2.f;
     nnode->set_radius(en_radius);
@@ -525,6 +578,50 @@ std::size_t SCWFCSolver::get_boundary_size() const noexcept {return m_boundary->
 
 std::size_t SCWFCSolver::get_discovered_size() const noexcept {return m_discovered.size();}
 
+wfc::ValidityCache::Stats SCWFCSolver::get_validity_cache_stats() const noexcept {
+    return wfc_solver->get_validity_cache_stats();
+}
+
+SCWFCSolverStats SCWFCSolver::get_stats() const {
+    SCWFCSolverStats stats = m_stats;
+    stats.adjacency_updates = scwfc_node.get_adjacency_stats().updates;
+    stats.adjacency_ms = scwfc_node.get_adjacency_stats().ms;
+    stats.solver = wfc_solver->get_solver_stats();
+    return stats;
+}
+
+void SCWFCSolver::reset_stats() {
+    m_stats = SCWFCSolverStats{};
+    scwfc_node.reset_adjacency_stats();
+    wfc_solver->reset_solver_stats();
+}
+
+void SCWFCSolver::set_timing_enabled(bool enabled) {
+    m_timing_enabled = enabled;
+    scwfc_node.set_timing_enabled(enabled);
+    wfc_solver->set_timing_enabled(enabled);
+}
+
+void SCWFCSolver::set_stats_log(std::shared_ptr<std::ostream> os) {
+    m_stats_log = std::move(os);
+    if (m_stats_log) {
+        SCWFCSolverStats::write_tsv_header(*m_stats_log);
+        *m_stats_log << '\n';
+    }
+}
+
+void SCWFCSolverStats::write_tsv_header(std::ostream& os) {
+    os << "steps\tplacements\tdestroyed_contradiction\tdestroyed_intersection\tdestroyed_invalid\t"
+          "adjacency_updates\tadjacency_ms\tplacement_ms\t";
+    wfc::SolverStats::write_tsv_header(os);
+}
+
+void SCWFCSolverStats::write_tsv(std::ostream& os) const {
+    os << steps << '\t' << placements << '\t' << destroyed_contradiction << '\t' << destroyed_intersection << '\t'
+       << destroyed_invalid << '\t' << adjacency_updates << '\t' << adjacency_ms << '\t' << placement_ms << '\t';
+    solver.write_tsv(os);
+}
+
 
 } // ev2::pcg
 
@@ -648,7 +745,7 @@ void SCWFCSolver::wfc_solve(int steps) {
         wfc_solver->step_wfc((wfc::DGraphNode*)n.get());
 
         // add all adjacent nodes to the solver boundary
-        auto adjacent = scwfc_node.get_graph()->adjacent_nodes(n.get());
+        const auto adjacent = scwfc_node.get_graph()->adjacent_span(n.get());
         std::for_each(
             adjacent.begin(), adjacent.end(), [this](auto* dgn) -> void {
 
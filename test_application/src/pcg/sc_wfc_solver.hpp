@@ -15,6 +15,7 @@
 #include "application.hpp"
 #include "events/notifier.hpp"
 #include "pcg/wfc.hpp"
+#include "pcg/wfc_partition.hpp"
 #include "sc_wfc.hpp"
 #include "object_database.hpp"
 
@@ -38,21 +39,63 @@ enum class DiscoveryMode {
 struct SCWFCSolverArgs {
     NewDomainMode domain_mode = NewDomainMode::Dependent;
     wfc::SolverValidMode validity_mode = wfc::SolverValidMode::Correct;
+    wfc::SolverDomainMode domain_representation = wfc::SolverDomainMode::Vector;
     DiscoveryMode solving_order = DiscoveryMode::DiscoveryOrder;
     
     RefreshNeighborhoodRadius node_neighborhood = RefreshNeighborhoodRadius::Never;
 
     float neighbor_radius_fac = 3.f;
     bool allow_revisit_node = false;
+    bool cache_validity = true;
+
+    RepulsionArgs repulsion{};      // applied to the SCWFC node by the solver
+};
+
+/**
+ * @brief counters and phase times of a SCWFCSolver. Phases nest, placement runs in the propagate
+ *  callback and moving a placed node updates its adjacencies.
+ *
+ */
+struct SCWFCSolverStats {
+    std::uint64_t steps = 0;                    // nodes taken from the boundary by wfc_solve()
+    std::uint64_t placements = 0;               // nodes given the model of their solved pattern
+    std::uint64_t destroyed_contradiction = 0;  // nodes removed with an empty domain
+    std::uint64_t destroyed_intersection = 0;   // solved nodes removed for intersecting a solved neighbor
+    std::uint64_t destroyed_invalid = 0;        // nodes removed by reevaluate_validity()
+    std::uint64_t adjacency_updates = 0;
+    double adjacency_ms = 0.0;                  // SCWFC graph edge updates
+    double placement_ms = 0.0;                  // in node_check_and_update()
+    wfc::SolverStats solver{};                  // propagate and validity times
+
+    /**
+     * @brief tab separated column names, in the order of write_tsv()
+     *
+     * @param os
+     */
+    static void write_tsv_header(std::ostream& os);
+
+    /**
+     * @brief tab separated values, without a trailing separator or newline
+     *
+     * @param os
+     */
+    void write_tsv(std::ostream& os) const;
 };
 
 class SCWFCSolver {
+public:
+    // SCWFC nodes live in a SparseGraph, solve with a solver specialized for it
+    using GraphSolver = wfc::BasicWFCSolver<wfc::SparseGraph<wfc::DGraphNode>>;
+
 private:
     struct BoundaryQueue  {
         virtual ~BoundaryQueue() = default;
         virtual void push(Ref<SCWFCGraphNode> node) = 0;
         virtual Ref<SCWFCGraphNode> pop_top() = 0;
         virtual std::size_t size() = 0;
+        // called when the domain of a node changed, node may not be in the queue
+        virtual void update(SCWFCGraphNode* node) {}
+        virtual void remove(SCWFCGraphNode* node) {}
     };
     struct BoundaryQueueFIFO;
     struct BoundaryQueueEntropy;
@@ -63,14 +106,26 @@ private:
                 std::shared_ptr<renderer::Mesh> unsolved_drawable,
                 const SCWFCSolverArgs& args,
                 std::unique_ptr<SCWFCSolver::BoundaryQueue> boundary_queue,
-                std::unique_ptr<wfc::WFCSolver> wfc_solver);
+                std::unique_ptr<GraphSolver> wfc_solver);
 
 public:
+    /**
+     * @brief solver placing and solving the nodes of scwfc_node
+     * 
+     * @param scwfc_node 
+     * @param obj_db 
+     * @param rd 
+     * @param unsolved_drawable 
+     * @param args 
+     * @param patterns compiled patterns shared with other solvers, made from obj_db if nullptr
+     * @return std::unique_ptr<SCWFCSolver> 
+     */
     static std::unique_ptr<SCWFCSolver> make_solver(
         SCWFC& scwfc_node, std::shared_ptr<ObjectMetadataDB> obj_db,
         std::random_device& rd,
         std::shared_ptr<renderer::Mesh> unsolved_drawable,
-        const SCWFCSolverArgs& args);
+        const SCWFCSolverArgs& args,
+        std::shared_ptr<const wfc::PatternTable> patterns = nullptr);
 
     void sc_propagate(int n, int brf, float mass);
 
@@ -78,6 +133,17 @@ public:
 
     void wfc_solve(int steps);
 
+    /**
+     * @brief solve every unsolved node of the graph at once, connected components and parts of
+     *  large components on separate threads, see wfc::wfc_solve_partitioned
+     *
+     * @param max_part_nodes
+     * @return wfc::PartitionedSolveStats
+     */
+    wfc::PartitionedSolveStats wfc_solve_partitioned(int max_part_nodes = 4096);
+
+    void set_thread_pool(std::shared_ptr<ThreadPool> pool) {m_thread_pool = std::move(pool);}
+
     void reevaluate_validity();
 
     void node_check_and_update(SCWFCGraphNode* s_node);
@@ -106,23 +172,39 @@ public:
 
     void notify_node_removed(SCWFCGraphNode* node) {
         m_discovered.erase(node->get_ref<SCWFCGraphNode>());
+        m_boundary->remove(node);
     }
 
     std::size_t get_boundary_size() const noexcept;
     std::size_t get_discovered_size() const noexcept;
 
-private:
-    struct LessThanByEntropy {
-        LessThanByEntropy(wfc::WFCSolver* solver) : wfc_solver{solver} {}
+    wfc::ValidityCache::Stats get_validity_cache_stats() const noexcept;
 
-        bool operator()(const Ref<SCWFCGraphNode>& lhs, const Ref<SCWFCGraphNode>& rhs) const
-        {
-            // low to high values
-            return wfc_solver->node_entropy(lhs.get()) > wfc_solver->node_entropy(rhs.get());
-        }
+    /**
+     * @brief counters and phase times since the solver was made or the last reset_stats()
+     *
+     * @return SCWFCSolverStats
+     */
+    SCWFCSolverStats get_stats() const;
 
-        wfc::WFCSolver* wfc_solver;
-    };
+    void reset_stats();
+
+    /**
+     * @brief time the solver phases, off by default
+     *
+     * @param enabled
+     */
+    void set_timing_enabled(bool enabled);
+
+    /**
+     * @brief write a header to os, then after every wfc_solve() step a row with the cumulative stats.
+     *  nullptr stops logging.
+     *
+     * @param os
+     */
+    void set_stats_log(std::shared_ptr<std::ostream> os);
+
+    bool is_logging_stats() const noexcept {return m_stats_log != nullptr;}
 
 public:
     DelegateListener<SCWFCGraphNode*> node_removed_listener{};
@@ -135,7 +217,7 @@ private:
     SCWFC& scwfc_node;
     std::unique_ptr<std::mt19937> m_mt;
     std::shared_ptr<ObjectMetadataDB> obj_db;
-    std::unique_ptr<wfc::WFCSolver> wfc_solver;
+    std::unique_ptr<GraphSolver> wfc_solver;
     std::shared_ptr<renderer::Mesh> unsolved_drawable;
 
     std::unique_ptr<BoundaryQueue> m_boundary;
@@ -143,6 +225,12 @@ private:
     std::unordered_set<Ref<SCWFCGraphNode>> m_discovered{};
 
     SCWFCSolverArgs m_args{};
+
+    std::shared_ptr<ThreadPool> m_thread_pool{};
+
+    SCWFCSolverStats m_stats{};     // counted by this class, see get_stats()
+    bool m_timing_enabled = false;
+    std::shared_ptr<std::ostream> m_stats_log{};
 };
 
 } // namespace ev2::pcg
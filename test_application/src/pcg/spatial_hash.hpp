@@ -0,0 +1,322 @@
+/**
+ * @file spatial_hash.hpp
+ * @brief Uniform hash grid over spheres, for neighborhood queries that only visit nearby cells
+ * @date 2023-06-15
+ *
+ * @copyright Copyright (c) 2023
+ *
+ */
+#ifndef EV2_PCG_SPATIAL_HASH_HPP
+#define EV2_PCG_SPATIAL_HASH_HPP
+
+#include "evpch.hpp"
+
+#include <glm/glm.hpp>
+
+#include "flat_hash_map.hpp"
+
+namespace ev2::pcg {
+
+/**
+ * @brief Spheres bucketed by the cubic cell holding their center. Only occupied cells are stored,
+ *  in a hash map from packed cell coordinates, so memory grows with the number of items and not
+ *  with the extent of the scene.
+ *
+ *  A query for spheres intersecting (center, radius) visits the cells within radius plus the
+ *  largest item radius of the center. With the cell size close to the query radius that is a
+ *  3x3x3 block of cells.
+ *
+ *  Moving an item within its cell only rewrites the item. Moving it to another cell is a swap
+ *  remove from the old cell and an append to the new one.
+ *
+ * @tparam T item, a pointer or an integer id
+ */
+template<typename T>
+class SpatialHash {
+public:
+    explicit SpatialHash(float cell_size = 1.f) : m_cell_size{cell_size}, m_inv_cell_size{1.f / cell_size} {
+        assert(cell_size > 0.f);
+    }
+
+    /**
+     * @brief insert an item, or move an item that is already in the hash
+     *
+     * @param item
+     * @param center
+     * @param radius
+     */
+    void update(T item, const glm::vec3& center, float radius) {
+        m_max_radius = std::max(m_max_radius, radius);
+        const std::uint64_t cell = cell_key(cell_coord(center));
+        auto [index, inserted] = m_item_index.try_emplace(item_key(item), (int)m_entries.size());
+        if (inserted) {
+            m_entries.push_back(Entry{item, center, radius, cell, 0});
+            add_to_cell(*index, cell);
+            return;
+        }
+
+        const int e = *index;
+        Entry& entry = m_entries[e];
+        entry.center = center;
+        entry.radius = radius;
+        if (entry.cell != cell) {
+            remove_from_cell(e);
+            add_to_cell(e, cell);
+        }
+    }
+
+    /**
+     * @brief remove an item
+     *
+     * @param item
+     * @return true if the item was in the hash
+     */
+    bool remove(T item) {
+        const int* index = m_item_index.find(item_key(item));
+        if (!index)
+            return false;
+        const int e = *index;
+        m_item_index.erase(item_key(item));
+        remove_from_cell(e);
+
+        // swap remove, the last entry takes slot e
+        const int last = (int)m_entries.size() - 1;
+        if (e != last) {
+            m_entries[e] = m_entries[last];
+            const Entry& moved = m_entries[e];
+            m_cells[*m_cell_index.find(moved.cell)][moved.position] = e;
+            *m_item_index.find(item_key(moved.item)) = e;
+        }
+        m_entries.pop_back();
+        return true;
+    }
+
+    bool contains(T item) const noexcept {return m_item_index.find(item_key(item)) != nullptr;}
+
+    /**
+     * @brief call fn(item) for every item whose sphere intersects the sphere (center, radius),
+     *  that is whose center is closer than the sum of the radii
+     *
+     * @tparam Fn
+     * @param center
+     * @param radius
+     * @param fn
+     */
+    template<typename Fn>
+    void for_each_intersecting(const glm::vec3& center, float radius, Fn&& fn) const {
+        for_each_candidate(center, radius + m_max_radius, [&, this](int e) {
+            const Entry& entry = m_entries[e];
+            const glm::vec3 d = entry.center - center;
+            const float r = radius + entry.radius;
+            if (glm::dot(d, d) < r * r)
+                fn(entry.item);
+        });
+    }
+
+    /**
+     * @brief call fn(item) for every item with its center closer than radius to center
+     *
+     * @tparam Fn
+     * @param center
+     * @param radius
+     * @param fn
+     */
+    template<typename Fn>
+    void for_each_within(const glm::vec3& center, float radius, Fn&& fn) const {
+        for_each_sphere_within(center, radius, [&fn](T item, const glm::vec3&, float) {fn(item);});
+    }
+
+    /**
+     * @brief for_each_within() passing the stored sphere as well, fn(item, center, radius)
+     *
+     * @tparam Fn
+     * @param center
+     * @param radius
+     * @param fn
+     */
+    template<typename Fn>
+    void for_each_sphere_within(const glm::vec3& center, float radius, Fn&& fn) const {
+        for_each_candidate(center, radius, [&, this](int e) {
+            const Entry& entry = m_entries[e];
+            const glm::vec3 d = entry.center - center;
+            if (glm::dot(d, d) < radius * radius)
+                fn(entry.item, entry.center, entry.radius);
+        });
+    }
+
+    /**
+     * @brief change the cell size and rebucket every item
+     *
+     * @param cell_size
+     */
+    void set_cell_size(float cell_size) {
+        assert(cell_size > 0.f);
+        m_cell_size = cell_size;
+        m_inv_cell_size = 1.f / cell_size;
+        rebuild();
+    }
+
+    /**
+     * @brief rebucket every item, also recomputes the largest radius
+     *
+     */
+    void rebuild() {
+        m_cells.clear();
+        m_free_cells.clear();
+        m_cell_index.clear();
+        m_max_radius = 0.f;
+        reset_bounds();
+        for (int e = 0; e < (int)m_entries.size(); ++e) {
+            Entry& entry = m_entries[e];
+            entry.cell = cell_key(cell_coord(entry.center));
+            m_max_radius = std::max(m_max_radius, entry.radius);
+            add_to_cell(e, entry.cell);
+        }
+    }
+
+    void clear() {
+        m_entries.clear();
+        m_item_index.clear();
+        m_cells.clear();
+        m_free_cells.clear();
+        m_cell_index.clear();
+        m_max_radius = 0.f;
+        reset_bounds();
+    }
+
+    std::size_t size() const noexcept {return m_entries.size();}
+    std::size_t cell_count() const noexcept {return m_cell_index.size();}
+    float get_cell_size() const noexcept {return m_cell_size;}
+
+    /**
+     * @brief largest radius of an item since the last rebuild(), an upper bound once items shrink
+     *
+     * @return float
+     */
+    float get_max_radius() const noexcept {return m_max_radius;}
+
+private:
+    struct Entry {
+        T item;
+        glm::vec3 center;
+        float radius;
+        std::uint64_t cell;     // packed cell coordinate
+        int position;           // index in the item list of the cell
+    };
+
+    struct Coord {
+        int x, y, z;
+    };
+
+    static std::uint64_t item_key(T item) noexcept {
+        if constexpr (std::is_pointer_v<T>)
+            return (std::uint64_t)reinterpret_cast<std::uintptr_t>(item);
+        else
+            return (std::uint64_t)item;
+    }
+
+    // 21 bits per axis, coordinates further out wrap around and share cells with nearer ones
+    static std::uint64_t cell_key(const Coord& c) noexcept {
+        constexpr std::uint64_t mask = (1ull << 21) - 1;
+        return ((std::uint64_t)c.x & mask) << 42 | ((std::uint64_t)c.y & mask) << 21 | ((std::uint64_t)c.z & mask);
+    }
+
+    Coord cell_coord(const glm::vec3& p) const noexcept {
+        return {(int)std::floor(p.x * m_inv_cell_size), (int)std::floor(p.y * m_inv_cell_size), (int)std::floor(p.z * m_inv_cell_size)};
+    }
+
+    void reset_bounds() noexcept {
+        m_lo = Coord{std::numeric_limits<int>::max(), std::numeric_limits<int>::max(), std::numeric_limits<int>::max()};
+        m_hi = Coord{std::numeric_limits<int>::min(), std::numeric_limits<int>::min(), std::numeric_limits<int>::min()};
+    }
+
+    void add_to_cell(int e, std::uint64_t cell) {
+        const Coord c = cell_coord(m_entries[e].center);
+        m_lo = Coord{std::min(m_lo.x, c.x), std::min(m_lo.y, c.y), std::min(m_lo.z, c.z)};
+        m_hi = Coord{std::max(m_hi.x, c.x), std::max(m_hi.y, c.y), std::max(m_hi.z, c.z)};
+
+        auto [index, inserted] = m_cell_index.try_emplace(cell, 0);
+        if (inserted) {
+            if (m_free_cells.empty()) {
+                *index = (int)m_cells.size();
+                m_cells.emplace_back();
+            } else {
+                *index = m_free_cells.back();
+                m_free_cells.pop_back();
+            }
+        }
+        std::vector<int>& items = m_cells[*index];
+        m_entries[e].cell = cell;
+        m_entries[e].position = (int)items.size();
+        items.push_back(e);
+    }
+
+    void remove_from_cell(int e) {
+        const Entry& entry = m_entries[e];
+        int* index = m_cell_index.find(entry.cell);
+        assert(index);
+        const int c = *index;
+        std::vector<int>& items = m_cells[c];
+        const int moved = items.back();
+        items[entry.position] = moved;
+        m_entries[moved].position = entry.position;
+        items.pop_back();
+        if (items.empty()) {
+            m_cell_index.erase(entry.cell);
+            m_free_cells.push_back(c);
+        }
+    }
+
+    /**
+     * @brief call fn(entry index) for the items of every cell within reach of center, clamped to
+     *  the cells ever occupied since the last rebuild. Falls back to all items when the block of
+     *  cells is larger than the number of occupied cells.
+     *
+     */
+    template<typename Fn>
+    void for_each_candidate(const glm::vec3& center, float reach, Fn&& fn) const {
+        // keys wrap past 2^21 cells per axis, so wide blocks go through the full scan as well
+        constexpr float max_reach_cells = 1 << 16;
+        bool scan_all = !(reach * m_inv_cell_size < max_reach_cells);
+        Coord lo{}, hi{};
+        if (!scan_all) {
+            lo = cell_coord(center - glm::vec3{reach});
+            hi = cell_coord(center + glm::vec3{reach});
+            lo = Coord{std::max(lo.x, m_lo.x), std::max(lo.y, m_lo.y), std::max(lo.z, m_lo.z)};
+            hi = Coord{std::min(hi.x, m_hi.x), std::min(hi.y, m_hi.y), std::min(hi.z, m_hi.z)};
+            if (lo.x > hi.x || lo.y > hi.y || lo.z > hi.z)
+                return;
+            const std::uint64_t n_cells = (std::uint64_t)(hi.x - lo.x + 1) * (hi.y - lo.y + 1) * (hi.z - lo.z + 1);
+            scan_all = n_cells >= m_cell_index.size();
+        }
+        if (scan_all) {
+            for (int e = 0; e < (int)m_entries.size(); ++e)
+                fn(e);
+            return;
+        }
+        for (int x = lo.x; x <= hi.x; ++x)
+            for (int y = lo.y; y <= hi.y; ++y)
+                for (int z = lo.z; z <= hi.z; ++z)
+                    if (const int* index = m_cell_index.find(cell_key({x, y, z})))
+                        for (int e : m_cells[*index])
+                            fn(e);
+    }
+
+private:
+    float m_cell_size;
+    float m_inv_cell_size;
+    float m_max_radius = 0.f;
+    // bounds of the cells occupied since the last rebuild, grow only
+    Coord m_lo{std::numeric_limits<int>::max(), std::numeric_limits<int>::max(), std::numeric_limits<int>::max()};
+    Coord m_hi{std::numeric_limits<int>::min(), std::numeric_limits<int>::min(), std::numeric_limits<int>::min()};
+
+    std::vector<Entry> m_entries{};
+    ev2::FlatHashMap<int> m_item_index{};       // item key -> index in m_entries
+    std::vector<std::vector<int>> m_cells{};    // entry indices per occupied cell
+    std::vector<int> m_free_cells{};            // emptied lists in m_cells, for reuse
+    ev2::FlatHashMap<int> m_cell_index{};       // packed cell coordinate -> index in m_cells
+};
+
+} // namespace ev2::pcg
+
+#endif // EV2_PCG_SPATIAL_HASH_HPP
@@ -1,9 +1,271 @@
 #include <pcg/wfc.hpp>
+#include <atomic>
 #include <unordered_map>
+#include <limits>
+#include <array>
 
 namespace wfc {
 
-bool Pattern::valid(const std::vector<DGraphNode*>& neighborhood) const {
+void RequirementMatcher::build_types(const int* required_types, int n_required) {
+    m_types.assign(required_types, required_types + n_required);
+    std::sort(m_types.begin(), m_types.end());
+    m_types.erase(std::unique(m_types.begin(), m_types.end()), m_types.end());
+
+    m_left_row.resize(n_required);
+    for (int i = 0; i < n_required; ++i)
+        m_left_row[i] = type_row(required_types[i]);
+}
+
+void RequirementMatcher::build_csr() {
+    // counting sort edges into rows
+    m_offsets.resize(m_types.size() + 1);
+    m_offsets[0] = 0;
+    for (std::size_t r = 0; r < m_types.size(); ++r)
+        m_offsets[r + 1] = m_offsets[r] + m_row_count[r];
+
+    m_adjacency.resize(m_edges.size());
+    m_iter.assign(m_offsets.begin(), m_offsets.end() - 1); // insert position per row
+    for (const auto& e : m_edges)
+        m_adjacency[m_iter[e.row]++] = e.neighbor;
+}
+
+int RequirementMatcher::hopcroft_karp(int n_neighbors) {
+    const int n_left = (int)m_left_row.size();
+    m_pair_left.assign(n_left, -1);
+    m_pair_right.assign(n_neighbors, -1);
+    m_dist.resize(n_left);
+    m_iter.resize(n_left);
+    m_augmentations = 0;
+
+    int matched = 0;
+
+    // greedy initial matching
+    for (int u = 0; u < n_left; ++u) {
+        const int row = m_left_row[u];
+        for (int k = m_offsets[row]; k < m_offsets[row + 1]; ++k) {
+            const int v = m_adjacency[k];
+            if (m_pair_right[v] == -1) {
+                m_pair_left[u] = v;
+                m_pair_right[v] = u;
+                ++matched;
+                break;
+            }
+        }
+    }
+
+    while (matched < n_left && hk_bfs()) {
+        for (int u = 0; u < n_left; ++u)
+            m_iter[u] = m_offsets[m_left_row[u]];
+        for (int u = 0; u < n_left; ++u) {
+            if (m_pair_left[u] == -1 && hk_dfs(u)) {
+                ++matched;
+                ++m_augmentations;
+            }
+        }
+    }
+    m_total_augmentations += m_augmentations;
+    return matched;
+}
+
+bool RequirementMatcher::hk_bfs() {
+    constexpr int inf = std::numeric_limits<int>::max();
+    const int n_left = (int)m_left_row.size();
+
+    m_queue.clear();
+    for (int u = 0; u < n_left; ++u) {
+        if (m_pair_left[u] == -1) {
+            m_dist[u] = 0;
+            m_queue.push_back(u);
+        } else
+            m_dist[u] = inf;
+    }
+
+    bool found_free = false;
+    for (std::size_t q = 0; q < m_queue.size(); ++q) {
+        const int u = m_queue[q];
+        const int row = m_left_row[u];
+        for (int k = m_offsets[row]; k < m_offsets[row + 1]; ++k) {
+            const int w = m_pair_right[m_adjacency[k]];
+            if (w == -1)
+                found_free = true;
+            else if (m_dist[w] == inf) {
+                m_dist[w] = m_dist[u] + 1;
+                m_queue.push_back(w);
+            }
+        }
+    }
+    return found_free;
+}
+
+bool RequirementMatcher::hk_dfs(int u) {
+    const int row = m_left_row[u];
+    for (int& k = m_iter[u]; k < m_offsets[row + 1]; ++k) {
+        const int v = m_adjacency[k];
+        const int w = m_pair_right[v];
+        if (w == -1 || (m_dist[w] == m_dist[u] + 1 && hk_dfs(w))) {
+            m_pair_left[u] = v;
+            m_pair_right[v] = u;
+            ++k;
+            return true;
+        }
+    }
+    m_dist[u] = std::numeric_limits<int>::max();
+    return false;
+}
+
+std::uint64_t ValidityCache::type_signature(const DGraphNode* node) {
+    if (node->type_signature_generation == node->domain_generation)
+        return node->type_signature;
+
+    thread_local std::vector<int> types{};
+    types.clear();
+    for (const auto& v : node->domain)
+        types.push_back(v.type);
+    std::sort(types.begin(), types.end());
+    types.erase(std::unique(types.begin(), types.end()), types.end());
+
+    std::uint64_t h = mix(types.size());
+    for (int t : types)
+        h = mix(h ^ (std::uint64_t)(std::uint32_t)t);
+
+    node->type_signature = h;
+    node->type_signature_generation = node->domain_generation;
+    return h;
+}
+
+RequirementMatcher& matching_scratch() {
+    thread_local RequirementMatcher matcher{};
+    return matcher;
+}
+
+std::uint32_t next_solver_stamp() noexcept {
+    static std::atomic<std::uint32_t> stamp{0};
+    return ++stamp;
+}
+
+bool Pattern::valid(Span<DGraphNode* const> neighborhood) const {
+    return matching_scratch().match(required_types.data(), (int)required_types.size(), (int)neighborhood.size(),
+        [&neighborhood](int j, auto&& emit) {
+            for (const auto& val : neighborhood[j]->domain)
+                emit(val.type); // requirements are only for type
+        });
+}
+
+bool Pattern::valid_tiered(Span<DGraphNode* const> neighborhood, ValidityTierStats* stats) const {
+    // fixed size histograms, patterns with more distinct required types go straight to matching
+    constexpr int max_types = 64;
+    constexpr int max_pair_types = 16;
+    constexpr int max_triple_types = 8;
+
+    ValidityTierStats local{};
+    ValidityTierStats& st = stats ? *stats : local;
+    ++st.calls;
+
+    const int n_req = (int)required_types.size();
+    const int n_neighbors = (int)neighborhood.size();
+    if (n_req == 0 || n_neighbors == 0 || n_req > n_neighbors) {
+        ++st.trivial;
+        return n_req == 0;
+    }
+
+    // distinct required types and their multiplicity
+    std::array<int, max_types> types;
+    std::array<int, max_types> multiplicity{};
+    int n_types = 0;
+    for (int t : required_types) {
+        auto end = types.begin() + n_types;
+        auto itr = std::lower_bound(types.begin(), end, t);
+        if (itr != end && *itr == t) {
+            ++multiplicity[itr - types.begin()];
+            continue;
+        }
+        if (n_types == max_types) { // too many distinct types for the prefilter
+            ++st.exact;
+            return valid(neighborhood);
+        }
+        const auto pos = itr - types.begin();
+        std::move_backward(itr, end, end + 1);
+        std::move_backward(multiplicity.begin() + pos, multiplicity.begin() + n_types, multiplicity.begin() + n_types + 1);
+        *itr = t;
+        multiplicity[pos] = 1;
+        ++n_types;
+    }
+
+    auto type_bit = [&types, n_types](int t) -> int {
+        auto end = types.begin() + n_types;
+        auto itr = std::lower_bound(types.begin(), end, t);
+        return (itr != end && *itr == t) ? (int)(itr - types.begin()) : -1;
+    };
+
+    // tier 1, supply counts. masks[j] has bit k set when neighbor j can supply types[k]
+    thread_local std::vector<std::uint64_t> masks{};
+    masks.resize(n_neighbors);
+    std::array<int, max_types> supply{};
+    int n_suppliers = 0;
+    for (int j = 0; j < n_neighbors; ++j) {
+        std::uint64_t m = 0;
+        for (const auto& val : neighborhood[j]->domain) {
+            const int b = type_bit(val.type);
+            if (b >= 0)
+                m |= std::uint64_t{1} << b;
+        }
+        masks[j] = m;
+        n_suppliers += m != 0;
+        for (std::uint64_t w = m; w; w &= w - 1)
+            ++supply[__builtin_ctzll(w)];
+    }
+
+    if (n_suppliers < n_req) {
+        ++st.rejected_count;
+        return false;
+    }
+    for (int k = 0; k < n_types; ++k) {
+        if (supply[k] < multiplicity[k]) {
+            ++st.rejected_count;
+            return false;
+        }
+    }
+
+    // tier 2, Hall's condition |N(S)| >= sum of multiplicities in S for small subsets S
+    // a subset can only fail when no single member is already supplied often enough to cover it
+    auto hall_violated = [n_neighbors, &supply](std::uint64_t subset, int required) -> bool {
+        for (std::uint64_t w = subset; w; w &= w - 1)
+            if (supply[__builtin_ctzll(w)] >= required)
+                return false;
+        int covered = 0;
+        for (int j = 0; j < n_neighbors && covered < required; ++j)
+            covered += (masks[j] & subset) != 0;
+        return covered < required;
+    };
+    if (n_types <= max_pair_types) {
+        for (int a = 0; a < n_types; ++a)
+            for (int b = a + 1; b < n_types; ++b) {
+                const std::uint64_t ab = (std::uint64_t{1} << a) | (std::uint64_t{1} << b);
+                if (hall_violated(ab, multiplicity[a] + multiplicity[b])) {
+                    ++st.rejected_hall;
+                    return false;
+                }
+                if (n_types > max_triple_types)
+                    continue;
+                for (int c = b + 1; c < n_types; ++c) {
+                    if (hall_violated(ab | (std::uint64_t{1} << c), multiplicity[a] + multiplicity[b] + multiplicity[c])) {
+                        ++st.rejected_hall;
+                        return false;
+                    }
+                }
+            }
+    }
+
+    // tier 3, exact matching over the masks already built
+    ++st.exact;
+    return matching_scratch().match(required_types.data(), n_req, n_neighbors,
+        [&types](int j, auto&& emit) {
+            for (std::uint64_t w = masks[j]; w; w &= w - 1)
+                emit(types[__builtin_ctzll(w)]);
+        });
+}
+
+bool Pattern::valid_max_flow(Span<DGraphNode* const> neighborhood) const {
     /* matching problem (edges are between required values and neighbors with that value in domain)
      * map required values one-to-one (perfect matching) with available neighbors
      * if all requirements are satisfied, return true
@@ -124,7 +386,315 @@ bool Pattern::valid(const std::vector<DGraphNode*>& neighborhood) const {
 }
 
 
-bool Pattern::valid_approx(const std::vector<DGraphNode*>& neighborhood) const {
+bool BacktrackingSolver::solve(Span<DGraphNode* const> order) {
+    const bool trail_was_enabled = m_solver.is_trail_enabled();
+    m_solver.set_trail_enabled(true);
+    m_decisions.clear();
+    m_stats = {};
+
+    // removes values that are invalid from the start, returns false if a domain emptied
+    auto consistent = [this, &order]() -> bool {
+        const std::uint64_t contradictions = m_solver.get_contradiction_count();
+        for (DGraphNode* node : order) {
+            if (m_solver.update_domain(node))
+                m_solver.propagate(node);
+            if (m_solver.get_contradiction_count() != contradictions)
+                return false;
+        }
+        return true;
+    };
+
+    bool solved = consistent();
+    const int n = (int)order.size();
+    for (int position = 0; solved;) {
+        if (position == n) {
+            // propagation only visits each node once, so check the complete assignment
+            if (consistent())
+                break;
+            solved = backtrack(position);
+            continue;
+        }
+
+        DGraphNode* node = order[position];
+        const std::size_t size = m_solver.domain_size(node);
+        if (size == 1) {
+            ++position;
+            continue;
+        }
+        if (size == 0) {
+            solved = backtrack(position);
+            continue;
+        }
+
+        const std::size_t mark = m_solver.trail_size();
+        const std::uint64_t contradictions = m_solver.get_contradiction_count();
+        m_solver.observe(node);
+        m_decisions.push_back(Decision{position, node, node->domain[0], mark});
+        ++m_stats.decisions;
+
+        m_solver.propagate(node);
+        if (m_solver.get_contradiction_count() != contradictions)
+            solved = backtrack(position);
+        else
+            ++position;
+    }
+
+    m_decisions.clear();
+    m_solver.set_trail_enabled(trail_was_enabled);
+    return solved;
+}
+
+bool BacktrackingSolver::backtrack(int& position) {
+    while (!m_decisions.empty() && m_stats.backtracks < m_max_backtracks) {
+        ++m_stats.backtracks;
+        const Decision d = m_decisions.back();
+        m_decisions.pop_back();
+
+        m_solver.rewind(d.trail_mark);
+
+        // the ban belongs to the previous decision, rewinding that one restores the value
+        const std::uint64_t contradictions = m_solver.get_contradiction_count();
+        m_solver.ban(d.node, d.value);
+        if (m_solver.domain_size(d.node) == 0)
+            continue;
+        m_solver.propagate(d.node);
+        if (m_solver.get_contradiction_count() == contradictions) {
+            position = d.position;
+            return true;
+        }
+    }
+    return false;
+}
+
+PatternTable::PatternTable(const PatternMap& patterns) {
+    // sort by pattern id so the index does not depend on hash map ordering
+    std::vector<int> ids{};
+    ids.reserve(patterns.size());
+    for (const auto& [id, p] : patterns)
+        ids.push_back(id);
+    std::sort(ids.begin(), ids.end());
+
+    const int n = (int)ids.size();
+    m_ids = ids;
+    m_types.reserve(n);
+    m_weights.reserve(n);
+    m_patterns.reserve(n);
+    m_req_offsets.reserve(n + 1);
+    m_req_offsets.push_back(0);
+    for (int id : ids) {
+        const Pattern& p = patterns.at(id);
+        m_types.push_back(p.pattern_type);
+        m_weights.push_back(p.weight);
+        m_patterns.push_back(p);
+        m_req_types.insert(m_req_types.end(), p.required_types.begin(), p.required_types.end());
+        m_req_offsets.push_back((int)m_req_types.size());
+        m_total_weight += p.weight;
+    }
+
+    // array lookup unless the id range is much larger than the number of patterns
+    if (n > 0) {
+        const long long range = (long long)ids.back() - ids.front() + 1;
+        m_sparse = range > 4ll * n + 64;
+        m_id_base = ids.front();
+    }
+    if (m_sparse) {
+        m_sparse_index.reserve(n);
+        for (int i = 0; i < n; ++i)
+            m_sparse_index.insert({ids[i], i});
+    } else if (n > 0) {
+        m_dense_index.assign(ids.back() - m_id_base + 1, -1);
+        for (int i = 0; i < n; ++i)
+            m_dense_index[ids[i] - m_id_base] = i;
+    }
+
+    build_alias();
+}
+
+void PatternTable::build_alias() {
+    const int n = size();
+    m_alias_prob.assign(n, 1.f);
+    m_alias.assign(n, 0);
+    if (n == 0 || !(m_total_weight > 0.f))
+        return;
+
+    // scaled weights average to 1, columns below 1 are topped up by one column above 1
+    std::vector<float> scaled(n);
+    std::vector<int> small{};
+    std::vector<int> large{};
+    for (int i = 0; i < n; ++i) {
+        m_alias[i] = i;
+        scaled[i] = m_weights[i] * (float)n / m_total_weight;
+        (scaled[i] < 1.f ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        const int s = small.back();
+        small.pop_back();
+        const int l = large.back();
+        m_alias_prob[s] = scaled[s];
+        m_alias[s] = l;
+        scaled[l] -= 1.f - scaled[s];
+        if (scaled[l] < 1.f) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+    // leftovers are 1 up to rounding
+    for (int i : small)
+        m_alias_prob[i] = 1.f;
+    for (int i : large)
+        m_alias_prob[i] = 1.f;
+}
+
+void FlowNetwork::build_csr() {
+    if (!m_csr_dirty)
+        return;
+    m_offsets.assign(m_n_nodes + 1, 0);
+    for (int e = 0; e < (int)m_to.size(); ++e)
+        ++m_offsets[edge_from(e) + 1];
+    for (int u = 0; u < m_n_nodes; ++u)
+        m_offsets[u + 1] += m_offsets[u];
+    m_edges.resize(m_to.size());
+    m_iter.assign(m_offsets.begin(), m_offsets.end() - 1);
+    for (int e = 0; e < (int)m_to.size(); ++e)
+        m_edges[m_iter[edge_from(e)]++] = e;
+    m_csr_dirty = false;
+}
+
+bool FlowNetwork::dinic_levels(int source, int sink) {
+    m_level.assign(m_n_nodes, -1);
+    m_queue.clear();
+    m_queue.push_back(source);
+    m_level[source] = 0;
+    for (std::size_t q = 0; q < m_queue.size(); ++q) {
+        const int u = m_queue[q];
+        for (int k = m_offsets[u]; k < m_offsets[u + 1]; ++k) {
+            const int e = m_edges[k];
+            const int v = m_to[e];
+            if (m_level[v] < 0 && m_residual[e] > 0.f) {
+                m_level[v] = m_level[u] + 1;
+                m_queue.push_back(v);
+            }
+        }
+    }
+    return m_level[sink] >= 0;
+}
+
+float FlowNetwork::dinic_augment(int u, int sink, float limit) {
+    if (u == sink)
+        return limit;
+    for (int& k = m_iter[u]; k < m_offsets[u + 1]; ++k) {
+        const int e = m_edges[k];
+        const int v = m_to[e];
+        if (m_level[v] != m_level[u] + 1 || !(m_residual[e] > 0.f))
+            continue;
+        const float pushed = dinic_augment(v, sink, std::min(limit, m_residual[e]));
+        if (pushed > 0.f) {
+            m_residual[e] -= pushed;
+            m_residual[e ^ 1] += pushed;
+            return pushed;
+        }
+    }
+    return 0.f;
+}
+
+float FlowNetwork::max_flow_dinic(int source, int sink) {
+    assert(source >= 0 && source < m_n_nodes && sink >= 0 && sink < m_n_nodes);
+    if (source == sink)
+        return 0.f;
+    build_csr();
+
+    float total = 0.f;
+    while (dinic_levels(source, sink)) {
+        m_iter.assign(m_offsets.begin(), m_offsets.end() - 1);
+        while (true) {
+            const float pushed = dinic_augment(source, sink, std::numeric_limits<float>::infinity());
+            if (!(pushed > 0.f))
+                break;
+            total += pushed;
+        }
+    }
+    return total;
+}
+
+float FlowNetwork::max_flow_push_relabel(int source, int sink) {
+    assert(source >= 0 && source < m_n_nodes && sink >= 0 && sink < m_n_nodes);
+    if (source == sink)
+        return 0.f;
+    build_csr();
+
+    const int n = m_n_nodes;
+    m_excess.assign(n, 0.f);
+    m_height.assign(n, 0);
+    m_height_count.assign(2 * n + 1, 0);
+    m_iter.assign(m_offsets.begin(), m_offsets.end() - 1);
+    m_active.clear();
+
+    m_height[source] = n;
+    m_height_count[0] = n - 1;
+    m_height_count[n] = 1;
+
+    auto push = [this, source, sink](int e, float amount) {
+        const int v = m_to[e];
+        m_residual[e] -= amount;
+        m_residual[e ^ 1] += amount;
+        m_excess[m_to[e ^ 1]] -= amount;
+        if (m_excess[v] == 0.f && v != source && v != sink)
+            m_active.push(v); // becomes active
+        m_excess[v] += amount;
+    };
+
+    // saturate every edge leaving the source
+    for (int k = m_offsets[source]; k < m_offsets[source + 1]; ++k) {
+        const int e = m_edges[k];
+        if (m_residual[e] > 0.f)
+            push(e, m_residual[e]);
+    }
+
+    while (!m_active.empty()) {
+        const int u = m_active.pop();
+        // discharge u
+        while (m_excess[u] > 0.f) {
+            if (m_iter[u] == m_offsets[u + 1]) {
+                // relabel, to one above the lowest neighbor reachable through a residual edge
+                const int old_height = m_height[u];
+                int height = 2 * n;
+                for (int k = m_offsets[u]; k < m_offsets[u + 1]; ++k) {
+                    const int e = m_edges[k];
+                    if (m_residual[e] > 0.f)
+                        height = std::min(height, m_height[m_to[e]] + 1);
+                }
+                --m_height_count[old_height];
+                m_height[u] = height;
+                ++m_height_count[height];
+                m_iter[u] = m_offsets[u];
+
+                // gap, nodes above an empty height below n can no longer reach the sink
+                if (m_height_count[old_height] == 0 && old_height < n) {
+                    for (int v = 0; v < n; ++v) {
+                        if (v != source && m_height[v] > old_height && m_height[v] < n) {
+                            --m_height_count[m_height[v]];
+                            m_height[v] = n + 1;
+                            ++m_height_count[n + 1];
+                            m_iter[v] = m_offsets[v];
+                        }
+                    }
+                }
+                if (m_height[u] >= 2 * n)
+                    break; // no residual edge left, excess stays
+                continue;
+            }
+
+            const int e = m_edges[m_iter[u]];
+            if (m_residual[e] > 0.f && m_height[u] == m_height[m_to[e]] + 1)
+                push(e, std::min(m_excess[u], m_residual[e]));
+            else
+                ++m_iter[u];
+        }
+    }
+    return m_excess[sink];
+}
+
+bool Pattern::valid_approx(Span<DGraphNode* const> neighborhood) const {
     std::unordered_multiset<int> requirements{required_types.begin(), required_types.end()};
     std::vector<int> available_values{};
 
@@ -143,6 +713,17 @@ bool Pattern::valid_approx(const std::vector<DGraphNode*>& neighborhood) const {
     return requirements.empty();
 }
 
+void SolverStats::write_tsv_header(std::ostream& os) {
+    os << "observations\tpropagations\trevisions\tvalid_calls\tflow_augmentations\tdomain_removals\t"
+          "contradictions\tpropagate_ms\tvalidity_ms";
+}
+
+void SolverStats::write_tsv(std::ostream& os) const {
+    os << observations << '\t' << propagations << '\t' << revisions << '\t' << valid_calls << '\t'
+       << flow_augmentations << '\t' << domain_removals << '\t' << contradictions << '\t'
+       << propagate_ms << '\t' << validity_ms;
+}
 
+template class BasicWFCSolver<Graph<DGraphNode>>;
 
 }
\ No newline at end of file
@@ -9,6 +9,8 @@
 
 
 #include "evpch.hpp"
+#include "flat_hash_map.hpp"
+#include "thread_pool.hpp"
 
 
 namespace wfc {
@@ -51,6 +53,219 @@ private:
     }
 };
 
+/**
+ * @brief non owning view of contiguous elements, valid as long as the storage it points at
+ *
+ * @tparam T
+ */
+template<typename T>
+class Span {
+public:
+    Span() = default;
+    Span(T* data, std::size_t size) noexcept : m_data{data}, m_size{size} {}
+
+    template<typename U, typename = std::enable_if_t<std::is_convertible_v<U*, T*>>>
+    Span(const std::vector<U>& v) noexcept : m_data{v.data()}, m_size{v.size()} {}
+
+    T* begin() const noexcept {return m_data;}
+    T* end() const noexcept {return m_data + m_size;}
+    T* data() const noexcept {return m_data;}
+    std::size_t size() const noexcept {return m_size;}
+    bool empty() const noexcept {return m_size == 0;}
+    T& operator[](std::size_t i) const noexcept {
+        assert(i < m_size);
+        return m_data[i];
+    }
+
+private:
+    T* m_data = nullptr;
+    std::size_t m_size = 0;
+};
+
+/**
+ * @brief FIFO queue over a power of two ring buffer. Storage is kept by clear(),
+ *  so a queue that is reused does not allocate once it reached its largest size.
+ *
+ * @tparam T
+ */
+template<typename T>
+class RingQueue {
+public:
+    void clear() noexcept {
+        m_head = 0;
+        m_size = 0;
+    }
+
+    bool empty() const noexcept {return m_size == 0;}
+    std::size_t size() const noexcept {return m_size;}
+    std::size_t capacity() const noexcept {return m_buffer.size();}
+
+    void push(const T& v) {
+        if (m_size == m_buffer.size())
+            grow();
+        m_buffer[(m_head + m_size) & (m_buffer.size() - 1)] = v;
+        ++m_size;
+    }
+
+    T pop() noexcept {
+        assert(m_size > 0);
+        T v = m_buffer[m_head];
+        m_head = (m_head + 1) & (m_buffer.size() - 1);
+        --m_size;
+        return v;
+    }
+
+private:
+    void grow() {
+        std::vector<T> next(std::max<std::size_t>(16, m_buffer.size() * 2));
+        for (std::size_t i = 0; i < m_size; ++i)
+            next[i] = m_buffer[(m_head + i) & (m_buffer.size() - 1)];
+        m_buffer.swap(next);
+        m_head = 0;
+    }
+
+    std::vector<T> m_buffer{};
+    std::size_t m_head = 0;
+    std::size_t m_size = 0;
+};
+
+/**
+ * @brief Dense bitset over pattern indices. Used as the domain representation
+ *  in SolverDomainMode::Bitset, where bit i is set when the pattern with dense
+ *  index i is still in the domain.
+ *
+ */
+class DomainBits {
+public:
+    using word_t = std::uint64_t;
+    static constexpr int word_bits = 64;
+
+    DomainBits() = default;
+    explicit DomainBits(int n_bits) : m_n_bits{n_bits}, m_words(n_words(n_bits), 0) {}
+
+    /**
+     * @brief resize to n_bits and clear all bits
+     *
+     * @param n_bits
+     */
+    void reset_size(int n_bits) {
+        m_n_bits = n_bits;
+        m_words.assign(n_words(n_bits), 0);
+    }
+
+    /**
+     * @brief release all bits, size() becomes 0. Keeps allocated storage.
+     *
+     */
+    void clear() noexcept {
+        m_n_bits = 0;
+        m_words.clear();
+    }
+
+    int size() const noexcept {return m_n_bits;}
+
+    bool test(int i) const noexcept {
+        assert(i >= 0 && i < m_n_bits);
+        return (m_words[i / word_bits] >> (i % word_bits)) & 1u;
+    }
+
+    void set(int i) noexcept {
+        assert(i >= 0 && i < m_n_bits);
+        m_words[i / word_bits] |= word_t{1} << (i % word_bits);
+    }
+
+    void reset(int i) noexcept {
+        assert(i >= 0 && i < m_n_bits);
+        m_words[i / word_bits] &= ~(word_t{1} << (i % word_bits));
+    }
+
+    void reset_all() noexcept {
+        std::fill(m_words.begin(), m_words.end(), 0);
+    }
+
+    /**
+     * @brief number of set bits
+     *
+     * @return int
+     */
+    int count() const noexcept {
+        int c = 0;
+        for (auto w : m_words)
+            c += __builtin_popcountll(w);
+        return c;
+    }
+
+    bool any() const noexcept {
+        for (auto w : m_words)
+            if (w) return true;
+        return false;
+    }
+
+    /**
+     * @brief word-wise intersection with other, other must be the same size
+     *
+     * @param other
+     * @return true if any bit was cleared
+     */
+    bool intersect(const DomainBits& other) noexcept {
+        assert(other.m_n_bits == m_n_bits);
+        word_t changed = 0;
+        for (std::size_t i = 0; i < m_words.size(); ++i) {
+            const word_t w = m_words[i] & other.m_words[i];
+            changed |= w ^ m_words[i];
+            m_words[i] = w;
+        }
+        return changed != 0;
+    }
+
+    /**
+     * @brief check if there is any bit set in both this and other
+     *
+     * @param other
+     * @return true
+     * @return false
+     */
+    bool intersects(const DomainBits& other) const noexcept {
+        assert(other.m_n_bits == m_n_bits);
+        for (std::size_t i = 0; i < m_words.size(); ++i)
+            if (m_words[i] & other.m_words[i]) return true;
+        return false;
+    }
+
+    /**
+     * @brief call fn(index) for each set bit, in increasing index order
+     *
+     * @tparam Fn
+     * @param fn
+     */
+    template<typename Fn>
+    void for_each_set(Fn&& fn) const {
+        for (std::size_t i = 0; i < m_words.size(); ++i) {
+            word_t w = m_words[i];
+            while (w) {
+                const int b = __builtin_ctzll(w);
+                fn((int)i * word_bits + b);
+                w &= w - 1;
+            }
+        }
+    }
+
+    const word_t* words() const noexcept {return m_words.data();}
+    std::size_t n_words() const noexcept {return m_words.size();}
+
+    static std::size_t n_words(int n_bits) noexcept {
+        return (std::size_t)(n_bits + word_bits - 1) / word_bits;
+    }
+
+private:
+    friend bool operator==(const DomainBits& a, const DomainBits& b) noexcept {
+        return a.m_n_bits == b.m_n_bits && a.m_words == b.m_words;
+    }
+
+    int m_n_bits = 0;
+    std::vector<word_t> m_words{};
+};
+
 } // namespace pcg
 
 namespace std {
@@ -59,18 +274,8 @@ template<>
 struct hash<wfc::coord>
 {
     size_t operator()(const wfc::coord& k) const {
-        // see https://stackoverflow.com/questions/17016175/c-unordered-map-using-a-custom-class-type-as-the-key
-        using std::size_t;
-        using std::hash;
-        using std::string;
-
-        // Compute individual hash values for first,
-        // second and third and combine them using XOR
-        // and bit shifting:
-
-        return ((hash<int>()(k.x)
-            ^ (hash<int>()(k.y) << 1)) >> 1);
-        // ^ (hash<int>()(k.third) << 1);
+        // xor and shift of the two ints collided heavily on upper triangular coordinates
+        return (size_t)ev2::mix64(ev2::pack_key(k.x, k.y));
     }
 };
 
@@ -126,9 +331,50 @@ public:
 
     void set_value(const Val& v) noexcept {
         domain = {v};
+        invalidate_domain();
     }
-    
+
+    /**
+     * @brief Replace the domain. Prefer this over writing domain directly on nodes
+     *  that a solver has already seen, so that cached domain data is dropped.
+     *
+     * @param d
+     */
+    void set_domain(std::vector<Val> d) {
+        domain = std::move(d);
+        invalidate_domain();
+    }
+
+    /**
+     * @brief drop solver data derived from domain
+     *
+     */
+    void invalidate_domain() noexcept {
+        domain_bits.clear();
+        domain_changed();
+    }
+
+    /**
+     * @brief called by solvers after changing domain (and domain_bits) in place
+     *
+     */
+    void domain_changed() noexcept {
+        entropy = -1.f;
+        ++domain_generation;
+    }
+
     std::vector<Val> domain{};      // valid patterns for this node
+
+    DomainBits domain_bits{};       // pattern index mirror of domain, maintained by WFCSolver in SolverDomainMode::Bitset
+    mutable float entropy = -1.f;   // cached entropy in SolverDomainMode::Bitset, negative when stale
+
+    std::uint32_t domain_generation = 0;    // incremented every time the domain changes
+    mutable std::uint32_t type_signature_generation = std::numeric_limits<std::uint32_t>::max();
+    mutable std::uint64_t type_signature = 0; // hash of the set of types in domain, see ValidityCache
+
+    mutable std::uint32_t bits_generation = std::numeric_limits<std::uint32_t>::max(); // domain_generation domain_bits mirror
+    int solver_slot = -1;           // dense index assigned by the solver that last propagated through this node
+    std::uint32_t solver_stamp = 0; // stamp of that solver, a slot is only used by the solver with the same stamp
 };
 
 template<typename T,
@@ -177,6 +423,14 @@ public:
      */
     virtual std::vector<T*> adjacent_nodes(const T* a) const = 0;
 
+    /**
+     * @brief get adjacent nodes without copying. The view is invalidated by any change to the graph.
+     *
+     * @param a
+     * @return Span<T* const>
+     */
+    virtual Span<T* const> adjacent_span(const T* a) const = 0;
+
     virtual bool is_directed() const noexcept = 0;
 
     virtual int get_n_nodes() const noexcept = 0;
@@ -190,21 +444,37 @@ public:
 };
 
 template<typename T>
-class SparseGraph: public Graph<T>
+class CSRGraph;
+
+template<typename T>
+class SparseGraph final : public Graph<T>
 {
 private:
+    friend class CSRGraph<T>;
 
     struct internal_node {
         int mat_coord = -1;
         T* node = nullptr;
         std::vector<T*> adjacent_nodes{};
+        std::vector<int> adjacent_coords{}; // mat_coord of each adjacent node
+        // directed graphs only, nodes with an edge to this node
+        std::vector<T*> in_nodes{};
+        std::vector<int> in_coords{};
     };
 
+    /**
+     * @brief Edge at matrix coord (x, y). pos_a is the index of y in the adjacency list of x,
+     *  pos_b the index of x in the adjacency list of y, or in its in list if directed.
+     *  Lists are updated by swap remove, so the back indices make add and remove O(1).
+     *
+     */
     struct weight {
         float w = 0.f;
         // quick reference for finding adjacent nodes
         internal_node* i_nodeA = nullptr;
         internal_node* i_nodeB = nullptr;
+        int pos_a = -1;
+        int pos_b = -1;
     };
 
 public:
@@ -225,14 +495,23 @@ public:
         }
 
         // takes care of directed vs undirected graphs
-        if (!add_i_edge_sam(a_i, b_i, v))
+        weight* sam = add_i_edge_sam(a_i, b_i, v);
+        if (!sam)
             return;
 
         // build adjacency information
+        sam->pos_a = (int)a_i->adjacent_nodes.size();
         a_i->adjacent_nodes.push_back(b);
-        if (!m_is_directed)
+        a_i->adjacent_coords.push_back(b_i->mat_coord);
+        if (m_is_directed) {
+            sam->pos_b = (int)b_i->in_nodes.size();
+            b_i->in_nodes.push_back(a);
+            b_i->in_coords.push_back(a_i->mat_coord);
+        } else {
+            sam->pos_b = (int)b_i->adjacent_nodes.size();
             b_i->adjacent_nodes.push_back(a);
-
+            b_i->adjacent_coords.push_back(a_i->mat_coord);
+        }
     }
 
     void remove_edge(T* a, T* b) override {
@@ -244,21 +523,14 @@ public:
         if (!(a_i && b_i))
             return;
 
-        // takes care of directed vs undirected graphs
-        if (!remove_i_edge_sam(a_i, b_i))
-            return;
-
-        // erase element from adjacency lists
-        auto& vec = a_i->adjacent_nodes;
-        vec.erase(std::remove(vec.begin(), vec.end(), b_i->node), vec.end());
-
-        // if this is not a directed graph, erase reverse edge as well
-        if (!m_is_directed) {
-            auto& vecb = b_i->adjacent_nodes;
-            vecb.erase(std::remove(vecb.begin(), vecb.end(), a_i->node), vecb.end());
-        }
+        remove_i_edge(a_i, b_i);
     }
 
+    /**
+     * @brief Remove a node and every edge to or from it, in time proportional to its degree
+     *
+     * @param a
+     */
     void remove_node(T* a) override {
         assert(a != nullptr);
         internal_node* a_i = get_i_node(a);
@@ -266,22 +538,15 @@ public:
         if (!a_i) // not in graph
             return;
 
-        for (auto& n : a_i->adjacent_nodes) {
-            internal_node* b_i = get_i_node(n);
-            assert(b_i);
-
-            bool remove = remove_i_edge_sam(a_i, b_i);
-            if (m_is_directed) // if directed, remove reverse edge
-                remove &= remove_i_edge_sam(b_i, a_i);
-            
-            assert(remove);
-
-            // remove a from b, since we are removing node, this always happens
-            auto& vecb = b_i->adjacent_nodes;
-            vecb.erase(std::remove(vecb.begin(), vecb.end(), a_i->node), vecb.end());
+        // removing the last entry of a list does not move any other entry
+        while (!a_i->adjacent_nodes.empty()) {
+            const bool removed = remove_i_edge(a_i, get_i_node(a_i->adjacent_nodes.back()));
+            assert(removed);
+        }
+        while (!a_i->in_nodes.empty()) {
+            const bool removed = remove_i_edge(get_i_node(a_i->in_nodes.back()), a_i);
+            assert(removed);
         }
-
-        a_i->adjacent_nodes = {};
 
         remove_i_node(a_i);
     }
@@ -302,10 +567,8 @@ public:
         if (!m_is_directed && c.x == c.y)
             return 0.f; // no self loops (diagonals)
 
-        auto itr = sparse_adjacency_map.find(c);
-        if (itr != sparse_adjacency_map.end())
-            return itr->second.w;
-        return 0.f;
+        const weight* w = sparse_adjacency_map.find(edge_key(c));
+        return w ? w->w : 0.f;
     }
 
     std::vector<T*> adjacent_nodes(const T* a) const override {
@@ -318,9 +581,19 @@ public:
         return a_i->adjacent_nodes;
     }
 
+    Span<T* const> adjacent_span(const T* a) const override {
+        assert(a != nullptr);
+        const internal_node* a_i = get_i_node(a);
+
+        if (a_i == nullptr)
+            return {};
+
+        return a_i->adjacent_nodes;
+    }
+
     bool is_directed() const noexcept override { return m_is_directed; }
 
-    int get_n_nodes() const noexcept override { return node_map.size(); }
+    int get_n_nodes() const noexcept override { return (int)node_map.size(); }
 
     /**
      * @brief Make map of <node_id -> bool> for use in marking visitation
@@ -329,8 +602,9 @@ public:
      */
     std::unordered_map<int, bool> make_visited_map() const override {
         std::unordered_map<int, bool> out(get_n_nodes());
-        for (const auto& [k, _] : node_map)
-            out.insert({ k, false });
+        for (const auto& i_node : m_i_nodes)
+            if (i_node.node)
+                out.insert({ i_node.node->node_id, false });
         return out;
     }
 
@@ -368,34 +642,47 @@ public:
 
 private:
     internal_node* add_i_node(T* node) {
-        internal_node* i_node = nullptr;
-        if (node) {
-            auto itr = node_map.find(node->node_id);
-            // node does not exist
-            if (itr == node_map.end()) {
-                auto [p, inserted] = node_map.emplace(node->node_id, internal_node{ get_next_mat_coord(), node, {} });
-
-                // if false, failed to create, we probably already have the same id
-                if (inserted)
-                    i_node = &p->second;
-            } else
-                i_node = &itr->second;
+        if (!node)
+            return nullptr;
+        auto [index, inserted] = node_map.try_emplace(node_key(node), -1);
+        if (!inserted)
+            return &m_i_nodes[*index];
+
+        // node does not exist, reuse a free slot so that internal node addresses stay stable
+        if (m_free_i_nodes.empty()) {
+            *index = (int)m_i_nodes.size();
+            m_i_nodes.emplace_back();
+        } else {
+            *index = m_free_i_nodes.back();
+            m_free_i_nodes.pop_back();
         }
-        return i_node;
+        internal_node& i_node = m_i_nodes[*index];
+        i_node.mat_coord = get_next_mat_coord();
+        i_node.node = node;
+        return &i_node;
     }
 
     void remove_i_node(internal_node* node) {
-        node_map.erase(node->node->node_id);
+        const int* index = node_map.find(node_key(node->node));
+        assert(index);
+        m_free_i_nodes.push_back(*index);
+        node_map.erase(node_key(node->node));
+        *node = internal_node{};
     }
 
     const internal_node* get_i_node(const T* node) const {
-        const internal_node* i_node = nullptr;
-        if (node) {
-            auto itr = node_map.find(node->node_id);
-            if (itr != node_map.end())
-                i_node = &itr->second;
-        }
-        return i_node;
+        if (!node)
+            return nullptr;
+        const int* index = node_map.find(node_key(node));
+        return index ? &m_i_nodes[*index] : nullptr;
+    }
+
+    static std::uint64_t node_key(const T* node) noexcept {
+        return (std::uint64_t)(std::uint32_t)node->node_id;
+    }
+
+    static std::uint64_t edge_key(const coord& c) noexcept {
+        return ev2::pack_key(c.x, c.y);
     }
 
     internal_node* get_i_node(const T* node) {
@@ -414,13 +701,19 @@ private:
         if (!m_is_directed && c.x == c.y)
             return 0.f; // no self loops (diagonals)
 
-        auto itr = sparse_adjacency_map.find(c);
-        if (itr != sparse_adjacency_map.end())
-            return itr->second.w;
-        return 0.f;
+        const weight* w = sparse_adjacency_map.find(edge_key(c));
+        return w ? w->w : 0.f;
     }
 
-    bool add_i_edge_sam(internal_node* a_i, internal_node* b_i, float w) {
+    /**
+     * @brief add the weight entry for an edge
+     *
+     * @param a_i
+     * @param b_i
+     * @param w
+     * @return weight* nullptr if the edge exists or is a self loop of an undirected graph
+     */
+    weight* add_i_edge_sam(internal_node* a_i, internal_node* b_i, float w) {
         // enforce populating only the upper triangular matrix
         if (!m_is_directed && a_i->mat_coord > b_i->mat_coord) {
             std::swap(a_i, b_i);
@@ -428,35 +721,81 @@ private:
 
         coord c{ a_i->mat_coord, b_i->mat_coord };
 
-        if (sparse_adjacency_map.find(c) != sparse_adjacency_map.end())
-            return false; // already added
-
         if (!m_is_directed && c.x == c.y)
-            return false; // no self loops (diagonals)
-        
-        auto& sam = sparse_adjacency_map[c];
-        sam.i_nodeA = a_i;
-        sam.i_nodeB = b_i;
-        sam.w = w;
+            return nullptr; // no self loops (diagonals)
 
-        return true;
+        auto [sam, inserted] = sparse_adjacency_map.try_emplace(edge_key(c));
+        if (!inserted)
+            return nullptr; // already added
+
+        sam->i_nodeA = a_i;
+        sam->i_nodeB = b_i;
+        sam->w = w;
+
+        return sam;
     }
 
-    bool remove_i_edge_sam(internal_node* a_i, internal_node* b_i) {
+    /**
+     * @brief remove the edge and its adjacency list entries
+     *
+     * @param a_i
+     * @param b_i
+     * @return true if the edge existed
+     */
+    bool remove_i_edge(internal_node* a_i, internal_node* b_i) {
         // enforce populating only the upper triangular matrix
         if (!m_is_directed && a_i->mat_coord > b_i->mat_coord) {
             std::swap(a_i, b_i);
         }
 
-        coord c{ a_i->mat_coord, b_i->mat_coord };
+        const std::uint64_t key = edge_key(coord{ a_i->mat_coord, b_i->mat_coord });
+        const weight* sam = sparse_adjacency_map.find(key);
+        if (!sam)
+            return false;
+        const int pos_a = sam->pos_a;
+        const int pos_b = sam->pos_b;
+        sparse_adjacency_map.erase(key);
 
-        auto sam_itr = sparse_adjacency_map.find(c);
+        swap_remove(a_i, false, pos_a);
+        swap_remove(b_i, m_is_directed, pos_b);
+        return true;
+    }
 
-        if (sam_itr != sparse_adjacency_map.end()) {
-            sparse_adjacency_map.erase(sam_itr);
-            return true;
+    /**
+     * @brief remove entry pos of an adjacency list by moving the last entry into its place,
+     *  then point the edge of the moved entry at its new position
+     *
+     * @param owner
+     * @param in_list remove from the in list instead of the adjacency list
+     * @param pos
+     */
+    void swap_remove(internal_node* owner, bool in_list, int pos) {
+        auto& nodes = in_list ? owner->in_nodes : owner->adjacent_nodes;
+        auto& coords = in_list ? owner->in_coords : owner->adjacent_coords;
+        assert(pos >= 0 && pos < (int)nodes.size());
+
+        const int last = (int)nodes.size() - 1;
+        if (pos != last) {
+            nodes[pos] = nodes[last];
+            coords[pos] = coords[last];
+
+            const int other = coords[pos];
+            weight* moved = nullptr;
+            if (in_list) // edge other -> owner
+                moved = sparse_adjacency_map.find(edge_key(coord{ other, owner->mat_coord }));
+            else if (m_is_directed || owner->mat_coord < other) // edge owner -> other
+                moved = sparse_adjacency_map.find(edge_key(coord{ owner->mat_coord, other }));
+            else // undirected, stored as other -> owner
+                moved = sparse_adjacency_map.find(edge_key(coord{ other, owner->mat_coord }));
+            assert(moved);
+
+            if (!in_list && (m_is_directed || owner->mat_coord < other))
+                moved->pos_a = pos;
+            else
+                moved->pos_b = pos;
         }
-        return false;
+        nodes.pop_back();
+        coords.pop_back();
     }
 
     int get_next_mat_coord() noexcept { return next_mat_coord++; }
@@ -468,17 +807,19 @@ private:
         out << std::setw(10) << "_";
 
         std::vector<T*> node_order{};
-        for (auto& [i, i_node] : graph.node_map) {
+        for (auto& i_node : graph.m_i_nodes) {
+            if (!i_node.node)
+                continue;
             out << std::setw(10) << i_node.node->node_id;
             node_order.push_back(i_node.node);
         }
         out << "\n" << std::setprecision(5);
-        for (auto& [i, i_node] : graph.node_map) {
-            out << std::setw(10) << i_node.node->node_id;
+        for (auto i_node : node_order) {
+            out << std::setw(10) << i_node->node_id;
             
             // print row of adjacencies for this node
             for (auto j_node : node_order) {
-                out << std::setw(10) << graph.adjacent(i_node.node, j_node);
+                out << std::setw(10) << graph.adjacent(i_node, j_node);
             }
             out << "\n";
         }
@@ -488,8 +829,10 @@ private:
 private:
     int next_mat_coord = 0;
     bool m_is_directed = false;
-    std::unordered_map<int, internal_node> node_map{}; // node id to internal adjacency
-    std::unordered_map<coord, weight> sparse_adjacency_map{};
+    std::deque<internal_node> m_i_nodes{};      // internal adjacency, addresses are stable
+    std::vector<int> m_free_i_nodes{};          // unused entries of m_i_nodes
+    ev2::FlatHashMap<int> node_map{};           // node id to index in m_i_nodes
+    ev2::FlatHashMap<weight> sparse_adjacency_map{}; // packed matrix coord to edge weight
 };
 
 /**
@@ -497,7 +840,7 @@ private:
  *
  */
 template<typename T>
-class DenseGraph: public Graph<T> {
+class DenseGraph final : public Graph<T> {
 public:
     explicit DenseGraph(int n_nodes, bool directed = false): m_n_nodes{ n_nodes }, m_is_directed{ directed }, m_adjacency_matrix(n_nodes* n_nodes) {}
 
@@ -531,6 +874,8 @@ public:
             return; // no self loops (diagonals)
 
         m_adjacency_matrix[index] = v;
+        if (m_bit_packed && !m_bits_dirty)
+            set_adjacency_bits(ind_a, ind_b, v > 0.f);
     }
 
     void remove_edge(T* a, T* b) override {
@@ -571,9 +916,26 @@ public:
         assert(a_ind >= 0 && b_ind >= 0);
         assert(a_ind < m_nodes.size() && b_ind < m_nodes.size()); // node should already be in graph
 
+        m_bits_dirty = true; // the value may be written through the reference
         return m_adjacency_matrix[ind(a_ind, b_ind)];
     }
 
+    /**
+     * @brief Keep a bit per matrix entry (set when the weight is positive) next to the weights.
+     *  bfs then scans 64 candidate nodes per word instead of one float per node. The bits are
+     *  rebuilt on the next bfs after weights were written through adjacent(int, int).
+     *
+     * @param enabled
+     */
+    void set_bit_packed(bool enabled) {
+        m_bit_packed = enabled;
+        m_bits_dirty = true;
+        if (!enabled)
+            m_adjacency_bits = {};
+    }
+
+    bool is_bit_packed() const noexcept {return m_bit_packed;}
+
     /**
      * @brief get adjacent nodes
      *
@@ -600,6 +962,31 @@ public:
         return nodes;
     }
 
+    /**
+     * @brief adjacency is stored as a matrix, so this view points at a scratch buffer
+     *  that is overwritten by the next call
+     *
+     * @param a
+     * @return Span<T* const>
+     */
+    Span<T* const> adjacent_span(const T* a) const override {
+        assert(a != nullptr);
+        m_adjacent_scratch.clear();
+
+        int ind_a = get_node_index(a);
+        if (ind_a < 0)
+            return {}; // node not in graph
+
+        for (int i = 0; i < m_n_nodes; ++i) {
+            if (i == ind_a)
+                continue;
+            coord c{ ind_a, i };
+            if (m_adjacency_matrix[c.to_index(m_n_nodes)] > 0.f)
+                m_adjacent_scratch.push_back(m_nodes[i]);
+        }
+        return m_adjacent_scratch;
+    }
+
     bool is_directed() const noexcept override { return m_is_directed; }
 
     int get_n_nodes() const noexcept override { return m_nodes.size(); }
@@ -674,6 +1061,9 @@ public:
      */
     bool bfs(int a_ind, int b_ind, std::vector<int>& parent) const {
         assert(a_ind >= 0 && b_ind >= 0);
+        if (m_bit_packed)
+            return bfs_bits(a_ind, b_ind, parent);
+
         parent.clear();
         parent = std::vector<int>(m_nodes.size(), -1);
 
@@ -706,6 +1096,65 @@ public:
     }
 
 private:
+    bool bfs_bits(int a_ind, int b_ind, std::vector<int>& parent) const {
+        if (m_bits_dirty)
+            rebuild_adjacency_bits();
+
+        parent.assign(m_nodes.size(), -1);
+        // unvisited[w] has a bit for every node of word w that is in the graph and not visited yet
+        std::vector<std::uint64_t> unvisited(m_words_per_row, 0);
+        for (std::size_t i = 0; i < m_nodes.size(); ++i)
+            unvisited[i / 64] |= std::uint64_t{1} << (i % 64);
+        unvisited[a_ind / 64] &= ~(std::uint64_t{1} << (a_ind % 64));
+
+        std::queue<int> q{};
+        q.push(a_ind);
+
+        while (!q.empty()) {
+            const int u_ind = q.front();
+            q.pop();
+            const std::uint64_t* row = &m_adjacency_bits[(std::size_t)u_ind * m_words_per_row];
+            for (std::size_t w = 0; w < m_words_per_row; ++w) {
+                std::uint64_t next = row[w] & unvisited[w];
+                unvisited[w] &= ~next;
+                while (next) {
+                    const int v_ind = (int)(w * 64) + __builtin_ctzll(next);
+                    next &= next - 1;
+                    q.push(v_ind);
+                    parent[v_ind] = u_ind; // v was reached from u
+
+                    if (v_ind == b_ind)
+                        return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void rebuild_adjacency_bits() const {
+        m_words_per_row = (m_n_nodes + 63) / 64;
+        m_adjacency_bits.assign((std::size_t)m_n_nodes * m_words_per_row, 0);
+        for (int a = 0; a < (int)m_nodes.size(); ++a)
+            for (int b = 0; b < (int)m_nodes.size(); ++b) {
+                const int index = ind(a, b);
+                if (index >= 0 && m_adjacency_matrix[index] > 0.f)
+                    m_adjacency_bits[(std::size_t)a * m_words_per_row + b / 64] |= std::uint64_t{1} << (b % 64);
+            }
+        m_bits_dirty = false;
+    }
+
+    // bit for a -> b, and b -> a when undirected
+    void set_adjacency_bits(int a, int b, bool set) {
+        auto assign = [this, set](int row, int col) {
+            std::uint64_t& word = m_adjacency_bits[(std::size_t)row * m_words_per_row + col / 64];
+            const std::uint64_t bit = std::uint64_t{1} << (col % 64);
+            word = set ? (word | bit) : (word & ~bit);
+        };
+        assign(a, b);
+        if (!m_is_directed)
+            assign(b, a);
+    }
+
     int check_node_index(T* node) {
         auto itr = m_nodeid_to_nodeind.find(node->node_id);
         if (itr == m_nodeid_to_nodeind.end()) { // not found, add node and allocate it a row in matrix
@@ -763,36 +1212,461 @@ private:
     std::vector<float> m_adjacency_matrix{};
     std::vector<T*> m_nodes{}; // m_nodes indexing follows adjacency matrix, m_nodes at i corresponds to row and column i
     std::unordered_map<int, int> m_nodeid_to_nodeind{};
+    mutable std::vector<T*> m_adjacent_scratch{};
+
+    // see set_bit_packed, rows of m_words_per_row words
+    bool m_bit_packed = false;
+    mutable bool m_bits_dirty = true;
+    mutable std::size_t m_words_per_row = 0;
+    mutable std::vector<std::uint64_t> m_adjacency_bits{};
 };
 
 /**
- * @brief return maximum flow through graph from source to sink
+ * @brief Read only snapshot of a SparseGraph in compressed sparse row form. Node i has its neighbors
+ *  at [offsets[i], offsets[i + 1]) of one contiguous array, both as node indices and as node pointers,
+ *  so iterating a neighborhood touches a single block of memory. Nodes are indexed in the order they
+ *  were first added to the source graph, and neighbors keep the source adjacency order.
+ *
+ *  Changes to the source graph after the snapshot was taken are not seen, take a new snapshot instead.
+ *  All mutating Graph functions throw.
  *
- * @param dg            dense graph of flow capacities
- * @param source        source node
- * @param sink          sink node
- * @param residual_graph optional residual graph output
- * @return int max flow
  */
-// float ford_fulkerson(const DenseGraph<GraphNode>& dg, const GraphNode* source, const GraphNode* sink, DenseGraph<GraphNode>* residual_graph);
-
 template<typename T>
-float ford_fulkerson(const DenseGraph<T>& dg, const T* source, const T* sink, DenseGraph<T>* residual_graph) {
-    // based on https://www.geeksforgeeks.org/ford-fulkerson-algorithm-for-maximum-flow-problem/
-    assert(source && sink);
+class CSRGraph final : public Graph<T> {
+public:
+    CSRGraph() = default;
 
-    DenseGraph<T> residual = dg;
+    /**
+     * @brief build the snapshot, O(V log V + E)
+     *
+     * @param graph
+     */
+    explicit CSRGraph(const SparseGraph<T>& graph) : m_is_directed{graph.is_directed()} {
+        using internal_node = typename SparseGraph<T>::internal_node;
+
+        std::vector<const internal_node*> order{};
+        order.reserve(graph.node_map.size());
+        for (const auto& i_node : graph.m_i_nodes)
+            if (i_node.node)
+                order.push_back(&i_node);
+        std::sort(order.begin(), order.end(), [](const internal_node* a, const internal_node* b) {
+            return a->mat_coord < b->mat_coord;
+        });
 
-    float max_flow = 0.f;
+        const std::size_t n = order.size();
+        m_nodes.reserve(n);
+        m_nodeid_to_index.reserve(n);
+        m_offsets.reserve(n + 1);
+        m_offsets.push_back(0);
+        std::size_t n_edges = 0;
+        for (const internal_node* i_node : order) {
+            m_nodeid_to_index.insert({i_node->node->node_id, (int)m_nodes.size()});
+            m_nodes.push_back(i_node->node);
+            n_edges += i_node->adjacent_nodes.size();
+            m_offsets.push_back((int)n_edges);
+        }
 
-    int s_ind = residual.get_node_index(source);
-    int t_ind = residual.get_node_index(sink);
+        m_neighbor_nodes.reserve(n_edges);
+        m_neighbors.reserve(n_edges);
+        m_weights.reserve(n_edges);
+        for (const internal_node* i_node : order) {
+            for (T* b : i_node->adjacent_nodes) {
+                m_neighbor_nodes.push_back(b);
+                m_neighbors.push_back(m_nodeid_to_index.at(b->node_id));
+                m_weights.push_back(graph.adjacent(i_node->node, b));
+            }
+        }
+    }
 
-    std::vector<int> parent;
-    while (residual.bfs(s_ind, t_ind, parent)) {
-        // find the minimum residual capacity along the 
-        // path in residual graph
-        float path_flow = INFINITY;
+    void add_edge(T* a, T* b, float v) override {
+        throw std::runtime_error("CSRGraph is read only");
+    }
+
+    void remove_edge(T* a, T* b) override {
+        throw std::runtime_error("CSRGraph is read only");
+    }
+
+    void remove_node(T* a) override {
+        throw std::runtime_error("CSRGraph is read only");
+    }
+
+    float adjacent(T* a, T* b) const override {
+        assert(a != nullptr && b != nullptr);
+        const int i = index_of(a);
+        const int j = index_of(b);
+        if (i < 0 || j < 0)
+            return 0.f;
+        for (int k = m_offsets[i]; k < m_offsets[i + 1]; ++k)
+            if (m_neighbors[k] == j)
+                return m_weights[k];
+        return 0.f;
+    }
+
+    std::vector<T*> adjacent_nodes(const T* a) const override {
+        const auto span = adjacent_span(a);
+        return {span.begin(), span.end()};
+    }
+
+    Span<T* const> adjacent_span(const T* a) const override {
+        assert(a != nullptr);
+        const int i = index_of(a);
+        if (i < 0)
+            return {};
+        return adjacent_span(i);
+    }
+
+    bool is_directed() const noexcept override { return m_is_directed; }
+
+    int get_n_nodes() const noexcept override { return (int)m_nodes.size(); }
+
+    std::unordered_map<int, bool> make_visited_map() const override {
+        std::unordered_map<int, bool> out(get_n_nodes());
+        for (const T* node : m_nodes)
+            out.insert({ node->node_id, false });
+        return out;
+    }
+
+    /**
+     * @brief index of a node in the snapshot
+     *
+     * @param a
+     * @return int -1 if the node was not in the source graph
+     */
+    int index_of(const T* a) const {
+        auto itr = m_nodeid_to_index.find(a->node_id);
+        return itr != m_nodeid_to_index.end() ? itr->second : -1;
+    }
+
+    T* node(int i) const noexcept {return m_nodes[i];}
+
+    int degree(int i) const noexcept {return m_offsets[i + 1] - m_offsets[i];}
+
+    std::size_t get_n_edges() const noexcept {return m_neighbors.size();}
+
+    Span<T* const> adjacent_span(int i) const noexcept {
+        return {m_neighbor_nodes.data() + m_offsets[i], (std::size_t)degree(i)};
+    }
+
+    /**
+     * @brief neighbor indices of node i
+     *
+     * @param i
+     * @return Span<const int>
+     */
+    Span<const int> neighbors(int i) const noexcept {
+        return {m_neighbors.data() + m_offsets[i], (std::size_t)degree(i)};
+    }
+
+    /**
+     * @brief edge weights of node i, in the same order as neighbors(i)
+     *
+     * @param i
+     * @return Span<const float>
+     */
+    Span<const float> weights(int i) const noexcept {
+        return {m_weights.data() + m_offsets[i], (std::size_t)degree(i)};
+    }
+
+private:
+    bool m_is_directed = false;
+    std::vector<T*> m_nodes{};
+    std::unordered_map<int, int> m_nodeid_to_index{};
+    std::vector<int> m_offsets{};           // node index -> range of the arrays below
+    std::vector<int> m_neighbors{};         // neighbor node indices
+    std::vector<T*> m_neighbor_nodes{};     // neighbor node pointers
+    std::vector<float> m_weights{};
+};
+
+/**
+ * @brief Undirected 4-neighborhood grid over nodes owned elsewhere. Node (row, column) is
+ *  nodes[row * width + column]. Neighbors are listed left, up, right, down, the same order a
+ *  SparseGraph gets when the edges are added row by row. Edges have weight 1 and the topology is
+ *  fixed, all mutating Graph functions throw.
+ *
+ */
+template<typename T>
+class GridGraph final : public Graph<T> {
+public:
+    GridGraph() = default;
+
+    GridGraph(int width, int height, const std::vector<T*>& nodes)
+        : m_width{width}, m_height{height}, m_nodes{nodes},
+          m_neighbors(nodes.size() * 4), m_degree(nodes.size(), 0) {
+        if (width <= 0 || height <= 0 || (std::size_t)width * height != nodes.size())
+            throw std::logic_error("GridGraph::GridGraph invalid size argument");
+
+        m_nodeid_to_index.reserve(nodes.size());
+        for (int i = 0; i < height; ++i)
+            for (int j = 0; j < width; ++j) {
+                const int index = i * width + j;
+                m_nodeid_to_index[nodes[index]->node_id] = index;
+                if (j > 0) link(index, index - 1);
+                if (i > 0) link(index, index - width);
+                if (j + 1 < width) link(index, index + 1);
+                if (i + 1 < height) link(index, index + width);
+            }
+    }
+
+    void add_edge(T* a, T* b, float v) override {
+        throw std::runtime_error("GridGraph topology is fixed");
+    }
+
+    void remove_edge(T* a, T* b) override {
+        throw std::runtime_error("GridGraph topology is fixed");
+    }
+
+    void remove_node(T* a) override {
+        throw std::runtime_error("GridGraph topology is fixed");
+    }
+
+    float adjacent(T* a, T* b) const override {
+        assert(a != nullptr && b != nullptr);
+        for (T* n : adjacent_span(a))
+            if (n == b)
+                return 1.f;
+        return 0.f;
+    }
+
+    std::vector<T*> adjacent_nodes(const T* a) const override {
+        const auto span = adjacent_span(a);
+        return {span.begin(), span.end()};
+    }
+
+    Span<T* const> adjacent_span(const T* a) const override {
+        assert(a != nullptr);
+        const int i = index_of(a);
+        if (i < 0)
+            return {};
+        return adjacent_span(i);
+    }
+
+    Span<T* const> adjacent_span(int i) const noexcept {
+        return {m_neighbors.data() + i * 4, (std::size_t)m_degree[i]};
+    }
+
+    bool is_directed() const noexcept override { return false; }
+
+    int get_n_nodes() const noexcept override { return (int)m_nodes.size(); }
+
+    std::unordered_map<int, bool> make_visited_map() const override {
+        std::unordered_map<int, bool> out(get_n_nodes());
+        for (const T* node : m_nodes)
+            out.insert({ node->node_id, false });
+        return out;
+    }
+
+    int index_of(const T* a) const noexcept {
+        const int* index = m_nodeid_to_index.find((std::uint64_t)(std::uint32_t)a->node_id);
+        return index ? *index : -1;
+    }
+
+    int get_width() const noexcept {return m_width;}
+    int get_height() const noexcept {return m_height;}
+
+private:
+    void link(int index, int neighbor) {
+        m_neighbors[index * 4 + m_degree[index]++] = m_nodes[neighbor];
+    }
+
+    int m_width = 0, m_height = 0;
+    std::vector<T*> m_nodes{};
+    std::vector<T*> m_neighbors{};      // 4 entries per node, the first m_degree are used
+    std::vector<std::uint8_t> m_degree{};
+    ev2::FlatHashMap<int> m_nodeid_to_index{};
+};
+
+/**
+ * @brief Max flow over an adjacency list residual network. Every edge is stored next to its
+ *  reverse edge (ids e and e ^ 1), and solving updates the residual capacities in place.
+ *  Node and edge storage is kept by reset(), so a reused network does not allocate once warmed up.
+ *
+ */
+class FlowNetwork {
+public:
+    FlowNetwork() = default;
+    explicit FlowNetwork(int n_nodes) {reset(n_nodes);}
+
+    /**
+     * @brief remove all edges and resize to n_nodes
+     *
+     * @param n_nodes
+     */
+    void reset(int n_nodes) {
+        m_n_nodes = n_nodes;
+        m_to.clear();
+        m_capacity.clear();
+        m_residual.clear();
+        m_csr_dirty = true;
+    }
+
+    int add_node() {
+        m_csr_dirty = true;
+        return m_n_nodes++;
+    }
+
+    /**
+     * @brief add an edge and its reverse
+     *
+     * @param from
+     * @param to
+     * @param capacity
+     * @param reverse_capacity capacity of to -> from, 0 for a plain directed edge
+     * @return int edge id, the reverse edge is id ^ 1
+     */
+    int add_edge(int from, int to, float capacity, float reverse_capacity = 0.f) {
+        assert(from >= 0 && from < m_n_nodes && to >= 0 && to < m_n_nodes);
+        const int e = (int)m_to.size();
+        m_to.push_back(to);
+        m_to.push_back(from);
+        m_capacity.push_back(capacity);
+        m_capacity.push_back(reverse_capacity);
+        m_residual.push_back(capacity);
+        m_residual.push_back(reverse_capacity);
+        m_csr_dirty = true;
+        return e;
+    }
+
+    int get_n_nodes() const noexcept {return m_n_nodes;}
+    int get_n_edges() const noexcept {return (int)m_to.size();}
+
+    int edge_to(int e) const noexcept {return m_to[e];}
+    int edge_from(int e) const noexcept {return m_to[e ^ 1];}
+
+    float residual(int e) const noexcept {return m_residual[e];}
+
+    // net flow along edge e, negative when flow goes the reverse way
+    float flow(int e) const noexcept {return m_capacity[e] - m_residual[e];}
+
+    // restore all residual capacities to the edge capacities
+    void reset_flow() {m_residual = m_capacity;}
+
+    /**
+     * @brief Dinic, BFS level graph then blocking flow by DFS. O(V^2 E), O(E sqrt(V)) for unit capacity
+     *  bipartite networks. Adds to any flow already in the network.
+     *
+     * @param source
+     * @param sink
+     * @return float flow added
+     */
+    float max_flow_dinic(int source, int sink);
+
+    /**
+     * @brief FIFO push-relabel with the gap heuristic, O(V^3). Adds to any flow already in the network.
+     *
+     * @param source
+     * @param sink
+     * @return float flow added
+     */
+    float max_flow_push_relabel(int source, int sink);
+
+private:
+    void build_csr();
+    bool dinic_levels(int source, int sink);
+    float dinic_augment(int u, int sink, float limit);
+
+    int m_n_nodes = 0;
+    // per edge, pairs e, e ^ 1
+    std::vector<int> m_to{};
+    std::vector<float> m_capacity{};
+    std::vector<float> m_residual{};
+
+    // edges leaving each node
+    bool m_csr_dirty = true;
+    std::vector<int> m_offsets{};
+    std::vector<int> m_edges{};
+
+    // solver scratch
+    std::vector<int> m_level{};
+    std::vector<int> m_iter{};
+    std::vector<int> m_queue{};
+    RingQueue<int> m_active{};
+    std::vector<float> m_excess{};
+    std::vector<int> m_height{};
+    std::vector<int> m_height_count{};
+};
+
+/**
+ * @brief return maximum flow through graph from source to sink, Dinic over a FlowNetwork
+ *  built from the matrix. Weights are capacities, for an undirected graph in both directions.
+ *
+ * @param dg            dense graph of flow capacities
+ * @param source        source node
+ * @param sink          sink node
+ * @param residual_graph optional residual graph output, may be dg. For an undirected graph
+ *  each entry holds the capacity left from the higher to the lower node index.
+ * @return float max flow
+ */
+template<typename T>
+float ford_fulkerson(const DenseGraph<T>& dg, const T* source, const T* sink, DenseGraph<T>* residual_graph) {
+    assert(source && sink);
+
+    const int n = dg.get_n_nodes();
+    thread_local FlowNetwork network{};
+    network.reset(n);
+
+    auto has_edge = [&dg](int u, int v) {
+        return dg.adjacent(u, v) > 0.f || (dg.is_directed() && dg.adjacent(v, u) > 0.f);
+    };
+
+    // one edge pair per node pair, carrying both directions
+    for (int u = 0; u < n; ++u)
+        for (int v = 0; v < u; ++v)
+            if (has_edge(u, v))
+                network.add_edge(u, v, dg.adjacent(u, v), dg.is_directed() ? dg.adjacent(v, u) : dg.adjacent(u, v));
+
+    const int s_ind = dg.get_node_index(source);
+    const int t_ind = dg.get_node_index(sink);
+    if (s_ind < 0 || t_ind < 0)
+        return 0.f;
+    const float max_flow = network.max_flow_dinic(s_ind, t_ind);
+
+    if (residual_graph) {
+        if (residual_graph != &dg)
+            *residual_graph = dg;
+        // same scan order as the edges were added in, edge pairs have consecutive ids. A pair of dg
+        // is read before it is written, so residual_graph may be dg
+        int e = 0;
+        for (int u = 0; u < n; ++u)
+            for (int v = 0; v < u; ++v) {
+                if (!has_edge(u, v))
+                    continue;
+                residual_graph->adjacent(u, v) = network.residual(e);
+                if (dg.is_directed())
+                    residual_graph->adjacent(v, u) = network.residual(e ^ 1);
+                e += 2;
+            }
+        assert(e == network.get_n_edges());
+    }
+    return max_flow;
+}
+
+/**
+ * @brief Edmonds-Karp over a copy of the dense matrix, O(V^2) per augmenting path.
+ *  Kept as the reference for ford_fulkerson.
+ *
+ * @param dg            dense graph of flow capacities
+ * @param source        source node
+ * @param sink          sink node
+ * @param residual_graph optional residual graph output
+ * @return float max flow
+ */
+template<typename T>
+float ford_fulkerson_reference(const DenseGraph<T>& dg, const T* source, const T* sink, DenseGraph<T>* residual_graph) {
+    // based on https://www.geeksforgeeks.org/ford-fulkerson-algorithm-for-maximum-flow-problem/
+    assert(source && sink);
+
+    DenseGraph<T> residual = dg;
+
+    float max_flow = 0.f;
+
+    int s_ind = residual.get_node_index(source);
+    int t_ind = residual.get_node_index(sink);
+
+    std::vector<int> parent;
+    while (residual.bfs(s_ind, t_ind, parent)) {
+        // find the minimum residual capacity along the 
+        // path in residual graph
+        float path_flow = INFINITY;
         for (int v = t_ind; v != s_ind; v = parent[v]) {
             int u = parent[v];
             path_flow = std::min(path_flow, residual.adjacent(u, v));
@@ -804,248 +1678,1849 @@ float ford_fulkerson(const DenseGraph<T>& dg, const T* source, const T* sink, De
             residual.adjacent(u, v) -= path_flow;
             residual.adjacent(v, u) += path_flow;
         }
-
-        max_flow += path_flow;
+
+        max_flow += path_flow;
+    }
+    if (residual_graph)
+        *residual_graph = residual;
+    return max_flow;
+}
+
+/**
+ * @brief Bipartite matching of pattern requirements (left) onto neighbors (right) using
+ *  Hopcroft-Karp over a CSR adjacency. An edge connects requirement i to neighbor j when
+ *  neighbor j can supply the type required by i. Requirements with the same type share one
+ *  adjacency row.
+ *
+ *  All buffers are kept between calls, so after warming up a match does not allocate.
+ *  Use matching_scratch() to get the instance for the calling thread.
+ *
+ */
+class RequirementMatcher {
+public:
+    /**
+     * @brief check if every requirement can be assigned a distinct neighbor
+     *
+     * @tparam ForEachType callable as for_each_type(neighbor_index, emit) where emit(int type)
+     *      is called for each type neighbor_index can supply. Repeated types are allowed.
+     * @param required_types requirement types, may contain duplicates
+     * @param n_required
+     * @param n_neighbors
+     * @param for_each_type
+     * @return true all requirements matched
+     * @return false
+     */
+    template<typename ForEachType>
+    bool match(const int* required_types, int n_required, int n_neighbors, ForEachType&& for_each_type) {
+        if (n_required == 0)
+            return true;
+        if (n_neighbors == 0 || n_required > n_neighbors)
+            return false;
+
+        build_types(required_types, n_required);
+
+        // collect (type row, neighbor) edges, each neighbor appears at most once per row
+        m_row_count.assign(m_types.size(), 0);
+        m_stamp.assign(m_types.size(), -1);
+        m_edges.clear();
+        for (int j = 0; j < n_neighbors; ++j) {
+            for_each_type(j, [this, j](int type) {
+                const int row = type_row(type);
+                if (row >= 0 && m_stamp[row] != j) {
+                    m_stamp[row] = j;
+                    m_edges.push_back({row, j});
+                    ++m_row_count[row];
+                }
+            });
+        }
+
+        // there is not at least one node satisfying a requirement
+        for (int c : m_row_count)
+            if (c == 0)
+                return false;
+
+        build_csr();
+        return hopcroft_karp(n_neighbors) == n_required;
+    }
+
+    /**
+     * @brief augmenting paths found by the last call to match()
+     *
+     * @return int
+     */
+    int last_augmentations() const noexcept {return m_augmentations;}
+
+    /**
+     * @brief augmenting paths found by every match() of this matcher
+     *
+     * @return std::uint64_t
+     */
+    std::uint64_t total_augmentations() const noexcept {return m_total_augmentations;}
+
+private:
+    struct Edge {
+        int row;
+        int neighbor;
+    };
+
+    void build_types(const int* required_types, int n_required);
+
+    int type_row(int type) const noexcept {
+        auto itr = std::lower_bound(m_types.begin(), m_types.end(), type);
+        if (itr == m_types.end() || *itr != type)
+            return -1;
+        return (int)(itr - m_types.begin());
+    }
+
+    void build_csr();
+
+    int hopcroft_karp(int n_neighbors);
+
+    bool hk_bfs();
+
+    bool hk_dfs(int u);
+
+private:
+    std::vector<int> m_types{};         // sorted distinct required types, index is the CSR row
+    std::vector<int> m_left_row{};      // requirement -> CSR row
+    std::vector<int> m_row_count{};
+    std::vector<int> m_stamp{};
+    std::vector<Edge> m_edges{};
+
+    std::vector<int> m_offsets{};       // CSR row offsets into m_adjacency
+    std::vector<int> m_adjacency{};     // neighbor indices
+
+    std::vector<int> m_pair_left{};
+    std::vector<int> m_pair_right{};
+    std::vector<int> m_dist{};
+    std::vector<int> m_iter{};
+    std::vector<int> m_queue{};
+
+    int m_augmentations = 0;
+    std::uint64_t m_total_augmentations = 0;
+};
+
+/**
+ * @brief matcher scratch owned by the calling thread
+ *
+ * @return RequirementMatcher&
+ */
+RequirementMatcher& matching_scratch();
+
+/**
+ * @brief stamp for the node slots of a solver, never 0 and unique for the life of the process
+ *
+ * @return std::uint32_t
+ */
+std::uint32_t next_solver_stamp() noexcept;
+
+/**
+ * @brief counts of where Pattern::valid_tiered resolved its checks
+ *
+ */
+struct ValidityTierStats {
+    std::uint64_t calls = 0;
+    std::uint64_t trivial = 0;          // resolved without building histograms
+    std::uint64_t rejected_count = 0;   // a type had fewer suppliers than its multiplicity
+    std::uint64_t rejected_hall = 0;    // a small requirement subset violated Hall's condition
+    std::uint64_t exact = 0;            // required the full matching
+};
+
+/**
+ * @brief Pattern is a valid configuration of cell values in the generated output
+ *
+ */
+class Pattern {
+  public:
+    Pattern() = default;
+    explicit Pattern(int pattern_class) noexcept : pattern_type{pattern_class} {}
+
+    Pattern(int pattern_class, std::initializer_list<int> l,
+            float weight = 1.f) noexcept
+        : required_types{l}, pattern_type{pattern_class}, weight{weight} {}
+    Pattern(int pattern_class, const std::vector<int>& l,
+            float weight = 1.f) noexcept
+        : required_types{l}, pattern_type{pattern_class}, weight{weight} {}
+
+    /**
+     * @brief check if the requirements of this pattern can be matched one-to-one with neighbors
+     *
+     * @param neighborhood
+     * @return true
+     * @return false
+     */
+    bool valid(Span<DGraphNode* const> neighborhood) const;
+
+    /**
+     * @brief reference implementation of valid(), builds a flow graph and solves it with
+     *  ford_fulkerson. Allocates on every call.
+     *
+     * @param neighborhood
+     * @return true
+     * @return false
+     */
+    bool valid_max_flow(Span<DGraphNode* const> neighborhood) const;
+
+    /**
+     * @brief same result as valid(), but first rejects with necessary conditions that do not
+     *  need a matching:
+     *      1. every required type has at least as many neighbors supplying it as its multiplicity,
+     *          and enough neighbors supply any required type at all.
+     *      2. Hall's condition for every pair (and triple, when there are few types) of required types.
+     *  Only when both pass is the exact matching run.
+     *
+     * @param neighborhood
+     * @param stats optional counters
+     * @return true
+     * @return false
+     */
+    bool valid_tiered(Span<DGraphNode* const> neighborhood, ValidityTierStats* stats = nullptr) const;
+
+    bool valid_approx(Span<DGraphNode* const> neighborhood) const;
+
+    std::vector<int> required_types{};
+    int pattern_type{-1};
+    float weight = 1.f; // relative probabilistic weight on this pattern
+};
+
+using PatternMap = std::unordered_map<int, Pattern>;
+
+inline PatternMap make_pattern_map(std::initializer_list<Pattern> patterns) {
+    PatternMap pm{};
+    pm.reserve(patterns.size());
+    for (auto itr = patterns.begin(), end = patterns.end(); itr != end; ++itr) {
+        pm.insert(std::make_pair(itr->pattern_type, *itr));
+    }
+    return pm;
+}
+
+/**
+ * @brief PatternMap compiled into dense structure of arrays tables. Patterns get dense indices
+ *  in pattern id order. Lookup from pattern id is an array access when ids are compact,
+ *  and falls back to a hash map otherwise.
+ *
+ *  Also holds an alias table over all pattern weights (Vose), for O(1) weighted samples.
+ *
+ *  A table is never modified after construction, solvers can share one through
+ *  std::shared_ptr<const PatternTable>.
+ *
+ */
+class PatternTable {
+public:
+    PatternTable() = default;
+    explicit PatternTable(const PatternMap& patterns);
+
+    int size() const noexcept {return (int)m_ids.size();}
+
+    /**
+     * @brief dense index of a pattern id
+     *
+     * @param pattern_id
+     * @return int index, -1 if there is no such pattern
+     */
+    int index_of(int pattern_id) const noexcept {
+        if (!m_sparse) {
+            const unsigned offset = (unsigned)pattern_id - (unsigned)m_id_base; // wraps instead of overflowing
+            return offset < m_dense_index.size() ? m_dense_index[offset] : -1;
+        }
+        auto itr = m_sparse_index.find(pattern_id);
+        return itr != m_sparse_index.end() ? itr->second : -1;
+    }
+
+    /**
+     * @brief weight of a pattern id, 0 for unknown ids
+     *
+     * @param pattern_id
+     * @return float
+     */
+    float weight_of(int pattern_id) const noexcept {
+        const int i = index_of(pattern_id);
+        return i < 0 ? 0.f : m_weights[i];
+    }
+
+    int id(int i) const noexcept {return m_ids[i];}
+    int type(int i) const noexcept {return m_types[i];}
+    float weight(int i) const noexcept {return m_weights[i];}
+    Val value(int i) const noexcept {return Val{m_types[i], m_ids[i]};}
+    const Pattern& pattern(int i) const noexcept {return m_patterns[i];}
+
+    Span<const int> requirements(int i) const noexcept {
+        return {m_req_types.data() + m_req_offsets[i], (std::size_t)(m_req_offsets[i + 1] - m_req_offsets[i])};
+    }
+
+    const std::vector<float>& weights() const noexcept {return m_weights;}
+    float total_weight() const noexcept {return m_total_weight;}
+
+    /**
+     * @brief weighted sample over all patterns with the alias table. Requires total_weight() > 0
+     *
+     * @param gen
+     * @return int dense index
+     */
+    int sample_alias(std::mt19937& gen) const {
+        assert(m_total_weight > 0.f);
+        std::uniform_real_distribution<float> dist{0.f, (float)m_alias.size()};
+        const float r = dist(gen);
+        const int column = std::min((int)r, (int)m_alias.size() - 1);
+        return (r - (float)column) < m_alias_prob[column] ? column : m_alias[column];
+    }
+
+private:
+    void build_alias();
+
+    // per pattern, indexed by dense index
+    std::vector<int> m_ids{};
+    std::vector<int> m_types{};
+    std::vector<float> m_weights{};
+    std::vector<int> m_req_offsets{};   // requirements of pattern i are m_req_types[m_req_offsets[i], m_req_offsets[i + 1])
+    std::vector<int> m_req_types{};
+    std::vector<Pattern> m_patterns{};  // for validity checks
+
+    // pattern id -> dense index
+    bool m_sparse = false;
+    int m_id_base = 0;
+    std::vector<int> m_dense_index{};
+    std::unordered_map<int, int> m_sparse_index{};
+
+    float m_total_weight = 0.f;
+    std::vector<float> m_alias_prob{};
+    std::vector<int> m_alias{};
+};
+
+/**
+ * @brief Memoized pattern validity. Validity of a pattern only depends on the set of types
+ *  each neighbor can supply, so results are keyed by (pattern id, neighborhood signature)
+ *  where the neighborhood signature is an order independent hash of the neighbors' type sets.
+ *
+ *  A node's type set hash is cached on the node and recomputed when its domain_generation
+ *  changes, so a neighbor losing values produces a new key instead of a stale hit.
+ *
+ */
+class ValidityCache {
+public:
+    struct Stats {
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+    };
+
+    explicit ValidityCache(std::size_t max_entries = 1 << 18) : m_max_entries{max_entries} {}
+
+    /**
+     * @brief signature of a neighborhood, computed once per node domain update
+     *
+     * @tparam Container range of DGraphNode pointers
+     * @param neighborhood
+     * @return std::uint64_t
+     */
+    template<typename Container>
+    static std::uint64_t neighborhood_signature(const Container& neighborhood) {
+        std::uint64_t acc = 0;
+        std::uint64_t n = 0;
+        for (const DGraphNode* node : neighborhood) {
+            acc += mix(type_signature(node)); // sum of hashes, order independent multiset hash
+            ++n;
+        }
+        return mix(acc ^ mix(n));
+    }
+
+    /**
+     * @brief hash of the set of types in the node domain, cached on the node
+     *
+     * @param node
+     * @return std::uint64_t
+     */
+    static std::uint64_t type_signature(const DGraphNode* node);
+
+    /**
+     * @brief look up a cached result
+     *
+     * @param pattern_id
+     * @param signature neighborhood signature
+     * @param result set when found
+     * @return true cache hit
+     * @return false
+     */
+    bool find(int pattern_id, std::uint64_t signature, bool& result) {
+        auto itr = m_entries.find(key(pattern_id, signature));
+        if (itr == m_entries.end()) {
+            ++m_stats.misses;
+            return false;
+        }
+        ++m_stats.hits;
+        result = itr->second;
+        return true;
+    }
+
+    void insert(int pattern_id, std::uint64_t signature, bool result) {
+        if (m_entries.size() >= m_max_entries)
+            m_entries.clear(); // keep memory bounded, entries are cheap to recompute
+        m_entries.insert({key(pattern_id, signature), result});
+    }
+
+    void clear() {m_entries.clear();}
+
+    const Stats& get_stats() const noexcept {return m_stats;}
+    void reset_stats() noexcept {m_stats = {};}
+
+    std::size_t size() const noexcept {return m_entries.size();}
+
+    static std::uint64_t mix(std::uint64_t x) noexcept {
+        // splitmix64 finalizer
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ull;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebull;
+        x ^= x >> 31;
+        return x;
+    }
+
+private:
+    static std::uint64_t key(int pattern_id, std::uint64_t signature) noexcept {
+        return mix(signature ^ mix((std::uint64_t)(std::uint32_t)pattern_id + 0x9e3779b97f4a7c15ull));
+    }
+
+    std::size_t m_max_entries;
+    std::unordered_map<std::uint64_t, bool> m_entries{};
+    Stats m_stats{};
+};
+
+template<typename T, typename = std::enable_if_t<std::is_base_of_v<DGraphNode, T>>>
+class IWFCSolver {
+public:
+    using entropy_callback_t = std::function<float(const T*, const T*)>;
+    using propagate_callback_t = std::function<void(T*)>;
+
+public:
+    virtual ~IWFCSolver() = default;
+
+    virtual void step_wfc(T* node) = 0;
+    virtual void propagate(T* node) = 0;
+    virtual bool update_domain(T* node) = 0;
+    virtual void observe(T* node) = 0;
+
+    virtual float node_entropy(const T* node) const = 0;
+    virtual std::size_t domain_size(const T* node) const = 0;
+    virtual void set_entropy_func(const entropy_callback_t& callback) = 0;
+    virtual void set_propagate_callback_func(const propagate_callback_t& callback) = 0;
+};
+
+enum class SolverValidMode {
+    Correct = 0,
+    Approximate,
+    Tiered      // same results as Correct, see Pattern::valid_tiered
+};
+
+/**
+ * @brief Representation the solver works on for node domains.
+ *  Vector uses DGraphNode::domain directly. Bitset keeps DGraphNode::domain_bits
+ *  over dense pattern indices and writes the vector back only when it changes.
+ *
+ */
+enum class SolverDomainMode {
+    Vector = 0,
+    Bitset
+};
+
+/**
+ * @brief How propagation decides which domain values to re-check.
+ *  Revisit re-checks every value of a visited node against its whole neighborhood.
+ *  Incremental keeps per node type counts and per neighborhood supply counts (AC-4 style),
+ *  so a removal only re-checks values that require a type that vanished from a neighbor.
+ *  Incremental assumes the graph topology does not change while solving, see WFCSolver::reset_supports.
+ *  Parallel revisits nodes one BFS wave at a time. Every node of a wave is checked against the
+ *  domains left by the previous wave, on the solver thread pool, then the removals are applied in
+ *  wave order. The result does not depend on the number of threads.
+ *
+ */
+enum class SolverPropagationMode {
+    Revisit = 0,
+    Incremental,
+    Parallel
+};
+
+/**
+ * @brief counters for SolverPropagationMode::Incremental
+ *
+ */
+struct IncrementalStats {
+    std::uint64_t revisions = 0;        // nodes revised because a neighbor lost a type
+    std::uint64_t checks = 0;           // values with an affected requirement
+    std::uint64_t count_rejects = 0;    // removed because a required type has fewer suppliers than needed
+    std::uint64_t slack_accepts = 0;    // kept because every required type has a supplier per requirement
+    std::uint64_t matchings = 0;        // needed the full matching
+};
+
+/**
+ * @brief counters and phase times of a solver. Counters are always kept, phase times only
+ *  while timing is enabled, see BasicWFCSolver::set_timing_enabled
+ *
+ */
+struct SolverStats {
+    std::uint64_t observations = 0;         // nodes collapsed to one value
+    std::uint64_t propagations = 0;         // calls to propagate()
+    std::uint64_t revisions = 0;            // domains checked against their neighborhood
+    std::uint64_t valid_calls = 0;          // validity checks of one value, cached or not
+    std::uint64_t flow_augmentations = 0;   // augmenting paths of requirement matchings on the solver thread
+    std::uint64_t domain_removals = 0;      // values removed by revisions and bans
+    std::uint64_t contradictions = 0;       // domains emptied
+    double propagate_ms = 0.0;              // in propagate(), including callbacks and validity checks
+    double validity_ms = 0.0;               // in uncached validity checks
+
+    /**
+     * @brief tab separated column names, in the order of write_tsv()
+     *
+     * @param os
+     */
+    static void write_tsv_header(std::ostream& os);
+
+    /**
+     * @brief tab separated values, without a trailing separator or newline
+     *
+     * @param os
+     */
+    void write_tsv(std::ostream& os) const;
+};
+
+/**
+ * @brief adds the time from construction to destruction to *ms, does nothing for a nullptr
+ *
+ */
+class PhaseTimer {
+public:
+    explicit PhaseTimer(double* ms) noexcept : m_ms{ms} {
+        if (m_ms)
+            m_start = std::chrono::steady_clock::now();
+    }
+
+    ~PhaseTimer() {
+        if (m_ms)
+            *m_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    double* m_ms;
+    std::chrono::steady_clock::time_point m_start{};
+};
+
+/**
+ * @brief WFC has two stages. 
+ *      1. collapse a node to force it to have a single value
+ *      2. propagate the changes applied to that node
+ *
+ *  The graph type is a template parameter so that neighbor access is resolved at compile time.
+ *  Any type with adjacent_span(const DGraphNode*) -> Span<DGraphNode* const> works. With a final
+ *  graph class (SparseGraph, DenseGraph, CSRGraph, GridGraph) the calls are inlined, WFCSolver
+ *  runs on any Graph<DGraphNode> through its virtual interface.
+ *
+ * @tparam G graph type
+ */
+template<typename G>
+class BasicWFCSolver : public IWFCSolver<DGraphNode> {
+public:
+    using graph_type = G;
+
+    BasicWFCSolver(G* graph, const PatternMap& patterns, std::mt19937& gen,
+              bool constraint_prop_solved, SolverValidMode mode,
+              SolverDomainMode domain_mode = SolverDomainMode::Vector)
+        : BasicWFCSolver{graph, std::make_shared<const PatternTable>(patterns), gen,
+                         constraint_prop_solved, mode, domain_mode} {}
+
+    /**
+     * @brief solver over a pattern table shared with other solvers
+     *
+     * @param graph
+     * @param table
+     * @param gen
+     * @param constraint_prop_solved
+     * @param mode
+     * @param domain_mode
+     */
+    BasicWFCSolver(G* graph, std::shared_ptr<const PatternTable> table, std::mt19937& gen,
+              bool constraint_prop_solved, SolverValidMode mode,
+              SolverDomainMode domain_mode = SolverDomainMode::Vector)
+        : graph{graph},
+          gen{gen},
+          m_constraint_prop_solved{constraint_prop_solved},
+          m_validity_mode{mode},
+          m_domain_mode{domain_mode},
+          m_shared_table{std::move(table)},
+          m_table{*m_shared_table} {
+        build_type_index();
+    }
+
+    void step_wfc(DGraphNode* node) override {
+        observe(node);
+        propagate(node);
+    }
+
+    /**
+     * @brief pattern with id pattern_id
+     *
+     * @param pattern_id
+     * @return const Pattern* nullptr if there is no such pattern
+     */
+    const Pattern* get_pattern(int pattern_id) const {
+        const int i = m_table.index_of(pattern_id);
+        return i < 0 ? nullptr : &m_table.pattern(i);
+    }
+
+    SolverDomainMode get_domain_mode() const noexcept {return m_domain_mode;}
+
+    const PatternTable& get_pattern_table() const noexcept {return m_table;}
+
+    const std::shared_ptr<const PatternTable>& get_shared_pattern_table() const noexcept {return m_shared_table;}
+
+    /**
+     * @brief Propagate the wave function collapse algorithm. Visited marks, the work queue and
+     *  neighbor access reuse solver storage, so propagation does not allocate once warmed up.
+     *
+     * @param node
+     */
+    void propagate(DGraphNode* node) override {
+        assert(node != nullptr);
+        ++m_stats.propagations;
+        PhaseTimer timer{m_timing_enabled ? &m_stats.propagate_ms : nullptr};
+        release_slots();
+        if (m_propagation_mode == SolverPropagationMode::Incremental) {
+            propagate_incremental(node);
+            return;
+        }
+        if (m_propagation_mode == SolverPropagationMode::Parallel) {
+            propagate_parallel(node);
+            return;
+        }
+
+        const std::uint32_t epoch = next_visit_epoch();
+        const std::uint64_t contradictions = m_contradictions;
+        m_propagation_queue.clear();
+        m_propagation_queue.push(node);
+        mark_visited(node, epoch);
+        bool f = true; // force propagation on the first node
+
+        while (!m_propagation_queue.empty()) {
+            // with the trail enabled this state is about to be rewound, stop at the first empty domain
+            if (m_trail_enabled && m_contradictions != contradictions)
+                break;
+
+            DGraphNode* n = m_propagation_queue.pop();
+
+            if (!m_constraint_prop_solved && domain_size(n) <= 1 && !f) // skip solved nodes
+                continue;
+
+            if (f || update_domain(n)) { // only update neighbors if the domain changed
+                f = false;
+                // random visit order, so revisions do not favor the direction of the adjacency order
+                const auto adjacent = graph->adjacent_span(n);
+                m_neighbor_order.assign(adjacent.begin(), adjacent.end());
+                std::shuffle(m_neighbor_order.begin(), m_neighbor_order.end(), gen);
+                for (DGraphNode* neighbor : m_neighbor_order) {
+                    if (mark_visited(neighbor, epoch))
+                        m_propagation_queue.push(neighbor);
+                }
+
+                if (propagate_callback_func) propagate_callback_func(n);
+            }
+        }
+    }
+
+    /**
+     * @brief remove values that no longer have a valid neighborhood, in place
+     *
+     * @param node
+     */
+    bool update_domain(DGraphNode* node) override {
+        assert(node != nullptr);
+        ++m_stats.revisions;
+        const bool changed = m_domain_mode == SolverDomainMode::Bitset ? update_domain_bits(node) : update_domain_vector(node);
+        if (changed)
+            domain_modified(node);
+        return changed;
+    }
+
+    /**
+     * @brief Collapse the node to a single value. Performing a weighted random selection if multiple values are available.
+     *
+     * @param node
+     */
+    void observe(DGraphNode* node) override {
+        assert(node != nullptr);
+        
+        if (domain_size(node) <= 1)
+            return;
+        ++m_stats.observations;
+
+        // weighted random selection of available domain values
+        if (m_domain_mode == SolverDomainMode::Bitset) {
+            const int picked = weighted_pick_index(node);
+            if (m_trail_enabled) {
+                node->domain_bits.for_each_set([this, node, picked](int i) {
+                    if (i != picked)
+                        m_trail.push_back(TrailEntry{node, m_table.value(i), i});
+                });
+            }
+            node->domain_bits.reset_all();
+            node->domain_bits.set(picked);
+            mark_domain_changed(node);
+            sync_domain(node);
+        } else {
+            const Val picked = weighted_pick_domain(node);
+            if (m_trail_enabled) {
+                bool skipped = false; // keep other copies of a duplicated value on the trail
+                for (const auto& value : node->domain) {
+                    if (value == picked && !skipped)
+                        skipped = true;
+                    else
+                        m_trail.push_back(TrailEntry{node, value, -1});
+                }
+            }
+            node->set_value(picked);
+        }
+        domain_modified(node);
+
+        if (propagate_callback_func) propagate_callback_func(node);
+    }
+
+    void set_entropy_func(const entropy_callback_t& callback) override {
+        entropy_func = callback;
+    }
+
+    void set_propagate_callback_func(const propagate_callback_t& callback) override {
+        propagate_callback_func = callback;
+    }
+
+    float node_entropy(const DGraphNode* node) const override {
+        if (m_domain_mode == SolverDomainMode::Bitset) {
+            const DGraphNode* n = load_domain_bits(node);
+            if (n->entropy < 0.f) {
+                float sum = 0;
+                if (n->domain_bits.count() != 1)
+                    n->domain_bits.for_each_set([this, &sum](int i) {sum += m_table.weight(i);});
+                n->entropy = sum;
+            }
+            return n->entropy;
+        }
+
+        float sum = 0;
+        if (node->domain.size() == 1)
+            return 0;
+        for (const auto& value : node->domain)
+            sum += m_table.weight_of(value.value);
+        return sum;
+    }
+
+    std::size_t domain_size(const DGraphNode* node) const override {
+        if (m_domain_mode == SolverDomainMode::Bitset)
+            return load_domain_bits(node)->domain_bits.count();
+        return node->domain.size();
+    }
+
+    /**
+     * @brief weighted pick of value in node domain, binary search over the cumulative weights
+     * 
+     * @param node 
+     * @return Val value picked
+     */
+    Val weighted_pick_domain(DGraphNode* node) const {
+        if (m_domain_mode == SolverDomainMode::Bitset)
+            return m_table.value(weighted_pick_index(node));
+
+        assert(!node->domain.empty());
+        if (node->domain.size() == 1)
+            return node->domain[0];
+
+        m_pick_cumulative.resize(node->domain.size());
+        float total = 0.f;
+        for (std::size_t i = 0; i < node->domain.size(); ++i) {
+            total += m_table.weight_of(node->domain[i].value);
+            m_pick_cumulative[i] = total;
+        }
+        return node->domain[pick_cumulative(total)];
+    }
+
+    bool valid(const wfc::Val& value, const DGraphNode* node) {
+        const int index = m_table.index_of(value.value);
+        if (index < 0)
+            return false;
+        const auto neighborhood = graph->adjacent_span(node);
+        return valid(value.value, m_table.pattern(index), neighborhood, neighborhood_signature(neighborhood));
+    }
+
+    /**
+     * @brief memoize validity checks, see ValidityCache
+     *
+     * @param enabled
+     */
+    void set_validity_cache_enabled(bool enabled) {
+        if (enabled && !m_validity_cache)
+            m_validity_cache = std::make_unique<ValidityCache>();
+        else if (!enabled)
+            m_validity_cache.reset();
+    }
+
+    bool is_validity_cache_enabled() const noexcept {return m_validity_cache != nullptr;}
+
+    ValidityCache::Stats get_validity_cache_stats() const noexcept {
+        return m_validity_cache ? m_validity_cache->get_stats() : ValidityCache::Stats{};
+    }
+
+    /**
+     * @brief tier counters, only updated in SolverValidMode::Tiered
+     *
+     * @return const ValidityTierStats&
+     */
+    const ValidityTierStats& get_validity_tier_stats() const noexcept {return m_tier_stats;}
+
+    /**
+     * @brief counters and phase times since construction or the last reset_solver_stats()
+     *
+     * @return SolverStats
+     */
+    SolverStats get_solver_stats() const noexcept {
+        SolverStats stats = m_stats;
+        stats.contradictions = m_contradictions - m_contradictions_at_reset;
+        return stats;
+    }
+
+    void reset_solver_stats() noexcept {
+        m_stats = SolverStats{};
+        m_contradictions_at_reset = m_contradictions;
+    }
+
+    /**
+     * @brief time propagation and validity checks into SolverStats, off by default.
+     *  Reads the clock twice per propagation and per uncached validity check.
+     *
+     * @param enabled
+     */
+    void set_timing_enabled(bool enabled) noexcept {m_timing_enabled = enabled;}
+
+    bool is_timing_enabled() const noexcept {return m_timing_enabled;}
+
+    /**
+     * @brief record every value removed from a domain (by observe, propagate or ban) on an undo trail,
+     *  so that rewind() can restore earlier states. Used by BacktrackingSolver.
+     *
+     * @param enabled
+     */
+    void set_trail_enabled(bool enabled) {
+        m_trail_enabled = enabled;
+        if (!enabled)
+            m_trail.clear();
+    }
+
+    bool is_trail_enabled() const noexcept {return m_trail_enabled;}
+
+    /**
+     * @brief current trail position, pass to rewind() to return to this state
+     *
+     * @return std::size_t
+     */
+    std::size_t trail_size() const noexcept {return m_trail.size();}
+
+    /**
+     * @brief restore every value removed since the trail had size mark
+     *
+     * @param mark
+     */
+    void rewind(std::size_t mark) {
+        assert(mark <= m_trail.size());
+        const std::uint32_t epoch = next_visit_epoch();
+        m_rewound.clear();
+        while (m_trail.size() > mark) {
+            const TrailEntry& e = m_trail.back();
+            if (e.index >= 0)
+                e.node->domain_bits.set(e.index);
+            else
+                e.node->domain.push_back(e.value);
+            if (mark_visited(e.node, epoch))
+                m_rewound.push_back(e.node);
+            m_trail.pop_back();
+        }
+        for (DGraphNode* n : m_rewound) {
+            if (m_domain_mode == SolverDomainMode::Bitset)
+                sync_domain(n);
+            mark_domain_changed(n);
+            domain_modified(n);
+            if (propagate_callback_func) propagate_callback_func(n);
+        }
+    }
+
+    /**
+     * @brief remove a value from a node domain, recorded on the trail when enabled
+     *
+     * @param node
+     * @param value
+     * @return true if the value was in the domain
+     */
+    bool ban(DGraphNode* node, Val value) {
+        assert(node != nullptr);
+        bool removed = false;
+        if (m_domain_mode == SolverDomainMode::Bitset) {
+            load_domain_bits(node);
+            const int index = m_table.index_of(value.value);
+            removed = index >= 0 && node->domain_bits.test(index);
+            if (removed) {
+                node->domain_bits.reset(index);
+                sync_domain(node);
+                if (m_trail_enabled)
+                    m_trail.push_back(TrailEntry{node, value, index});
+            }
+        } else {
+            auto itr = std::find(node->domain.begin(), node->domain.end(), value);
+            removed = itr != node->domain.end();
+            if (removed) {
+                node->domain.erase(itr);
+                if (m_trail_enabled)
+                    m_trail.push_back(TrailEntry{node, value, -1});
+            }
+        }
+        if (removed) {
+            ++m_stats.domain_removals;
+            mark_domain_changed(node);
+            m_contradictions += node->domain.empty();
+            domain_modified(node);
+            if (propagate_callback_func) propagate_callback_func(node);
+        }
+        return removed;
+    }
+
+    /**
+     * @brief number of times a domain was emptied by this solver
+     *
+     * @return std::uint64_t
+     */
+    std::uint64_t get_contradiction_count() const noexcept {return m_contradictions;}
+
+    /**
+     * @brief see SolverPropagationMode
+     *
+     * @param mode
+     */
+    void set_propagation_mode(SolverPropagationMode mode) {
+        m_propagation_mode = mode;
+        reset_supports();
+    }
+
+    SolverPropagationMode get_propagation_mode() const noexcept {return m_propagation_mode;}
+
+    /**
+     * @brief drop all type and supply counts, they are rebuilt from the current domains when needed.
+     *  Call after changing the graph topology, or domains outside of this solver, in SolverPropagationMode::Incremental.
+     *
+     */
+    void reset_supports() {
+        std::fill(m_counts_ready.begin(), m_counts_ready.end(), 0);
+        std::fill(m_supply_ready.begin(), m_supply_ready.end(), 0);
+        std::fill(m_dirty_types.begin(), m_dirty_types.end(), 0);
+        std::fill(m_queued.begin(), m_queued.end(), 0);
+        m_incremental_queue.clear();
+    }
+
+    const IncrementalStats& get_incremental_stats() const noexcept {return m_incremental_stats;}
+
+    /**
+     * @brief number of node slots in use, bounded by twice the graph size after each propagate
+     *
+     * @return std::size_t
+     */
+    std::size_t slot_count() const noexcept {return m_visit_epoch.size();}
+
+    /**
+     * @brief threads used in SolverPropagationMode::Parallel. The pool can be shared between solvers
+     *  that do not propagate at the same time. Without a pool, one with a thread per core is created
+     *  on first use.
+     *
+     * @param pool
+     */
+    void set_thread_pool(std::shared_ptr<ThreadPool> pool) {m_thread_pool = std::move(pool);}
+
+    const std::shared_ptr<ThreadPool>& get_thread_pool() const noexcept {return m_thread_pool;}
+
+    /**
+     * @brief waves with fewer nodes are checked on the calling thread, the result is the same
+     *
+     * @param n
+     */
+    void set_parallel_min_wave(std::size_t n) noexcept {m_parallel_min_wave = n;}
+
+private:
+    std::uint64_t neighborhood_signature(Span<DGraphNode* const> neighborhood) const {
+        return m_validity_cache ? ValidityCache::neighborhood_signature(neighborhood) : 0;
+    }
+
+    bool valid(int pattern_id, const Pattern& pattern, Span<DGraphNode* const> neighborhood, std::uint64_t signature) {
+        ++m_stats.valid_calls;
+        bool validity = false;
+        if (m_validity_cache && m_validity_cache->find(pattern_id, signature, validity))
+            return validity;
+
+        validity = valid_uncached(pattern, neighborhood);
+
+        if (m_validity_cache)
+            m_validity_cache->insert(pattern_id, signature, validity);
+        return validity;
+    }
+
+    bool valid_uncached(const Pattern& pattern, Span<DGraphNode* const> neighborhood) {
+        PhaseTimer timer{m_timing_enabled ? &m_stats.validity_ms : nullptr};
+        bool validity = false;
+        switch(m_validity_mode) {
+            case SolverValidMode::Correct:
+            case SolverValidMode::Tiered: {
+                const RequirementMatcher& matcher = matching_scratch();
+                const std::uint64_t augmentations = matcher.total_augmentations();
+                validity = m_validity_mode == SolverValidMode::Correct ? pattern.valid(neighborhood)
+                                                                       : pattern.valid_tiered(neighborhood, &m_tier_stats);
+                m_stats.flow_augmentations += matcher.total_augmentations() - augmentations;
+            }
+            break;
+            case SolverValidMode::Approximate:
+                validity = pattern.valid_approx(neighborhood);
+            break;
+        }
+        return validity;
+    }
+
+    /**
+     * @brief dense index for every type used by the patterns, and per pattern the distinct
+     *  required types with their multiplicity
+     *
+     */
+    void build_type_index() {
+        std::vector<int> types{};
+        for (int i = 0; i < m_table.size(); ++i) {
+            types.push_back(m_table.type(i));
+            for (int t : m_table.requirements(i))
+                types.push_back(t);
+        }
+        std::sort(types.begin(), types.end());
+        types.erase(std::unique(types.begin(), types.end()), types.end());
+        m_type_ids = types;
+
+        auto dense_type = [this](int t) {
+            return (int)(std::lower_bound(m_type_ids.begin(), m_type_ids.end(), t) - m_type_ids.begin());
+        };
+
+        m_pattern_dtype.resize(m_table.size());
+        m_req_offsets.assign(1, 0);
+        m_req_dtypes.clear();
+        m_req_mult.clear();
+        m_req_total.resize(m_table.size());
+        m_req_mask.resize(m_table.size());
+        for (int i = 0; i < m_table.size(); ++i) {
+            m_pattern_dtype[i] = dense_type(m_table.type(i));
+
+            std::vector<int> req{m_table.requirements(i).begin(), m_table.requirements(i).end()};
+            std::sort(req.begin(), req.end());
+            std::uint64_t mask = 0;
+            for (std::size_t r = 0; r < req.size(); ++r) {
+                if (r > 0 && req[r] == req[r - 1]) {
+                    ++m_req_mult.back();
+                    continue;
+                }
+                const int dt = dense_type(req[r]);
+                m_req_dtypes.push_back(dt);
+                m_req_mult.push_back(1);
+                mask |= type_bit(dt);
+            }
+            m_req_offsets.push_back((int)m_req_dtypes.size());
+            m_req_total[i] = (int)req.size();
+            m_req_mask[i] = mask;
+        }
+    }
+
+    // dirty types are tracked in 64 bits, types sharing a bit are re-checked together
+    static std::uint64_t type_bit(int dense_type) noexcept {
+        return std::uint64_t{1} << (dense_type & 63);
+    }
+
+    /**
+     * @brief make sure incremental state exists for slot
+     *
+     * @param slot
+     */
+    void reserve_incremental(int slot) {
+        if (slot < (int)m_counts_ready.size())
+            return;
+        const std::size_t n = std::max<std::size_t>(slot + 1, m_counts_ready.size() * 2);
+        const std::size_t n_types = m_type_ids.size();
+        m_counts_ready.resize(n, 0);
+        m_supply_ready.resize(n, 0);
+        m_count_generation.resize(n, 0);
+        m_dirty_types.resize(n, 0);
+        m_queued.resize(n, 0);
+        m_type_counts.resize(n * n_types, 0);
+        m_supply.resize(n * n_types, 0);
+    }
+
+    /**
+     * @brief call fn(dense pattern index) for every value in the node domain
+     *
+     * @param node
+     * @param fn
+     */
+    template<typename Fn>
+    void for_each_domain_index(const DGraphNode* node, Fn&& fn) const {
+        if (m_domain_mode == SolverDomainMode::Bitset) {
+            load_domain_bits(node)->domain_bits.for_each_set(fn);
+            return;
+        }
+        for (const auto& value : node->domain)
+            if (const int i = m_table.index_of(value.value); i >= 0)
+                fn(i);
     }
-    if (residual_graph)
-        *residual_graph = residual;
-    return max_flow;
-}
 
-/**
- * @brief Pattern is a valid configuration of cell values in the generated output
- *
- */
-class Pattern {
-  public:
-    Pattern() = default;
-    explicit Pattern(int pattern_class) noexcept : pattern_type{pattern_class} {}
+    void count_types(const DGraphNode* node, int* counts) const {
+        std::fill(counts, counts + m_type_ids.size(), 0);
+        for_each_domain_index(node, [this, counts](int i) {++counts[m_pattern_dtype[i]];});
+    }
 
-    Pattern(int pattern_class, std::initializer_list<int> l,
-            float weight = 1.f) noexcept
-        : required_types{l}, pattern_type{pattern_class}, weight{weight} {}
-    Pattern(int pattern_class, const std::vector<int>& l,
-            float weight = 1.f) noexcept
-        : required_types{l}, pattern_type{pattern_class}, weight{weight} {}
+    /**
+     * @brief type counts of node, computed from its domain the first time
+     *
+     * @param node
+     * @return int slot
+     */
+    int ensure_counts(DGraphNode* node) {
+        const int slot = node_slot(node);
+        reserve_incremental(slot);
+        if (!m_counts_ready[slot]) {
+            count_types(node, &m_type_counts[slot * m_type_ids.size()]);
+            m_counts_ready[slot] = 1;
+            m_count_generation[slot] = node->domain_generation;
+        } else if (m_count_generation[slot] != node->domain_generation)
+            sync_counts(node, slot); // changed outside of this solver
+        return slot;
+    }
 
-    bool valid(const std::vector<DGraphNode *> &neighborhood) const;
+    /**
+     * @brief supply counts of node, number of neighbors with each type in their domain
+     *
+     * @param node
+     * @return int slot
+     */
+    int ensure_supply(DGraphNode* node) {
+        const int slot = ensure_counts(node);
+        if (m_supply_ready[slot])
+            return slot;
+        const std::size_t n_types = m_type_ids.size();
+        std::fill_n(&m_supply[slot * n_types], n_types, 0); // totals left over from before reset_supports()
+        for (DGraphNode* neighbor : graph->adjacent_span(node)) {
+            const int n_slot = ensure_counts(neighbor);
+            const int* counts = &m_type_counts[n_slot * n_types];
+            int* supply = &m_supply[slot * n_types];
+            for (std::size_t t = 0; t < n_types; ++t)
+                supply[t] += counts[t] > 0;
+        }
+        m_supply_ready[slot] = 1;
+        return slot;
+    }
 
-    bool valid_approx(const std::vector<DGraphNode *> &neighborhood) const;
+    /**
+     * @brief called after a node domain changed. Only needed in SolverPropagationMode::Incremental
+     *
+     * @param node
+     */
+    void domain_modified(DGraphNode* node) {
+        if (m_propagation_mode != SolverPropagationMode::Incremental)
+            return;
+        const int slot = node_slot(node);
+        reserve_incremental(slot);
+        if (m_counts_ready[slot])
+            sync_counts(node, slot);
+    }
 
-    std::vector<int> required_types{};
-    int pattern_type{-1};
-    float weight = 1.f; // relative probabilistic weight on this pattern
-};
+    /**
+     * @brief recount the types of node and apply the difference to the supply of its neighbors.
+     *  Neighbors that lost a supplier for a type are queued for revision.
+     *
+     * @param node
+     * @param slot
+     */
+    void sync_counts(DGraphNode* node, int slot) {
+        const std::size_t n_types = m_type_ids.size();
+        m_count_scratch.resize(n_types);
+        count_types(node, m_count_scratch.data());
+        m_count_generation[slot] = node->domain_generation;
+
+        for (std::size_t t = 0; t < n_types; ++t) {
+            const int before = m_type_counts[slot * n_types + t];
+            const int after = m_count_scratch[t];
+            m_type_counts[slot * n_types + t] = after;
+            if ((before > 0) == (after > 0))
+                continue;
+            for (DGraphNode* neighbor : graph->adjacent_span(node)) {
+                const int n_slot = node_slot(neighbor);
+                reserve_incremental(n_slot);
+                if (!m_supply_ready[n_slot]) {
+                    // built from current counts when revised, which it still needs to be
+                    if (after == 0)
+                        mark_dirty(neighbor, n_slot, type_bit((int)t));
+                    continue;
+                }
+                m_supply[n_slot * n_types + t] += after > 0 ? 1 : -1;
+                if (after == 0)
+                    mark_dirty(neighbor, n_slot, type_bit((int)t));
+            }
+        }
+    }
 
-using PatternMap = std::unordered_map<int, Pattern>;
+    void mark_dirty(DGraphNode* node, int slot, std::uint64_t types) {
+        m_dirty_types[slot] |= types;
+        if (!m_queued[slot]) {
+            m_queued[slot] = 1;
+            m_incremental_queue.push(node);
+        }
+    }
 
-inline PatternMap make_pattern_map(std::initializer_list<Pattern> patterns) {
-    PatternMap pm{};
-    pm.reserve(patterns.size());
-    for (auto itr = patterns.begin(), end = patterns.end(); itr != end; ++itr) {
-        pm.insert(std::make_pair(itr->pattern_type, *itr));
+    /**
+     * @brief check pattern index i at node from the supply counts, running the matching only when the
+     *  counts cannot decide. A pattern is valid when every required type has a separate supplier per
+     *  requirement, since then any requirement subset has enough neighbors (Hall's condition).
+     *
+     */
+    bool check_supported(int i, int slot, Span<DGraphNode* const> neighborhood, std::uint64_t signature) {
+        ++m_incremental_stats.checks;
+        const int* supply = &m_supply[slot * m_type_ids.size()];
+        int min_supply = std::numeric_limits<int>::max();
+        for (int g = m_req_offsets[i]; g < m_req_offsets[i + 1]; ++g) {
+            const int s = supply[m_req_dtypes[g]];
+            if (s < m_req_mult[g]) {
+                ++m_incremental_stats.count_rejects;
+                return false;
+            }
+            min_supply = std::min(min_supply, s);
+        }
+        if (min_supply >= m_req_total[i]) {
+            ++m_incremental_stats.slack_accepts;
+            return true;
+        }
+        ++m_incremental_stats.matchings;
+        return valid(m_table.id(i), m_table.pattern(i), neighborhood, signature);
     }
-    return pm;
-}
 
-template<typename T, typename = std::enable_if_t<std::is_base_of_v<DGraphNode, T>>>
-class IWFCSolver {
-public:
-    using entropy_callback_t = std::function<float(const T*, const T*)>;
-    using propagate_callback_t = std::function<void(T*)>;
+    /**
+     * @brief remove the values of node whose requirements include a dirty type and are no longer supported
+     *
+     * @param node
+     * @param dirty
+     * @return true if the domain changed
+     */
+    bool revise(DGraphNode* node, std::uint64_t dirty) {
+        ++m_incremental_stats.revisions;
+        ++m_stats.revisions;
+        const int slot = ensure_supply(node);
+        const auto neighborhood = graph->adjacent_span(node);
+        const std::uint64_t signature = neighborhood_signature(neighborhood);
 
-public:
-    virtual ~IWFCSolver() = default;
+        bool changed = false;
+        if (m_domain_mode == SolverDomainMode::Bitset) {
+            m_keep_bits = node->domain_bits;
+            node->domain_bits.for_each_set([&, this](int i) {
+                if ((m_req_mask[i] & dirty) && !check_supported(i, slot, neighborhood, signature)) {
+                    m_keep_bits.reset(i);
+                    ++m_stats.domain_removals;
+                    if (m_trail_enabled)
+                        m_trail.push_back(TrailEntry{node, m_table.value(i), i});
+                }
+            });
+            changed = node->domain_bits.intersect(m_keep_bits);
+            if (changed)
+                sync_domain(node);
+        } else {
+            auto& domain = node->domain;
+            std::size_t kept = 0;
+            for (std::size_t d = 0; d < domain.size(); ++d) {
+                const Val value = domain[d];
+                const int i = m_table.index_of(value.value);
+                if (i >= 0 && (!(m_req_mask[i] & dirty) || check_supported(i, slot, neighborhood, signature)))
+                    domain[kept++] = value;
+                else if (m_trail_enabled)
+                    m_trail.push_back(TrailEntry{node, value, -1});
+            }
+            changed = kept != domain.size();
+            m_stats.domain_removals += domain.size() - kept;
+            domain.resize(kept);
+        }
 
-    virtual void step_wfc(T* node) = 0;
-    virtual void propagate(T* node) = 0;
-    virtual bool update_domain(T* node) = 0;
-    virtual void observe(T* node) = 0;
+        if (changed) {
+            mark_domain_changed(node);
+            m_contradictions += node->domain.empty();
+            sync_counts(node, slot);
+        }
+        return changed;
+    }
 
-    virtual float node_entropy(const T* node) const = 0;
-    virtual void set_entropy_func(const entropy_callback_t& callback) = 0;
-    virtual void set_propagate_callback_func(const propagate_callback_t& callback) = 0;
-};
+    /**
+     * @brief propagate in SolverPropagationMode::Incremental. Changes to node were already applied
+     *  to the counters when they were made. Neighbors that were never revised are revised for all types.
+     *  Revisions continue until no supplier is lost, so this reaches a fixed point.
+     *
+     * @param node
+     */
+    void propagate_incremental(DGraphNode* node) {
+        const std::uint64_t contradictions = m_contradictions;
+        ensure_counts(node); // picks up changes made to node outside of this solver
+        for (DGraphNode* neighbor : graph->adjacent_span(node)) {
+            const int n_slot = node_slot(neighbor);
+            reserve_incremental(n_slot);
+            if (!m_supply_ready[n_slot]) // never revised
+                mark_dirty(neighbor, n_slot, ~std::uint64_t{0});
+        }
 
-enum class SolverValidMode {
-    Correct = 0,
-    Approximate
-};
+        while (!m_incremental_queue.empty()) {
+            // with the trail enabled this state is about to be rewound, stop at the first empty domain
+            if (m_trail_enabled && m_contradictions != contradictions)
+                break;
 
-/**
- * @brief WFC has two stages. 
- *      1. collapse a node to force it to have a single value
- *      2. propagate the changes applied to that node
- * 
- */
-class WFCSolver : public IWFCSolver<DGraphNode> {
-public:
- WFCSolver(Graph<DGraphNode>* graph, PatternMap patterns, std::mt19937& gen,
-           bool constraint_prop_solved, SolverValidMode mode)
-     : graph{graph},
-       gen{gen},
-       m_patterns{std::move(patterns)},
-       m_constraint_prop_solved{constraint_prop_solved},
-       m_validity_mode{mode} {}
+            DGraphNode* n = m_incremental_queue.pop();
+            const int n_slot = node_slot(n);
+            const std::uint64_t dirty = m_dirty_types[n_slot];
+            m_dirty_types[n_slot] = 0;
+            m_queued[n_slot] = 0;
 
-    void step_wfc(DGraphNode* node) override {
-        observe(node);
-        propagate(node);
+            if (!m_constraint_prop_solved && domain_size(n) <= 1) // skip solved nodes
+                continue;
+
+            if (revise(n, dirty) && propagate_callback_func)
+                propagate_callback_func(n);
+        }
     }
 
-    auto get_pattern(int pattern_id) const {
-        return m_patterns.find(pattern_id);
+    /**
+     * @brief validity check that only reads solver and node state, safe to call from several threads.
+     *  Does not use the validity cache or count tier stats.
+     *
+     * @param pattern
+     * @param neighborhood
+     * @return true
+     */
+    bool valid_concurrent(const Pattern& pattern, Span<DGraphNode* const> neighborhood) const {
+        switch(m_validity_mode) {
+            case SolverValidMode::Correct:
+                return pattern.valid(neighborhood);
+            case SolverValidMode::Approximate:
+                return pattern.valid_approx(neighborhood);
+            case SolverValidMode::Tiered:
+                return pattern.valid_tiered(neighborhood, nullptr);
+        }
+        return false;
     }
 
     /**
-     * @brief Propagate the wave function collapse algorithm
+     * @brief push the neighbors of node that were not visited in this epoch to the next wave
      *
      * @param node
+     * @param epoch
      */
-    void propagate(DGraphNode* node) override {
-        assert(node != nullptr);
-        std::queue<DGraphNode*> propagation_stack;
-        std::unordered_set<DGraphNode*> visited_set;
-        propagation_stack.push(node);
-        visited_set.insert(node);
-        bool f = true; // force propagation on the first node
-
-        while (!propagation_stack.empty()) {
-            DGraphNode* n = propagation_stack.front();
-            propagation_stack.pop();
+    void expand_wave(DGraphNode* node, std::uint32_t epoch) {
+        for (DGraphNode* neighbor : graph->adjacent_span(node)) {
+            if (mark_visited(neighbor, epoch))
+                m_next_wave.push_back(neighbor);
+        }
+    }
 
-            if (!m_constraint_prop_solved && n->domain.size() <= 1 && !f) // skip solved nodes
-                continue;
+    /**
+     * @brief propagate in SolverPropagationMode::Parallel. Visits the same nodes as the sequential
+     *  revisit, but a wave only sees the removals of earlier waves.
+     *      1. sequentially, gather the neighborhood of every wave node and bring domains up to date
+     *      2. in parallel, flag the values of every wave node that are still valid, nothing is written to nodes
+     *      3. sequentially and in wave order, apply the removals and collect the next wave
+     *
+     * @param node
+     */
+    void propagate_parallel(DGraphNode* node) {
+        const std::uint32_t epoch = next_visit_epoch();
+        const std::uint64_t contradictions = m_contradictions;
+        const bool bits = m_domain_mode == SolverDomainMode::Bitset;
+
+        mark_visited(node, epoch);
+        m_next_wave.clear();
+        expand_wave(node, epoch); // the first node is forced
+        if (propagate_callback_func) propagate_callback_func(node);
 
-            if (f || update_domain(n)) { // only update neighbors if the domain changed
-                f = false;
-                auto neighbor_nodes = graph->adjacent_nodes(n);
-                std::shuffle(neighbor_nodes.begin(), neighbor_nodes.end(), gen);
-                for (auto& neighbor_n : neighbor_nodes) {
-                    DGraphNode* neighbor = static_cast<DGraphNode*>(neighbor_n);
-
-                    auto itr = visited_set.insert(neighbor);
-                    if (itr.second) { // was inserted
-                        propagation_stack.push(neighbor);
+        while (!m_next_wave.empty()) {
+            std::swap(m_wave, m_next_wave);
+            m_next_wave.clear();
+
+            // 1. snapshot, flat neighborhoods and value flag ranges per wave node
+            m_wave_adjacency_offsets.assign(1, 0);
+            m_wave_flag_offsets.assign(1, 0);
+            m_wave_adjacency.clear();
+            std::size_t kept = 0;
+            for (DGraphNode* n : m_wave) {
+                if (!m_constraint_prop_solved && domain_size(n) <= 1) // skip solved nodes
+                    continue;
+                m_wave[kept++] = n;
+                for (DGraphNode* neighbor : graph->adjacent_span(n)) {
+                    if (bits)
+                        load_domain_bits(neighbor);
+                    m_wave_adjacency.push_back(neighbor);
+                }
+                m_wave_adjacency_offsets.push_back(m_wave_adjacency.size());
+                m_wave_flag_offsets.push_back(m_wave_flag_offsets.back() + domain_size(n));
+            }
+            m_wave.resize(kept);
+            m_wave_keep.assign(m_wave_flag_offsets.back(), 0);
+
+            // 2. check every wave node against the snapshot
+            const std::function<void(std::size_t, std::size_t, unsigned)> check_range =
+                [this, bits](std::size_t begin, std::size_t end, unsigned) {
+                for (std::size_t w = begin; w < end; ++w) {
+                    const DGraphNode* n = m_wave[w];
+                    const Span<DGraphNode* const> neighborhood{
+                        m_wave_adjacency.data() + m_wave_adjacency_offsets[w],
+                        m_wave_adjacency_offsets[w + 1] - m_wave_adjacency_offsets[w]};
+                    std::uint8_t* keep = m_wave_keep.data() + m_wave_flag_offsets[w];
+                    if (bits) {
+                        std::size_t k = 0;
+                        n->domain_bits.for_each_set([&, this](int i) {
+                            keep[k++] = valid_concurrent(m_table.pattern(i), neighborhood);
+                        });
+                    } else {
+                        for (std::size_t d = 0; d < n->domain.size(); ++d) {
+                            const int i = m_table.index_of(n->domain[d].value);
+                            keep[d] = i >= 0 && valid_concurrent(m_table.pattern(i), neighborhood);
+                        }
                     }
                 }
+            };
+            if (m_wave.size() < m_parallel_min_wave)
+                check_range(0, m_wave.size(), 0);
+            else {
+                if (!m_thread_pool)
+                    m_thread_pool = std::make_shared<ThreadPool>();
+                m_thread_pool->parallel_for(m_wave.size(), check_range);
+            }
 
-                if (propagate_callback_func) propagate_callback_func(n);
+            // 3. commit in wave order
+            for (std::size_t w = 0; w < m_wave.size(); ++w) {
+                DGraphNode* n = m_wave[w];
+                if (commit_wave_node(n, m_wave_keep.data() + m_wave_flag_offsets[w])) {
+                    domain_modified(n);
+                    expand_wave(n, epoch);
+                    if (propagate_callback_func) propagate_callback_func(n);
+                }
+                // with the trail enabled this state is about to be rewound, stop at the first empty domain
+                if (m_trail_enabled && m_contradictions != contradictions)
+                    return;
             }
         }
     }
 
     /**
-     * @brief 
+     * @brief remove the values of node that are not flagged in keep
      *
      * @param node
+     * @param keep one flag per domain value, in domain order
+     * @return true if the domain changed
      */
-    bool update_domain(DGraphNode* node) override {
-        assert(node != nullptr);
+    bool commit_wave_node(DGraphNode* node, const std::uint8_t* keep) {
+        ++m_stats.revisions;
         bool changed = false;
-        decltype(node->domain) new_domain{};
-        for (auto value : node->domain) {
-            // for every pattern for this class id, check if it has a valid neighborhood
-            // for each valid pattern id, push that class id (only once) to the new domain
-            bool value_kept = false;
-            if (valid(value, node)) { // node pointer used to find adjacent nodes, validity determined based on value
-                new_domain.push_back(value);
-                value_kept = true; // a pattern for this class id was still valid
+        if (m_domain_mode == SolverDomainMode::Bitset) {
+            m_keep_bits.reset_size(node->domain_bits.size());
+            std::size_t k = 0;
+            node->domain_bits.for_each_set([&, this](int i) {
+                if (keep[k++])
+                    m_keep_bits.set(i);
+                else {
+                    ++m_stats.domain_removals;
+                    if (m_trail_enabled)
+                        m_trail.push_back(TrailEntry{node, m_table.value(i), i});
+                }
+            });
+            changed = node->domain_bits.intersect(m_keep_bits);
+            if (changed)
+                sync_domain(node);
+        } else {
+            auto& domain = node->domain;
+            std::size_t kept = 0;
+            for (std::size_t d = 0; d < domain.size(); ++d) {
+                const Val value = domain[d];
+                if (keep[d])
+                    domain[kept++] = value;
+                else if (m_trail_enabled)
+                    m_trail.push_back(TrailEntry{node, value, -1});
             }
-            changed |= !value_kept; // if the class id was not kept, set changed flag
+            changed = kept != domain.size();
+            m_stats.domain_removals += domain.size() - kept;
+            domain.resize(kept);
+        }
+
+        if (changed) {
+            mark_domain_changed(node);
+            m_contradictions += node->domain.empty();
         }
-        node->domain = new_domain;
         return changed;
     }
 
     /**
-     * @brief Collapse the node to a single value. Performing a weighted random selection if multiple values are available.
+     * @brief dense slot of a node in the visit table, assigned the first time this solver sees the node.
+     *  A slot set by another solver, or by this solver before release_slots(), has another stamp and is
+     *  reassigned. New nodes have no stamp, so a node reusing the address of a removed one gets a new slot.
      *
      * @param node
+     * @return int
      */
-    void observe(DGraphNode* node) override {
-        assert(node != nullptr);
-        
-        if (node->domain.size() <= 1)
+    int node_slot(DGraphNode* node) {
+        if (node->solver_stamp != m_slot_stamp) {
+            node->solver_stamp = m_slot_stamp;
+            node->solver_slot = (int)m_visit_epoch.size();
+            m_visit_epoch.push_back(0);
+        }
+        assert(node->solver_slot >= 0 && node->solver_slot < (int)m_visit_epoch.size());
+        return node->solver_slot;
+    }
+
+    /**
+     * @brief drop every slot once there are twice as many as graph nodes. Slots leak when nodes are
+     *  removed from the graph, or reassigned by another solver working on the same nodes. Incremental
+     *  counts are per slot, they are rebuilt from the domains as after reset_supports().
+     *
+     */
+    void release_slots() {
+        if (m_visit_epoch.size() <= 2 * (std::size_t)graph->get_n_nodes() + 64)
             return;
+        m_slot_stamp = next_solver_stamp();
+        m_visit_epoch.clear();
+        m_counts_ready.clear();
+        m_supply_ready.clear();
+        m_count_generation.clear();
+        m_dirty_types.clear();
+        m_queued.clear();
+        m_type_counts.clear();
+        m_supply.clear();
+        m_incremental_queue.clear();
+    }
 
-        // weighted random selection of available domain values
-        node->set_value(weighted_pick_domain(node));
+    /**
+     * @brief stamp node as visited in this epoch
+     *
+     * @param node
+     * @param epoch
+     * @return true if the node was not visited yet
+     */
+    bool mark_visited(DGraphNode* node, std::uint32_t epoch) {
+        std::uint32_t& stamp = m_visit_epoch[node_slot(node)];
+        if (stamp == epoch)
+            return false;
+        stamp = epoch;
+        return true;
+    }
 
-        if (propagate_callback_func) propagate_callback_func(node);
+    std::uint32_t next_visit_epoch() noexcept {
+        if (++m_epoch == 0) { // wrapped, old stamps could collide
+            std::fill(m_visit_epoch.begin(), m_visit_epoch.end(), 0);
+            m_epoch = 1;
+        }
+        return m_epoch;
     }
 
-    void set_entropy_func(const entropy_callback_t& callback) override {
-        entropy_func = callback;
+    /**
+     * @brief make sure domain_bits mirrors the node domain. The bits are rebuilt when the node
+     *  domain changed since a solver last built or updated them, by domain_generation, so code
+     *  writing domain directly must call domain_changed(). Values that do not have a pattern are
+     *  dropped since they can never be valid.
+     *
+     * @param node
+     * @return const DGraphNode*
+     */
+    const DGraphNode* load_domain_bits(const DGraphNode* node) const {
+        DGraphNode* n = const_cast<DGraphNode*>(node);
+        const int n_patterns = m_table.size();
+        if (n->bits_generation == n->domain_generation && n->domain_bits.size() == n_patterns)
+            return n;
+
+        n->domain_bits.reset_size(n_patterns);
+        n->entropy = -1.f;
+        for (const auto& v : n->domain) {
+            if (const int index = m_table.index_of(v.value); index >= 0)
+                n->domain_bits.set(index);
+        }
+        if (n->domain_bits.count() != (int)n->domain.size()) {
+            sync_domain(n);
+            n->domain_changed();
+        }
+        n->bits_generation = n->domain_generation;
+        return n;
     }
 
-    void set_propagate_callback_func(const propagate_callback_t& callback) override {
-        propagate_callback_func = callback;
+    /**
+     * @brief domain_changed() for a change made by this solver. In SolverDomainMode::Bitset the bits
+     *  and the domain were changed together, the bits stay current for load_domain_bits().
+     *
+     * @param node
+     */
+    void mark_domain_changed(DGraphNode* node) const noexcept {
+        node->domain_changed();
+        if (m_domain_mode == SolverDomainMode::Bitset)
+            node->bits_generation = node->domain_generation;
     }
 
-    float node_entropy(const DGraphNode* node) const override {
-        float sum = 0;
-        if (node->domain.size() == 1)
-            return 0;
-        for (auto value : node->domain) {
-            auto end = m_patterns.end();
-            if (auto itr = m_patterns.find(value.value); itr != end) {
-                sum += itr->second.weight;
-            }
+    /**
+     * @brief write domain bits back to the node domain vector, reusing its storage
+     *
+     * @param node
+     */
+    void sync_domain(DGraphNode* node) const {
+        node->domain.clear();
+        node->domain_bits.for_each_set([this, node](int i) {
+            node->domain.push_back(m_table.value(i));
+        });
+    }
+
+    bool update_domain_vector(DGraphNode* node) {
+        const auto neighborhood = graph->adjacent_span(node);
+        const std::uint64_t signature = neighborhood_signature(neighborhood);
+
+        // for every pattern for this class id, check if it has a valid neighborhood
+        // valid values are compacted to the front of the domain
+        auto& domain = node->domain;
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < domain.size(); ++i) {
+            const Val value = domain[i];
+            const int index = m_table.index_of(value.value);
+            if (index >= 0 && valid(value.value, m_table.pattern(index), neighborhood, signature))
+                domain[kept++] = value;
+            else if (m_trail_enabled)
+                m_trail.push_back(TrailEntry{node, value, -1});
         }
-        return sum;
+
+        const bool changed = kept != domain.size();
+        if (changed) {
+            m_stats.domain_removals += domain.size() - kept;
+            domain.resize(kept);
+            mark_domain_changed(node);
+            m_contradictions += kept == 0;
+        }
+        return changed;
+    }
+
+    bool update_domain_bits(DGraphNode* node) {
+        load_domain_bits(node);
+
+        const auto neighborhood = graph->adjacent_span(node);
+        const std::uint64_t signature = neighborhood_signature(neighborhood);
+
+        // keep mask, values that are still valid given the neighborhood
+        m_keep_bits.reset_size(node->domain_bits.size());
+        node->domain_bits.for_each_set([this, &neighborhood, signature](int i) {
+            if (valid(m_table.id(i), m_table.pattern(i), neighborhood, signature))
+                m_keep_bits.set(i);
+            else
+                ++m_stats.domain_removals;
+        });
+
+        if (m_trail_enabled) {
+            node->domain_bits.for_each_set([this, node](int i) {
+                if (!m_keep_bits.test(i))
+                    m_trail.push_back(TrailEntry{node, m_table.value(i), i});
+            });
+        }
+
+        const bool changed = node->domain_bits.intersect(m_keep_bits);
+        if (changed) {
+            mark_domain_changed(node);
+            sync_domain(node);
+            m_contradictions += !node->domain_bits.any();
+        }
+        return changed;
     }
 
     /**
-     * @brief weighted pick of value in node domain
-     * 
-     * @param gen 
-     * @return int value picked
+     * @brief weighted pick over the set bits of the node domain. When the live values hold a large
+     *  share of the total weight, samples the alias table over all patterns and rejects values that are
+     *  not in the domain. Otherwise, or if rejection keeps failing, searches the cumulative weights of the
+     *  set bits. Both give each live value probability weight / live weight.
+     *
+     * @param node
+     * @return int dense pattern index
      */
-    Val weighted_pick_domain(DGraphNode* node) const {
-        if (node->domain.size() == 1)
-            return node->domain[0];
-        
-        std::vector<float> weights(node->domain.size());
-        std::transform(node->domain.begin(), node->domain.end(), weights.begin(), [this](const wfc::Val& value) -> auto {
-            float total_class_weight = 0.f;
-            auto end = m_patterns.end();
-            if (auto itr = m_patterns.find(value.value); itr != end) {
-                total_class_weight += itr->second.weight;
+    int weighted_pick_index(DGraphNode* node) const {
+        constexpr float alias_min_fraction = 0.25f; // expected alias attempts are at most 1 / fraction
+        constexpr int max_alias_attempts = 16;
+
+        load_domain_bits(node);
+        assert(node->domain_bits.any());
+
+        const float live_weight = node_entropy(node); // cached, 0 for a single value
+        if (live_weight > 0.f && live_weight >= alias_min_fraction * m_table.total_weight()) {
+            for (int attempt = 0; attempt < max_alias_attempts; ++attempt) {
+                const int i = m_table.sample_alias(gen);
+                if (node->domain_bits.test(i))
+                    return i;
             }
-            return total_class_weight;
+        }
+
+        m_pick_indices.clear();
+        m_pick_cumulative.clear();
+        float total = 0.f;
+        node->domain_bits.for_each_set([this, &total](int i) {
+            total += m_table.weight(i);
+            m_pick_indices.push_back(i);
+            m_pick_cumulative.push_back(total);
         });
-        std::discrete_distribution<int> dist(weights.begin(), weights.end());
-        return node->domain.at(dist(gen));
+        return m_pick_indices[pick_cumulative(total)];
     }
 
-    bool valid(const wfc::Val& value, const DGraphNode* node) {
-        auto neighborhood = graph->adjacent_nodes(node);
-        auto itr = m_patterns.find(value.value);
-        auto end = m_patterns.end();
-        bool validity = false;
-        if (itr != end) {
-            switch(m_validity_mode) {
-                case SolverValidMode::Correct:
-                    validity = itr->second.valid(neighborhood);
-                break;
-                case SolverValidMode::Approximate:
-                    validity = itr->second.valid_approx(neighborhood);
-                break;
-            }
+    /**
+     * @brief pick a position in m_pick_cumulative, uniform when there is no weight
+     *
+     * @param total last cumulative weight
+     * @return int
+     */
+    int pick_cumulative(float total) const {
+        const int n = (int)m_pick_cumulative.size();
+        assert(n > 0);
+        if (!(total > 0.f)) {
+            std::uniform_int_distribution<int> udist{0, n - 1};
+            return udist(gen);
         }
-        return validity;
+        std::uniform_real_distribution<float> dist{0.f, total};
+        const float target = dist(gen);
+        const auto itr = std::upper_bound(m_pick_cumulative.begin(), m_pick_cumulative.end(), target);
+        return std::min((int)(itr - m_pick_cumulative.begin()), n - 1);
     }
 
 private:
-    Graph<DGraphNode>* graph = nullptr;
+    G* graph = nullptr;
     entropy_callback_t entropy_func{};
     propagate_callback_t propagate_callback_func{};
     std::mt19937& gen;
-    PatternMap m_patterns{};
 
     bool m_constraint_prop_solved = true;
     SolverValidMode m_validity_mode = SolverValidMode::Correct;
+    SolverDomainMode m_domain_mode = SolverDomainMode::Vector;
+
+    // dense pattern index, bit i of a node domain refers to pattern i of the table
+    std::shared_ptr<const PatternTable> m_shared_table;
+    const PatternTable& m_table;
+    DomainBits m_keep_bits{};
+
+    // weighted pick scratch
+    mutable std::vector<float> m_pick_cumulative{};
+    mutable std::vector<int> m_pick_indices{};
+
+    std::unique_ptr<ValidityCache> m_validity_cache{};
+    ValidityTierStats m_tier_stats{};
+
+    // propagation state, reused between calls
+    std::uint32_t m_slot_stamp = next_solver_stamp(); // marks the nodes holding a slot of this solver
+    std::vector<std::uint32_t> m_visit_epoch{}; // last epoch each slot was visited in
+    std::uint32_t m_epoch = 0;
+    RingQueue<DGraphNode*> m_propagation_queue{};
+    std::vector<DGraphNode*> m_neighbor_order{};
+
+    // undo trail, see set_trail_enabled
+    struct TrailEntry {
+        DGraphNode* node;
+        Val value;
+        int index; // dense pattern index in SolverDomainMode::Bitset, -1 otherwise
+    };
+    bool m_trail_enabled = false;
+    std::vector<TrailEntry> m_trail{};
+    std::vector<DGraphNode*> m_rewound{};
+    std::uint64_t m_contradictions = 0;
+
+    // see get_solver_stats
+    SolverStats m_stats{};
+    std::uint64_t m_contradictions_at_reset = 0;
+    bool m_timing_enabled = false;
+
+    // SolverPropagationMode::Incremental
+    SolverPropagationMode m_propagation_mode = SolverPropagationMode::Revisit;
+    std::vector<int> m_type_ids{};          // dense type -> type
+    std::vector<int> m_pattern_dtype{};     // pattern index -> dense type
+    std::vector<int> m_req_offsets{};       // pattern index -> range of distinct required types
+    std::vector<int> m_req_dtypes{};
+    std::vector<int> m_req_mult{};          // multiplicity of each distinct required type
+    std::vector<int> m_req_total{};         // pattern index -> number of requirements
+    std::vector<std::uint64_t> m_req_mask{};
+    // per slot, counts are [slot * n_types + dense type]
+    std::vector<int> m_type_counts{};       // values of each type in the node domain
+    std::vector<int> m_supply{};            // neighbors with each type in their domain
+    std::vector<std::uint8_t> m_counts_ready{};
+    std::vector<std::uint8_t> m_supply_ready{};
+    std::vector<std::uint32_t> m_count_generation{};
+    std::vector<std::uint64_t> m_dirty_types{};
+    std::vector<std::uint8_t> m_queued{};
+    std::vector<int> m_count_scratch{};
+    RingQueue<DGraphNode*> m_incremental_queue{};
+    IncrementalStats m_incremental_stats{};
+
+    // SolverPropagationMode::Parallel
+    std::shared_ptr<ThreadPool> m_thread_pool{};
+    std::size_t m_parallel_min_wave = 64;
+    std::vector<DGraphNode*> m_wave{};
+    std::vector<DGraphNode*> m_next_wave{};
+    std::vector<DGraphNode*> m_wave_adjacency{};        // neighborhoods of the wave nodes, back to back
+    std::vector<std::size_t> m_wave_adjacency_offsets{};
+    std::vector<std::size_t> m_wave_flag_offsets{};     // wave node -> range of m_wave_keep
+    std::vector<std::uint8_t> m_wave_keep{};            // per domain value, still valid
+};
+
+using WFCSolver = BasicWFCSolver<Graph<DGraphNode>>;
+
+extern template class BasicWFCSolver<Graph<DGraphNode>>;
+
+/**
+ * @brief Depth first search over observations. Nodes are observed in a fixed order with the
+ *  WFCSolver undo trail enabled, and every observation is a decision. When propagation empties a
+ *  domain, the solver rewinds to the last decision and bans the value it picked from that node.
+ *  If the node has no values left, the decision before it is undone as well.
+ *
+ */
+class BacktrackingSolver {
+public:
+    struct Stats {
+        std::uint64_t decisions = 0;
+        std::uint64_t backtracks = 0;
+    };
+
+    /**
+     * @param solver
+     * @param max_backtracks give up after this many backtracks
+     */
+    explicit BacktrackingSolver(WFCSolver& solver, std::uint64_t max_backtracks = 100000)
+        : m_solver{solver}, m_max_backtracks{max_backtracks} {}
+
+    /**
+     * @brief observe and propagate nodes in order until every node has a single value
+     *
+     * @param order nodes to solve
+     * @return true solved
+     * @return false no solution was found within max_backtracks, or none exists.
+     *      Nodes are left in the last state tried.
+     */
+    bool solve(Span<DGraphNode* const> order);
+
+    const Stats& get_stats() const noexcept {return m_stats;}
+
+private:
+    struct Decision {
+        int position;           // position of node in the solve order
+        DGraphNode* node;
+        Val value;
+        std::size_t trail_mark; // trail size before the observation
+    };
+
+    /**
+     * @brief undo decisions until banning one of their values propagates without a contradiction
+     *
+     * @param position set to the position of that decision
+     * @return true
+     * @return false when no decisions are left
+     */
+    bool backtrack(int& position);
+
+    WFCSolver& m_solver;
+    std::uint64_t m_max_backtracks;
+    std::vector<Decision> m_decisions{};
+    Stats m_stats{};
 };
 
 } // namespace pcg
@@ -0,0 +1,84 @@
+#include <pcg/wfc_batch.hpp>
+
+namespace wfc {
+
+using BatchSolver = BasicWFCSolver<CSRGraph<DGraphNode>>;
+
+// copy of the layout owned by one thread, the solver holds references to gen and graph
+struct BatchWorker {
+    std::vector<std::unique_ptr<DGraphNode>> nodes{};   // by layout node index
+    std::unique_ptr<CSRGraph<DGraphNode>> graph{};
+    std::mt19937 gen{};
+    std::unique_ptr<BatchSolver> solver{};
+};
+
+static void init_worker(BatchWorker& worker, const CSRGraph<DGraphNode>& layout, const std::shared_ptr<const PatternTable>& patterns,
+                        const BatchSolveArgs& args) {
+    const int n = layout.get_n_nodes();
+    worker.nodes.reserve(n);
+    for (int i = 0; i < n; ++i)
+        worker.nodes.push_back(std::make_unique<DGraphNode>(layout.node(i)->identifier, layout.node(i)->node_id));
+
+    SparseGraph<DGraphNode> edges{layout.is_directed()};
+    for (int i = 0; i < n; ++i) {
+        const auto neighbors = layout.neighbors(i);
+        const auto weights = layout.weights(i);
+        for (std::size_t k = 0; k < neighbors.size(); ++k)
+            if (layout.is_directed() || i < neighbors[k])
+                edges.add_edge(worker.nodes[i].get(), worker.nodes[neighbors[k]].get(), weights[k]);
+    }
+    worker.graph = std::make_unique<CSRGraph<DGraphNode>>(edges);
+
+    worker.solver = std::make_unique<BatchSolver>(worker.graph.get(), patterns, worker.gen, args.constraint_prop_solved,
+                                                  args.validity_mode, args.domain_mode);
+    worker.solver->set_validity_cache_enabled(args.cache_validity);
+}
+
+static void solve_run(BatchWorker& worker, const CSRGraph<DGraphNode>& layout, BatchRunResult& run) {
+    PhaseTimer timer{&run.solve_ms};
+    BatchSolver& solver = *worker.solver;
+    solver.reset_solver_stats();
+    worker.gen.seed((std::uint32_t)ev2::mix64(run.seed));
+
+    const int n = layout.get_n_nodes();
+    for (int i = 0; i < n; ++i)
+        worker.nodes[i]->set_domain(layout.node(i)->domain);
+    for (int i = 0; i < n; ++i) {
+        DGraphNode* node = worker.nodes[i].get();
+        if (solver.domain_size(node) > 1)
+            solver.step_wfc(node);
+    }
+
+    run.values.resize(n);
+    run.n_empty = 0;
+    for (int i = 0; i < n; ++i) {
+        const auto& domain = worker.nodes[i]->domain;
+        run.values[i] = domain.empty() ? -1 : domain[0].value;
+        run.n_empty += domain.empty();
+    }
+    run.stats = solver.get_solver_stats();
+}
+
+BatchSolveResult wfc_solve_batch(const CSRGraph<DGraphNode>& layout, std::shared_ptr<const PatternTable> patterns,
+                                 const std::vector<std::uint64_t>& seeds, ThreadPool& pool, const BatchSolveArgs& args) {
+    BatchSolveResult result{};
+    result.runs.resize(seeds.size());
+    for (std::size_t r = 0; r < seeds.size(); ++r)
+        result.runs[r].seed = seeds[r];
+
+    {
+        PhaseTimer timer{&result.wall_ms};
+        // workers copy the layout on the thread that uses them, the first time they get a run
+        std::vector<BatchWorker> workers(pool.size());
+        pool.parallel_for(seeds.size(), [&](std::size_t begin, std::size_t end, unsigned thread_index) {
+            BatchWorker& worker = workers[thread_index];
+            if (!worker.solver)
+                init_worker(worker, layout, patterns, args);
+            for (std::size_t r = begin; r < end; ++r)
+                solve_run(worker, layout, result.runs[r]);
+        }, 1);
+    }
+    return result;
+}
+
+} // namespace wfc
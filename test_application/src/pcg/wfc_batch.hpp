@@ -0,0 +1,59 @@
+/**
+ * @file wfc_batch.hpp
+ * @brief many independent WFC solves of one layout with different seeds, in parallel
+ * @date 2023-06-14
+ *
+ */
+#ifndef WFC_BATCH_HPP
+#define WFC_BATCH_HPP
+
+#include <pcg/wfc.hpp>
+
+namespace wfc {
+
+struct BatchSolveArgs {
+    SolverValidMode validity_mode = SolverValidMode::Correct;
+    SolverDomainMode domain_mode = SolverDomainMode::Bitset;
+    bool constraint_prop_solved = true;
+    bool cache_validity = true;         // per thread, validity results carry over between the runs of a thread
+};
+
+struct BatchRunResult {
+    std::uint64_t seed = 0;
+    std::vector<int> values{};          // pattern id per layout node index, -1 for an empty domain
+    int n_empty = 0;
+    double solve_ms = 0.0;
+    SolverStats stats{};                // counters of this run, without phase times
+};
+
+struct BatchSolveResult {
+    std::vector<BatchRunResult> runs{}; // in the order of the seeds
+    double wall_ms = 0.0;
+
+    double runs_per_second() const noexcept {return wall_ms > 0.0 ? runs.size() * 1000.0 / wall_ms : 0.0;}
+};
+
+/**
+ * @brief Solve layout once for every seed, runs spread over the pool.
+ *
+ *  layout is only read. Its nodes give the node ids and the starting domains. Every thread copies
+ *  the nodes and edges once, then for each of its runs resets the domains of the copy and solves
+ *  the nodes in layout index order. A run draws from a generator seeded from its seed only. The
+ *  result of a run depends on its seed, not on the thread or the other runs.
+ *
+ *  All solvers share patterns and write nothing else in common. A thread keeps its solver and
+ *  validity cache for all of its runs instead of building them per run.
+ *
+ * @param layout
+ * @param patterns compiled once, shared by the solvers of every thread
+ * @param seeds one run per seed
+ * @param pool
+ * @param args
+ * @return BatchSolveResult
+ */
+BatchSolveResult wfc_solve_batch(const CSRGraph<DGraphNode>& layout, std::shared_ptr<const PatternTable> patterns,
+                                 const std::vector<std::uint64_t>& seeds, ThreadPool& pool, const BatchSolveArgs& args = {});
+
+} // namespace wfc
+
+#endif // WFC_BATCH_HPP
@@ -0,0 +1,294 @@
+#include <pcg/wfc_chunked.hpp>
+
+#include <fstream>
+
+namespace wfc {
+
+static constexpr std::uint32_t chunk_magic = 0x43434657; // "WFCC"
+
+static int floor_div(int a, int b) noexcept {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+ChunkedWorld::ChunkedWorld(int chunk_size, PatternMap patterns, std::filesystem::path directory,
+                           std::uint64_t seed, std::size_t max_resident)
+    : m_chunk_size{chunk_size}, m_patterns{std::move(patterns)}, m_table{m_patterns},
+      m_directory{std::move(directory)}, m_seed{seed}, m_max_resident{std::max<std::size_t>(1, max_resident)} {
+    // chunks of one generate() phase are two chunks apart, their halos must not reach each other
+    if (chunk_size < halo)
+        throw std::logic_error("ChunkedWorld::ChunkedWorld invalid chunk size");
+    if (m_table.size() >= empty_cell)
+        throw std::logic_error("ChunkedWorld::ChunkedWorld too many patterns");
+    std::filesystem::create_directories(m_directory);
+}
+
+void ChunkedWorld::set_adjacency_rules(const AdjacencyRules& rules) {
+    m_rules = std::make_unique<AdjacencyRules>(rules);
+    // workers made by an earlier generate() still hold the previous constraint model
+    for (auto& worker : m_workers)
+        worker->solver->set_adjacency_rules(*m_rules);
+}
+
+std::filesystem::path ChunkedWorld::chunk_path(int cx, int cy) const {
+    return m_directory / ("chunk_" + std::to_string(cx) + "_" + std::to_string(cy) + ".bin");
+}
+
+std::uint32_t ChunkedWorld::chunk_seed(int cx, int cy, int attempt) const noexcept {
+    return (std::uint32_t)ev2::mix64(m_seed ^ ev2::mix64(ev2::pack_key(cx, cy)) ^ (std::uint64_t)attempt << 56);
+}
+
+bool ChunkedWorld::is_solved(int cx, int cy) const {
+    return m_resident_index.contains(ev2::pack_key(cx, cy)) || std::filesystem::exists(chunk_path(cx, cy));
+}
+
+int ChunkedWorld::value_at(int x, int y) {
+    const int cx = floor_div(x, m_chunk_size), cy = floor_div(y, m_chunk_size);
+    const auto* cells = chunk_cells(cx, cy);
+    if (!cells)
+        return -1;
+    const std::uint16_t i = (*cells)[(y - cy * m_chunk_size) * m_chunk_size + (x - cx * m_chunk_size)];
+    return i == empty_cell ? -1 : m_table.id(i);
+}
+
+const std::vector<std::uint16_t>* ChunkedWorld::chunk_cells(int cx, int cy) {
+    const auto key = ev2::pack_key(cx, cy);
+    if (const int* r = m_resident_index.find(key)) {
+        m_resident[*r].last_use = ++m_clock;
+        return &m_resident[*r].cells;
+    }
+
+    std::vector<std::uint16_t> cells;
+    if (!read_chunk(cx, cy, cells))
+        return nullptr;
+    ++m_stats.chunk_reads;
+    make_resident(cx, cy, std::move(cells));
+    return &m_resident[*m_resident_index.find(key)].cells;
+}
+
+void ChunkedWorld::make_resident(int cx, int cy, std::vector<std::uint16_t> cells) {
+    const auto key = ev2::pack_key(cx, cy);
+    if (const int* r = m_resident_index.find(key)) {
+        m_resident[*r].cells = std::move(cells);
+        m_resident[*r].last_use = ++m_clock;
+        return;
+    }
+
+    if (m_resident.size() >= m_max_resident) {
+        // evict the least recently used chunk, it is already on disk
+        std::size_t lru = 0;
+        for (std::size_t r = 1; r < m_resident.size(); ++r)
+            if (m_resident[r].last_use < m_resident[lru].last_use)
+                lru = r;
+        m_resident_index.erase(m_resident[lru].key);
+        if (lru + 1 != m_resident.size()) {
+            m_resident[lru] = std::move(m_resident.back());
+            m_resident_index[m_resident[lru].key] = (int)lru;
+        }
+        m_resident.pop_back();
+    }
+    m_resident_index[key] = (int)m_resident.size();
+    m_resident.push_back(Resident{key, ++m_clock, std::move(cells)});
+}
+
+void ChunkedWorld::write_chunk(int cx, int cy, const std::vector<std::uint16_t>& cells) const {
+    // patterns fit a byte for most tile sets, 0xff is the empty cell then
+    const std::int32_t bytes_per_cell = m_table.size() < 0xff ? 1 : 2;
+    const std::int32_t header[4] = {(std::int32_t)chunk_magic, m_chunk_size, m_table.size(), bytes_per_cell};
+
+    const auto path = chunk_path(cx, cy);
+    const auto tmp_path = path.string() + ".tmp";
+    {
+        std::ofstream ostr{tmp_path, std::ios::out | std::ios::binary | std::ios::trunc};
+        ostr.write(reinterpret_cast<const char*>(header), sizeof(header));
+        if (bytes_per_cell == 1) {
+            std::vector<std::uint8_t> bytes(cells.size());
+            for (std::size_t c = 0; c < cells.size(); ++c)
+                bytes[c] = cells[c] == empty_cell ? 0xff : (std::uint8_t)cells[c];
+            ostr.write(reinterpret_cast<const char*>(bytes.data()), (std::streamsize)bytes.size());
+        } else {
+            ostr.write(reinterpret_cast<const char*>(cells.data()), (std::streamsize)(cells.size() * sizeof(std::uint16_t)));
+        }
+        if (!ostr)
+            throw std::runtime_error("ChunkedWorld::write_chunk could not write " + tmp_path);
+    }
+    // a chunk file is complete or absent, so an interrupted run never leaves a partial chunk marked solved
+    std::filesystem::rename(tmp_path, path);
+}
+
+bool ChunkedWorld::read_chunk(int cx, int cy, std::vector<std::uint16_t>& cells) const {
+    std::ifstream istr{chunk_path(cx, cy), std::ios::in | std::ios::binary};
+    if (!istr)
+        return false;
+
+    std::int32_t header[4] = {};
+    istr.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!istr || header[0] != (std::int32_t)chunk_magic || header[1] != m_chunk_size || header[2] != m_table.size()
+        || (header[3] != 1 && header[3] != 2))
+        throw std::runtime_error("ChunkedWorld::read_chunk chunk does not match the world settings");
+
+    const std::size_t n = (std::size_t)m_chunk_size * m_chunk_size;
+    cells.resize(n);
+    if (header[3] == 1) {
+        std::vector<std::uint8_t> bytes(n);
+        istr.read(reinterpret_cast<char*>(bytes.data()), (std::streamsize)n);
+        for (std::size_t c = 0; c < n; ++c)
+            cells[c] = bytes[c] == 0xff ? empty_cell : bytes[c];
+    } else {
+        istr.read(reinterpret_cast<char*>(cells.data()), (std::streamsize)(n * sizeof(std::uint16_t)));
+    }
+    if (!istr)
+        throw std::runtime_error("ChunkedWorld::read_chunk truncated chunk");
+    return true;
+}
+
+void ChunkedWorld::gather_halo(Job& job) {
+    const int s = m_chunk_size, w = s + 2 * halo;
+    job.input.assign((std::size_t)w * w, empty_cell);
+    for (int dy = -1; dy <= 1; ++dy)
+        for (int dx = -1; dx <= 1; ++dx) {
+            if (dx == 0 && dy == 0)
+                continue;
+            const auto* cells = chunk_cells(job.cx + dx, job.cy + dy);
+            if (!cells)
+                continue;
+            // halo cells of the solver grid that fall in chunk (cx + dx, cy + dy)
+            for (int r = 0; r < w; ++r) {
+                const int y = r - halo; // relative to the chunk origin
+                if (floor_div(y, s) != dy)
+                    continue;
+                for (int col = 0; col < w; ++col) {
+                    const int x = col - halo;
+                    if (floor_div(x, s) == dx)
+                        job.input[r * w + col] = (*cells)[(y - dy * s) * s + (x - dx * s)];
+                }
+            }
+        }
+}
+
+void ChunkedWorld::solve_job(Job& job, Worker& worker) const {
+    const int s = m_chunk_size, w = s + 2 * halo;
+    GridWFCSolver& solver = *worker.solver;
+    auto interior = [s](int r, int col) {return r >= halo && r < halo + s && col >= halo && col < halo + s;};
+    auto inner_ring = [s, w](int r, int col) {
+        return r >= 1 && r < w - 1 && col >= 1 && col < w - 1 && (r == 1 || r == w - 2 || col == 1 || col == w - 2);
+    };
+
+    int best_failed = std::numeric_limits<int>::max();
+    job.output.assign((std::size_t)s * s, empty_cell);
+    for (int attempt = 0; attempt < m_max_attempts && best_failed > 0; ++attempt) {
+        ++job.attempts;
+        worker.gen.seed(chunk_seed(job.cx, job.cy, attempt));
+        solver.reset_domains();
+        for (int c = 0; c < w * w; ++c)
+            if (job.input[c] != empty_cell)
+                solver.set_domain(c, {m_table.value(job.input[c])});
+
+        // narrow the chunk to what its solved neighbors allow, and need from it
+        if (solver.get_constraint_model() == CellConstraintModel::Adjacency) {
+            solver.propagate(0);
+        } else {
+            for (int r = 1; r < w - 1; ++r)
+                for (int col = 1; col < w - 1; ++col)
+                    if (inner_ring(r, col) && job.input[r * w + col] != empty_cell)
+                        solver.propagate(solver.cell(r, col));
+            for (int r = 1; r < w - 1; ++r)
+                for (int col = 1; col < w - 1; ++col) {
+                    const int c = solver.cell(r, col);
+                    if (!inner_ring(r, col) || job.input[c] == empty_cell)
+                        continue;
+                    // a boundary cell has at most one neighbor in the chunk
+                    const int inside = r == 1 ? solver.cell(halo, col) : r == w - 2 ? solver.cell(w - 1 - halo, col)
+                        : col == 1 ? solver.cell(r, halo) : solver.cell(r, w - 1 - halo);
+                    if (interior(inside / w, inside % w) && solver.keep_supporting(inside, c))
+                        solver.propagate(inside);
+                }
+        }
+
+        for (int r = halo; r < halo + s; ++r)
+            for (int col = halo; col < halo + s; ++col) {
+                const int c = solver.cell(r, col);
+                if (solver.domain_size(c) > 1)
+                    solver.step_wfc(c);
+            }
+
+        // an empty chunk cell, or a neighbor value the chunk could not support, is a failure
+        int failed = 0;
+        for (int r = 1; r < w - 1; ++r)
+            for (int col = 1; col < w - 1; ++col) {
+                const int c = solver.cell(r, col);
+                if (interior(r, col))
+                    failed += solver.update_domain(c) || solver.domain_size(c) != 1;
+                else if (inner_ring(r, col) && job.input[c] != empty_cell)
+                    failed += solver.update_domain(c) || solver.domain_size(c) != 1;
+            }
+
+        if (failed < best_failed) {
+            best_failed = failed;
+            for (int r = 0; r < s; ++r)
+                for (int col = 0; col < s; ++col) {
+                    const int i = solver.solved_index(solver.cell(r + halo, col + halo));
+                    job.output[r * s + col] = i < 0 ? empty_cell : (std::uint16_t)i;
+                }
+        }
+    }
+    job.failed = best_failed;
+}
+
+const ChunkedWorld::Stats& ChunkedWorld::generate(int cx0, int cy0, int cx1, int cy1) {
+    if (!m_thread_pool)
+        m_thread_pool = std::make_shared<ThreadPool>();
+
+    const int w = m_chunk_size + 2 * halo;
+    while (m_workers.size() < m_thread_pool->size()) {
+        auto worker = std::make_unique<Worker>();
+        worker->solver = std::make_unique<GridWFCSolver>(w, w, m_patterns, worker->gen);
+        if (m_rules)
+            worker->solver->set_adjacency_rules(*m_rules);
+        // the outer halo ring misses neighbors outside the solver grid, its requirements can not be checked
+        for (int r = 0; r < w; ++r)
+            for (int col = 0; col < w; ++col)
+                if (r == 0 || r == w - 1 || col == 0 || col == w - 1)
+                    worker->solver->set_frozen(worker->solver->cell(r, col), true);
+        m_workers.push_back(std::move(worker));
+    }
+
+    // chunks of one parity class share no halo, they are solved in parallel in batches that bound the halo copies held
+    const std::size_t batch_size = (std::size_t)m_thread_pool->size() * 4;
+    std::vector<Job> batch;
+    for (int phase = 0; phase < 4; ++phase) {
+        std::vector<std::pair<int, int>> pending;
+        for (int cy = cy0; cy < cy1; ++cy)
+            for (int cx = cx0; cx < cx1; ++cx)
+                if ((cx & 1) == (phase & 1) && (cy & 1) == (phase >> 1) && !is_solved(cx, cy))
+                    pending.emplace_back(cx, cy);
+
+        for (std::size_t begin = 0; begin < pending.size(); begin += batch_size) {
+            const std::size_t end = std::min(pending.size(), begin + batch_size);
+            batch.resize(end - begin);
+            for (std::size_t j = begin; j < end; ++j) {
+                Job& job = batch[j - begin];
+                job.cx = pending[j].first;
+                job.cy = pending[j].second;
+                job.attempts = 0;
+                job.failed = 0;
+                gather_halo(job);
+            }
+
+            m_thread_pool->parallel_for(batch.size(), [this, &batch](std::size_t b, std::size_t e, unsigned thread_index) {
+                for (std::size_t j = b; j < e; ++j)
+                    solve_job(batch[j], *m_workers[thread_index]);
+            }, 1);
+
+            for (Job& job : batch) {
+                write_chunk(job.cx, job.cy, job.output);
+                make_resident(job.cx, job.cy, std::move(job.output));
+                ++m_stats.chunks;
+                m_stats.attempts += job.attempts;
+                m_stats.failed_cells += job.failed;
+            }
+        }
+    }
+    return m_stats;
+}
+
+} // namespace wfc
@@ -0,0 +1,157 @@
+/**
+ * @file wfc_chunked.hpp
+ * @brief WFC over an unbounded grid, solved and stored in chunks
+ * @date 2023-06-12
+ *
+ */
+#ifndef WFC_CHUNKED_HPP
+#define WFC_CHUNKED_HPP
+
+#include <pcg/wfc_grid.hpp>
+
+#include <filesystem>
+#include <memory>
+
+namespace wfc {
+
+/**
+ * @brief Unbounded 2D world split into chunk_size x chunk_size chunks. Chunk (cx, cy) holds world
+ *  cells x in [cx * chunk_size, (cx + 1) * chunk_size), same for y.
+ *
+ *  A chunk is solved once with a GridWFCSolver over the chunk and a 2 cell halo. Halo cells of
+ *  solved neighbor chunks are fixed to their values, the rest start with every pattern. The inner
+ *  halo ring is revised like any cell, so solved neighbors constrain the chunk, and chunk cells next
+ *  to a solved neighbor only keep values that leave its requirements matched. The outer ring only
+ *  completes the neighborhood of the inner ring and is frozen.
+ *  A chunk that ends with an empty cell is solved again with the next seed, up to max_attempts,
+ *  and the attempt with the fewest failed cells is kept.
+ *
+ *  Chunks at least 2 apart on some axis share no halo, so generate() solves the chunks of a
+ *  region in 4 checkerboard phases with the chunks of a phase in parallel. Every chunk has its own
+ *  seed, the result does not depend on the number of threads.
+ *
+ *  Finished chunks are written to one file each in the world directory, one or two bytes per
+ *  cell. At most max_resident chunks stay in memory, so memory does not grow with the world.
+ *
+ */
+class ChunkedWorld {
+public:
+    struct Stats {
+        std::uint64_t chunks = 0;           // chunks solved
+        std::uint64_t attempts = 0;         // solves, including retries
+        std::uint64_t failed_cells = 0;     // cells left empty, or neighbor cells they conflict with, in the kept attempt
+        std::uint64_t chunk_reads = 0;      // chunks loaded from disk
+    };
+
+    /**
+     * @param chunk_size cells per chunk side
+     * @param patterns
+     * @param directory where chunk files are stored, created if needed. Chunks found there count as solved.
+     * @param seed
+     * @param max_resident chunks kept in memory
+     */
+    ChunkedWorld(int chunk_size, PatternMap patterns, std::filesystem::path directory,
+                 std::uint64_t seed = 0, std::size_t max_resident = 64);
+
+    /**
+     * @brief solve with AdjacencyRules for GridWFCSolver directions instead of pattern requirements,
+     *  applies to the chunks solved after the call
+     *
+     * @param rules
+     */
+    void set_adjacency_rules(const AdjacencyRules& rules);
+
+    void set_thread_pool(std::shared_ptr<ThreadPool> pool) {m_thread_pool = std::move(pool);}
+
+    void set_max_attempts(int n) noexcept {m_max_attempts = std::max(1, n);}
+
+    /**
+     * @brief solve every unsolved chunk with cx in [cx0, cx1) and cy in [cy0, cy1)
+     *
+     * @return const Stats& totals over the lifetime of the world
+     */
+    const Stats& generate(int cx0, int cy0, int cx1, int cy1);
+
+    /**
+     * @brief pattern id at a world cell
+     *
+     * @param x
+     * @param y
+     * @return int -1 if the chunk is not solved or the cell was left empty
+     */
+    int value_at(int x, int y);
+
+    bool is_solved(int cx, int cy) const;
+
+    int get_chunk_size() const noexcept {return m_chunk_size;}
+    std::size_t resident_chunks() const noexcept {return m_resident.size();}
+    const Stats& get_stats() const noexcept {return m_stats;}
+    const PatternTable& get_pattern_table() const noexcept {return m_table;}
+
+    static constexpr std::uint16_t empty_cell = 0xffff;
+    static constexpr int halo = 2;
+
+private:
+    struct Resident {
+        std::uint64_t key;
+        std::uint64_t last_use;
+        std::vector<std::uint16_t> cells;   // dense pattern index per cell, row major
+    };
+
+    struct Job {
+        int cx, cy;
+        std::vector<std::uint16_t> input;   // (chunk_size + 2 * halo)^2, fixed halo values or empty_cell
+        std::vector<std::uint16_t> output;  // chunk_size^2
+        int attempts = 0;
+        int failed = 0;
+    };
+
+    // solver state of one pool thread, the solver holds a reference to gen
+    struct Worker {
+        std::mt19937 gen{};
+        std::unique_ptr<GridWFCSolver> solver{};
+    };
+
+    std::filesystem::path chunk_path(int cx, int cy) const;
+
+    /**
+     * @brief cells of a solved chunk, loaded from disk if it is not resident
+     *
+     * @return const std::vector<std::uint16_t>* nullptr if the chunk is not solved
+     */
+    const std::vector<std::uint16_t>* chunk_cells(int cx, int cy);
+
+    void make_resident(int cx, int cy, std::vector<std::uint16_t> cells);
+
+    std::uint32_t chunk_seed(int cx, int cy, int attempt) const noexcept;
+
+    void gather_halo(Job& job);
+
+    void solve_job(Job& job, Worker& worker) const;
+
+    void write_chunk(int cx, int cy, const std::vector<std::uint16_t>& cells) const;
+
+    bool read_chunk(int cx, int cy, std::vector<std::uint16_t>& cells) const;
+
+private:
+    int m_chunk_size;
+    PatternMap m_patterns;
+    PatternTable m_table;
+    std::filesystem::path m_directory;
+    std::uint64_t m_seed;
+    std::size_t m_max_resident;
+    int m_max_attempts = 8;
+    std::unique_ptr<AdjacencyRules> m_rules{};
+
+    std::vector<Resident> m_resident{};
+    ev2::FlatHashMap<int> m_resident_index{};   // packed chunk coordinate -> index in m_resident
+    std::uint64_t m_clock = 0;
+
+    std::shared_ptr<ThreadPool> m_thread_pool{};
+    std::vector<std::unique_ptr<Worker>> m_workers{};
+    Stats m_stats{};
+};
+
+} // namespace wfc
+
+#endif // WFC_CHUNKED_HPP
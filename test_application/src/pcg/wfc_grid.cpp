@@ -0,0 +1,415 @@
+#include <pcg/wfc_grid.hpp>
+
+namespace wfc {
+
+CellWFCSolver::CellWFCSolver(int n_cells, std::vector<int> opposite_directions, direction_neighbor_t direction_neighbor,
+                             const PatternMap& patterns, std::mt19937& gen)
+    : gen{gen}, m_table{patterns}, m_opposite{std::move(opposite_directions)}, m_direction_neighbor{direction_neighbor} {
+    if (n_cells <= 0 || m_opposite.size() > max_neighbors)
+        throw std::logic_error("CellWFCSolver::CellWFCSolver invalid size argument");
+
+    m_words_per_cell = std::max<std::size_t>(1, DomainBits::n_words(m_table.size()));
+    m_domains.assign((std::size_t)n_cells * m_words_per_cell, 0);
+    m_visit_epoch.assign((std::size_t)n_cells, 0);
+    m_keep.resize(m_words_per_cell);
+    m_union.resize(m_words_per_cell);
+    build_type_index();
+    m_supply.resize(m_opposite.size() * m_type_words);
+}
+
+void CellWFCSolver::set_adjacency_rules(const AdjacencyRules& rules) {
+    const int n_directions = get_n_directions();
+    if (rules.get_n_directions() != n_directions)
+        throw std::logic_error("CellWFCSolver::set_adjacency_rules rules do not match the topology directions");
+    if (m_table.size() > std::numeric_limits<std::uint16_t>::max())
+        throw std::logic_error("CellWFCSolver::set_adjacency_rules too many patterns for support counts");
+
+    m_allowed.assign((std::size_t)m_table.size() * n_directions * m_words_per_cell, 0);
+    auto set_allowed = [this, n_directions](int a, int direction, int b) {
+        word_t* words = m_allowed.data() + ((std::size_t)a * n_directions + direction) * m_words_per_cell;
+        words[b / DomainBits::word_bits] |= word_t{1} << (b % DomainBits::word_bits);
+    };
+    for (const auto& rule : rules.rules()) {
+        const int a = m_table.index_of(rule.pattern_a);
+        const int b = m_table.index_of(rule.pattern_b);
+        if (a < 0 || b < 0)
+            continue;
+        set_allowed(a, rule.direction, b);
+        set_allowed(b, m_opposite[rule.direction], a);
+    }
+
+    m_model = CellConstraintModel::Adjacency;
+    m_supports_ready = false;
+    m_removals.clear();
+}
+
+void CellWFCSolver::clear_adjacency_rules() {
+    m_model = CellConstraintModel::Patterns;
+    m_allowed.clear();
+    m_support = {};
+    m_supports_ready = false;
+    m_removals.clear();
+}
+
+void CellWFCSolver::build_type_index() {
+    m_type_ids.clear();
+    for (int i = 0; i < m_table.size(); ++i)
+        for (int t : m_table.requirements(i))
+            m_type_ids.push_back(t);
+    std::sort(m_type_ids.begin(), m_type_ids.end());
+    m_type_ids.erase(std::unique(m_type_ids.begin(), m_type_ids.end()), m_type_ids.end());
+    m_type_words = std::max<std::size_t>(1, DomainBits::n_words((int)m_type_ids.size()));
+
+    auto dense_type = [this](int t) {
+        auto itr = std::lower_bound(m_type_ids.begin(), m_type_ids.end(), t);
+        return itr != m_type_ids.end() && *itr == t ? (int)(itr - m_type_ids.begin()) : -1;
+    };
+
+    m_pattern_dtype.resize(m_table.size());
+    m_req_offsets.assign(1, 0);
+    m_req_dtypes.clear();
+    for (int i = 0; i < m_table.size(); ++i) {
+        m_pattern_dtype[i] = dense_type(m_table.type(i));
+        for (int t : m_table.requirements(i))
+            m_req_dtypes.push_back(dense_type(t));
+        m_req_offsets.push_back((int)m_req_dtypes.size());
+    }
+}
+
+void CellWFCSolver::reset_domains() {
+    m_supports_ready = false;
+    m_removals.clear();
+    std::fill(m_keep.begin(), m_keep.end(), 0);
+    for (int i = 0; i < m_table.size(); ++i)
+        m_keep[i / DomainBits::word_bits] |= word_t{1} << (i % DomainBits::word_bits);
+    for (std::size_t c = 0; c < m_visit_epoch.size(); ++c)
+        std::copy(m_keep.begin(), m_keep.end(), domain((int)c));
+}
+
+void CellWFCSolver::reset_domains(const std::vector<Val>& values) {
+    set_domain(0, values);
+    for (std::size_t c = 1; c < m_visit_epoch.size(); ++c)
+        std::copy(domain(0), domain(0) + m_words_per_cell, domain((int)c));
+}
+
+void CellWFCSolver::set_domain(int cell, const std::vector<Val>& values) {
+    m_supports_ready = false;
+    m_removals.clear();
+    word_t* w = domain(cell);
+    std::fill(w, w + m_words_per_cell, 0);
+    for (const auto& v : values) {
+        const int i = m_table.index_of(v.value);
+        if (i >= 0)
+            w[i / DomainBits::word_bits] |= word_t{1} << (i % DomainBits::word_bits);
+    }
+}
+
+void CellWFCSolver::observe(int cell) {
+    ensure_supports();
+    if (domain_size(cell) <= 1)
+        return;
+
+    const int picked = weighted_pick_index(cell);
+    if (m_model == CellConstraintModel::Adjacency) {
+        for_each_set(cell, [this, cell, picked](int i) {
+            if (i != picked)
+                remove_value(cell, i);
+        });
+        return;
+    }
+    word_t* w = domain(cell);
+    std::fill(w, w + m_words_per_cell, 0);
+    w[picked / DomainBits::word_bits] = word_t{1} << (picked % DomainBits::word_bits);
+}
+
+bool CellWFCSolver::update_domain(int cell, const int* adjacent, int n_neighbors) {
+    if (first_index(cell) < 0)
+        return false; // nothing left to remove
+
+    load_supply(adjacent, n_neighbors);
+
+    std::fill(m_keep.begin(), m_keep.end(), 0);
+    for_each_set(cell, [this, n_neighbors](int i) {
+        if (valid(i, n_neighbors))
+            m_keep[i / DomainBits::word_bits] |= word_t{1} << (i % DomainBits::word_bits);
+    });
+
+    word_t* w = domain(cell);
+    word_t changed = 0, any = 0;
+    for (std::size_t i = 0; i < m_words_per_cell; ++i) {
+        changed |= w[i] ^ m_keep[i];
+        any |= m_keep[i];
+        w[i] = m_keep[i];
+    }
+    m_contradictions += changed && !any;
+    return changed != 0;
+}
+
+bool CellWFCSolver::keep_supporting(int cell, int neighbor, const int* adjacent, int n_neighbors) {
+    const int k = (int)(std::find(adjacent, adjacent + n_neighbors, cell) - adjacent);
+    assert(k < n_neighbors);
+    if (first_index(cell) < 0 || first_index(neighbor) < 0)
+        return false;
+
+    // supply of cell is replaced by one value at a time, the other neighbors keep their domains
+    load_supply(adjacent, n_neighbors);
+    word_t* supply = m_supply.data() + k * m_type_words;
+    std::fill(m_keep.begin(), m_keep.end(), 0);
+    for_each_set(cell, [this, neighbor, n_neighbors, supply](int i) {
+        std::fill(supply, supply + m_type_words, 0);
+        const int t = m_pattern_dtype[i];
+        if (t >= 0)
+            supply[t / DomainBits::word_bits] |= word_t{1} << (t % DomainBits::word_bits);
+        bool supported = false;
+        for_each_set(neighbor, [this, n_neighbors, &supported](int j) {
+            supported = supported || valid(j, n_neighbors);
+        });
+        if (supported)
+            m_keep[i / DomainBits::word_bits] |= word_t{1} << (i % DomainBits::word_bits);
+    });
+
+    word_t* w = domain(cell);
+    word_t changed = 0, any = 0;
+    for (std::size_t i = 0; i < m_words_per_cell; ++i) {
+        changed |= w[i] ^ m_keep[i];
+        any |= m_keep[i];
+        w[i] = m_keep[i];
+    }
+    m_contradictions += changed && !any;
+    return changed != 0;
+}
+
+void CellWFCSolver::load_supply(const int* adjacent, int n_neighbors) {
+    std::fill(m_supply.begin(), m_supply.begin() + n_neighbors * m_type_words, 0);
+    for (int j = 0; j < n_neighbors; ++j) {
+        word_t* supply = m_supply.data() + j * m_type_words;
+        for_each_set(adjacent[j], [this, supply](int i) {
+            const int t = m_pattern_dtype[i];
+            if (t >= 0)
+                supply[t / DomainBits::word_bits] |= word_t{1} << (t % DomainBits::word_bits);
+        });
+    }
+}
+
+/**
+ * @brief find an augmenting path from requirement r, Kuhn's algorithm over neighbor bitmasks
+ *
+ */
+static bool augment(int r, const std::uint32_t* suppliers, int* owner, std::uint32_t& visited) {
+    for (std::uint32_t free = suppliers[r] & ~visited; free; free &= free - 1) {
+        const int j = __builtin_ctz(free);
+        visited |= 1u << j;
+        if (owner[j] < 0 || augment(owner[j], suppliers, owner, visited)) {
+            owner[j] = r;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CellWFCSolver::valid(int i, int n_neighbors) const {
+    const int begin = m_req_offsets[i], n_req = m_req_offsets[i + 1] - begin;
+    if (n_req > n_neighbors)
+        return false;
+
+    std::array<std::uint32_t, max_neighbors> suppliers;
+    for (int r = 0; r < n_req; ++r) {
+        const int t = m_req_dtypes[begin + r];
+        suppliers[r] = 0;
+        for (int j = 0; j < n_neighbors; ++j)
+            suppliers[r] |= (std::uint32_t)supplies(j, t) << j;
+        if (!suppliers[r])
+            return false;
+    }
+
+    std::array<int, max_neighbors> owner;
+    std::fill(owner.begin(), owner.begin() + n_neighbors, -1);
+    for (int r = 0; r < n_req; ++r) {
+        std::uint32_t visited = 0;
+        if (!augment(r, suppliers.data(), owner.data(), visited))
+            return false;
+    }
+    return true;
+}
+
+float CellWFCSolver::cell_entropy(int cell) const {
+    if (domain_size(cell) == 1)
+        return 0.f;
+    float sum = 0.f;
+    for_each_set(cell, [this, &sum](int i) {sum += m_table.weight(i);});
+    return sum;
+}
+
+std::vector<Val> CellWFCSolver::domain_values(int cell) const {
+    std::vector<Val> values{};
+    for_each_set(cell, [this, &values](int i) {values.push_back(m_table.value(i));});
+    return values;
+}
+
+bool CellWFCSolver::ban(int cell, Val value) {
+    ensure_supports();
+    const int i = m_table.index_of(value.value);
+    if (i < 0 || !test(cell, i))
+        return false;
+    remove_value(cell, i);
+    return true;
+}
+
+void CellWFCSolver::remove_value(int cell, int i) {
+    word_t* w = domain(cell);
+    w[i / DomainBits::word_bits] &= ~(word_t{1} << (i % DomainBits::word_bits));
+    m_contradictions += first_index(cell) < 0;
+    if (m_supports_ready)
+        m_removals.push(Removal{cell, i});
+}
+
+void CellWFCSolver::ensure_supports() {
+    if (m_model != CellConstraintModel::Adjacency || m_supports_ready)
+        return;
+
+    const int n_cells = (int)m_visit_epoch.size();
+    const int n_directions = get_n_directions();
+    m_support.assign((std::size_t)n_cells * n_directions * m_table.size(), 0);
+    m_removals.clear();
+    for (int c = 0; c < n_cells; ++c)
+        for (int d = 0; d < n_directions; ++d) {
+            const int n = m_direction_neighbor(*this, c, d);
+            if (n < 0)
+                continue;
+            const word_t* neighbor_domain = domain(n);
+            for_each_set(c, [&](int i) {
+                const word_t* a = allowed(i, d);
+                int count = 0;
+                for (std::size_t w = 0; w < m_words_per_cell; ++w)
+                    count += __builtin_popcountll(a[w] & neighbor_domain[w]);
+                support(c, d, i) = (std::uint16_t)count;
+            });
+        }
+    m_supports_ready = true;
+
+    // counts are from the domains before any removal, queue the removals so propagate_removals brings them up to date
+    for (int c = 0; c < n_cells; ++c)
+        for (int d = 0; d < n_directions; ++d) {
+            if (m_direction_neighbor(*this, c, d) < 0)
+                continue;
+            for_each_set(c, [this, c, d](int i) {
+                if (support(c, d, i) == 0)
+                    remove_value(c, i);
+            });
+        }
+}
+
+bool CellWFCSolver::revise_adjacency(int cell) {
+    ensure_supports();
+    const word_t* w = domain(cell);
+    std::copy(w, w + m_words_per_cell, m_keep.begin());
+    for (int d = 0; d < get_n_directions(); ++d) {
+        const int n = m_direction_neighbor(*this, cell, d);
+        if (n < 0)
+            continue;
+        // values of cell allowed by some value of the neighbor, cell is in the opposite direction from it
+        std::fill(m_union.begin(), m_union.end(), 0);
+        const int od = m_opposite[d];
+        for_each_set(n, [this, od](int q) {
+            const word_t* a = allowed(q, od);
+            for (std::size_t k = 0; k < m_words_per_cell; ++k)
+                m_union[k] |= a[k];
+        });
+        for (std::size_t k = 0; k < m_words_per_cell; ++k)
+            m_keep[k] &= m_union[k];
+    }
+
+    bool changed = false;
+    for_each_set(cell, [this, cell, &changed](int i) {
+        if (!((m_keep[i / DomainBits::word_bits] >> (i % DomainBits::word_bits)) & 1u)) {
+            remove_value(cell, i);
+            changed = true;
+        }
+    });
+    return changed;
+}
+
+void CellWFCSolver::propagate_removals() {
+    ensure_supports();
+    const int n_directions = get_n_directions();
+    while (!m_removals.empty()) {
+        const Removal r = m_removals.pop();
+        for (int d = 0; d < n_directions; ++d) {
+            const int n = m_direction_neighbor(*this, r.cell, d);
+            if (n < 0)
+                continue;
+            // values of the neighbor that r.index allowed lose one support from the opposite direction
+            const int od = m_opposite[d];
+            const word_t* a = allowed(r.index, d);
+            const word_t* neighbor_domain = domain(n);
+            for (std::size_t w = 0; w < m_words_per_cell; ++w) {
+                for (word_t bits = a[w] & neighbor_domain[w]; bits; bits &= bits - 1) {
+                    const int p = (int)w * DomainBits::word_bits + __builtin_ctzll(bits);
+                    std::uint16_t& s = support(n, od, p);
+                    assert(s > 0);
+                    if (--s == 0)
+                        remove_value(n, p);
+                }
+            }
+        }
+    }
+}
+
+int CellWFCSolver::weighted_pick_index(int cell) {
+    constexpr float alias_min_fraction = 0.25f; // same sampling as WFCSolver::weighted_pick_index
+    constexpr int max_alias_attempts = 16;
+
+    const float live_weight = cell_entropy(cell);
+    if (live_weight > 0.f && live_weight >= alias_min_fraction * m_table.total_weight()) {
+        for (int attempt = 0; attempt < max_alias_attempts; ++attempt) {
+            const int i = m_table.sample_alias(gen);
+            if (test(cell, i))
+                return i;
+        }
+    }
+
+    m_pick_indices.clear();
+    m_pick_cumulative.clear();
+    float total = 0.f;
+    for_each_set(cell, [this, &total](int i) {
+        total += m_table.weight(i);
+        m_pick_indices.push_back(i);
+        m_pick_cumulative.push_back(total);
+    });
+    return m_pick_indices[pick_cumulative(total)];
+}
+
+int CellWFCSolver::pick_cumulative(float total) {
+    const int n = (int)m_pick_cumulative.size();
+    assert(n > 0);
+    if (!(total > 0.f)) {
+        std::uniform_int_distribution<int> udist{0, n - 1};
+        return udist(gen);
+    }
+    std::uniform_real_distribution<float> dist{0.f, total};
+    const float target = dist(gen);
+    const auto itr = std::upper_bound(m_pick_cumulative.begin(), m_pick_cumulative.end(), target);
+    return std::min((int)(itr - m_pick_cumulative.begin()), n - 1);
+}
+
+GridWFCSolver::GridWFCSolver(int width, int height, const PatternMap& patterns, std::mt19937& gen)
+    : CellWFCSolver{width > 0 && height > 0 ? width * height : 0, {Right, Down, Left, Up},
+                    [](const CellWFCSolver& solver, int cell, int direction) {
+                        return static_cast<const GridWFCSolver&>(solver).neighbor(cell, direction);
+                    },
+                    patterns, gen},
+      m_width{width}, m_height{height} {}
+
+int GridWFCSolver::solve() {
+    const int n = get_n_cells();
+    for (int c = 0; c < n; ++c)
+        if (domain_size(c) > 1)
+            step_wfc(c);
+
+    int empty = 0;
+    for (int c = 0; c < n; ++c)
+        empty += first_index(c) < 0;
+    return empty;
+}
+
+} // namespace wfc
@@ -0,0 +1,571 @@
+/**
+ * @file wfc_grid.hpp
+ * @brief WFC on a 2D grid with implicit topology
+ * @date 2023-06-09
+ *
+ */
+#ifndef WFC_GRID_HPP
+#define WFC_GRID_HPP
+
+#include <pcg/wfc.hpp>
+
+namespace wfc {
+
+/**
+ * @brief Directional tile adjacency, the constraint model of classic tile based WFC. Directions
+ *  are numbered by the solver topology, see GridWFCSolver and VoxelWFCSolver.
+ *
+ */
+class AdjacencyRules {
+public:
+    struct Rule {
+        int pattern_a;
+        int direction;
+        int pattern_b;
+    };
+
+    explicit AdjacencyRules(int n_directions) : m_n_directions{n_directions} {}
+
+    /**
+     * @brief let pattern_b be the neighbor of pattern_a in direction. The reverse, pattern_a in the
+     *  opposite direction of pattern_b, is implied.
+     *
+     * @param pattern_a pattern id
+     * @param direction
+     * @param pattern_b pattern id
+     */
+    void allow(int pattern_a, int direction, int pattern_b) {
+        assert(direction >= 0 && direction < m_n_directions);
+        m_rules.push_back(Rule{pattern_a, direction, pattern_b});
+    }
+
+    /**
+     * @brief allow pattern_a and pattern_b next to each other in every direction
+     *
+     * @param pattern_a
+     * @param pattern_b
+     */
+    void allow_all_directions(int pattern_a, int pattern_b) {
+        for (int d = 0; d < m_n_directions; ++d)
+            allow(pattern_a, d, pattern_b);
+    }
+
+    int get_n_directions() const noexcept {return m_n_directions;}
+    const std::vector<Rule>& rules() const noexcept {return m_rules;}
+
+private:
+    int m_n_directions = 0;
+    std::vector<Rule> m_rules{};
+};
+
+/**
+ * @brief Constraint checked by a CellWFCSolver.
+ *  Patterns matches Pattern requirements one-to-one with the neighborhood.
+ *  Adjacency uses AdjacencyRules: per pattern and direction a bitmask of the patterns allowed there,
+ *  and per cell, direction and pattern a count of the supporting patterns in that neighbor (AC-4).
+ *  A removal decrements the counts of the patterns it supported, found with a word-wise AND of
+ *  its mask and the neighbor domain, and removes the ones that reach zero.
+ *
+ */
+enum class CellConstraintModel {
+    Patterns = 0,
+    Adjacency
+};
+
+/**
+ * @brief Domains and constraint checks for WFC over cells identified by index, without node objects
+ *  or graph storage. Domains are bits over PatternTable dense indices, stored for all cells in one
+ *  contiguous word array. Besides the domain bits a cell only keeps a 4 byte visit stamp.
+ *  Subclasses define the topology, the neighbors of a cell are computed from its index.
+ *
+ *  Solves like WFCSolver in SolverDomainMode::Bitset, SolverPropagationMode::Revisit and
+ *  SolverValidMode::Correct: the same seed and visiting order give the same domains.
+ *
+ */
+class CellWFCSolver {
+public:
+    using word_t = DomainBits::word_t;
+
+    static constexpr int max_neighbors = 26;
+
+    /**
+     * @brief neighbor of cell in direction, -1 if there is none
+     *
+     */
+    using direction_neighbor_t = int (*)(const CellWFCSolver& solver, int cell, int direction);
+
+    /**
+     * @param n_cells
+     * @param opposite_directions opposite of every direction, the size is the most neighbors a cell can have
+     * @param direction_neighbor
+     * @param patterns
+     * @param gen
+     */
+    CellWFCSolver(int n_cells, std::vector<int> opposite_directions, direction_neighbor_t direction_neighbor,
+                  const PatternMap& patterns, std::mt19937& gen);
+
+    /**
+     * @brief switch to CellConstraintModel::Adjacency with rules. Rules for unknown pattern ids are ignored.
+     *
+     * @param rules must use the number of directions of the solver topology
+     */
+    void set_adjacency_rules(const AdjacencyRules& rules);
+
+    /**
+     * @brief go back to CellConstraintModel::Patterns
+     *
+     */
+    void clear_adjacency_rules();
+
+    CellConstraintModel get_constraint_model() const noexcept {return m_model;}
+
+    int get_n_directions() const noexcept {return (int)m_opposite.size();}
+
+    int opposite_direction(int direction) const noexcept {return m_opposite[direction];}
+
+    /**
+     * @brief check if dense pattern index b may be the neighbor of a in direction
+     *
+     */
+    bool adjacency_allowed(int a, int direction, int b) const noexcept {
+        assert(m_model == CellConstraintModel::Adjacency);
+        return (allowed(a, direction)[b / DomainBits::word_bits] >> (b % DomainBits::word_bits)) & 1u;
+    }
+
+    /**
+     * @brief put every pattern in the domain of every cell
+     *
+     */
+    void reset_domains();
+
+    /**
+     * @brief put values in the domain of every cell, values without a pattern are dropped
+     *
+     * @param values
+     */
+    void reset_domains(const std::vector<Val>& values);
+
+    /**
+     * @brief replace the domain of one cell
+     *
+     * @param cell
+     * @param values
+     */
+    void set_domain(int cell, const std::vector<Val>& values);
+
+    /**
+     * @brief collapse the cell to a single value, weighted random selection over its domain
+     *
+     * @param cell
+     */
+    void observe(int cell);
+
+    bool test(int cell, int pattern_index) const noexcept {
+        assert(pattern_index >= 0 && pattern_index < m_table.size());
+        return (domain(cell)[pattern_index / DomainBits::word_bits] >> (pattern_index % DomainBits::word_bits)) & 1u;
+    }
+
+    int domain_size(int cell) const noexcept {
+        int c = 0;
+        const word_t* w = domain(cell);
+        for (std::size_t i = 0; i < m_words_per_cell; ++i)
+            c += __builtin_popcountll(w[i]);
+        return c;
+    }
+
+    /**
+     * @brief sum of the weights in the domain, 0 for a solved cell
+     *
+     * @param cell
+     * @return float
+     */
+    float cell_entropy(int cell) const;
+
+    /**
+     * @brief values in the domain of cell, in dense index order
+     *
+     * @param cell
+     * @return std::vector<Val>
+     */
+    std::vector<Val> domain_values(int cell) const;
+
+    /**
+     * @brief dense index of the value of a solved cell
+     *
+     * @param cell
+     * @return int -1 if the cell does not have exactly one value
+     */
+    int solved_index(int cell) const noexcept {
+        return domain_size(cell) == 1 ? first_index(cell) : -1;
+    }
+
+    /**
+     * @brief remove a value from a cell domain, does not propagate
+     *
+     * @param cell
+     * @param value
+     * @return true if the value was in the domain
+     */
+    bool ban(int cell, Val value);
+
+    /**
+     * @brief call fn(index) for each set bit of the cell domain, in increasing index order
+     *
+     * @tparam Fn
+     * @param cell
+     * @param fn
+     */
+    template<typename Fn>
+    void for_each_set(int cell, Fn&& fn) const {
+        const word_t* words = domain(cell);
+        for (std::size_t i = 0; i < m_words_per_cell; ++i) {
+            word_t w = words[i];
+            while (w) {
+                fn((int)i * DomainBits::word_bits + __builtin_ctzll(w));
+                w &= w - 1;
+            }
+        }
+    }
+
+    /**
+     * @brief a frozen cell is never revised by CellConstraintModel::Patterns propagation, its domain
+     *  only changes when set or observed directly. For cells whose neighborhood is only partly
+     *  inside the solver, such as the outer ring of a chunk halo.
+     *
+     * @param cell
+     * @param frozen
+     */
+    void set_frozen(int cell, bool frozen) {
+        if (m_frozen.empty())
+            m_frozen.assign(m_visit_epoch.size(), 0);
+        m_frozen[cell] = frozen;
+    }
+
+    bool is_frozen(int cell) const noexcept {return !m_frozen.empty() && m_frozen[cell];}
+
+    std::size_t words_per_cell() const noexcept {return m_words_per_cell;}
+
+    const PatternTable& get_pattern_table() const noexcept {return m_table;}
+
+    /**
+     * @brief number of times a domain was emptied by this solver
+     *
+     * @return std::uint64_t
+     */
+    std::uint64_t get_contradiction_count() const noexcept {return m_contradictions;}
+
+    /**
+     * @brief bytes held per cell, domain words, visit stamps and adjacency supports
+     *
+     * @return std::size_t
+     */
+    std::size_t cell_bytes() const noexcept {
+        return (m_domains.capacity() * sizeof(word_t) + m_visit_epoch.capacity() * sizeof(std::uint32_t)
+            + m_support.capacity() * sizeof(std::uint16_t)) / m_visit_epoch.size();
+    }
+
+protected:
+    word_t* domain(int cell) noexcept {return m_domains.data() + (std::size_t)cell * m_words_per_cell;}
+    const word_t* domain(int cell) const noexcept {return m_domains.data() + (std::size_t)cell * m_words_per_cell;}
+
+    int first_index(int cell) const noexcept {
+        const word_t* w = domain(cell);
+        for (std::size_t i = 0; i < m_words_per_cell; ++i)
+            if (w[i])
+                return (int)i * DomainBits::word_bits + __builtin_ctzll(w[i]);
+        return -1;
+    }
+
+    /**
+     * @brief remove values of cell that no longer have a valid neighborhood
+     *
+     * @param cell
+     * @param adjacent neighbors of cell
+     * @param n_neighbors
+     * @return true if the domain changed
+     */
+    bool update_domain(int cell, const int* adjacent, int n_neighbors);
+
+    /**
+     * @brief remove values of cell that leave neighbor without a valid value. Revising neighbor
+     *  afterwards would only find out after cell is observed, this keeps cell from taking a value
+     *  its neighbor can not live with.
+     *
+     * @param cell
+     * @param neighbor
+     * @param adjacent neighbors of neighbor, cell among them
+     * @param n_neighbors
+     * @return true if the domain of cell changed
+     */
+    bool keep_supporting(int cell, int neighbor, const int* adjacent, int n_neighbors);
+
+    /**
+     * @brief CellConstraintModel::Adjacency update_domain, intersect the domain with the patterns
+     *  allowed by each neighbor. Removals are queued for propagate_removals().
+     *
+     * @param cell
+     * @return true if the domain changed
+     */
+    bool revise_adjacency(int cell);
+
+    /**
+     * @brief CellConstraintModel::Adjacency propagation, apply every queued removal to the support counts
+     *
+     */
+    void propagate_removals();
+
+    /**
+     * @brief revise cells outward from cell until domains stop changing. Each cell is revised
+     *  at most once per call and the first cell always passes the change on to its neighbors.
+     *
+     * @tparam Neighbors callable as neighbors(cell, int* out) -> number of neighbors written
+     * @param cell
+     * @param neighbors
+     */
+    template<typename Neighbors>
+    void propagate_from(int cell, Neighbors&& neighbors) {
+        const std::uint32_t epoch = next_visit_epoch();
+        m_propagation_queue.clear();
+        m_propagation_queue.push(cell);
+        mark_visited(cell, epoch);
+        bool f = true; // force propagation on the first cell
+
+        std::array<int, max_neighbors> adjacent;
+        while (!m_propagation_queue.empty()) {
+            const int c = m_propagation_queue.pop();
+            const int n = neighbors(c, adjacent.data());
+            if (f || (!is_frozen(c) && update_domain(c, adjacent.data(), n))) {
+                f = false;
+                // random visit order like BasicWFCSolver::propagate, same draws for the same neighbor order
+                std::shuffle(adjacent.begin(), adjacent.begin() + n, gen);
+                for (int j = 0; j < n; ++j)
+                    if (mark_visited(adjacent[j], epoch))
+                        m_propagation_queue.push(adjacent[j]);
+            }
+        }
+    }
+
+private:
+    void build_type_index();
+
+    const word_t* allowed(int i, int direction) const noexcept {
+        return m_allowed.data() + ((std::size_t)i * m_opposite.size() + direction) * m_words_per_cell;
+    }
+
+    std::uint16_t& support(int cell, int direction, int i) noexcept {
+        return m_support[((std::size_t)cell * m_opposite.size() + direction) * m_table.size() + i];
+    }
+
+    /**
+     * @brief count the supports of every cell from the current domains, if they are not up to date.
+     *  Values without support are removed.
+     *
+     */
+    void ensure_supports();
+
+    /**
+     * @brief clear a value of cell, queued for propagate_removals() in CellConstraintModel::Adjacency
+     *
+     * @param cell
+     * @param i dense pattern index
+     */
+    void remove_value(int cell, int i);
+
+    /**
+     * @brief required types each neighbor can supply, into m_supply
+     *
+     * @param adjacent
+     * @param n_neighbors
+     */
+    void load_supply(const int* adjacent, int n_neighbors);
+
+    /**
+     * @brief check if the requirements of pattern i can be matched one-to-one with the neighbors
+     *  in m_supply. Neighborhoods have at most 32 cells, so the matching runs on neighbor bitmasks.
+     *
+     * @param i dense pattern index
+     * @param n_neighbors
+     * @return true
+     * @return false
+     */
+    bool valid(int i, int n_neighbors) const;
+
+    bool supplies(int j, int t) const noexcept {
+        return (m_supply[j * m_type_words + t / DomainBits::word_bits] >> (t % DomainBits::word_bits)) & 1u;
+    }
+
+    int weighted_pick_index(int cell);
+
+    int pick_cumulative(float total);
+
+    std::uint32_t next_visit_epoch() noexcept {
+        if (++m_epoch == 0) {
+            std::fill(m_visit_epoch.begin(), m_visit_epoch.end(), 0);
+            m_epoch = 1;
+        }
+        return m_epoch;
+    }
+
+    bool mark_visited(int cell, std::uint32_t epoch) noexcept {
+        if (m_visit_epoch[cell] == epoch)
+            return false;
+        m_visit_epoch[cell] = epoch;
+        return true;
+    }
+
+private:
+    std::mt19937& gen;
+
+    PatternTable m_table{};
+    std::size_t m_words_per_cell = 0;
+    std::vector<word_t> m_domains{};            // m_words_per_cell words per cell
+
+    // required types, dense index is the bit in m_supply
+    std::vector<int> m_type_ids{};
+    std::size_t m_type_words = 0;
+    std::vector<int> m_pattern_dtype{};         // dense pattern index -> dense type, -1 if never required
+    std::vector<int> m_req_offsets{};           // requirements of pattern i are m_req_dtypes[m_req_offsets[i], m_req_offsets[i + 1])
+    std::vector<int> m_req_dtypes{};
+    std::vector<word_t> m_supply{};             // m_type_words words per neighbor
+
+    std::vector<std::uint32_t> m_visit_epoch{};
+    std::vector<std::uint8_t> m_frozen{};       // empty until a cell is frozen
+    std::uint32_t m_epoch = 0;
+    RingQueue<int> m_propagation_queue{};
+
+    // CellConstraintModel::Adjacency
+    struct Removal {
+        int cell;
+        int index;
+    };
+
+    CellConstraintModel m_model = CellConstraintModel::Patterns;
+    std::vector<int> m_opposite{};
+    direction_neighbor_t m_direction_neighbor = nullptr;
+    std::vector<word_t> m_allowed{};            // per pattern and direction, patterns allowed as that neighbor
+    std::vector<std::uint16_t> m_support{};     // per cell, direction and pattern, supporting values of that neighbor
+    bool m_supports_ready = false;
+    RingQueue<Removal> m_removals{};
+
+    std::vector<word_t> m_keep{};
+    std::vector<word_t> m_union{};
+    std::vector<int> m_pick_indices{};
+    std::vector<float> m_pick_cumulative{};
+
+    std::uint64_t m_contradictions = 0;
+};
+
+/**
+ * @brief WFC over a width x height grid. Cell (row, column) has index row * width + column and
+ *  its neighbors are listed left, up, right, down like GridGraph. Directions for AdjacencyRules
+ *  are numbered in the same order, Left = 0 to Down = 3.
+ *
+ */
+class GridWFCSolver : public CellWFCSolver {
+public:
+    enum Direction {
+        Left = 0,
+        Up,
+        Right,
+        Down
+    };
+
+    static constexpr int n_directions = 4;
+
+    GridWFCSolver(int width, int height, const PatternMap& patterns, std::mt19937& gen);
+
+    void step_wfc(int cell) {
+        observe(cell);
+        propagate(cell);
+    }
+
+    void propagate(int cell) {
+        if (get_constraint_model() == CellConstraintModel::Adjacency)
+            propagate_removals();
+        else
+            propagate_from(cell, [this](int c, int* out) {return neighbors(c, out);});
+    }
+
+    bool update_domain(int cell) {
+        if (get_constraint_model() == CellConstraintModel::Adjacency)
+            return revise_adjacency(cell);
+        std::array<int, 4> adjacent;
+        return CellWFCSolver::update_domain(cell, adjacent.data(), neighbors(cell, adjacent.data()));
+    }
+
+    /**
+     * @brief remove values of cell under which neighbor has no valid value, for a neighbor that
+     *  must keep its domain such as a fixed boundary cell. Adjacency rules hold both ways, in
+     *  CellConstraintModel::Adjacency this is a revision of cell.
+     *
+     * @param cell
+     * @param neighbor
+     * @return true if the domain of cell changed
+     */
+    bool keep_supporting(int cell, int neighbor) {
+        if (get_constraint_model() == CellConstraintModel::Adjacency)
+            return revise_adjacency(cell);
+        std::array<int, 4> adjacent;
+        return CellWFCSolver::keep_supporting(cell, neighbor, adjacent.data(), neighbors(neighbor, adjacent.data()));
+    }
+
+    /**
+     * @brief observe and propagate every unsolved cell in index order
+     *
+     * @return int number of cells left with an empty domain
+     */
+    int solve();
+
+    int cell(int row, int column) const noexcept {
+        assert(row >= 0 && row < m_height && column >= 0 && column < m_width);
+        return row * m_width + column;
+    }
+
+    /**
+     * @brief neighbors of cell, left, up, right, down, skipping the ones outside the grid
+     *
+     * @param cell
+     * @param out room for 4 cells
+     * @return int number of neighbors written
+     */
+    int neighbors(int cell, int* out) const noexcept {
+        const int row = cell / m_width;
+        const int column = cell - row * m_width;
+        int n = 0;
+        if (column > 0) out[n++] = cell - 1;
+        if (row > 0) out[n++] = cell - m_width;
+        if (column + 1 < m_width) out[n++] = cell + 1;
+        if (row + 1 < m_height) out[n++] = cell + m_width;
+        return n;
+    }
+
+    /**
+     * @brief neighbor of cell in direction
+     *
+     * @param cell
+     * @param direction
+     * @return int -1 outside the grid
+     */
+    int neighbor(int cell, int direction) const noexcept {
+        const int row = cell / m_width;
+        const int column = cell - row * m_width;
+        switch (direction) {
+            case Left: return column > 0 ? cell - 1 : -1;
+            case Up: return row > 0 ? cell - m_width : -1;
+            case Right: return column + 1 < m_width ? cell + 1 : -1;
+            case Down: return row + 1 < m_height ? cell + m_width : -1;
+        }
+        return -1;
+    }
+
+    int get_width() const noexcept {return m_width;}
+    int get_height() const noexcept {return m_height;}
+    int get_n_cells() const noexcept {return m_width * m_height;}
+
+private:
+    int m_width = 0, m_height = 0;
+};
+
+} // namespace wfc
+
+#endif // WFC_GRID_HPP
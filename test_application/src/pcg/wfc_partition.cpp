@@ -0,0 +1,104 @@
+#include <pcg/wfc_partition.hpp>
+
+#include <numeric>
+
+namespace wfc {
+
+using PartSolver = BasicWFCSolver<CSRGraph<DGraphNode>>;
+
+static std::uint32_t part_seed(std::uint64_t seed, int part) noexcept {
+    return (std::uint32_t)ev2::mix64(seed ^ ev2::mix64((std::uint64_t)part + 1));
+}
+
+PartitionedSolveStats wfc_solve_partitioned(CSRGraph<DGraphNode>& graph, std::shared_ptr<const PatternTable> patterns,
+                                            std::uint64_t seed, ThreadPool& pool, const PartitionedSolveArgs& args) {
+    const GraphPartition partition = partition_graph(graph, args.max_part_nodes);
+    const int n_parts = partition.get_n_parts();
+
+    PartitionedSolveStats stats{};
+    stats.n_components = partition.n_components;
+    stats.n_parts = n_parts;
+
+    // halo first, over the whole graph
+    std::mt19937 gen{(std::uint32_t)ev2::mix64(seed)};
+    PartSolver solver{&graph, patterns, gen, args.constraint_prop_solved, args.validity_mode, args.domain_mode};
+
+    // nodes solved before the call are kept as they are, reconciling only resets open ones, back
+    // to the domain they started with
+    std::vector<std::uint8_t> open(graph.get_n_nodes());
+    std::vector<int> start_offsets(graph.get_n_nodes() + 1, 0);
+    std::vector<Val> start_values{};
+    for (int i = 0; i < graph.get_n_nodes(); ++i) {
+        const DGraphNode* node = graph.node(i);
+        open[i] = solver.domain_size(node) > 1;
+        if (open[i])
+            start_values.insert(start_values.end(), node->domain.begin(), node->domain.end());
+        start_offsets[i + 1] = (int)start_values.size();
+    }
+
+    for (int i : partition.part_nodes) {
+        if (!partition.halo[i])
+            continue;
+        ++stats.n_halo_nodes;
+        DGraphNode* node = graph.node(i);
+        if (solver.domain_size(node) > 1)
+            solver.step_wfc(node);
+    }
+
+    // largest parts first, so the pool does not wait on one big part at the end
+    std::vector<int> order(n_parts);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&partition](int a, int b) {
+        const std::size_t size_a = partition.nodes(a).size(), size_b = partition.nodes(b).size();
+        return size_a != size_b ? size_a > size_b : a < b;
+    });
+
+    struct Worker {
+        std::mt19937 gen{};
+        std::unique_ptr<PartSolver> solver{};
+    };
+    std::vector<std::unique_ptr<Worker>> workers(pool.size());
+    for (auto& worker : workers) {
+        worker = std::make_unique<Worker>();
+        worker->solver = std::make_unique<PartSolver>(&graph, patterns, worker->gen, false, args.validity_mode, args.domain_mode);
+    }
+
+    pool.parallel_for(order.size(), [&](std::size_t begin, std::size_t end, unsigned thread_index) {
+        Worker& worker = *workers[thread_index];
+        for (std::size_t k = begin; k < end; ++k) {
+            const int part = order[k];
+            worker.gen.seed(part_seed(seed, part));
+            for (int i : partition.nodes(part)) {
+                DGraphNode* node = graph.node(i);
+                if (!partition.halo[i] && worker.solver->domain_size(node) > 1)
+                    worker.solver->step_wfc(node);
+            }
+        }
+    }, 1);
+
+    // reconcile, parts did not revise the halo nodes they rely on
+    std::vector<int> reset{};
+    for (int i : partition.part_nodes) {
+        DGraphNode* node = graph.node(i);
+        if (!partition.halo[i] || !open[i] || solver.domain_size(node) != 1 || !solver.update_domain(node))
+            continue;
+        ++stats.n_conflicts;
+        reset.assign(1, i);
+        for (int j : graph.neighbors(i))
+            if (open[j])
+                reset.push_back(j);
+        for (int j : reset)
+            graph.node(j)->set_domain({start_values.begin() + start_offsets[j], start_values.begin() + start_offsets[j + 1]});
+        for (int j : reset)
+            solver.update_domain(graph.node(j));
+        for (int j : reset)
+            if (solver.domain_size(graph.node(j)) > 1)
+                solver.step_wfc(graph.node(j));
+    }
+
+    for (int i = 0; i < graph.get_n_nodes(); ++i)
+        stats.n_empty += graph.node(i)->domain.empty();
+    return stats;
+}
+
+} // namespace wfc
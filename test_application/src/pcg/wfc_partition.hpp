@@ -0,0 +1,158 @@
+/**
+ * @file wfc_partition.hpp
+ * @brief connected components, graph partitions and WFC solving of the parts in parallel
+ * @date 2023-06-13
+ *
+ */
+#ifndef WFC_PARTITION_HPP
+#define WFC_PARTITION_HPP
+
+#include <pcg/wfc.hpp>
+
+namespace wfc {
+
+/**
+ * @brief Nodes of a CSRGraph split into parts of at most max_part_nodes nodes. A part never spans
+ *  two connected components. Larger components are cut into slices of a breadth first order from
+ *  a pseudo-peripheral node, so slices are bands with short boundaries on mesh like graphs.
+ *  Nodes are node indices of the CSRGraph.
+ *
+ *  A halo node has a neighbor in another part. Nodes of different parts are only adjacent through
+ *  halo nodes, once the halo is solved the rest of each part can be solved on its own.
+ *
+ */
+struct GraphPartition {
+    std::vector<int> part_of{};         // part of each node
+    std::vector<std::uint8_t> halo{};   // 1 for halo nodes
+    std::vector<int> part_offsets{};    // nodes of part p are part_nodes[part_offsets[p], part_offsets[p + 1])
+    std::vector<int> part_nodes{};      // in breadth first order within a part
+    std::vector<int> part_component{};  // connected component of each part
+    int n_components = 0;
+
+    int get_n_parts() const noexcept {return (int)part_offsets.size() - 1;}
+
+    Span<const int> nodes(int part) const noexcept {
+        return {part_nodes.data() + part_offsets[part], (std::size_t)(part_offsets[part + 1] - part_offsets[part])};
+    }
+};
+
+/**
+ * @brief connected components of graph, split into parts of at most max_part_nodes nodes
+ *
+ * @tparam T
+ * @param graph undirected
+ * @param max_part_nodes
+ * @return GraphPartition
+ */
+template<typename T>
+GraphPartition partition_graph(const CSRGraph<T>& graph, int max_part_nodes) {
+    if (graph.is_directed())
+        throw std::logic_error("partition_graph requires an undirected graph");
+    if (max_part_nodes <= 0)
+        throw std::logic_error("partition_graph invalid part size");
+
+    const int n = graph.get_n_nodes();
+    GraphPartition partition{};
+    partition.part_of.assign(n, -1);
+    partition.halo.assign(n, 0);
+    partition.part_nodes.reserve(n);
+    partition.part_offsets.push_back(0);
+
+    // breadth first order of the component of start, appended to order. seen[i] == stamp marks visited
+    std::vector<int> seen(n, -1);
+    auto bfs = [&graph, &seen](int start, int stamp, std::vector<int>& order) {
+        const std::size_t begin = order.size();
+        seen[start] = stamp;
+        order.push_back(start);
+        for (std::size_t head = begin; head < order.size(); ++head)
+            for (int j : graph.neighbors(order[head]))
+                if (seen[j] != stamp) {
+                    seen[j] = stamp;
+                    order.push_back(j);
+                }
+    };
+
+    std::vector<int> component{};
+    for (int s = 0; s < n; ++s) {
+        if (seen[s] >= 0)
+            continue;
+        const int c = partition.n_components++;
+        component.clear();
+        bfs(s, 2 * c, component);
+
+        const int size = (int)component.size();
+        const int n_parts = (size + max_part_nodes - 1) / max_part_nodes;
+        if (n_parts > 1) {
+            // the last node reached is far from s, a search from it gives thin level sets
+            const int start = component.back();
+            component.clear();
+            bfs(start, 2 * c + 1, component);
+        }
+
+        for (int k = 0; k < n_parts; ++k) {
+            const int part = partition.get_n_parts();
+            const int begin = (int)((std::int64_t)size * k / n_parts), end = (int)((std::int64_t)size * (k + 1) / n_parts);
+            for (int i = begin; i < end; ++i) {
+                partition.part_of[component[i]] = part;
+                partition.part_nodes.push_back(component[i]);
+            }
+            partition.part_offsets.push_back((int)partition.part_nodes.size());
+            partition.part_component.push_back(c);
+        }
+    }
+
+    for (int i = 0; i < n; ++i)
+        for (int j : graph.neighbors(i))
+            if (partition.part_of[j] != partition.part_of[i]) {
+                partition.halo[i] = 1;
+                break;
+            }
+    return partition;
+}
+
+struct PartitionedSolveArgs {
+    int max_part_nodes = 4096;
+    SolverValidMode validity_mode = SolverValidMode::Correct;
+    SolverDomainMode domain_mode = SolverDomainMode::Bitset;
+    bool constraint_prop_solved = true;     // for the sequential halo and reconcile passes
+};
+
+struct PartitionedSolveStats {
+    int n_components = 0;
+    int n_parts = 0;
+    int n_halo_nodes = 0;
+    int n_conflicts = 0;        // halo nodes invalid after the parts were solved, re-solved with their neighbors
+    int n_empty = 0;            // nodes left with an empty domain
+};
+
+/**
+ * @brief Solve every unsolved node of graph, the parts of a partition_graph() partition in parallel.
+ *
+ *  1. Halo nodes are solved in part order with one solver over the whole graph.
+ *  2. Parts are solved on the pool, one solver per thread, nodes in breadth first order. Solved
+ *     nodes are not revisited in this pass, so propagation stops at the halo and never leaves a part.
+ *  3. Halo nodes are checked again in part order. An invalid halo node and its neighbors get back the
+ *     domain they had before the call and are solved again sequentially. Nodes that were solved
+ *     before the call are never reset, they only constrain the nodes around them.
+ *
+ *  Each part draws from its own generator seeded from seed and the part index, the result does not
+ *  depend on the number of threads.
+ *
+ * @param graph
+ * @param patterns shared by the solvers of every thread
+ * @param seed
+ * @param pool
+ * @param args
+ * @return PartitionedSolveStats
+ */
+PartitionedSolveStats wfc_solve_partitioned(CSRGraph<DGraphNode>& graph, std::shared_ptr<const PatternTable> patterns,
+                                            std::uint64_t seed, ThreadPool& pool, const PartitionedSolveArgs& args = {});
+
+inline PartitionedSolveStats wfc_solve_partitioned(CSRGraph<DGraphNode>& graph, const PatternMap& patterns, std::uint64_t seed,
+                                                   ThreadPool& pool, const PartitionedSolveArgs& args = {}) {
+    return wfc_solve_partitioned(graph, std::make_shared<const PatternTable>(patterns), seed, pool, args);
+}
+
+} // namespace wfc
+
+#endif // WFC_PARTITION_HPP
@@ -0,0 +1,97 @@
+#include <pcg/wfc_voxel.hpp>
+
+namespace wfc {
+
+static int n_bricks(int size) noexcept {
+    return (size + VoxelWFCSolver::brick_size - 1) / VoxelWFCSolver::brick_size;
+}
+
+static int stored_cells(int size_x, int size_y, int size_z) {
+    if (size_x <= 0 || size_y <= 0 || size_z <= 0)
+        throw std::logic_error("VoxelWFCSolver::VoxelWFCSolver invalid size argument");
+    const std::int64_t n = (std::int64_t)n_bricks(size_x) * n_bricks(size_y) * n_bricks(size_z) * VoxelWFCSolver::brick_cells;
+    if (n > std::numeric_limits<int>::max())
+        throw std::logic_error("VoxelWFCSolver::VoxelWFCSolver grid too large");
+    return (int)n;
+}
+
+static std::vector<int> opposite_directions(VoxelNeighborhood neighborhood) {
+    std::vector<int> opposite((int)neighborhood);
+    for (int d = 0; d < (int)opposite.size(); ++d)
+        opposite[d] = neighborhood == VoxelNeighborhood::Faces ? d ^ 1 : 25 - d;
+    return opposite;
+}
+
+VoxelWFCSolver::VoxelWFCSolver(int size_x, int size_y, int size_z, VoxelNeighborhood neighborhood,
+                               const PatternMap& patterns, std::mt19937& gen)
+    : CellWFCSolver{stored_cells(size_x, size_y, size_z), opposite_directions(neighborhood),
+                    [](const CellWFCSolver& solver, int cell, int direction) {
+                        return static_cast<const VoxelWFCSolver&>(solver).neighbor(cell, direction);
+                    },
+                    patterns, gen},
+      m_size{size_x, size_y, size_z},
+      m_bricks{n_bricks(size_x), n_bricks(size_y), n_bricks(size_z)},
+      m_neighborhood{neighborhood} {}
+
+int VoxelWFCSolver::neighbors(int cell, int* out) const noexcept {
+    const auto p = position(cell);
+    int n = 0;
+    if (m_neighborhood == VoxelNeighborhood::Faces) {
+        for (int axis = 0; axis < 3; ++axis) {
+            auto q = p;
+            if (p[axis] > 0) {
+                --q[axis];
+                out[n++] = this->cell(q[0], q[1], q[2]);
+            }
+            q = p;
+            if (p[axis] + 1 < m_size[axis]) {
+                ++q[axis];
+                out[n++] = this->cell(q[0], q[1], q[2]);
+            }
+        }
+        return n;
+    }
+
+    const int x0 = std::max(p[0] - 1, 0), x1 = std::min(p[0] + 1, m_size[0] - 1);
+    const int y0 = std::max(p[1] - 1, 0), y1 = std::min(p[1] + 1, m_size[1] - 1);
+    const int z0 = std::max(p[2] - 1, 0), z1 = std::min(p[2] + 1, m_size[2] - 1);
+    for (int z = z0; z <= z1; ++z)
+        for (int y = y0; y <= y1; ++y)
+            for (int x = x0; x <= x1; ++x)
+                if (x != p[0] || y != p[1] || z != p[2])
+                    out[n++] = this->cell(x, y, z);
+    return n;
+}
+
+int VoxelWFCSolver::neighbor(int cell, int direction) const noexcept {
+    auto p = position(cell);
+    if (p[0] >= m_size[0] || p[1] >= m_size[1] || p[2] >= m_size[2])
+        return -1;
+
+    if (m_neighborhood == VoxelNeighborhood::Faces) {
+        p[direction >> 1] += direction & 1 ? 1 : -1;
+    } else {
+        const int k = direction < 13 ? direction : direction + 1; // skip the center offset
+        p[0] += k % 3 - 1;
+        p[1] += k / 3 % 3 - 1;
+        p[2] += k / 9 - 1;
+    }
+    for (int axis = 0; axis < 3; ++axis)
+        if (p[axis] < 0 || p[axis] >= m_size[axis])
+            return -1;
+    return this->cell(p[0], p[1], p[2]);
+}
+
+int VoxelWFCSolver::solve() {
+    const int n = get_n_stored_cells();
+    for (int c = 0; c < n; ++c)
+        if (contains(c) && domain_size(c) > 1)
+            step_wfc(c);
+
+    int empty = 0;
+    for (int c = 0; c < n; ++c)
+        empty += contains(c) && first_index(c) < 0;
+    return empty;
+}
+
+} // namespace wfc
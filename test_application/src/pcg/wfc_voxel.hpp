@@ -0,0 +1,152 @@
+/**
+ * @file wfc_voxel.hpp
+ * @brief WFC on a 3D voxel grid with Morton ordered storage
+ * @date 2023-06-10
+ *
+ */
+#ifndef WFC_VOXEL_HPP
+#define WFC_VOXEL_HPP
+
+#include <pcg/wfc_grid.hpp>
+
+namespace wfc {
+
+enum class VoxelNeighborhood {
+    Faces = 6,      // cells sharing a face
+    Full = 26       // cells sharing a face, edge or corner
+};
+
+/**
+ * @brief WFC over a size_x x size_y x size_z voxel grid. Cells are stored in 8x8x8 bricks, Morton
+ *  (Z-order) ordered inside a brick and bricks in x, y, z order, so cells close in space are close
+ *  in memory and a propagation wave mostly touches a few bricks. Sizes are padded up to whole
+ *  bricks, padding cells are never visited.
+ *
+ *  Constraints are Pattern requirements matched one-to-one with the neighborhood, like every other
+ *  solver, or AdjacencyRules. Face neighbors are listed -x, +x, -y, +y, -z, +z. The full neighborhood
+ *  is listed in z, y, x order of the offsets. Directions are numbered in the same order, so the
+ *  opposite of direction d is d ^ 1 for faces and 25 - d for the full neighborhood.
+ *
+ */
+class VoxelWFCSolver : public CellWFCSolver {
+public:
+    static constexpr int brick_bits = 3;
+    static constexpr int brick_size = 1 << brick_bits;
+    static constexpr int brick_cells = brick_size * brick_size * brick_size;
+
+    VoxelWFCSolver(int size_x, int size_y, int size_z, VoxelNeighborhood neighborhood,
+                   const PatternMap& patterns, std::mt19937& gen);
+
+    void step_wfc(int cell) {
+        observe(cell);
+        propagate(cell);
+    }
+
+    void propagate(int cell) {
+        if (get_constraint_model() == CellConstraintModel::Adjacency)
+            propagate_removals();
+        else
+            propagate_from(cell, [this](int c, int* out) {return neighbors(c, out);});
+    }
+
+    bool update_domain(int cell) {
+        if (get_constraint_model() == CellConstraintModel::Adjacency)
+            return revise_adjacency(cell);
+        std::array<int, max_neighbors> adjacent;
+        return CellWFCSolver::update_domain(cell, adjacent.data(), neighbors(cell, adjacent.data()));
+    }
+
+    /**
+     * @brief observe and propagate every unsolved cell in storage order
+     *
+     * @return int number of cells left with an empty domain
+     */
+    int solve();
+
+    /**
+     * @brief storage index of the cell at (x, y, z)
+     *
+     */
+    int cell(int x, int y, int z) const noexcept {
+        assert(x >= 0 && x < m_size[0] && y >= 0 && y < m_size[1] && z >= 0 && z < m_size[2]);
+        const int brick = ((z >> brick_bits) * m_bricks[1] + (y >> brick_bits)) * m_bricks[0] + (x >> brick_bits);
+        return brick * brick_cells
+            + (s_spread[x & (brick_size - 1)] | s_spread[y & (brick_size - 1)] << 1 | s_spread[z & (brick_size - 1)] << 2);
+    }
+
+    /**
+     * @brief (x, y, z) of a storage index
+     *
+     * @param cell
+     * @return std::array<int, 3>
+     */
+    std::array<int, 3> position(int cell) const noexcept {
+        const int brick = cell >> (3 * brick_bits);
+        const int local = cell & (brick_cells - 1);
+        const int bx = brick % m_bricks[0];
+        const int by = (brick / m_bricks[0]) % m_bricks[1];
+        const int bz = brick / (m_bricks[0] * m_bricks[1]);
+        return {bx << brick_bits | compact(local), by << brick_bits | compact(local >> 1), bz << brick_bits | compact(local >> 2)};
+    }
+
+    /**
+     * @brief check if a storage index is a cell of the grid and not padding
+     *
+     * @param cell
+     */
+    bool contains(int cell) const noexcept {
+        const auto p = position(cell);
+        return p[0] < m_size[0] && p[1] < m_size[1] && p[2] < m_size[2];
+    }
+
+    /**
+     * @brief neighbors of cell inside the grid, see the class description for the order
+     *
+     * @param cell
+     * @param out room for the neighborhood size
+     * @return int number of neighbors written
+     */
+    int neighbors(int cell, int* out) const noexcept;
+
+    /**
+     * @brief neighbor of cell in direction
+     *
+     * @param cell
+     * @param direction
+     * @return int -1 outside the grid, or if cell is padding
+     */
+    int neighbor(int cell, int direction) const noexcept;
+
+    VoxelNeighborhood get_neighborhood() const noexcept {return m_neighborhood;}
+    const std::array<int, 3>& get_size() const noexcept {return m_size;}
+
+    /**
+     * @brief cells inside the grid
+     *
+     * @return int
+     */
+    int get_n_cells() const noexcept {return m_size[0] * m_size[1] * m_size[2];}
+
+    /**
+     * @brief cells in storage, including padding
+     *
+     * @return int
+     */
+    int get_n_stored_cells() const noexcept {return m_bricks[0] * m_bricks[1] * m_bricks[2] * brick_cells;}
+
+private:
+    // bits of a brick coordinate moved to every third bit
+    static constexpr int s_spread[brick_size] = {0x000, 0x001, 0x008, 0x009, 0x040, 0x041, 0x048, 0x049};
+
+    static int compact(int bits) noexcept {
+        return (bits & 1) | (bits >> 2 & 2) | (bits >> 4 & 4);
+    }
+
+    std::array<int, 3> m_size{};
+    std::array<int, 3> m_bricks{};
+    VoxelNeighborhood m_neighborhood = VoxelNeighborhood::Faces;
+};
+
+} // namespace wfc
+
+#endif // WFC_VOXEL_HPP
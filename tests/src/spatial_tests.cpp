@@ -0,0 +1,593 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "pcg/aabb_tree.hpp"
+#include "pcg/repulsion.hpp"
+#include "pcg/spatial_hash.hpp"
+#include "timer.hpp"
+
+#define ENABLE_TESTS
+#define ENABLE_PERF
+
+using namespace ev2::pcg;
+
+struct TestSphere {
+    glm::vec3 center{};
+    float radius = 0.f;
+};
+
+static bool spheres_intersect(const TestSphere& a, const TestSphere& b) {
+    return glm::length(a.center - b.center) < a.radius + b.radius;
+}
+
+static glm::vec3 exact_repulsion(const std::vector<TestSphere>& spheres, const TestSphere& s, float cutoff = 1e30f) {
+    glm::vec3 net{};
+    for (const auto& c : spheres)
+        if (glm::length(c.center - s.center) < cutoff)
+            net += repulsion_term(s.center, s.radius, c.center, c.radius);
+    return net;
+}
+
+#ifdef ENABLE_TESTS
+
+std::set<int> brute_intersecting(const std::map<int, TestSphere>& spheres, const TestSphere& query) {
+    std::set<int> out{};
+    for (const auto& [id, s] : spheres)
+        if (spheres_intersect(s, query))
+            out.insert(id);
+    return out;
+}
+
+std::set<int> brute_within(const std::map<int, TestSphere>& spheres, const TestSphere& query) {
+    std::set<int> out{};
+    for (const auto& [id, s] : spheres)
+        if (glm::length(s.center - query.center) < query.radius)
+            out.insert(id);
+    return out;
+}
+
+void spatial_hash_matches_brute_force() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 gen{3};
+    std::uniform_real_distribution<float> coord{-25.f, 25.f};
+    std::uniform_real_distribution<float> radius{0.2f, 1.5f};
+    std::uniform_real_distribution<float> step{-1.f, 1.f};
+    auto random_sphere = [&]() {return TestSphere{{coord(gen), coord(gen), coord(gen)}, radius(gen)};};
+
+    SpatialHash<int> hash{2.f};
+    std::map<int, TestSphere> spheres{};
+    for (int id = 0; id < 2000; ++id) {
+        spheres[id] = random_sphere();
+        hash.update(id, spheres[id].center, spheres[id].radius);
+    }
+    assert(hash.size() == spheres.size());
+
+    auto check_queries = [&]() {
+        for (int q = 0; q < 50; ++q) {
+            const TestSphere query = random_sphere();
+            std::set<int> found{};
+            hash.for_each_intersecting(query.center, query.radius * 3.f, [&found](int id) {
+                assert(found.insert(id).second); // every item is reported once
+            });
+            assert(found == brute_intersecting(spheres, TestSphere{query.center, query.radius * 3.f}));
+
+            found.clear();
+            hash.for_each_within(query.center, query.radius * 2.f, [&found](int id) {found.insert(id);});
+            assert(found == brute_within(spheres, TestSphere{query.center, query.radius * 2.f}));
+        }
+    };
+    check_queries();
+
+    // small moves mostly stay in the cell, teleports change cells, removes and reinserts
+    for (int round = 0; round < 2000; ++round) {
+        const int id = (int)(gen() % 2500);
+        const int op = (int)(gen() % 4);
+        auto itr = spheres.find(id);
+        if (op == 0 && itr != spheres.end()) {
+            assert(hash.remove(id));
+            spheres.erase(itr);
+        } else if (op == 1 && itr != spheres.end()) {
+            itr->second.center += glm::vec3{step(gen), step(gen), step(gen)} * 0.1f;
+            hash.update(id, itr->second.center, itr->second.radius);
+        } else {
+            spheres[id] = random_sphere();
+            hash.update(id, spheres[id].center, spheres[id].radius);
+        }
+        assert(hash.contains(id) == (spheres.count(id) == 1));
+    }
+    assert(hash.size() == spheres.size());
+    check_queries();
+
+    // a different cell size gives the same answers
+    hash.set_cell_size(0.5f);
+    check_queries();
+
+    // a query reaching over the whole scene scans every item
+    std::set<int> all{};
+    hash.for_each_within(glm::vec3{0.f}, 1e30f, [&all](int id) {all.insert(id);});
+    assert(all.size() == spheres.size());
+
+    for (const auto& [id, s] : spheres)
+        assert(hash.remove(id));
+    assert(hash.size() == 0);
+    assert(hash.cell_count() == 0);
+}
+
+void spatial_hash_pointer_items() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::vector<TestSphere> spheres{{{0.f, 0.f, 0.f}, 1.f}, {{1.5f, 0.f, 0.f}, 1.f}, {{10.f, 0.f, 0.f}, 1.f}};
+    SpatialHash<const TestSphere*> hash{2.f};
+    for (const auto& s : spheres)
+        hash.update(&s, s.center, s.radius);
+
+    std::vector<const TestSphere*> found{};
+    hash.for_each_intersecting(glm::vec3{0.f}, 1.f, [&found](const TestSphere* s) {found.push_back(s);});
+    std::sort(found.begin(), found.end());
+    assert((found == std::vector<const TestSphere*>{&spheres[0], &spheres[1]}));
+
+    // moving an item next to the query picks it up, the old cell no longer reports it
+    spheres[2].center = glm::vec3{0.f, 1.5f, 0.f};
+    hash.update(&spheres[2], spheres[2].center, spheres[2].radius);
+    found.clear();
+    hash.for_each_intersecting(glm::vec3{0.f}, 1.f, [&found](const TestSphere* s) {found.push_back(s);});
+    assert(found.size() == 3);
+    found.clear();
+    hash.for_each_intersecting(glm::vec3{10.f, 0.f, 0.f}, 1.f, [&found](const TestSphere* s) {found.push_back(s);});
+    assert(found.empty());
+}
+
+std::vector<float> brute_nearest_distances(const std::map<int, TestSphere>& spheres, const glm::vec3& p, int k) {
+    std::vector<float> d{};
+    for (const auto& [id, s] : spheres)
+        d.push_back(glm::length(s.center - p));
+    std::sort(d.begin(), d.end());
+    d.resize(std::min<std::size_t>(d.size(), k));
+    return d;
+}
+
+void aabb_tree_matches_brute_force() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 gen{5};
+    std::uniform_real_distribution<float> coord{-25.f, 25.f};
+    std::uniform_real_distribution<float> radius{0.05f, 3.f};
+    std::uniform_real_distribution<float> step{-1.f, 1.f};
+    auto random_sphere = [&]() {return TestSphere{{coord(gen), coord(gen), coord(gen)}, radius(gen)};};
+
+    AABBTree<int> tree{};
+    std::map<int, TestSphere> spheres{};
+    for (int id = 0; id < 2000; ++id) {
+        spheres[id] = random_sphere();
+        tree.update(id, spheres[id].center, spheres[id].radius);
+    }
+    assert(tree.size() == spheres.size());
+
+    auto check_queries = [&]() {
+        for (int q = 0; q < 50; ++q) {
+            const TestSphere query = random_sphere();
+            std::set<int> found{};
+            tree.for_each_intersecting(query.center, query.radius, [&found](int id) {
+                assert(found.insert(id).second); // every item is reported once
+            });
+            const auto expected = brute_intersecting(spheres, query);
+            assert(found == expected);
+
+            // stops at an item matching the predicate, or finds none
+            const bool any_odd = tree.any_intersecting(query.center, query.radius, [](int id) {return id % 2 == 1;});
+            assert(any_odd == std::any_of(expected.begin(), expected.end(), [](int id) {return id % 2 == 1;}));
+
+            found.clear();
+            tree.for_each_within(query.center, query.radius * 2.f, [&found](int id) {found.insert(id);});
+            assert(found == brute_within(spheres, TestSphere{query.center, query.radius * 2.f}));
+
+            // ties between equal distances may pick either item, compare the distances
+            std::vector<int> nearest{};
+            tree.k_nearest(query.center, 7, nearest);
+            std::vector<float> d{};
+            for (int id : nearest)
+                d.push_back(glm::length(spheres.at(id).center - query.center));
+            assert(std::is_sorted(d.begin(), d.end()));
+            assert(d == brute_nearest_distances(spheres, query.center, 7));
+        }
+    };
+    check_queries();
+
+    // small moves mostly stay in the loose box, teleports and resizes reinsert, removes and reinserts
+    for (int round = 0; round < 4000; ++round) {
+        const int id = (int)(gen() % 2500);
+        const int op = (int)(gen() % 4);
+        auto itr = spheres.find(id);
+        if (op == 0 && itr != spheres.end()) {
+            assert(tree.remove(id));
+            spheres.erase(itr);
+        } else if (op == 1 && itr != spheres.end()) {
+            itr->second.center += glm::vec3{step(gen), step(gen), step(gen)} * 0.1f;
+            tree.update(id, itr->second.center, itr->second.radius);
+        } else {
+            spheres[id] = random_sphere();
+            tree.update(id, spheres[id].center, spheres[id].radius);
+        }
+        assert(tree.contains(id) == (spheres.count(id) == 1));
+    }
+    assert(tree.size() == spheres.size());
+    check_queries();
+
+    std::vector<int> all{};
+    tree.k_nearest(glm::vec3{0.f}, (int)spheres.size() + 10, all);
+    assert(all.size() == spheres.size());
+
+    for (const auto& [id, s] : spheres)
+        assert(tree.remove(id));
+    assert(tree.size() == 0);
+    assert(tree.height() == -1);
+    assert(!tree.any_intersecting(glm::vec3{0.f}, 1e30f, [](int) {return true;}));
+}
+
+void aabb_tree_stays_balanced() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    // items in a sorted line would make a list of an unbalanced tree
+    constexpr int n = 4096;
+    AABBTree<int> tree{};
+    for (int id = 0; id < n; ++id)
+        tree.update(id, glm::vec3{(float)id, 0.f, 0.f}, 0.4f);
+    assert(tree.height() <= 2 * 12);
+
+    // removing every other item keeps it balanced
+    for (int id = 0; id < n; id += 2)
+        assert(tree.remove(id));
+    assert(tree.size() == n / 2);
+    assert(tree.height() <= 2 * 11);
+
+    // spheres 0.4 apart along the line only touch themselves
+    for (int id = 1; id < n; id += 2) {
+        std::vector<int> found{};
+        tree.for_each_intersecting(glm::vec3{(float)id, 0.f, 0.f}, 0.5f, [&found](int i) {found.push_back(i);});
+        assert((found == std::vector<int>{id}));
+    }
+}
+
+void repulsion_modes_match_exact() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 gen{7};
+    std::uniform_real_distribution<float> coord{-40.f, 40.f};
+    std::uniform_real_distribution<float> radius{0.5f, 1.5f};
+    std::uniform_real_distribution<float> step{-1.f, 1.f};
+
+    std::vector<TestSphere> spheres(3000);
+    SpatialHash<int> hash{3.f};
+    AABBTree<int> tree{};
+    auto place = [&](int id) {
+        hash.update(id, spheres[id].center, spheres[id].radius);
+        tree.update(id, spheres[id].center, spheres[id].radius);
+    };
+    for (int id = 0; id < (int)spheres.size(); ++id) {
+        spheres[id] = TestSphere{{coord(gen), 0.f, coord(gen)}, radius(gen)};
+        place(id);
+    }
+
+    auto close = [](const glm::vec3& a, const glm::vec3& b, float tolerance) {
+        return glm::length(a - b) <= tolerance * std::max(glm::length(b), 1e-6f);
+    };
+    auto check = [&]() {
+        double error = 0.0, magnitude = 0.0;
+        for (int q = 0; q < 200; ++q) {
+            // node positions, where the node adds nothing to its own sum, and free positions
+            const TestSphere s = q % 2 ? spheres[gen() % spheres.size()] : TestSphere{{coord(gen), 0.f, coord(gen)}, radius(gen)};
+            const glm::vec3 exact = exact_repulsion(spheres, s);
+
+            assert(close(repulsion_barnes_hut(tree, s.center, s.radius, 0.f), exact, 1e-3f));
+            assert(close(repulsion_cutoff(hash, s.center, s.radius, 1e30f), exact, 1e-3f));
+            assert(close(repulsion_cutoff(hash, s.center, s.radius, 10.f), exact_repulsion(spheres, s, 10.f), 1e-3f));
+
+            error += glm::length(repulsion_barnes_hut(tree, s.center, s.radius, 0.5f) - exact);
+            magnitude += glm::length(exact);
+        }
+        assert(error < 0.02 * magnitude);
+    };
+    check();
+
+    // small moves mostly keep the tree shape and only update the weights above the leaf
+    for (int round = 0; round < 3000; ++round) {
+        const int id = (int)(gen() % spheres.size());
+        if (round % 3)
+            spheres[id].center += glm::vec3{step(gen), 0.f, step(gen)} * 0.1f;
+        else
+            spheres[id] = TestSphere{{coord(gen), 0.f, coord(gen)}, radius(gen)};
+        place(id);
+    }
+    check();
+}
+
+#endif // ENABLE_TESTS
+
+#ifdef ENABLE_PERF
+
+/**
+ * @brief mean time per update_all_adjacencies call at each N, from the thesis timings (N, Time(ms) rows)
+ *
+ * @param path
+ * @return std::map<int, std::pair<double, int>> N -> (sum, count)
+ */
+std::map<int, std::pair<double, int>> load_adjacency_timings(const std::string& path) {
+    std::map<int, std::pair<double, int>> out{};
+    std::ifstream file{path};
+    std::string line{};
+    std::getline(file, line); // header
+    while (std::getline(file, line)) {
+        std::istringstream row{line};
+        int n = 0;
+        double ms = 0.0;
+        if (row >> n >> ms) {
+            out[n].first += ms;
+            ++out[n].second;
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Grow a scene one node at a time next to a random placed node, the way SCWFCSolver::sc_propagate
+ *  places nodes, and connect each new node to the nodes intersecting its neighborhood sphere. Compares
+ *  the linear scan over all nodes done by SCWFC::update_all_adjacencies before the spatial hash, with
+ *  the spatial hash. Prints the mean time per update for windows of N, next to the thesis timings when
+ *  the path of update_all_adjacencies_timings.tsv is given.
+ *
+ * @param timings_path
+ */
+void perf_adjacency_updates(const std::string& timings_path) {
+    const auto thesis = timings_path.empty() ? std::map<int, std::pair<double, int>>{} : load_adjacency_timings(timings_path);
+    constexpr float radius = 1.f;
+    constexpr float neighborhood_fac = 3.f;
+    constexpr int max_n = 32768;
+
+    std::mt19937 gen{0};
+    std::uniform_real_distribution<float> angle{0.f, 6.2831853f};
+    std::uniform_real_distribution<float> spread{2.f, 4.f};
+
+    std::vector<TestSphere> nodes{};
+    nodes.reserve(max_n);
+    SpatialHash<int> hash{radius * neighborhood_fac};
+
+    std::cout << "N" << "\t" << "Linear(ms)" << "\t" << "Hash(ms)" << "\t" << "Thesis(ms)" << "\t" << "Neighbors" << "\n";
+    double linear_ms = 0.0, hash_ms = 0.0;
+    std::uint64_t neighbors = 0;
+    int window_begin = 0;
+    for (int n = 0; n < max_n; ++n) {
+        TestSphere s{{}, radius};
+        if (!nodes.empty()) {
+            const TestSphere& parent = nodes[gen() % nodes.size()];
+            const float a = angle(gen), d = spread(gen);
+            s.center = parent.center + glm::vec3{std::cos(a) * d, 0.f, std::sin(a) * d};
+        }
+        const TestSphere neighborhood{s.center, radius * neighborhood_fac};
+
+        int linear_count = 0;
+        {
+            Timer timer{"linear", false};
+            for (const auto& c : nodes)
+                linear_count += spheres_intersect(c, neighborhood);
+            timer.stop();
+            linear_ms += timer.elapsed_ms();
+        }
+
+        int hash_count = 0;
+        {
+            Timer timer{"hash", false};
+            hash.update(n, s.center, s.radius);
+            hash.for_each_intersecting(neighborhood.center, neighborhood.radius, [&hash_count, n](int id) {hash_count += id != n;});
+            timer.stop();
+            hash_ms += timer.elapsed_ms();
+        }
+        assert(linear_count == hash_count);
+        neighbors += hash_count;
+        nodes.push_back(s);
+
+        const int count = n + 1;
+        if ((count & (count - 1)) == 0 && count >= 256) {
+            const int window = count - window_begin;
+            double thesis_sum = 0.0;
+            int thesis_count = 0;
+            for (auto itr = thesis.lower_bound(window_begin + 1); itr != thesis.end() && itr->first <= count; ++itr) {
+                thesis_sum += itr->second.first;
+                thesis_count += itr->second.second;
+            }
+            std::cout << count << "\t" << linear_ms / window << "\t" << hash_ms / window << "\t";
+            if (thesis_count > 0)
+                std::cout << thesis_sum / thesis_count;
+            else
+                std::cout << "-";
+            std::cout << "\t" << (double)neighbors / window << std::endl;
+            linear_ms = hash_ms = 0.0;
+            neighbors = 0;
+            window_begin = count;
+        }
+    }
+}
+
+/**
+ * @brief Grow a scene like perf_adjacency_updates, and before placing each node check its sphere
+ *  against every placed node, once with the linear scan SCWFC::intersects_any did over all children
+ *  and once with the bounding volume tree. Prints the mean time per check for windows of N.
+ *
+ */
+void perf_overlap_queries() {
+    constexpr int max_n = 32768;
+    std::mt19937 gen{0};
+    std::uniform_real_distribution<float> angle{0.f, 6.2831853f};
+    std::uniform_real_distribution<float> spread{1.5f, 4.f};
+    std::uniform_real_distribution<float> radius{0.5f, 1.5f};
+
+    std::vector<TestSphere> nodes{};
+    nodes.reserve(max_n);
+    AABBTree<int> tree{};
+
+    std::cout << "N" << "\t" << "Linear(ms)" << "\t" << "Tree(ms)" << "\t" << "Height" << "\t" << "Rejected" << "\n";
+    double linear_ms = 0.0, tree_ms = 0.0;
+    int rejected = 0;
+    int window_begin = 0;
+    while ((int)nodes.size() < max_n) {
+        TestSphere s{{}, radius(gen)};
+        if (!nodes.empty()) {
+            const TestSphere& parent = nodes[gen() % nodes.size()];
+            const float a = angle(gen), d = spread(gen);
+            s.center = parent.center + glm::vec3{std::cos(a) * d, 0.f, std::sin(a) * d};
+        }
+
+        bool linear_hit = false;
+        {
+            Timer timer{"linear", false};
+            for (const auto& c : nodes) {
+                if (spheres_intersect(c, s)) {
+                    linear_hit = true;
+                    break;
+                }
+            }
+            timer.stop();
+            linear_ms += timer.elapsed_ms();
+        }
+
+        bool tree_hit = false;
+        {
+            Timer timer{"tree", false};
+            tree_hit = tree.any_intersecting(s.center, s.radius, [](int) {return true;});
+            if (!tree_hit)
+                tree.update((int)nodes.size(), s.center, s.radius);
+            timer.stop();
+            tree_ms += timer.elapsed_ms();
+        }
+        assert(linear_hit == tree_hit);
+        if (linear_hit) {
+            ++rejected;
+            continue;
+        }
+        nodes.push_back(s);
+
+        const int count = (int)nodes.size();
+        if ((count & (count - 1)) == 0 && count >= 256) {
+            const int window = count - window_begin;
+            std::cout << count << "\t" << linear_ms / window << "\t" << tree_ms / window << "\t" << tree.height()
+                      << "\t" << (double)rejected / window << std::endl;
+            linear_ms = tree_ms = 0.0;
+            rejected = 0;
+            window_begin = count;
+        }
+    }
+}
+
+/**
+ * @brief Accuracy against speed of the repulsion modes, on scenes grown like perf_overlap_queries,
+ *  nodes overlapping a placed node are dropped as SCWFCSolver destroys them. For each N the repulsion is evaluated at the center of 2000 random nodes, the way
+ *  SCWFC::node_repulsion is called while propagating. Err is the mean error magnitude and MaxErr
+ *  the largest, both over the mean magnitude of the exact sums.
+ *
+ */
+void perf_repulsion() {
+    std::mt19937 gen{0};
+    std::uniform_real_distribution<float> angle{0.f, 6.2831853f};
+    std::uniform_real_distribution<float> spread{2.f, 4.f};
+    std::uniform_real_distribution<float> radius{0.5f, 1.5f};
+    constexpr int queries = 2000;
+
+    std::vector<TestSphere> nodes{};
+    SpatialHash<int> hash{3.f};
+    AABBTree<int> tree{};
+
+    std::cout << "N" << "\t" << "Mode" << "\t" << "Param" << "\t" << "Time(ms)" << "\t" << "Err" << "\t" << "MaxErr" << "\n";
+    for (int n : {1024, 4096, 16384, 32768}) {
+        while ((int)nodes.size() < n) {
+            TestSphere s{{}, radius(gen)};
+            if (!nodes.empty()) {
+                const TestSphere& parent = nodes[gen() % nodes.size()];
+                const float a = angle(gen), d = spread(gen);
+                s.center = parent.center + glm::vec3{std::cos(a) * d, 0.f, std::sin(a) * d};
+            }
+            if (tree.any_intersecting(s.center, s.radius, [](int) {return true;}))
+                continue;
+            hash.update((int)nodes.size(), s.center, s.radius);
+            tree.update((int)nodes.size(), s.center, s.radius);
+            nodes.push_back(s);
+        }
+
+        std::vector<int> query_ids(queries);
+        for (int& q : query_ids)
+            q = (int)(gen() % nodes.size());
+
+        std::vector<glm::vec3> exact(queries);
+        double magnitude = 0.0;
+        {
+            Timer timer{"exact", false};
+            for (int q = 0; q < queries; ++q)
+                exact[q] = exact_repulsion(nodes, nodes[query_ids[q]]);
+            timer.stop();
+            for (const auto& f : exact)
+                magnitude += glm::length(f);
+            magnitude /= queries;
+            std::cout << n << "\t" << "Exact" << "\t" << "-" << "\t" << timer.elapsed_ms() / queries << "\t" << 0.0 << "\t" << 0.0 << std::endl;
+        }
+
+        auto report = [&](const char* mode, float param, auto&& eval) {
+            std::vector<glm::vec3> approx(queries);
+            Timer timer{mode, false};
+            for (int q = 0; q < queries; ++q)
+                approx[q] = eval(nodes[query_ids[q]]);
+            timer.stop();
+            double error = 0.0, max_error = 0.0;
+            for (int q = 0; q < queries; ++q) {
+                const double e = glm::length(approx[q] - exact[q]);
+                error += e;
+                max_error = std::max(max_error, e);
+            }
+            std::cout << n << "\t" << mode << "\t" << param << "\t" << timer.elapsed_ms() / queries << "\t"
+                      << error / queries / magnitude << "\t" << max_error / magnitude << std::endl;
+        };
+        for (float cutoff : {8.f, 16.f, 32.f, 64.f})
+            report("Cutoff", cutoff, [&](const TestSphere& s) {return repulsion_cutoff(hash, s.center, s.radius, cutoff);});
+        for (float opening_angle : {0.25f, 0.5f, 0.75f, 1.f})
+            report("BarnesHut", opening_angle, [&](const TestSphere& s) {return repulsion_barnes_hut(tree, s.center, s.radius, opening_angle);});
+    }
+}
+
+#endif // ENABLE_PERF
+
+int main(int argc, const char** argv) {
+#ifdef ENABLE_TESTS
+    spatial_hash_matches_brute_force();
+    spatial_hash_pointer_items();
+    aabb_tree_matches_brute_force();
+    aabb_tree_stays_balanced();
+    repulsion_modes_match_exact();
+
+    std::cout << "Tests Done" << std::endl;
+#endif // ENABLE_TESTS
+
+#ifdef ENABLE_PERF
+    if (argc < 2)
+        return 0;
+    switch (argv[1][0]) {
+        case 'a':
+            perf_adjacency_updates(argc > 2 ? argv[2] : "");
+            break;
+        case 'b':
+            perf_overlap_queries();
+            break;
+        case 'c':
+            perf_repulsion();
+            break;
+        default:
+            break;
+    }
+#endif // ENABLE_PERF
+
+    return 0;
+}
@@ -1,13 +1,23 @@
 #include <algorithm>
+#include <array>
+#include <map>
 #include <memory>
+#include <numeric>
 #include <iostream>
 #include <random>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "pcg/wfc.hpp"
 #include "pcg/grid.hpp"
+#include "pcg/wfc_grid.hpp"
+#include "pcg/wfc_voxel.hpp"
+#include "pcg/wfc_chunked.hpp"
+#include "pcg/wfc_partition.hpp"
+#include "pcg/wfc_batch.hpp"
+#include "pcg/indexed_heap.hpp"
 #include "timer.hpp"
 
 #include "pcg/distributions.hpp"
@@ -17,6 +27,29 @@
 
 #define assert_throws(fn, exception) {bool threw = false; try{fn;} catch (exception& e) {threw = true;} assert(threw);}
 
+#ifdef ENABLE_TESTS
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// count every heap allocation made by the test binary
+static std::atomic<std::size_t> g_allocation_count{0};
+
+void* operator new(std::size_t size) {
+    ++g_allocation_count;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc{};
+}
+
+// gcc warns when the free below is inlined next to a new expression
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#endif // ENABLE_TESTS
+
 using namespace std;
 using namespace wfc;
 
@@ -265,6 +298,104 @@ void directed_adjacent_abc(Graph<GraphNode>* s) {
     assert(s->adjacent(c, a) == 0.f);
 }
 
+void sparse_adjacency_swap_remove() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    for (bool directed : {false, true}) {
+        SparseGraph<GraphNode> s{directed};
+        std::vector<unique_ptr<GraphNode>> nodes{};
+        for (int i = 0; i < 16; ++i)
+            nodes.push_back(make_unique<GraphNode>(std::to_string(i), i + 1));
+
+        // reference edge set, undirected edges stored in both directions
+        std::map<std::pair<int, int>, float> edges{};
+        std::mt19937 gen{directed ? 8u : 7u};
+        std::uniform_int_distribution<int> pick{0, 15};
+        for (int op = 0; op < 3000; ++op) {
+            const int a = pick(gen), b = pick(gen);
+            if (!directed && a == b)
+                continue;
+            if (op % 97 == 0) {
+                s.remove_node(nodes[a].get());
+                for (auto itr = edges.begin(); itr != edges.end();)
+                    itr = (itr->first.first == a || itr->first.second == a) ? edges.erase(itr) : std::next(itr);
+            } else if (op % 3 == 0) {
+                s.remove_edge(nodes[a].get(), nodes[b].get());
+                edges.erase({a, b});
+                if (!directed)
+                    edges.erase({b, a});
+            } else {
+                s.add_edge(nodes[a].get(), nodes[b].get(), 1.f + op);
+                if (edges.insert({{a, b}, 1.f + op}).second && !directed)
+                    edges.insert({{b, a}, 1.f + op});
+            }
+
+            if (op % 50 != 0)
+                continue;
+            for (int i = 0; i < 16; ++i) {
+                std::set<GraphNode*> expected{};
+                for (int j = 0; j < 16; ++j) {
+                    auto itr = edges.find({i, j});
+                    assert(s.adjacent(nodes[i].get(), nodes[j].get()) == (itr != edges.end() ? itr->second : 0.f));
+                    if (itr != edges.end())
+                        expected.insert(nodes[j].get());
+                }
+                const auto adjacent = s.adjacent_nodes(nodes[i].get());
+                assert(adjacent.size() == expected.size());
+                assert(std::set<GraphNode*>(adjacent.begin(), adjacent.end()) == expected);
+            }
+        }
+    }
+}
+
+void csr_snapshot_matches_sparse() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    for (bool directed : {false, true}) {
+        SparseGraph<GraphNode> s{directed};
+        std::vector<unique_ptr<GraphNode>> nodes{};
+        for (int i = 0; i < 12; ++i)
+            nodes.push_back(make_unique<GraphNode>(std::to_string(i), i + 1));
+
+        std::mt19937 gen{directed ? 2u : 1u};
+        std::uniform_int_distribution<int> pick{0, 11};
+        for (int e = 0; e < 40; ++e) {
+            const int a = pick(gen), b = pick(gen);
+            if (a != b)
+                s.add_edge(nodes[a].get(), nodes[b].get(), 1.f + e);
+        }
+        s.remove_edge(nodes[0].get(), nodes[1].get());
+        if (!directed) // directed remove_node expects edges in both directions
+            s.remove_node(nodes[2].get());
+
+        CSRGraph<GraphNode> csr{s};
+        assert(csr.is_directed() == directed);
+        assert(csr.get_n_nodes() == s.get_n_nodes());
+        std::size_t n_edges = 0;
+        for (const auto& n : nodes) {
+            GraphNode* a = n.get();
+            const auto span = csr.adjacent_span(a);
+            assert(std::vector<GraphNode*>(span.begin(), span.end()) == s.adjacent_nodes(a));
+            for (const auto& m : nodes)
+                assert(csr.adjacent(a, m.get()) == s.adjacent(a, m.get()));
+
+            const int i = csr.index_of(a);
+            if (i < 0)
+                continue;
+            assert(csr.node(i) == a);
+            n_edges += csr.degree(i);
+            for (std::size_t k = 0; k < csr.neighbors(i).size(); ++k) {
+                assert(csr.node(csr.neighbors(i)[k]) == span[k]);
+                assert(csr.weights(i)[k] == s.adjacent(a, span[k]));
+            }
+        }
+        assert(n_edges == csr.get_n_edges());
+        assert(directed || csr.index_of(nodes[2].get()) == -1);
+        assert_throws(csr.add_edge(nodes[0].get(), nodes[1].get(), 1.f), std::runtime_error);
+        assert_throws(csr.remove_node(nodes[0].get()), std::runtime_error);
+    }
+}
+
 void sparse_directed_add() {
     std::cout << __FUNCTION__ << std::endl;
     SparseGraph<GraphNode> s{true};
@@ -515,6 +646,125 @@ void dense_flow_soln_directional2() {
     std::cout << r << std::endl;
 }
 
+/**
+ * @brief random layered network source -> layers -> sink, like the dense_flow fixtures scaled up
+ * 
+ * @param g directed dense graph with room for n_layers * layer_size + 2 nodes
+ * @param nodes node storage, [0] is the source and [1] the sink
+ */
+void make_layered_network(DenseGraph<GraphNode>& g, std::vector<unique_ptr<GraphNode>>& nodes, int n_layers, int layer_size,
+                          int out_degree, bool integer_capacity, std::mt19937& gen) {
+    nodes.clear();
+    const int n = n_layers * layer_size + 2;
+    for (int i = 0; i < n; ++i)
+        nodes.push_back(make_unique<GraphNode>(std::to_string(i), i + 1));
+
+    std::uniform_int_distribution<int> pick{0, layer_size - 1};
+    std::uniform_int_distribution<int> int_capacity{1, 4};
+    std::uniform_real_distribution<float> real_capacity{0.1f, 2.f};
+    auto capacity = [&]() {return integer_capacity ? (float)int_capacity(gen) : real_capacity(gen);};
+    auto layer_node = [&](int layer, int i) {return nodes[2 + layer * layer_size + i].get();};
+
+    g.add_edge(nodes[0].get(), nodes[1].get(), 0.f); // register source and sink first
+    for (int i = 0; i < layer_size; ++i) {
+        g.add_edge(nodes[0].get(), layer_node(0, i), capacity());
+        g.add_edge(layer_node(n_layers - 1, i), nodes[1].get(), capacity());
+    }
+    for (int layer = 0; layer + 1 < n_layers; ++layer)
+        for (int i = 0; i < layer_size; ++i)
+            for (int k = 0; k < out_degree; ++k)
+                g.add_edge(layer_node(layer, i), layer_node(layer + 1, pick(gen)), capacity());
+}
+
+void flow_network_matches_reference() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    for (unsigned seed = 0; seed < 12; ++seed) {
+        const bool integer_capacity = seed % 2 == 0;
+        std::mt19937 gen{seed};
+        DenseGraph<GraphNode> g{3 * 8 + 2, true};
+        std::vector<unique_ptr<GraphNode>> nodes{};
+        make_layered_network(g, nodes, 3, 8, 3, integer_capacity, gen);
+        GraphNode* s = nodes[0].get();
+        GraphNode* t = nodes[1].get();
+
+        const float reference = ford_fulkerson_reference(g, s, t, (DenseGraph<GraphNode>*)nullptr);
+
+        DenseGraph<GraphNode> r = g;
+        const float flow = ford_fulkerson(g, s, t, &r);
+        assert(std::abs(flow - reference) < 1e-4f);
+
+        // residual keeps the capacity of every node pair
+        for (int u = 0; u < g.get_n_nodes(); ++u)
+            for (int v = 0; v < u; ++v)
+                assert(std::abs(r.adjacent(u, v) + r.adjacent(v, u) - g.adjacent(u, v) - g.adjacent(v, u)) < 1e-4f);
+
+        // both algorithms on the same network
+        FlowNetwork network{g.get_n_nodes()};
+        for (int u = 0; u < g.get_n_nodes(); ++u)
+            for (int v = 0; v < g.get_n_nodes(); ++v)
+                if (u != v && g.adjacent(u, v) > 0.f)
+                    network.add_edge(u, v, g.adjacent(u, v));
+        const int s_ind = g.get_node_index(s);
+        const int t_ind = g.get_node_index(t);
+        assert(std::abs(network.max_flow_dinic(s_ind, t_ind) - reference) < 1e-4f);
+        assert(network.max_flow_dinic(s_ind, t_ind) == 0.f); // already maximal
+        network.reset_flow();
+        assert(std::abs(network.max_flow_push_relabel(s_ind, t_ind) - reference) < 1e-4f);
+
+        // push-relabel flow is conserved at every inner node and within capacity
+        std::vector<float> net(network.get_n_nodes(), 0.f);
+        for (int e = 0; e < network.get_n_edges(); e += 2) {
+            assert(network.flow(e) <= g.adjacent(network.edge_from(e), network.edge_to(e)) + 1e-4f);
+            assert(network.residual(e) >= -1e-4f);
+            net[network.edge_from(e)] -= network.flow(e);
+            net[network.edge_to(e)] += network.flow(e);
+        }
+        for (int u = 0; u < network.get_n_nodes(); ++u)
+            if (u != s_ind && u != t_ind)
+                assert(std::abs(net[u]) < 1e-4f);
+    }
+
+    // undirected edges carry flow both ways
+    FlowNetwork network{4};
+    network.add_edge(0, 1, 1.f, 1.f);
+    network.add_edge(2, 1, 2.f, 2.f);
+    network.add_edge(2, 3, 1.f, 1.f);
+    network.add_edge(0, 3, 0.5f);
+    assert(network.max_flow_dinic(0, 3) == 1.5f);
+}
+
+void dense_bfs_bit_packed() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    for (bool directed : {false, true}) {
+        DenseGraph<GraphNode> g{150, directed};
+        std::vector<unique_ptr<GraphNode>> nodes{};
+        for (int i = 0; i < 130; ++i)
+            nodes.push_back(make_unique<GraphNode>(std::to_string(i), i + 1));
+        std::mt19937 gen{directed ? 4u : 3u};
+        std::uniform_int_distribution<int> pick{0, 129};
+        for (int e = 0; e < 200; ++e)
+            g.add_edge(nodes[pick(gen)].get(), nodes[pick(gen)].get(), 1.f);
+
+        DenseGraph<GraphNode> b = g;
+        b.set_bit_packed(true);
+        for (int q = 0; q < 100; ++q) {
+            if (q == 50) { // edges added and removed through the matrix after the bits were built
+                b.add_edge(nodes[1].get(), nodes[2].get(), 1.f);
+                g.add_edge(nodes[1].get(), nodes[2].get(), 1.f);
+                b.adjacent(0, 3) = 0.f;
+                g.adjacent(0, 3) = 0.f;
+            }
+            GraphNode* x = nodes[pick(gen)].get();
+            GraphNode* y = nodes[pick(gen)].get();
+            std::vector<GraphNode*> path_g{}, path_b{};
+            assert(g.bfs(x, y, path_g) == b.bfs(x, y, path_b));
+            assert(path_g == path_b);
+        }
+    }
+}
+
 void test_pattern_validity0() {
     std::cout << __FUNCTION__ << std::endl;
 
@@ -554,6 +804,7 @@ void test_pattern_validity0() {
     std::vector<DGraphNode*> neighborhood{a, b, c};
 
     assert(p_center.valid(neighborhood));
+    assert(p_center.valid_max_flow(neighborhood));
 }
 
 void test_pattern_validity1() {
@@ -595,6 +846,7 @@ void test_pattern_validity1() {
     std::vector<DGraphNode*> neighborhood{a, b, c, d};
 
     assert(p_center.valid(neighborhood));
+    assert(p_center.valid_max_flow(neighborhood));
 }
 
 void test_pattern_validity2() {
@@ -625,6 +877,7 @@ void test_pattern_validity2() {
     std::vector<DGraphNode*> neighborhood{a, b, c};
 
     assert(p_center.valid(neighborhood));
+    assert(p_center.valid_max_flow(neighborhood));
 }
 
 void test_pattern_validity3() {
@@ -654,6 +907,72 @@ void test_pattern_validity3() {
     std::vector<DGraphNode*> neighborhood{a, b, c};
 
     assert(!p_center.valid(neighborhood));
+    assert(!p_center.valid_max_flow(neighborhood));
+}
+
+void test_pattern_validity_matches_max_flow() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 gen{11};
+    std::uniform_int_distribution<int> type_dist{1, 6};
+
+    for (int trial = 0; trial < 2000; ++trial) {
+        const int n_nodes = trial % 9;
+        const int n_req = (trial / 9) % 7;
+
+        std::vector<unique_ptr<DGraphNode>> nodes{};
+        std::vector<DGraphNode*> neighborhood{};
+        for (int i = 0; i < n_nodes; ++i) {
+            nodes.push_back(make_unique<DGraphNode>("N" + std::to_string(i), 10 + i));
+            const int domain_size = 1 + trial % 3;
+            for (int d = 0; d < domain_size; ++d)
+                nodes.back()->domain.push_back(Val{type_dist(gen), 0});
+            neighborhood.push_back(nodes.back().get());
+        }
+
+        std::vector<int> requirements(n_req);
+        for (auto& r : requirements)
+            r = type_dist(gen);
+
+        Pattern p{0, requirements};
+        assert(p.valid(neighborhood) == p.valid_max_flow(neighborhood));
+    }
+}
+
+void test_pattern_validity_tiered() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 gen{13};
+    ValidityTierStats stats{};
+
+    for (int trial = 0; trial < 4000; ++trial) {
+        const int n_types = 2 + trial % 7;
+        std::uniform_int_distribution<int> type_dist{1, n_types};
+        const int n_nodes = trial % 10;
+        const int n_req = (trial / 10) % 8;
+
+        std::vector<unique_ptr<DGraphNode>> nodes{};
+        std::vector<DGraphNode*> neighborhood{};
+        for (int i = 0; i < n_nodes; ++i) {
+            nodes.push_back(make_unique<DGraphNode>("N" + std::to_string(i), 10 + i));
+            const int domain_size = 1 + (trial / 3) % 3;
+            for (int d = 0; d < domain_size; ++d)
+                nodes.back()->domain.push_back(Val{type_dist(gen), 0});
+            neighborhood.push_back(nodes.back().get());
+        }
+
+        std::vector<int> requirements(n_req);
+        for (auto& r : requirements)
+            r = type_dist(gen);
+
+        Pattern p{0, requirements};
+        assert(p.valid_tiered(neighborhood, &stats) == p.valid(neighborhood));
+    }
+
+    // every tier should have been exercised
+    assert(stats.calls == 4000);
+    assert(stats.trivial + stats.rejected_count + stats.rejected_hall + stats.exact == stats.calls);
+    assert(stats.rejected_count > 0 && stats.rejected_hall > 0 && stats.exact > 0);
 }
 
 #if 0
@@ -695,6 +1014,1380 @@ void wfc_solver_grid0() {
 }
 #endif
 
+void test_domain_bits() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    DomainBits a{130};
+    DomainBits b{130};
+    assert(a.count() == 0 && !a.any());
+
+    a.set(0);
+    a.set(64);
+    a.set(129);
+    b.set(64);
+    b.set(100);
+
+    assert(a.count() == 3);
+    assert(a.test(129) && !a.test(128));
+    assert(a.intersects(b));
+
+    std::vector<int> set_bits{};
+    a.for_each_set([&set_bits](int i) {set_bits.push_back(i);});
+    assert((set_bits == std::vector{0, 64, 129}));
+
+    assert(a.intersect(b));
+    assert(a.count() == 1 && a.test(64));
+    assert(!a.intersect(b)); // nothing left to clear
+
+    a.reset(64);
+    assert(!a.any());
+}
+
+/**
+ * @brief patterns with a single requirement chain, so grid solves have some constraint
+ * 
+ * @param n_patterns 
+ * @param n_types 
+ * @param max_requirements 
+ * @param gen 
+ * @return PatternMap 
+ */
+PatternMap make_random_patterns(int n_patterns, int n_types, int max_requirements, std::mt19937& gen) {
+    std::uniform_int_distribution<int> type_dist{1, n_types};
+    std::uniform_int_distribution<int> req_dist{0, max_requirements};
+    std::uniform_real_distribution<float> weight_dist{0.1f, 1.f};
+
+    PatternMap patterns{};
+    for (int id = 1; id <= n_patterns; ++id) {
+        std::vector<int> requirements(req_dist(gen));
+        for (auto& r : requirements)
+            r = type_dist(gen);
+        patterns.insert({id, Pattern{type_dist(gen), requirements, weight_dist(gen)}});
+    }
+    return patterns;
+}
+
+std::vector<Val> domain_from_patterns(const PatternMap& patterns) {
+    std::vector<Val> values{};
+    for (const auto& [id, p] : patterns)
+        values.push_back(Val{p.pattern_type, id});
+    std::sort(values.begin(), values.end(), [](const Val& a, const Val& b) {return a.value < b.value;});
+    return values;
+}
+
+/**
+ * @brief observe every unsolved cell in the grid in index order
+ * 
+ * @param grid 
+ * @param solver 
+ * @return int number of cells left with an empty domain
+ */
+int solve_grid(ev2::pcg::NodeGrid& grid, WFCSolver& solver) {
+    int empty = 0;
+    for (int y = 0; y < grid.height; ++y)
+        for (int x = 0; x < grid.width; ++x) {
+            DGraphNode* n = grid.at(x, y);
+            if (solver.domain_size(n) > 1)
+                solver.step_wfc(n);
+        }
+    for (int y = 0; y < grid.height; ++y)
+        for (int x = 0; x < grid.width; ++x)
+            empty += grid.at(x, y)->domain.empty();
+    return empty;
+}
+
+void wfc_solver_grid_bitset_matches_vector() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{7};
+    const PatternMap patterns = make_random_patterns(40, 6, 2, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    auto domain_set = [](const DGraphNode* n) {
+        std::set<int> out{};
+        for (auto v : n->domain)
+            out.insert(v.value);
+        return out;
+    };
+
+    ev2::pcg::NodeGrid grid_v{6, 6};
+    ev2::pcg::NodeGrid grid_b{6, 6};
+    grid_v.reset_domains(values);
+    grid_b.reset_domains(values);
+
+    std::mt19937 gen_v{3};
+    std::mt19937 gen_b{3};
+    WFCSolver solver_v{&grid_v.get_graph(), patterns, gen_v, true, SolverValidMode::Correct, SolverDomainMode::Vector};
+    WFCSolver solver_b{&grid_b.get_graph(), patterns, gen_b, true, SolverValidMode::Correct, SolverDomainMode::Bitset};
+
+    // fix a value without using the random pick, then propagate the same way in both modes
+    grid_v.at(2, 2)->set_value(values[0]);
+    grid_b.at(2, 2)->set_value(values[0]);
+    solver_v.propagate(grid_v.at(2, 2));
+    solver_b.propagate(grid_b.at(2, 2));
+
+    for (int y = 0; y < 6; ++y)
+        for (int x = 0; x < 6; ++x) {
+            assert(domain_set(grid_v.at(x, y)) == domain_set(grid_b.at(x, y)));
+            assert(solver_b.domain_size(grid_b.at(x, y)) == grid_b.at(x, y)->domain.size());
+            assert(std::abs(solver_v.node_entropy(grid_v.at(x, y)) - solver_b.node_entropy(grid_b.at(x, y))) < 1e-3f);
+        }
+
+    // full solve in bitset mode leaves every cell with at most one value
+    solve_grid(grid_b, solver_b);
+    for (int y = 0; y < 6; ++y)
+        for (int x = 0; x < 6; ++x)
+            assert(grid_b.at(x, y)->domain.size() <= 1);
+}
+
+void wfc_solver_bitset_external_domain() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{7};
+    const PatternMap patterns = make_random_patterns(40, 6, 2, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    auto domain_set = [](const DGraphNode* n) {
+        std::set<int> out{};
+        for (auto v : n->domain)
+            out.insert(v.value);
+        return out;
+    };
+
+    ev2::pcg::NodeGrid grid_v{6, 6};
+    ev2::pcg::NodeGrid grid_b{6, 6};
+    grid_v.reset_domains(values);
+    grid_b.reset_domains(values);
+
+    std::mt19937 gen_v{3};
+    std::mt19937 gen_b{3};
+    WFCSolver solver_v{&grid_v.get_graph(), patterns, gen_v, true, SolverValidMode::Correct, SolverDomainMode::Vector};
+    WFCSolver solver_b{&grid_b.get_graph(), patterns, gen_b, true, SolverValidMode::Correct, SolverDomainMode::Bitset};
+
+    // the solver builds bits for the first half of the values
+    const std::vector<Val> first{values.begin(), values.begin() + values.size() / 2};
+    const std::vector<Val> other{values.begin() + values.size() / 2, values.begin() + 2 * (values.size() / 2)};
+    DGraphNode* node_v = grid_v.at(2, 2);
+    DGraphNode* node_b = grid_b.at(2, 2);
+    node_v->set_domain(first);
+    node_b->set_domain(first);
+    solver_v.propagate(node_v);
+    solver_b.propagate(node_b);
+    assert(std::abs(solver_v.node_entropy(node_v) - solver_b.node_entropy(node_b)) < 1e-3f);
+    const std::set<int> before = domain_set(node_b);
+
+    // replace it with the same number of other values, written directly and announced with
+    // domain_changed()
+    node_v->domain = other;
+    node_b->domain = other;
+    node_v->domain_changed();
+    node_b->domain_changed();
+
+    solver_v.propagate(node_v);
+    solver_b.propagate(node_b);
+    assert(domain_set(node_b) != before);
+    assert(std::abs(solver_v.node_entropy(node_v) - solver_b.node_entropy(node_b)) < 1e-3f);
+    for (int y = 0; y < 6; ++y)
+        for (int x = 0; x < 6; ++x) {
+            assert(domain_set(grid_v.at(x, y)) == domain_set(grid_b.at(x, y)));
+            assert(solver_b.domain_size(grid_b.at(x, y)) == grid_b.at(x, y)->domain.size());
+        }
+}
+
+void wfc_solver_validity_cache() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{5};
+    const PatternMap patterns = make_random_patterns(30, 5, 2, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    ev2::pcg::NodeGrid grid_a{8, 8};
+    ev2::pcg::NodeGrid grid_b{8, 8};
+    grid_a.reset_domains(values);
+    grid_b.reset_domains(values);
+
+    std::mt19937 gen_a{9};
+    std::mt19937 gen_b{9};
+    WFCSolver solver_a{&grid_a.get_graph(), patterns, gen_a, true, SolverValidMode::Correct};
+    WFCSolver solver_b{&grid_b.get_graph(), patterns, gen_b, true, SolverValidMode::Correct};
+    solver_b.set_validity_cache_enabled(true);
+
+    solve_grid(grid_a, solver_a);
+    solve_grid(grid_b, solver_b);
+
+    // identical random choices and identical validity results give the same solution
+    for (int y = 0; y < 8; ++y)
+        for (int x = 0; x < 8; ++x)
+            assert(grid_a.at(x, y)->domain == grid_b.at(x, y)->domain);
+
+    const auto stats = solver_b.get_validity_cache_stats();
+    assert(stats.hits > 0);
+    assert(stats.misses > 0);
+    std::cout << "hits " << stats.hits << " misses " << stats.misses << std::endl;
+}
+
+void wfc_solver_stats() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{5};
+    const PatternMap patterns = make_random_patterns(30, 5, 2, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    ev2::pcg::NodeGrid grid{8, 8};
+    grid.reset_domains(values);
+    std::mt19937 gen{9};
+    WFCSolver solver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct};
+
+    const std::uint64_t augmentations = matching_scratch().total_augmentations();
+    solve_grid(grid, solver);
+    const SolverStats stats = solver.get_solver_stats();
+
+    // solve_grid only steps nodes with more than one value, every step observes and propagates once
+    assert(stats.observations > 0);
+    assert(stats.propagations == stats.observations);
+    assert(stats.revisions >= stats.propagations);
+    assert(stats.valid_calls > 0);
+    assert(stats.domain_removals > 0);
+    assert(stats.flow_augmentations == matching_scratch().total_augmentations() - augmentations);
+    assert(stats.contradictions == solver.get_contradiction_count());
+    assert(stats.propagate_ms == 0.0 && stats.validity_ms == 0.0); // timing is off by default
+
+    solver.reset_solver_stats();
+    assert(solver.get_solver_stats().valid_calls == 0);
+    assert(solver.get_solver_stats().contradictions == 0);
+
+    solver.set_timing_enabled(true);
+    grid.reset_domains(values);
+    solve_grid(grid, solver);
+    const SolverStats timed = solver.get_solver_stats();
+    assert(timed.propagate_ms > 0.0);
+    assert(timed.validity_ms <= timed.propagate_ms); // validity checks run inside propagation
+
+    std::ostringstream header{}, row{};
+    SolverStats::write_tsv_header(header);
+    timed.write_tsv(row);
+    const auto columns = [](const std::string& line) {return std::count(line.begin(), line.end(), '\t') + 1;};
+    assert(columns(header.str()) == 9);
+    assert(columns(row.str()) == columns(header.str()));
+    assert(header.str().find("flow_augmentations") != std::string::npos);
+    std::cout << header.str() << "\n" << row.str() << std::endl;
+}
+
+void test_pattern_table() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    PatternMap compact = make_pattern_map({Pattern{3, {1, 2}, 1.f}, Pattern{1, {}, 3.f}, Pattern{2, {3}, 0.f}});
+    PatternTable table{compact};
+    assert(table.size() == 3);
+    assert(table.index_of(1) == 0 && table.index_of(2) == 1 && table.index_of(3) == 2);
+    assert(table.index_of(0) == -1 && table.index_of(4) == -1 && table.index_of(-100) == -1);
+    assert(table.index_of(std::numeric_limits<int>::min()) == -1 && table.index_of(std::numeric_limits<int>::max()) == -1);
+    PatternTable negative_table{make_pattern_map({Pattern{-2}, Pattern{-1}, Pattern{0}})};
+    assert(negative_table.index_of(-2) == 0 && negative_table.index_of(0) == 2);
+    assert(negative_table.index_of(std::numeric_limits<int>::max()) == -1 && negative_table.index_of(std::numeric_limits<int>::min()) == -1);
+    assert(table.weight_of(1) == 3.f && table.weight_of(7) == 0.f);
+    assert(table.requirements(0).size() == 0);
+    assert(table.requirements(2).size() == 2 && table.requirements(2)[1] == 2);
+    assert(table.value(2) == (Val{3, 3}));
+    assert(table.total_weight() == 4.f);
+
+    // ids far apart use the hash map lookup
+    PatternMap sparse = make_pattern_map({Pattern{5}, Pattern{100000}, Pattern{-7}});
+    PatternTable sparse_table{sparse};
+    assert(sparse_table.index_of(-7) == 0 && sparse_table.index_of(5) == 1 && sparse_table.index_of(100000) == 2);
+    assert(sparse_table.index_of(6) == -1);
+
+    // alias samples follow the weights, the zero weight pattern is never picked
+    std::mt19937 gen{2};
+    std::array<int, 3> counts{};
+    const int n_samples = 200000;
+    for (int i = 0; i < n_samples; ++i)
+        ++counts[table.sample_alias(gen)];
+    assert(counts[1] == 0);
+    assert(std::abs(counts[0] / (float)n_samples - 0.75f) < 0.01f);
+    assert(std::abs(counts[2] / (float)n_samples - 0.25f) < 0.01f);
+}
+
+void wfc_solver_weighted_pick() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    PatternMap patterns{};
+    for (int id = 0; id < 8; ++id)
+        patterns.insert({id, Pattern{id, {}, (float)(id + 1)}});
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    // live domains holding most of the weight (alias path) and a small share (cumulative path)
+    for (const std::vector<int>& live : {std::vector<int>{1, 3, 5, 6, 7}, std::vector<int>{0, 2}}) {
+        float live_weight = 0.f;
+        std::vector<Val> domain{};
+        for (int id : live) {
+            domain.push_back(values[id]);
+            live_weight += id + 1;
+        }
+
+        for (auto mode : {SolverDomainMode::Vector, SolverDomainMode::Bitset}) {
+            ev2::pcg::NodeGrid grid{1, 1};
+            std::mt19937 gen{4};
+            WFCSolver solver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, mode};
+            DGraphNode* n = grid.at(0, 0);
+            n->set_domain(domain);
+
+            std::map<int, int> counts{};
+            const int n_samples = 100000;
+            for (int i = 0; i < n_samples; ++i)
+                ++counts[solver.weighted_pick_domain(n).value];
+
+            for (int id : live)
+                assert(std::abs(counts[id] / (float)n_samples - (id + 1) / live_weight) < 0.01f);
+            assert(counts.size() == live.size());
+        }
+    }
+}
+
+void wfc_solver_trail_rewind() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{8};
+    const PatternMap patterns = make_random_patterns(30, 5, 3, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    auto domain_set = [](const DGraphNode* n) {
+        std::set<int> out{};
+        for (auto v : n->domain)
+            out.insert(v.value);
+        return out;
+    };
+
+    for (auto mode : {SolverDomainMode::Vector, SolverDomainMode::Bitset}) {
+        ev2::pcg::NodeGrid grid{6, 6};
+        grid.reset_domains(values);
+        std::mt19937 gen{1};
+        WFCSolver solver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, mode};
+        solver.set_trail_enabled(true);
+
+        solver.propagate(grid.at(0, 0));
+        std::vector<std::set<int>> before{};
+        for (int y = 0; y < 6; ++y)
+            for (int x = 0; x < 6; ++x)
+                before.push_back(domain_set(grid.at(x, y)));
+
+        const std::size_t mark = solver.trail_size();
+        solver.step_wfc(grid.at(2, 3));
+        solver.step_wfc(grid.at(4, 1));
+        solver.ban(grid.at(5, 5), grid.at(5, 5)->domain.front());
+        assert(solver.trail_size() > mark);
+
+        solver.rewind(mark);
+        assert(solver.trail_size() == mark);
+        for (int y = 0, i = 0; y < 6; ++y)
+            for (int x = 0; x < 6; ++x, ++i) {
+                assert(domain_set(grid.at(x, y)) == before[i]);
+                assert(solver.domain_size(grid.at(x, y)) == before[i].size());
+            }
+    }
+}
+
+void wfc_backtracking_solver() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    // A needs two B neighbors and B needs an A neighbor. On a line of three nodes only B A B works,
+    // picking A at either end is a dead end.
+    PatternMap patterns = make_pattern_map({Pattern{1, {2, 2}, 10.f}, Pattern{2, {1}, 1.f}});
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    for (auto mode : {SolverDomainMode::Vector, SolverDomainMode::Bitset}) {
+        for (unsigned seed = 0; seed < 20; ++seed) {
+            ev2::pcg::NodeGrid grid{1, 3};
+            grid.reset_domains(values);
+            std::mt19937 gen{seed};
+            WFCSolver solver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, mode};
+            BacktrackingSolver backtracking{solver};
+
+            const std::vector<DGraphNode*> order{grid.at(0, 0), grid.at(0, 1), grid.at(0, 2)};
+            assert(backtracking.solve(order));
+            assert((grid.at(0, 0)->domain == std::vector{Val{2, 2}}));
+            assert((grid.at(0, 1)->domain == std::vector{Val{1, 1}}));
+            assert((grid.at(0, 2)->domain == std::vector{Val{2, 2}}));
+            assert(!solver.is_trail_enabled() && solver.trail_size() == 0);
+        }
+    }
+
+    // no solution, every branch is exhausted
+    PatternMap impossible = make_pattern_map({Pattern{1, {1, 1, 1}}});
+    ev2::pcg::NodeGrid grid{2, 2};
+    grid.reset_domains(domain_from_patterns(impossible));
+    std::mt19937 gen{0};
+    WFCSolver solver{&grid.get_graph(), impossible, gen, true, SolverValidMode::Correct};
+    BacktrackingSolver backtracking{solver};
+    const std::vector<DGraphNode*> order{grid.at(0, 0), grid.at(1, 0), grid.at(0, 1), grid.at(1, 1)};
+    assert(!backtracking.solve(order));
+}
+
+/**
+ * @brief remove invalid values everywhere until nothing changes
+ * 
+ * @param grid 
+ * @param solver 
+ */
+void full_fixed_point(ev2::pcg::NodeGrid& grid, WFCSolver& solver) {
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (int y = 0; y < grid.height; ++y)
+            for (int x = 0; x < grid.width; ++x)
+                changed |= solver.update_domain(grid.at(x, y));
+    }
+}
+
+void wfc_solver_incremental_fixed_point() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    auto domain_set = [](const DGraphNode* n) {
+        std::set<int> out{};
+        for (auto v : n->domain)
+            out.insert(v.value);
+        return out;
+    };
+
+    for (unsigned seed = 0; seed < 4; ++seed) {
+        std::mt19937 pattern_gen{seed};
+        const PatternMap patterns = make_random_patterns(30, 5, 3, pattern_gen);
+        const std::vector<Val> values = domain_from_patterns(patterns);
+
+        for (auto mode : {SolverDomainMode::Vector, SolverDomainMode::Bitset}) {
+            ev2::pcg::NodeGrid grid_i{7, 7};
+            ev2::pcg::NodeGrid grid_f{7, 7};
+            grid_i.reset_domains(values);
+            grid_f.reset_domains(values);
+            std::mt19937 gen_i{seed};
+            std::mt19937 gen_f{seed};
+            WFCSolver incremental{&grid_i.get_graph(), patterns, gen_i, true, SolverValidMode::Correct, mode};
+            WFCSolver full{&grid_f.get_graph(), patterns, gen_f, true, SolverValidMode::Correct};
+            incremental.set_propagation_mode(SolverPropagationMode::Incremental);
+
+            // first propagation from every node revises the whole grid
+            for (int y = 0; y < 7; ++y)
+                for (int x = 0; x < 7; ++x)
+                    incremental.propagate(grid_i.at(x, y));
+            full_fixed_point(grid_f, full);
+
+            // observe in the incremental solver, copy the pick to the reference
+            for (int step = 0; step < 49; ++step) {
+                for (int y = 0; y < 7; ++y)
+                    for (int x = 0; x < 7; ++x)
+                        assert(domain_set(grid_i.at(x, y)) == domain_set(grid_f.at(x, y)));
+
+                DGraphNode* n = grid_i.at((step * 3) % 7, step / 7);
+                if (incremental.domain_size(n) <= 1)
+                    continue;
+                incremental.observe(n);
+                incremental.propagate(n);
+
+                grid_f.at((step * 3) % 7, step / 7)->set_value(n->domain[0]);
+                full_fixed_point(grid_f, full);
+            }
+        }
+    }
+}
+
+void wfc_solver_incremental_reset_supports() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    for (unsigned seed = 0; seed < 10; ++seed) {
+        std::mt19937 pattern_gen{seed};
+        const PatternMap patterns = make_random_patterns(30, 5, 3, pattern_gen);
+        const std::vector<Val> values = domain_from_patterns(patterns);
+
+        for (auto mode : {SolverDomainMode::Vector, SolverDomainMode::Bitset}) {
+            ev2::pcg::NodeGrid grid{7, 7};
+            grid.reset_domains(values);
+            std::mt19937 gen{seed};
+            WFCSolver solver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, mode};
+            solver.set_propagation_mode(SolverPropagationMode::Incremental);
+
+            for (int y = 0; y < 7; ++y)
+                for (int x = 0; x < 7; ++x)
+                    solver.propagate(grid.at(x, y));
+
+            // supports are rebuilt from the current domains, on a reset and on a mode switch
+            for (int step = 0; step < 49; ++step) {
+                if (step == 10)
+                    solver.reset_supports();
+                if (step == 25)
+                    solver.set_propagation_mode(SolverPropagationMode::Incremental);
+                DGraphNode* n = grid.at((step * 3) % 7, step / 7);
+                if (solver.domain_size(n) <= 1)
+                    continue;
+                solver.observe(n);
+                solver.propagate(n);
+            }
+
+            // nothing is left for a full revision to remove
+            std::mt19937 check_gen{seed};
+            WFCSolver check{&grid.get_graph(), patterns, check_gen, true, SolverValidMode::Correct};
+            for (int y = 0; y < 7; ++y)
+                for (int x = 0; x < 7; ++x)
+                    assert(!check.update_domain(grid.at(x, y)));
+        }
+    }
+}
+
+void wfc_solver_slots_bounded() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{2};
+    const PatternMap patterns = make_random_patterns(20, 4, 2, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    for (auto mode : {SolverPropagationMode::Revisit, SolverPropagationMode::Incremental}) {
+        ev2::pcg::NodeGrid grid{8, 8};
+        std::mt19937 gen_a{1}, gen_b{2};
+        WFCSolver a{&grid.get_graph(), patterns, gen_a, true, SolverValidMode::Correct};
+        WFCSolver b{&grid.get_graph(), patterns, gen_b, true, SolverValidMode::Correct};
+        a.set_propagation_mode(mode);
+        b.set_propagation_mode(mode);
+
+        // two solvers taking turns on the same nodes take each other's slots every time
+        for (int round = 0; round < 50; ++round) {
+            grid.reset_domains(values);
+            a.propagate(grid.at(round % 8, 0));
+            b.propagate(grid.at(0, round % 8));
+            assert(a.slot_count() <= 2 * 64 + 64 + 64);
+            assert(b.slot_count() <= 2 * 64 + 64 + 64);
+        }
+
+        // still a fixed point after the slots were released
+        grid.reset_domains(values);
+        for (int y = 0; y < 8; ++y)
+            for (int x = 0; x < 8; ++x)
+                a.propagate(grid.at(x, y));
+        for (int step = 0; step < 64; ++step) {
+            DGraphNode* n = grid.at(step % 8, step / 8);
+            if (a.domain_size(n) > 1)
+                a.step_wfc(n);
+            b.propagate(n);
+        }
+        std::mt19937 check_gen{0};
+        WFCSolver check{&grid.get_graph(), patterns, check_gen, true, SolverValidMode::Correct};
+        for (int y = 0; y < 8; ++y)
+            for (int x = 0; x < 8; ++x)
+                assert(!check.update_domain(grid.at(x, y)));
+    }
+}
+
+void wfc_solver_csr_snapshot() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{9};
+    const PatternMap patterns = make_random_patterns(40, 6, 3, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    ev2::pcg::NodeGrid grid_s{8, 8};
+    ev2::pcg::NodeGrid grid_c{8, 8};
+    grid_s.reset_domains(values);
+    grid_c.reset_domains(values);
+    CSRGraph<DGraphNode> csr{grid_c.get_graph()};
+
+    std::mt19937 gen_s{4};
+    std::mt19937 gen_c{4};
+    WFCSolver solver_s{&grid_s.get_graph(), patterns, gen_s, true, SolverValidMode::Correct};
+    WFCSolver solver_c{&csr, patterns, gen_c, true, SolverValidMode::Correct};
+
+    solve_grid(grid_s, solver_s);
+    solve_grid(grid_c, solver_c);
+    for (int y = 0; y < 8; ++y)
+        for (int x = 0; x < 8; ++x)
+            assert(grid_s.at(x, y)->domain == grid_c.at(x, y)->domain);
+}
+
+void wfc_solver_static_graph_types() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{13};
+    const PatternMap patterns = make_random_patterns(40, 6, 3, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    auto solve = [&](auto make_solver) {
+        ev2::pcg::NodeGrid grid{9, 9};
+        grid.reset_domains(values);
+        std::mt19937 gen{6};
+        auto solver = make_solver(grid, gen);
+        for (int y = 0; y < grid.height; ++y)
+            for (int x = 0; x < grid.width; ++x)
+                if (solver.domain_size(grid.at(x, y)) > 1)
+                    solver.step_wfc(grid.at(x, y));
+
+        std::vector<std::vector<Val>> domains{};
+        for (int y = 0; y < grid.height; ++y)
+            for (int x = 0; x < grid.width; ++x)
+                domains.push_back(grid.at(x, y)->domain);
+        return domains;
+    };
+
+    const auto virtual_graph = solve([&](ev2::pcg::NodeGrid& grid, std::mt19937& gen) {
+        return WFCSolver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct};
+    });
+    const auto sparse_graph = solve([&](ev2::pcg::NodeGrid& grid, std::mt19937& gen) {
+        return BasicWFCSolver<SparseGraph<DGraphNode>>{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct};
+    });
+    const auto grid_graph = solve([&](ev2::pcg::NodeGrid& grid, std::mt19937& gen) {
+        return BasicWFCSolver<GridGraph<DGraphNode>>{&grid.get_grid_graph(), patterns, gen, true, SolverValidMode::Correct};
+    });
+    assert(sparse_graph == virtual_graph);
+    assert(grid_graph == virtual_graph);
+
+    // grid graph matches the sparse graph of the same grid
+    ev2::pcg::NodeGrid grid{5, 5};
+    for (int y = 0; y < 5; ++y)
+        for (int x = 0; x < 5; ++x) {
+            const auto expected = grid.get_graph().adjacent_nodes(grid.at(x, y));
+            assert(grid.get_grid_graph().adjacent_nodes(grid.at(x, y)) == expected);
+            for (auto* n : expected)
+                assert(grid.get_grid_graph().adjacent(grid.at(x, y), n) == 1.f);
+        }
+    assert(grid.get_grid_graph().adjacent(grid.at(0, 0), grid.at(4, 4)) == 0.f);
+    assert_throws(grid.get_grid_graph().remove_node(grid.at(0, 0)), std::runtime_error);
+}
+
+void wfc_solver_parallel_deterministic() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{5};
+    const PatternMap patterns = make_random_patterns(40, 6, 3, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    for (auto mode : {SolverDomainMode::Vector, SolverDomainMode::Bitset}) {
+        std::vector<std::vector<int>> reference{};
+        std::uint64_t reference_contradictions = 0;
+        for (unsigned n_threads : {1u, 2u, 4u, 8u}) {
+            ev2::pcg::NodeGrid grid{12, 12};
+            grid.reset_domains(values);
+            std::mt19937 gen{11};
+            WFCSolver solver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, mode};
+            solver.set_propagation_mode(SolverPropagationMode::Parallel);
+            solver.set_thread_pool(std::make_shared<ThreadPool>(n_threads));
+            solver.set_parallel_min_wave(1); // use the pool for every wave
+
+            solve_grid(grid, solver);
+
+            std::vector<std::vector<int>> domains{};
+            for (int y = 0; y < grid.height; ++y)
+                for (int x = 0; x < grid.width; ++x) {
+                    std::vector<int> d{};
+                    for (auto v : grid.at(x, y)->domain)
+                        d.push_back(v.value);
+                    domains.push_back(d);
+                    assert(d.size() <= 1);
+                }
+
+            if (n_threads == 1) {
+                reference = domains;
+                reference_contradictions = solver.get_contradiction_count();
+            }
+            assert(domains == reference);
+            assert(solver.get_contradiction_count() == reference_contradictions);
+        }
+    }
+}
+
+void wfc_grid_solver_matches_node_grid() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{17};
+    const PatternMap patterns = make_random_patterns(70, 6, 3, pattern_gen); // two domain words
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    for (int size : {1, 7, 11}) {
+        ev2::pcg::NodeGrid grid{size, size};
+        grid.reset_domains(values);
+        std::mt19937 gen_n{3};
+        BasicWFCSolver<GridGraph<DGraphNode>> node_solver{&grid.get_grid_graph(), patterns, gen_n, true,
+            SolverValidMode::Correct, SolverDomainMode::Bitset};
+
+        std::mt19937 gen_g{3};
+        GridWFCSolver grid_solver{size, size, patterns, gen_g};
+        grid_solver.reset_domains(values);
+        assert(grid_solver.words_per_cell() == 2);
+
+        std::array<int, 4> adjacent;
+        for (int c = 0; c < size * size; ++c) {
+            DGraphNode* node = grid.at(c / size, c % size);
+            const int n = grid_solver.neighbors(c, adjacent.data());
+            const auto expected = grid.get_grid_graph().adjacent_span(node);
+            assert(n == (int)expected.size());
+            for (int j = 0; j < n; ++j)
+                assert(grid.at(adjacent[j] / size, adjacent[j] % size) == expected[j]);
+        }
+
+        // same cell order and seed, every domain stays the same after each step
+        for (int c = 0; c < size * size; ++c) {
+            DGraphNode* node = grid.at(c / size, c % size);
+            assert((int)node_solver.domain_size(node) == grid_solver.domain_size(c));
+            if (grid_solver.domain_size(c) > 1) {
+                node_solver.step_wfc(node);
+                grid_solver.step_wfc(c);
+            }
+            for (int k = 0; k < size * size; ++k) {
+                const DGraphNode* other = grid.at(k / size, k % size);
+                assert(other->domain == grid_solver.domain_values(k));
+                assert(std::abs(node_solver.node_entropy(other) - grid_solver.cell_entropy(k)) < 1e-3f);
+            }
+        }
+        assert(node_solver.get_contradiction_count() == grid_solver.get_contradiction_count());
+    }
+
+    // a cell without neighbors only keeps patterns without requirements
+    std::mt19937 gen{1};
+    GridWFCSolver single{1, 1, make_pattern_map({Pattern{1, {}}, Pattern{2, {1}}}), gen};
+    single.reset_domains();
+    assert(single.update_domain(0));
+    assert(single.domain_size(0) == 1 && single.solved_index(0) == single.get_pattern_table().index_of(1));
+    assert(single.ban(0, Val{1, 1}));
+    assert(single.domain_size(0) == 0 && single.get_contradiction_count() == 1);
+    assert_throws(GridWFCSolver(0, 4, PatternMap{}, gen), std::logic_error);
+}
+
+void wfc_voxel_solver_layout() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 gen{1};
+    const PatternMap patterns = make_pattern_map({Pattern{1, {}}});
+    VoxelWFCSolver solver{10, 9, 3, VoxelNeighborhood::Faces, patterns, gen};
+    assert(solver.get_n_cells() == 270);
+    assert(solver.get_n_stored_cells() == 2 * 2 * 1 * VoxelWFCSolver::brick_cells);
+
+    // every cell has its own storage index and the cells of a 2x2x2 block are consecutive
+    std::set<int> seen{};
+    for (int z = 0; z < 3; ++z)
+        for (int y = 0; y < 9; ++y)
+            for (int x = 0; x < 10; ++x) {
+                const int c = solver.cell(x, y, z);
+                assert(seen.insert(c).second);
+                assert(solver.contains(c));
+                assert((solver.position(c) == std::array<int, 3>{x, y, z}));
+                if (x % 2 == 0 && y % 2 == 0 && z % 2 == 0 && x < 8 && y < 8 && z < 2)
+                    assert(solver.cell(x + 1, y + 1, z + 1) == c + 7);
+            }
+    int padding = 0;
+    for (int c = 0; c < solver.get_n_stored_cells(); ++c)
+        padding += !solver.contains(c);
+    assert(padding == solver.get_n_stored_cells() - solver.get_n_cells());
+
+    for (auto neighborhood : {VoxelNeighborhood::Faces, VoxelNeighborhood::Full}) {
+        VoxelWFCSolver voxels{10, 9, 3, neighborhood, patterns, gen};
+        std::array<int, CellWFCSolver::max_neighbors> adjacent, back;
+        for (int c : seen) {
+            const int n = voxels.neighbors(c, adjacent.data());
+            const auto p = voxels.position(c);
+            int expected = 0;
+            for (int dz = -1; dz <= 1; ++dz)
+                for (int dy = -1; dy <= 1; ++dy)
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        const int d = std::abs(dx) + std::abs(dy) + std::abs(dz);
+                        const bool inside = p[0] + dx >= 0 && p[0] + dx < 10 && p[1] + dy >= 0 && p[1] + dy < 9 && p[2] + dz >= 0 && p[2] + dz < 3;
+                        expected += inside && d > 0 && (neighborhood == VoxelNeighborhood::Full || d == 1);
+                    }
+            assert(n == expected);
+            for (int j = 0; j < n; ++j) {
+                const int m = voxels.neighbors(adjacent[j], back.data());
+                assert(std::count(back.begin(), back.begin() + m, c) == 1);
+            }
+        }
+        assert(voxels.neighbors(voxels.cell(0, 0, 0), adjacent.data()) == (neighborhood == VoxelNeighborhood::Faces ? 3 : 7));
+    }
+    assert_throws(VoxelWFCSolver(4, 0, 4, VoxelNeighborhood::Faces, patterns, gen), std::logic_error);
+}
+
+void wfc_voxel_solver_matches_graph() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{19};
+    const PatternMap patterns = make_random_patterns(40, 6, 5, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    for (auto neighborhood : {VoxelNeighborhood::Faces, VoxelNeighborhood::Full}) {
+        std::mt19937 gen_v{4};
+        VoxelWFCSolver voxels{5, 4, 3, neighborhood, patterns, gen_v};
+        voxels.reset_domains(values);
+
+        // the same topology as a directed graph, neighbors added in the voxel order
+        std::unordered_map<int, std::unique_ptr<DGraphNode>> nodes{};
+        for (int c = 0; c < voxels.get_n_stored_cells(); ++c)
+            if (voxels.contains(c)) {
+                nodes[c] = std::make_unique<DGraphNode>(std::to_string(c), c + 1);
+                nodes[c]->set_domain(values);
+            }
+        SparseGraph<DGraphNode> graph{true};
+        std::array<int, CellWFCSolver::max_neighbors> adjacent;
+        for (auto& [c, node] : nodes) {
+            const int n = voxels.neighbors(c, adjacent.data());
+            for (int j = 0; j < n; ++j)
+                graph.add_edge(node.get(), nodes[adjacent[j]].get(), 1.f);
+        }
+        std::mt19937 gen_g{4};
+        BasicWFCSolver<SparseGraph<DGraphNode>> solver{&graph, patterns, gen_g, true, SolverValidMode::Correct, SolverDomainMode::Bitset};
+
+        for (int c = 0; c < voxels.get_n_stored_cells(); ++c) {
+            if (!voxels.contains(c) || voxels.domain_size(c) <= 1)
+                continue;
+            voxels.step_wfc(c);
+            solver.step_wfc(nodes[c].get());
+            for (auto& [k, node] : nodes)
+                assert(node->domain == voxels.domain_values(k));
+        }
+        assert(solver.get_contradiction_count() == voxels.get_contradiction_count());
+    }
+}
+
+void wfc_adjacency_tiles() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    // land, coast and sea, land never touches sea
+    const PatternMap tiles = make_pattern_map({Pattern{1, {}, 1.f}, Pattern{2, {}, 0.5f}, Pattern{3, {}, 1.f}});
+    auto make_rules = [](int n_directions) {
+        AdjacencyRules rules{n_directions};
+        rules.allow_all_directions(1, 1);
+        rules.allow_all_directions(1, 2);
+        rules.allow_all_directions(2, 2);
+        rules.allow_all_directions(2, 3);
+        rules.allow_all_directions(3, 3);
+        return rules;
+    };
+
+    std::mt19937 gen{5};
+    GridWFCSolver grid{16, 12, tiles, gen};
+    grid.reset_domains();
+    assert(grid.get_constraint_model() == CellConstraintModel::Patterns);
+    grid.set_adjacency_rules(make_rules(GridWFCSolver::n_directions));
+    assert(grid.get_constraint_model() == CellConstraintModel::Adjacency);
+    assert(grid.solve() == 0);
+    assert(grid.get_contradiction_count() == 0);
+    for (int c = 0; c < grid.get_n_cells(); ++c)
+        for (int d = 0; d < GridWFCSolver::n_directions; ++d) {
+            const int n = grid.neighbor(c, d);
+            if (n >= 0) {
+                assert(grid.neighbor(n, grid.opposite_direction(d)) == c);
+                assert(grid.adjacency_allowed(grid.solved_index(c), d, grid.solved_index(n)));
+                assert(std::abs(grid.domain_values(c)[0].value - grid.domain_values(n)[0].value) <= 1);
+            }
+        }
+
+    for (auto neighborhood : {VoxelNeighborhood::Faces, VoxelNeighborhood::Full}) {
+        VoxelWFCSolver voxels{9, 6, 5, neighborhood, tiles, gen};
+        voxels.reset_domains();
+        voxels.set_adjacency_rules(make_rules((int)neighborhood));
+        assert(voxels.solve() == 0);
+        for (int c = 0; c < voxels.get_n_stored_cells(); ++c)
+            for (int d = 0; d < voxels.get_n_directions(); ++d) {
+                const int n = voxels.neighbor(c, d);
+                assert(n < 0 || voxels.contains(c));
+                if (n >= 0) {
+                    assert(voxels.neighbor(n, voxels.opposite_direction(d)) == c);
+                    assert(voxels.adjacency_allowed(voxels.solved_index(c), d, voxels.solved_index(n)));
+                }
+            }
+    }
+
+    assert_throws(grid.set_adjacency_rules(make_rules(6)), std::logic_error);
+    grid.clear_adjacency_rules();
+    assert(grid.get_constraint_model() == CellConstraintModel::Patterns);
+}
+
+/**
+ * @brief support counting gives the same domains as revising every cell until nothing changes
+ *
+ */
+void wfc_adjacency_supports_match_revise() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    auto check = [](auto& a, auto& b, const std::vector<int>& cells, int n_directions, const PatternMap& patterns) {
+        std::mt19937 rule_gen{9};
+        std::bernoulli_distribution allow{0.2};
+        AdjacencyRules rules{n_directions};
+        for (const auto& [id_a, pa] : patterns)
+            for (int d = 0; d < n_directions; ++d)
+                for (const auto& [id_b, pb] : patterns)
+                    if (allow(rule_gen))
+                        rules.allow(id_a, d, id_b);
+        a.reset_domains();
+        b.reset_domains();
+        a.set_adjacency_rules(rules);
+        b.set_adjacency_rules(rules);
+
+        auto revise_all = [&]() {
+            for (bool changed = true; changed;) {
+                changed = false;
+                for (int c : cells)
+                    changed |= b.update_domain(c);
+            }
+        };
+
+        int narrowed = 0; // cells that lost values before they were observed
+        for (int c : cells) {
+            narrowed += a.domain_size(c) < (int)patterns.size();
+            if (a.domain_size(c) <= 1)
+                continue;
+            a.observe(c);
+            const Val picked = a.domain_values(c)[0];
+            for (const Val& v : b.domain_values(c))
+                if (!(v == picked))
+                    b.ban(c, v);
+            a.propagate(c);
+            revise_all();
+            for (int k : cells) {
+                assert(a.domain_values(k) == b.domain_values(k));
+                assert(!a.update_domain(k)); // already arc consistent
+            }
+        }
+        return narrowed;
+    };
+
+    std::mt19937 pattern_gen{2};
+    const PatternMap patterns = make_random_patterns(12, 4, 0, pattern_gen);
+
+    std::mt19937 gen_a{8}, gen_b{8};
+    GridWFCSolver grid_a{7, 6, patterns, gen_a}, grid_b{7, 6, patterns, gen_b};
+    std::vector<int> cells(grid_a.get_n_cells());
+    std::iota(cells.begin(), cells.end(), 0);
+    assert(check(grid_a, grid_b, cells, GridWFCSolver::n_directions, patterns) > 0);
+
+    for (auto neighborhood : {VoxelNeighborhood::Faces, VoxelNeighborhood::Full}) {
+        VoxelWFCSolver voxels_a{4, 3, 3, neighborhood, patterns, gen_a}, voxels_b{4, 3, 3, neighborhood, patterns, gen_b};
+        cells.clear();
+        for (int c = 0; c < voxels_a.get_n_stored_cells(); ++c)
+            if (voxels_a.contains(c))
+                cells.push_back(c);
+        assert(check(voxels_a, voxels_b, cells, (int)neighborhood, patterns) > 0);
+    }
+}
+
+/**
+ * @brief chunk seams satisfy the constraints, results do not depend on threads or on chunks being
+ *  evicted and read back
+ *
+ */
+void wfc_chunked_world() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    const auto root = std::filesystem::temp_directory_path() / "wfc_chunked_world_test";
+    std::filesystem::remove_all(root);
+
+    const PatternMap patterns = make_pattern_map({Pattern{1, {}, 2.f}, Pattern{2, {1}, 1.f}, Pattern{3, {1, 2}, 0.5f}});
+    const PatternMap tiles = make_pattern_map({Pattern{1, {}, 1.f}, Pattern{2, {}, 0.5f}, Pattern{3, {}, 1.f}});
+    AdjacencyRules rules{GridWFCSolver::n_directions};
+    rules.allow_all_directions(1, 1);
+    rules.allow_all_directions(1, 2);
+    rules.allow_all_directions(2, 2);
+    rules.allow_all_directions(2, 3);
+    rules.allow_all_directions(3, 3);
+
+    const int chunk_size = 8, cx0 = -2, cy0 = -1, cx1 = 3, cy1 = 3;
+    const int x0 = cx0 * chunk_size, y0 = cy0 * chunk_size;
+    const int width = (cx1 - cx0) * chunk_size, height = (cy1 - cy0) * chunk_size;
+
+    for (bool adjacency : {false, true}) {
+        const PatternMap& pm = adjacency ? tiles : patterns;
+        auto make_world = [&](const std::string& name, std::size_t max_resident, unsigned n_threads) {
+            auto world = std::make_unique<ChunkedWorld>(chunk_size, pm, root / name, 7, max_resident);
+            if (adjacency)
+                world->set_adjacency_rules(rules);
+            world->set_thread_pool(std::make_shared<ThreadPool>(n_threads));
+            world->set_max_attempts(64); // without lookahead the pattern model often empties a cell of a chunk
+            return world;
+        };
+
+        const std::string tag = adjacency ? "adjacency" : "patterns";
+        auto world = make_world(tag + "_1", 64, 1);
+        assert(!world->is_solved(0, 0) && world->value_at(0, 0) == -1);
+        const auto& stats = world->generate(cx0, cy0, cx1, cy1);
+        assert(stats.chunks == (std::uint64_t)(cx1 - cx0) * (cy1 - cy0));
+        assert(stats.failed_cells == 0);
+        assert(world->is_solved(cx0, cy0) && !world->is_solved(cx1, cy1));
+
+        // every cell of the region is valid with its neighbors across chunk seams
+        std::mt19937 gen{1};
+        GridWFCSolver check{width, height, pm, gen};
+        if (adjacency)
+            check.set_adjacency_rules(rules);
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x) {
+                const int id = world->value_at(x0 + x, y0 + y);
+                assert(id >= 0);
+                check.set_domain(check.cell(y, x), {world->get_pattern_table().value(world->get_pattern_table().index_of(id))});
+            }
+        for (int y = 1; y + 1 < height; ++y)
+            for (int x = 1; x + 1 < width; ++x)
+                assert(!check.update_domain(check.cell(y, x)) && check.domain_size(check.cell(y, x)) == 1);
+
+        // same world with more threads and a cache smaller than the region
+        auto threaded = make_world(tag + "_3", 3, 3);
+        threaded->generate(cx0, cy0, cx1, cy1);
+        assert(threaded->resident_chunks() <= 3);
+        for (int y = y0; y < y0 + height; ++y)
+            for (int x = x0; x < x0 + width; ++x)
+                assert(threaded->value_at(x, y) == world->value_at(x, y));
+        assert(threaded->resident_chunks() <= 3 && threaded->get_stats().chunk_reads > 0);
+
+        // chunks on disk are solved for a new world over the same directory
+        auto reloaded = make_world(tag + "_1", 2, 1);
+        assert(reloaded->generate(cx0, cy0, cx1, cy1).chunks == 0);
+        for (int y = y0; y < y0 + height; ++y)
+            for (int x = x0; x < x0 + width; ++x)
+                assert(reloaded->value_at(x, y) == world->value_at(x, y));
+
+        // growing the world later keeps the seams with chunks solved before
+        world->generate(cx1, cy0, cx1 + 1, cy1);
+        for (int y = y0 + 1; y + 1 < y0 + height; ++y) {
+            const int a = world->value_at(cx1 * chunk_size - 1, y), b = world->value_at(cx1 * chunk_size, y);
+            assert(a >= 0 && b >= 0);
+            if (adjacency)
+                assert(std::abs(a - b) <= 1);
+        }
+        assert(world->get_stats().failed_cells == 0);
+    }
+
+    // rules set after a generate() apply to the chunks solved later
+    {
+        ChunkedWorld world{chunk_size, tiles, root / "late_rules", 7};
+        world.set_thread_pool(std::make_shared<ThreadPool>(1));
+        world.generate(0, 0, 1, 1);
+        world.set_adjacency_rules(rules);
+        world.generate(4, 4, 5, 5);
+        assert(world.get_stats().failed_cells == 0);
+        for (int y = 4 * chunk_size; y < 5 * chunk_size; ++y)
+            for (int x = 4 * chunk_size; x + 1 < 5 * chunk_size; ++x)
+                assert(std::abs(world.value_at(x, y) - world.value_at(x + 1, y)) <= 1);
+    }
+
+    assert_throws(ChunkedWorld(1, patterns, root / "invalid"), std::logic_error);
+    std::filesystem::remove_all(root);
+}
+
+/**
+ * @brief undirected graph of disjoint grid components, each width x height with 4 neighbors
+ *
+ */
+struct ComponentGraph {
+    std::vector<std::unique_ptr<DGraphNode>> nodes{};
+    SparseGraph<DGraphNode> graph{false};
+
+    void add_grid(int width, int height) {
+        const int base = (int)nodes.size();
+        for (int i = 0; i < width * height; ++i)
+            nodes.push_back(std::make_unique<DGraphNode>("n", (int)nodes.size()));
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x) {
+                DGraphNode* a = nodes[base + y * width + x].get();
+                if (x + 1 < width) graph.add_edge(a, nodes[base + y * width + x + 1].get(), 1.f);
+                if (y + 1 < height) graph.add_edge(a, nodes[base + (y + 1) * width + x].get(), 1.f);
+            }
+    }
+
+    void reset_domains(const std::vector<Val>& values) {
+        for (auto& n : nodes)
+            n->set_domain(values);
+    }
+};
+
+void wfc_partition_graph() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    ComponentGraph g{};
+    g.add_grid(30, 20);
+    g.add_grid(8, 8);
+    g.add_grid(2, 1);
+    g.add_grid(50, 1);
+    g.add_grid(2, 1);
+    CSRGraph<DGraphNode> csr{g.graph};
+
+    const int max_part_nodes = 64;
+    const GraphPartition partition = partition_graph(csr, max_part_nodes);
+    assert(partition.n_components == 5);
+    assert(partition.get_n_parts() == 10 + 1 + 1 + 1 + 1);
+    assert((int)partition.part_nodes.size() == csr.get_n_nodes());
+
+    std::vector<int> count(csr.get_n_nodes(), 0);
+    for (int p = 0; p < partition.get_n_parts(); ++p) {
+        const auto nodes = partition.nodes(p);
+        assert(!nodes.empty() && (int)nodes.size() <= max_part_nodes);
+        for (int i : nodes) {
+            ++count[i];
+            assert(partition.part_of[i] == p);
+        }
+    }
+    assert(std::all_of(count.begin(), count.end(), [](int c) {return c == 1;}));
+
+    for (int i = 0; i < csr.get_n_nodes(); ++i) {
+        bool crosses = false;
+        for (int j : csr.neighbors(i)) {
+            crosses = crosses || partition.part_of[j] != partition.part_of[i];
+            assert(partition.part_component[partition.part_of[j]] == partition.part_component[partition.part_of[i]]);
+        }
+        assert(crosses == (partition.halo[i] != 0));
+    }
+
+    // breadth first slices of the 30 x 20 grid only touch the slices before and after them
+    for (int i = 0; i < 600; ++i)
+        for (int j : csr.neighbors(i))
+            assert(std::abs(partition.part_of[i] - partition.part_of[j]) <= 1);
+
+    assert(partition_graph(csr, 1 << 20).get_n_parts() == 5);
+    assert_throws(partition_graph(csr, 0), std::logic_error);
+    SparseGraph<DGraphNode> directed{true};
+    assert_throws(partition_graph(CSRGraph<DGraphNode>{directed}, 4), std::logic_error);
+}
+
+void wfc_solver_partitioned_deterministic() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{5};
+    const PatternMap patterns = make_random_patterns(40, 6, 3, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    ComponentGraph g{};
+    g.add_grid(40, 30);
+    g.add_grid(12, 12);
+    g.add_grid(3, 1);
+    CSRGraph<DGraphNode> csr{g.graph};
+
+    for (auto mode : {SolverDomainMode::Vector, SolverDomainMode::Bitset}) {
+        std::vector<std::vector<Val>> reference{};
+        for (unsigned n_threads : {1u, 2u, 4u}) {
+            g.reset_domains(values);
+            ThreadPool pool{n_threads};
+            PartitionedSolveArgs args{};
+            args.max_part_nodes = 100;
+            args.domain_mode = mode;
+            const auto stats = wfc_solve_partitioned(csr, patterns, 3, pool, args);
+            assert(stats.n_components == 3 && stats.n_parts == 12 + 2 + 1);
+            assert(stats.n_halo_nodes > 0 && stats.n_halo_nodes < csr.get_n_nodes() / 2);
+
+            std::vector<std::vector<Val>> domains{};
+            int empty = 0;
+            for (auto& n : g.nodes) {
+                assert(n->domain.size() <= 1);
+                empty += n->domain.empty();
+                domains.push_back(n->domain);
+            }
+            assert(empty == stats.n_empty);
+
+            if (n_threads == 1)
+                reference = domains;
+            assert(domains == reference);
+        }
+
+        // nodes solved before the call keep their value, even when they conflict with a neighbor,
+        // as long as propagation does not revise solved nodes
+        g.reset_domains(values);
+        std::vector<std::vector<Val>> fixed(g.nodes.size());
+        for (std::size_t i = 0; i < g.nodes.size(); i += 7) {
+            g.nodes[i]->set_domain(std::vector<Val>{values[(i / 7) % values.size()]});
+            fixed[i] = g.nodes[i]->domain;
+        }
+        ThreadPool pool{2};
+        PartitionedSolveArgs args{};
+        args.max_part_nodes = 100;
+        args.domain_mode = mode;
+        args.constraint_prop_solved = false;
+        wfc_solve_partitioned(csr, patterns, 3, pool, args);
+        for (std::size_t i = 0; i < g.nodes.size(); i += 7)
+            assert(g.nodes[i]->domain == fixed[i]);
+
+        // nodes starting on different subsets of the patterns only ever get a value of their own
+        // subset, also when reconciling a conflict resets them
+        int conflicts = 0;
+        for (std::uint64_t seed = 0; seed < 8; ++seed) {
+            std::mt19937 subset_gen{(unsigned)seed};
+            std::vector<std::vector<Val>> start(g.nodes.size());
+            for (std::size_t i = 0; i < g.nodes.size(); ++i) {
+                start[i] = values;
+                std::shuffle(start[i].begin(), start[i].end(), subset_gen);
+                start[i].resize(values.size() * 3 / 5);
+                std::sort(start[i].begin(), start[i].end(), [](const Val& a, const Val& b) {return a.value < b.value;});
+                g.nodes[i]->set_domain(start[i]);
+            }
+            args.max_part_nodes = 50;
+            args.constraint_prop_solved = true;
+            conflicts += wfc_solve_partitioned(csr, patterns, seed, pool, args).n_conflicts;
+            for (std::size_t i = 0; i < g.nodes.size(); ++i)
+                for (const Val& v : g.nodes[i]->domain)
+                    assert(std::find(start[i].begin(), start[i].end(), v) != start[i].end());
+        }
+        assert(conflicts > 0);
+    }
+}
+
+void wfc_batch_solve_deterministic() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{6};
+    const PatternMap patterns = make_random_patterns(30, 5, 2, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+    const auto table = std::make_shared<const PatternTable>(patterns);
+
+    ev2::pcg::NodeGrid grid{10, 10};
+    grid.reset_domains(values);
+    const CSRGraph<DGraphNode> layout{grid.get_graph()};
+
+    std::vector<std::uint64_t> seeds(12);
+    std::iota(seeds.begin(), seeds.end(), 100);
+    ThreadPool pool_1{1};
+    ThreadPool pool_4{4};
+    const BatchSolveResult a = wfc_solve_batch(layout, table, seeds, pool_1);
+    const BatchSolveResult b = wfc_solve_batch(layout, table, seeds, pool_4);
+
+    // a run only depends on its seed
+    assert(a.runs.size() == seeds.size() && b.runs.size() == seeds.size());
+    bool seeds_differ = false;
+    for (std::size_t r = 0; r < seeds.size(); ++r) {
+        assert(a.runs[r].seed == seeds[r]);
+        assert(a.runs[r].values == b.runs[r].values);
+        assert(a.runs[r].n_empty == b.runs[r].n_empty);
+        assert(a.runs[r].stats.observations == b.runs[r].stats.observations);
+        assert((int)a.runs[r].values.size() == layout.get_n_nodes());
+        seeds_differ |= a.runs[r].values != a.runs[0].values;
+    }
+    assert(seeds_differ);
+
+    // the layout is only read and the table is released by the workers
+    for (int i = 0; i < layout.get_n_nodes(); ++i)
+        assert(layout.node(i)->domain == values);
+    assert(table.use_count() == 1);
+
+    // same as solving the layout directly in node index order
+    ev2::pcg::NodeGrid grid_d{10, 10};
+    grid_d.reset_domains(values);
+    CSRGraph<DGraphNode> direct{grid_d.get_graph()};
+    std::mt19937 gen{(std::uint32_t)ev2::mix64(seeds[3])};
+    BasicWFCSolver<CSRGraph<DGraphNode>> solver{&direct, table, gen, true, SolverValidMode::Correct, SolverDomainMode::Bitset};
+    for (int i = 0; i < direct.get_n_nodes(); ++i)
+        if (solver.domain_size(direct.node(i)) > 1)
+            solver.step_wfc(direct.node(i));
+    for (int i = 0; i < direct.get_n_nodes(); ++i) {
+        const auto& domain = direct.node(i)->domain;
+        assert(a.runs[3].values[i] == (domain.empty() ? -1 : domain[0].value));
+    }
+}
+
+void test_indexed_heap() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    ev2::pcg::IndexedHeap<int, int, float> heap{};
+    std::unordered_map<int, float> reference{}; // key -> priority
+
+    // lowest priority in reference, ties by lowest key since keys are inserted in increasing order here
+    auto reference_top = [&reference]() {
+        auto best = reference.begin();
+        for (auto itr = reference.begin(); itr != reference.end(); ++itr)
+            if (itr->second < best->second || (itr->second == best->second && itr->first < best->first))
+                best = itr;
+        return best->first;
+    };
+
+    std::mt19937 gen{21};
+    std::uniform_int_distribution<int> op_dist{0, 3};
+    std::uniform_int_distribution<int> priority_dist{0, 50};
+    int next_key = 0;
+    for (int i = 0; i < 5000; ++i) {
+        const int op = op_dist(gen);
+        if (op == 0 || reference.empty()) {
+            const float p = (float)priority_dist(gen);
+            assert(heap.push(next_key, next_key * 10, p));
+            reference[next_key++] = p;
+        } else if (op == 1) { // change priority of a random key, up or down
+            auto itr = std::next(reference.begin(), gen() % reference.size());
+            itr->second = (float)priority_dist(gen);
+            assert(heap.update(itr->first, itr->second));
+        } else if (op == 2) {
+            auto itr = std::next(reference.begin(), gen() % reference.size());
+            assert(heap.remove(itr->first));
+            assert(!heap.contains(itr->first));
+            reference.erase(itr);
+        } else {
+            const int key = reference_top();
+            assert(heap.top_priority() == reference[key]);
+            assert(heap.pop() == key * 10);
+            reference.erase(key);
+        }
+        assert(heap.size() == reference.size());
+    }
+
+    assert(!heap.update(-1, 0.f));
+    assert(!heap.remove(-1));
+}
+
+void test_flat_hash_map() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    ev2::FlatHashMap<int> map{};
+    std::unordered_map<std::uint64_t, int> reference{};
+    assert(map.empty() && map.find(0) == nullptr && !map.erase(0));
+
+    // few distinct keys so that inserts and erases hit the same probe runs
+    std::mt19937 gen{21};
+    std::uniform_int_distribution<int> key_dist{0, 400};
+    for (int op = 0; op < 20000; ++op) {
+        const std::uint64_t key = ev2::pack_key(key_dist(gen), key_dist(gen) % 4);
+        if (op % 3 == 2) {
+            assert(map.erase(key) == (reference.erase(key) == 1));
+        } else {
+            auto [value, inserted] = map.try_emplace(key, op);
+            assert(inserted == reference.insert({key, op}).second);
+            assert(*value == reference.at(key));
+        }
+        assert(map.size() == reference.size());
+    }
+    for (const auto& [key, value] : reference)
+        assert(map.find(key) && *map.find(key) == value);
+
+    std::size_t visited = 0;
+    map.for_each([&](std::uint64_t key, int value) {
+        assert(reference.at(key) == value);
+        ++visited;
+    });
+    assert(visited == reference.size());
+
+    map[ev2::pack_key(-1, -1)] = 5;
+    assert(*map.find(ev2::pack_key(-1, -1)) == 5);
+    map.clear();
+    assert(map.empty() && !map.contains(ev2::pack_key(-1, -1)));
+}
+
+#ifdef ENABLE_TESTS
+void wfc_solver_propagate_no_alloc() {
+    std::cout << __FUNCTION__ << std::endl;
+
+    std::mt19937 pattern_gen{3};
+    const PatternMap patterns = make_random_patterns(40, 6, 2, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    for (auto mode : {SolverDomainMode::Vector, SolverDomainMode::Bitset}) {
+        ev2::pcg::NodeGrid grid{8, 8};
+        grid.reset_domains(values);
+        std::mt19937 gen{17};
+        WFCSolver solver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, mode};
+
+        // warm up, every node gets a slot and scratch buffers reach their size
+        for (int y = 0; y < grid.height; ++y)
+            for (int x = 0; x < grid.width; ++x)
+                solver.propagate(grid.at(x, y));
+
+        // one observe to size the weighted pick scratch buffers
+        solver.observe(grid.at(0, 0));
+
+        std::size_t step_allocations = 0;
+        for (int y = 0; y < grid.height; ++y)
+            for (int x = 0; x < grid.width; ++x) {
+                DGraphNode* n = grid.at(x, y);
+                const std::size_t before = g_allocation_count;
+                solver.observe(n);
+                solver.propagate(n);
+                step_allocations += g_allocation_count - before;
+            }
+        assert(step_allocations == 0);
+    }
+}
+#endif // ENABLE_TESTS
+
 float perf_validity(int n_nodes, int n_domains, int n_requirements) {
     // std::cout << __FUNCTION__ << std::endl;
 
@@ -850,6 +2543,687 @@ void perf_exp(const PerfExp& exp) {
 
 }
 
+/**
+ * @brief time full grid solves in each domain representation
+ * 
+ */
+void perf_domain_mode() {
+    const int n_samples = 3;
+    const int grid_size = 8;
+
+    std::cout << "Mode" << "\t" << "NPatterns" << "\t" << "NCells" << "\t" << "Time(ms)" << "\n";
+    for (int n_patterns : {16, 64, 256}) {
+        for (int sample = 0; sample < n_samples; ++sample) {
+            std::mt19937 pattern_gen{(unsigned)sample};
+            const PatternMap patterns = make_random_patterns(n_patterns, 8, 2, pattern_gen);
+            const std::vector<Val> values = domain_from_patterns(patterns);
+
+            for (auto mode : {SolverDomainMode::Vector, SolverDomainMode::Bitset}) {
+                ev2::pcg::NodeGrid grid{grid_size, grid_size};
+                grid.reset_domains(values);
+                std::mt19937 gen{(unsigned)sample};
+                WFCSolver solver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, mode};
+
+                Timer timer{"solve_grid", false};
+                solve_grid(grid, solver);
+                timer.stop();
+
+                std::cout << (mode == SolverDomainMode::Vector ? "Vector" : "Bitset") << "\t" << n_patterns << "\t"
+                          << grid_size * grid_size << "\t" << timer.elapsed_ms() << std::endl;
+            }
+        }
+    }
+}
+
+/**
+ * @brief compare exact validity against the tiered prefilter on random neighborhoods
+ * 
+ */
+void perf_validity_tiered() {
+    const int n_trials = 20000;
+
+    std::cout << "NNodes" << "\t" << "NReq" << "\t" << "ExactTime(ms)" << "\t" << "TieredTime(ms)" << "\t"
+              << "RejectedCount" << "\t" << "RejectedHall" << "\t" << "SkippedFraction" << "\n";
+    for (int n_nodes : {4, 8, 16, 32}) {
+        for (int n_req : {2, 4, 8}) {
+            if (n_req > n_nodes)
+                continue;
+            std::mt19937 gen{(unsigned)(n_nodes * 31 + n_req)};
+            std::uniform_int_distribution<int> type_dist{1, 12};
+            std::uniform_int_distribution<int> domain_dist{1, 4};
+
+            std::vector<std::vector<unique_ptr<DGraphNode>>> node_sets(n_trials);
+            std::vector<std::vector<DGraphNode*>> neighborhoods(n_trials);
+            std::vector<Pattern> patterns{};
+            for (int t = 0; t < n_trials; ++t) {
+                for (int i = 0; i < n_nodes; ++i) {
+                    node_sets[t].push_back(make_unique<DGraphNode>("N", i));
+                    const int domain_size = domain_dist(gen);
+                    for (int d = 0; d < domain_size; ++d)
+                        node_sets[t].back()->domain.push_back(Val{type_dist(gen), 0});
+                    neighborhoods[t].push_back(node_sets[t].back().get());
+                }
+                std::vector<int> requirements(n_req);
+                for (auto& r : requirements)
+                    r = type_dist(gen);
+                patterns.push_back(Pattern{0, requirements});
+            }
+
+            int exact_valid = 0;
+            Timer exact_timer{"exact", false};
+            for (int t = 0; t < n_trials; ++t)
+                exact_valid += patterns[t].valid(neighborhoods[t]);
+            exact_timer.stop();
+
+            int tiered_valid = 0;
+            ValidityTierStats stats{};
+            Timer tiered_timer{"tiered", false};
+            for (int t = 0; t < n_trials; ++t)
+                tiered_valid += patterns[t].valid_tiered(neighborhoods[t], &stats);
+            tiered_timer.stop();
+
+            assert(exact_valid == tiered_valid);
+            const double skipped = 1.0 - (double)stats.exact / (double)stats.calls;
+            std::cout << n_nodes << "\t" << n_req << "\t" << exact_timer.elapsed_ms() << "\t" << tiered_timer.elapsed_ms() << "\t"
+                      << stats.rejected_count << "\t" << stats.rejected_hall << "\t" << skipped << std::endl;
+        }
+    }
+}
+
+/**
+ * @brief constrained databases, where plain solves often end with empty domains.
+ *  Compare restarting the whole grid until a solve has no empty cells against the backtracking solver.
+ * 
+ */
+void perf_backtracking() {
+    const int n_samples = 5;
+    const int max_restarts = 200;
+
+    std::cout << "Method" << "\t" << "GridSize" << "\t" << "MaxRequirements" << "\t" << "Solved" << "\t"
+              << "Attempts" << "\t" << "Backtracks" << "\t" << "Time(ms)" << "\n";
+    for (int grid_size : {6, 10, 14}) {
+        for (int max_requirements : {2, 3})
+        for (int sample = 0; sample < n_samples; ++sample) {
+            std::mt19937 pattern_gen{(unsigned)(100 + sample)};
+            const PatternMap patterns = make_random_patterns(24, 4, max_requirements, pattern_gen);
+            const std::vector<Val> values = domain_from_patterns(patterns);
+
+            std::vector<DGraphNode*> order{};
+            ev2::pcg::NodeGrid grid{grid_size, grid_size};
+            for (int y = 0; y < grid_size; ++y)
+                for (int x = 0; x < grid_size; ++x)
+                    order.push_back(grid.at(x, y));
+
+            {
+                std::mt19937 gen{(unsigned)sample};
+                Timer timer{"restart", false};
+                int attempts = 0;
+                bool solved = false;
+                while (!solved && attempts < max_restarts) {
+                    ++attempts;
+                    grid.reset_domains(values);
+                    WFCSolver solver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, SolverDomainMode::Bitset};
+                    solved = solve_grid(grid, solver) == 0;
+                }
+                timer.stop();
+                std::cout << "Restart" << "\t" << grid_size << "\t" << max_requirements << "\t" << solved << "\t"
+                          << attempts << "\t" << 0 << "\t" << timer.elapsed_ms() << std::endl;
+            }
+
+            {
+                std::mt19937 gen{(unsigned)sample};
+                Timer timer{"backtracking", false};
+                grid.reset_domains(values);
+                WFCSolver solver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, SolverDomainMode::Bitset};
+                BacktrackingSolver backtracking{solver, 20000};
+                const bool solved = backtracking.solve(order);
+                timer.stop();
+                std::cout << "Backtrack" << "\t" << grid_size << "\t" << max_requirements << "\t" << solved << "\t"
+                          << 1 << "\t" << backtracking.get_stats().backtracks << "\t" << timer.elapsed_ms() << std::endl;
+            }
+        }
+    }
+}
+
+/**
+ * @brief grid solves with full revisits and with incremental support counters
+ * 
+ */
+void perf_incremental() {
+    const int n_samples = 3;
+
+    std::cout << "Mode" << "\t" << "GridSize" << "\t" << "NPatterns" << "\t" << "Time(ms)" << "\t"
+              << "Checks" << "\t" << "Matchings" << "\n";
+    for (int grid_size : {8, 16, 32}) {
+        for (int n_patterns : {32, 128}) {
+            for (int sample = 0; sample < n_samples; ++sample) {
+                std::mt19937 pattern_gen{(unsigned)sample};
+                const PatternMap patterns = make_random_patterns(n_patterns, 8, 3, pattern_gen);
+                const std::vector<Val> values = domain_from_patterns(patterns);
+
+                for (auto mode : {SolverPropagationMode::Revisit, SolverPropagationMode::Incremental}) {
+                    ev2::pcg::NodeGrid grid{grid_size, grid_size};
+                    grid.reset_domains(values);
+                    std::mt19937 gen{(unsigned)sample};
+                    WFCSolver solver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, SolverDomainMode::Bitset};
+                    solver.set_propagation_mode(mode);
+
+                    Timer timer{"solve_grid", false};
+                    solve_grid(grid, solver);
+                    timer.stop();
+
+                    const auto& stats = solver.get_incremental_stats();
+                    std::cout << (mode == SolverPropagationMode::Revisit ? "Revisit" : "Incremental") << "\t" << grid_size << "\t"
+                              << n_patterns << "\t" << timer.elapsed_ms() << "\t" << stats.checks << "\t" << stats.matchings << std::endl;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief grid solves with sequential and parallel propagation, for a growing number of threads up to
+ *  the hardware concurrency. On a single core only the overhead of the Parallel mode is measured.
+ * 
+ */
+void perf_parallel() {
+    const int n_samples = 2;
+    const unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::cout << "Mode" << "\t" << "Threads" << "\t" << "GridSize" << "\t" << "NPatterns" << "\t" << "Time(ms)" << "\n";
+    for (int grid_size : {32, 64}) {
+        for (int n_patterns : {32, 64}) {
+            for (int sample = 0; sample < n_samples; ++sample) {
+                std::mt19937 pattern_gen{(unsigned)sample};
+                const PatternMap patterns = make_random_patterns(n_patterns, 8, 3, pattern_gen);
+                const std::vector<Val> values = domain_from_patterns(patterns);
+
+                auto run = [&](SolverPropagationMode mode, unsigned n_threads) {
+                    ev2::pcg::NodeGrid grid{grid_size, grid_size};
+                    grid.reset_domains(values);
+                    std::mt19937 gen{(unsigned)sample};
+                    WFCSolver solver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, SolverDomainMode::Bitset};
+                    solver.set_propagation_mode(mode);
+                    solver.set_thread_pool(std::make_shared<ThreadPool>(n_threads));
+
+                    Timer timer{"solve_grid", false};
+                    solve_grid(grid, solver);
+                    timer.stop();
+
+                    std::cout << (mode == SolverPropagationMode::Revisit ? "Revisit" : "Parallel") << "\t" << n_threads << "\t"
+                              << grid_size << "\t" << n_patterns << "\t" << timer.elapsed_ms() << std::endl;
+                };
+
+                run(SolverPropagationMode::Revisit, 1);
+                for (unsigned n_threads = 1; n_threads <= max_threads; n_threads *= 2)
+                    run(SolverPropagationMode::Parallel, n_threads);
+            }
+        }
+    }
+}
+
+/**
+ * @brief SparseGraph edge operations on a graph with n_edges random edges
+ * 
+ */
+void perf_sparse_graph() {
+    const int n_samples = 3;
+
+    std::cout << "NNodes" << "\t" << "NEdges" << "\t" << "AddEdge(ms)" << "\t" << "Adjacent(ms)" << "\t"
+              << "AdjacentNodes(ms)" << "\t" << "RemoveEdge(ms)" << "\t" << "HubEdges(ms)" << "\t" << "RemoveNode(ms)" << "\n";
+    for (int n_edges : {10000, 100000}) {
+        const int n_nodes = n_edges / 5;
+        for (int sample = 0; sample < n_samples; ++sample) {
+            std::vector<unique_ptr<GraphNode>> nodes{};
+            for (int i = 0; i < n_nodes; ++i)
+                nodes.push_back(make_unique<GraphNode>("", i * 7 + 1));
+
+            std::mt19937 gen{(unsigned)sample};
+            std::uniform_int_distribution<int> pick{0, n_nodes - 1};
+            std::vector<std::pair<GraphNode*, GraphNode*>> edges{};
+            while ((int)edges.size() < n_edges) {
+                const int a = pick(gen), b = pick(gen);
+                if (a != b)
+                    edges.push_back({nodes[a].get(), nodes[b].get()});
+            }
+
+            SparseGraph<GraphNode> s{};
+            Timer add_timer{"add_edge", false};
+            for (const auto& [a, b] : edges)
+                s.add_edge(a, b, 1.f);
+            add_timer.stop();
+
+            float sum = 0.f;
+            Timer adjacent_timer{"adjacent", false};
+            for (int r = 0; r < 4; ++r)
+                for (const auto& [a, b] : edges)
+                    sum += s.adjacent(b, a) + s.adjacent(a, nodes[pick(gen)].get());
+            adjacent_timer.stop();
+
+            std::size_t degree_sum = 0;
+            Timer nodes_timer{"adjacent_nodes", false};
+            for (const auto& n : nodes)
+                degree_sum += s.adjacent_nodes(n.get()).size();
+            nodes_timer.stop();
+
+            Timer remove_timer{"remove_edge", false};
+            for (const auto& [a, b] : edges)
+                s.remove_edge(a, b);
+            remove_timer.stop();
+
+            // a hub connected to every node, its edges removed one by one in insertion order
+            GraphNode* hub = nodes[0].get();
+            for (int i = 1; i < n_nodes; ++i)
+                s.add_edge(hub, nodes[i].get(), 1.f);
+            Timer hub_timer{"hub_edges", false};
+            for (int i = 1; i < n_nodes; ++i)
+                s.remove_edge(hub, nodes[i].get());
+            hub_timer.stop();
+
+            // remove every node of the full random graph
+            for (const auto& [a, b] : edges)
+                s.add_edge(a, b, 1.f);
+            Timer node_timer{"remove_node", false};
+            for (const auto& n : nodes)
+                s.remove_node(n.get());
+            node_timer.stop();
+            assert(s.get_n_nodes() == 0);
+
+            std::cout << n_nodes << "\t" << n_edges << "\t" << add_timer.elapsed_ms() << "\t" << adjacent_timer.elapsed_ms() << "\t"
+                      << nodes_timer.elapsed_ms() << "\t" << remove_timer.elapsed_ms() << "\t" << hub_timer.elapsed_ms() << "\t"
+                      << node_timer.elapsed_ms() << (sum + degree_sum < 0 ? "!" : "") << std::endl;
+        }
+    }
+}
+
+/**
+ * @brief grid solves with the solver on the virtual graph interface and specialized on graph types
+ * 
+ */
+void perf_graph_dispatch() {
+    const int n_samples = 3;
+
+    std::cout << "Graph" << "\t" << "GridSize" << "\t" << "NPatterns" << "\t" << "Time(ms)" << "\n";
+    for (int grid_size : {16, 32}) {
+        for (int n_patterns : {16, 64}) {
+            for (int sample = 0; sample < n_samples; ++sample) {
+                std::mt19937 pattern_gen{(unsigned)sample};
+                const PatternMap patterns = make_random_patterns(n_patterns, 8, 3, pattern_gen);
+                const std::vector<Val> values = domain_from_patterns(patterns);
+
+                auto run = [&](const char* name, auto make_solver) {
+                    ev2::pcg::NodeGrid grid{grid_size, grid_size};
+                    grid.reset_domains(values);
+                    std::mt19937 gen{(unsigned)sample};
+                    auto solver = make_solver(grid, gen);
+
+                    Timer timer{"solve", false};
+                    for (int y = 0; y < grid.height; ++y)
+                        for (int x = 0; x < grid.width; ++x)
+                            if (solver.domain_size(grid.at(x, y)) > 1)
+                                solver.step_wfc(grid.at(x, y));
+                    timer.stop();
+
+                    std::cout << name << "\t" << grid_size << "\t" << n_patterns << "\t" << timer.elapsed_ms() << std::endl;
+                };
+
+                run("Virtual", [&](ev2::pcg::NodeGrid& grid, std::mt19937& gen) {
+                    return WFCSolver{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, SolverDomainMode::Bitset};
+                });
+                run("Sparse", [&](ev2::pcg::NodeGrid& grid, std::mt19937& gen) {
+                    return BasicWFCSolver<SparseGraph<DGraphNode>>{&grid.get_graph(), patterns, gen, true, SolverValidMode::Correct, SolverDomainMode::Bitset};
+                });
+                run("Grid", [&](ev2::pcg::NodeGrid& grid, std::mt19937& gen) {
+                    return BasicWFCSolver<GridGraph<DGraphNode>>{&grid.get_grid_graph(), patterns, gen, true, SolverValidMode::Correct, SolverDomainMode::Bitset};
+                });
+            }
+        }
+    }
+}
+
+/**
+ * @brief max flow on layered networks of thousands of nodes, the reference Edmonds-Karp is only run on the smaller ones
+ * 
+ */
+void perf_max_flow() {
+    const int n_samples = 2;
+
+    std::cout << "Algorithm" << "\t" << "NNodes" << "\t" << "Flow" << "\t" << "Time(ms)" << "\n";
+    for (int layer_size : {50, 250, 1000}) {
+        for (int sample = 0; sample < n_samples; ++sample) {
+            const int n_layers = 4;
+            const int n = n_layers * layer_size + 2;
+            std::mt19937 gen{(unsigned)sample};
+            DenseGraph<GraphNode> g{n, true};
+            std::vector<unique_ptr<GraphNode>> nodes{};
+            make_layered_network(g, nodes, n_layers, layer_size, 4, true, gen);
+            GraphNode* s = nodes[0].get();
+            GraphNode* t = nodes[1].get();
+
+            auto report = [&](const char* name, auto fn) {
+                Timer timer{name, false};
+                const float flow = fn();
+                timer.stop();
+                std::cout << name << "\t" << n << "\t" << flow << "\t" << timer.elapsed_ms() << std::endl;
+            };
+
+            if (n <= 1024)
+                report("Reference", [&]() {return ford_fulkerson_reference(g, s, t, (DenseGraph<GraphNode>*)nullptr);});
+            report("FordFulkerson", [&]() {return ford_fulkerson(g, s, t, (DenseGraph<GraphNode>*)nullptr);});
+
+            FlowNetwork network{n};
+            for (int u = 0; u < n; ++u)
+                for (int v = 0; v < n; ++v)
+                    if (u != v && g.adjacent(u, v) > 0.f)
+                        network.add_edge(u, v, g.adjacent(u, v));
+            const int s_ind = g.get_node_index(s);
+            const int t_ind = g.get_node_index(t);
+            report("Dinic", [&]() {return network.max_flow_dinic(s_ind, t_ind);});
+            network.reset_flow();
+            report("PushRelabel", [&]() {return network.max_flow_push_relabel(s_ind, t_ind);});
+
+            // reachability from every node of the first layer
+            std::vector<GraphNode*> path{};
+            report("BFS", [&]() {
+                int found = 0;
+                for (int i = 0; i < layer_size; ++i)
+                    found += g.bfs(nodes[2 + i].get(), t, path);
+                return (float)found;
+            });
+            g.set_bit_packed(true);
+            report("BFSBits", [&]() {
+                int found = 0;
+                for (int i = 0; i < layer_size; ++i)
+                    found += g.bfs(nodes[2 + i].get(), t, path);
+                return (float)found;
+            });
+        }
+    }
+}
+
+/**
+ * @brief throughput of the implicit grid solver on large grids, next to the node grid solver on the sizes it can handle
+ * 
+ */
+void perf_grid_solver() {
+    const int n_samples = 2;
+
+    std::cout << "Solver" << "\t" << "GridSize" << "\t" << "NPatterns" << "\t" << "Time(ms)" << "\t" << "CellsPerSec" << "\t" << "BytesPerCell" << "\t" << "Empty" << "\n";
+    for (int grid_size : {64, 256, 1024}) {
+        for (int n_patterns : {16, 64}) {
+            for (int sample = 0; sample < n_samples; ++sample) {
+                std::mt19937 pattern_gen{(unsigned)sample};
+                const PatternMap patterns = make_random_patterns(n_patterns, 8, 3, pattern_gen);
+                const std::vector<Val> values = domain_from_patterns(patterns);
+                const double n_cells = (double)grid_size * grid_size;
+
+                {
+                    std::mt19937 gen{(unsigned)sample};
+                    GridWFCSolver solver{grid_size, grid_size, patterns, gen};
+                    solver.reset_domains();
+
+                    Timer timer{"solve", false};
+                    const int empty = solver.solve();
+                    timer.stop();
+
+                    std::cout << "Implicit" << "\t" << grid_size << "\t" << n_patterns << "\t" << timer.elapsed_ms() << "\t"
+                        << n_cells / (timer.elapsed_ms() / 1000.0) << "\t" << solver.cell_bytes() << "\t" << empty << std::endl;
+                }
+
+                if (grid_size <= 64) {
+                    ev2::pcg::NodeGrid grid{grid_size, grid_size};
+                    grid.reset_domains(values);
+                    std::mt19937 gen{(unsigned)sample};
+                    BasicWFCSolver<GridGraph<DGraphNode>> solver{&grid.get_grid_graph(), patterns, gen, true,
+                        SolverValidMode::Correct, SolverDomainMode::Bitset};
+
+                    Timer timer{"solve", false};
+                    int empty = 0;
+                    for (int c = 0; c < grid_size * grid_size; ++c) {
+                        DGraphNode* node = grid.at(c / grid_size, c % grid_size);
+                        if (solver.domain_size(node) > 1)
+                            solver.step_wfc(node);
+                    }
+                    timer.stop();
+                    for (int c = 0; c < grid_size * grid_size; ++c)
+                        empty += grid.at(c / grid_size, c % grid_size)->domain.empty();
+
+                    std::cout << "NodeGrid" << "\t" << grid_size << "\t" << n_patterns << "\t" << timer.elapsed_ms() << "\t"
+                        << n_cells / (timer.elapsed_ms() / 1000.0) << "\t" << "-" << "\t" << empty << std::endl;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief throughput of the voxel solver for both neighborhoods
+ * 
+ */
+void perf_voxel_solver() {
+    std::cout << "Neighborhood" << "\t" << "GridSize" << "\t" << "NPatterns" << "\t" << "Time(ms)" << "\t" << "CellsPerSec" << "\t" << "BytesPerCell" << "\t" << "Empty" << "\n";
+    for (auto neighborhood : {VoxelNeighborhood::Faces, VoxelNeighborhood::Full}) {
+        for (int grid_size : {32, 64, 128, 256}) {
+            for (int n_patterns : {16, 64}) {
+                if (neighborhood == VoxelNeighborhood::Full && grid_size > 32)
+                    continue;
+                if (grid_size > 64 && n_patterns > 16)
+                    continue;
+                std::mt19937 pattern_gen{0};
+                const PatternMap patterns = make_random_patterns(n_patterns, 8, neighborhood == VoxelNeighborhood::Faces ? 2 : 4, pattern_gen);
+
+                std::mt19937 gen{0};
+                VoxelWFCSolver solver{grid_size, grid_size, grid_size, neighborhood, patterns, gen};
+                solver.reset_domains();
+
+                Timer timer{"solve", false};
+                const int empty = solver.solve();
+                timer.stop();
+
+                std::cout << (int)neighborhood << "\t" << grid_size << "\t" << n_patterns << "\t" << timer.elapsed_ms() << "\t"
+                    << (double)solver.get_n_cells() / (timer.elapsed_ms() / 1000.0) << "\t" << solver.cell_bytes() << "\t" << empty << std::endl;
+            }
+        }
+    }
+}
+
+/**
+ * @brief tile adjacency rules against pattern requirements on the same grids
+ * 
+ */
+void perf_adjacency_model() {
+    std::cout << "Model" << "\t" << "Grid" << "\t" << "NPatterns" << "\t" << "Time(ms)" << "\t" << "CellsPerSec" << "\t" << "BytesPerCell" << "\t" << "Empty" << "\n";
+    for (int n_patterns : {16, 64}) {
+        std::mt19937 pattern_gen{0};
+        const PatternMap patterns = make_random_patterns(n_patterns, 8, 3, pattern_gen);
+
+        auto make_rules = [&](int n_directions) {
+            std::mt19937 rule_gen{1};
+            std::bernoulli_distribution allow{0.5};
+            AdjacencyRules rules{n_directions};
+            for (const auto& [a, pa] : patterns)
+                for (int d = 0; d < n_directions; ++d)
+                    for (const auto& [b, pb] : patterns)
+                        if (allow(rule_gen))
+                            rules.allow(a, d, b);
+            return rules;
+        };
+
+        auto report = [&](const char* model, const char* grid, auto& solver, int n_cells) {
+            Timer timer{"solve", false};
+            const int empty = solver.solve();
+            timer.stop();
+            std::cout << model << "\t" << grid << "\t" << n_patterns << "\t" << timer.elapsed_ms() << "\t"
+                << (double)n_cells / (timer.elapsed_ms() / 1000.0) << "\t" << solver.cell_bytes() << "\t" << empty << std::endl;
+        };
+
+        for (int size : {256, 1024}) {
+            const std::string name = std::to_string(size) + "^2";
+            for (bool adjacency : {false, true}) {
+                if (!adjacency && size > 256)
+                    continue;
+                std::mt19937 gen{0};
+                GridWFCSolver solver{size, size, patterns, gen};
+                solver.reset_domains();
+                if (adjacency)
+                    solver.set_adjacency_rules(make_rules(GridWFCSolver::n_directions));
+                report(adjacency ? "Adjacency" : "Patterns", name.c_str(), solver, solver.get_n_cells());
+            }
+        }
+
+        for (bool adjacency : {false, true}) {
+            std::mt19937 gen{0};
+            VoxelWFCSolver solver{64, 64, 64, VoxelNeighborhood::Faces, patterns, gen};
+            solver.reset_domains();
+            if (adjacency)
+                solver.set_adjacency_rules(make_rules(6));
+            report(adjacency ? "Adjacency" : "Patterns", "64^3", solver, solver.get_n_cells());
+        }
+    }
+}
+
+/**
+ * @brief chunked world throughput, memory stays at the resident chunks whatever the world size
+ * 
+ */
+void perf_chunked_world() {
+    const auto root = std::filesystem::temp_directory_path() / "wfc_perf_chunked_world";
+    const std::size_t max_resident = 32;
+
+    std::mt19937 pattern_gen{0};
+    const PatternMap patterns = make_random_patterns(16, 8, 3, pattern_gen);
+    std::mt19937 rule_gen{1};
+    std::bernoulli_distribution allow{0.5};
+    AdjacencyRules rules{GridWFCSolver::n_directions};
+    for (const auto& [a, pa] : patterns)
+        for (int d = 0; d < GridWFCSolver::n_directions; ++d)
+            for (const auto& [b, pb] : patterns)
+                if (allow(rule_gen))
+                    rules.allow(a, d, b);
+
+    std::cout << "Model" << "\t" << "ChunkSize" << "\t" << "Chunks" << "\t" << "Threads" << "\t" << "Time(ms)" << "\t" << "CellsPerSec"
+        << "\t" << "ResidentChunks" << "\t" << "ResidentBytes" << "\t" << "Attempts" << "\t" << "FailedCells" << "\n";
+    for (bool adjacency : {false, true}) {
+        for (int chunk_size : {32, 64}) {
+            for (int n_chunks : {8, 32}) {
+                for (unsigned n_threads : {1u, std::max(1u, std::thread::hardware_concurrency())}) {
+                    std::filesystem::remove_all(root);
+                    ChunkedWorld world{chunk_size, patterns, root, 0, max_resident};
+                    if (adjacency)
+                        world.set_adjacency_rules(rules);
+                    world.set_thread_pool(std::make_shared<ThreadPool>(n_threads));
+
+                    Timer timer{"generate", false};
+                    const auto& stats = world.generate(0, 0, n_chunks, n_chunks);
+                    timer.stop();
+
+                    const double n_cells = (double)n_chunks * n_chunks * chunk_size * chunk_size;
+                    std::cout << (adjacency ? "Adjacency" : "Patterns") << "\t" << chunk_size << "\t" << n_chunks * n_chunks << "\t" << n_threads
+                        << "\t" << timer.elapsed_ms() << "\t" << n_cells / (timer.elapsed_ms() / 1000.0) << "\t" << world.resident_chunks()
+                        << "\t" << world.resident_chunks() * chunk_size * chunk_size * sizeof(std::uint16_t)
+                        << "\t" << stats.attempts << "\t" << stats.failed_cells << std::endl;
+                }
+            }
+        }
+    }
+    std::filesystem::remove_all(root);
+}
+
+/**
+ * @brief one large component and many small ones, solved node by node against the partitioned solver.
+ *  The thread rows only show scaling on a machine with that many cores, with fewer cores they
+ *  measure the overhead of the halo and reconcile passes.
+ * 
+ */
+void perf_partitioned_solve() {
+    std::mt19937 pattern_gen{0};
+    const PatternMap patterns = make_random_patterns(16, 8, 3, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+
+    ComponentGraph g{};
+    g.add_grid(400, 400);
+    for (int i = 0; i < 64; ++i)
+        g.add_grid(20, 20);
+    CSRGraph<DGraphNode> csr{g.graph};
+    const double n_nodes = csr.get_n_nodes();
+
+    std::cout << "Solver" << "\t" << "Nodes" << "\t" << "Threads" << "\t" << "Parts" << "\t" << "Time(ms)" << "\t" << "NodesPerSec"
+        << "\t" << "Halo" << "\t" << "Conflicts" << "\t" << "Empty" << "\n";
+    {
+        g.reset_domains(values);
+        std::mt19937 gen{0};
+        BasicWFCSolver<CSRGraph<DGraphNode>> solver{&csr, patterns, gen, false, SolverValidMode::Correct, SolverDomainMode::Bitset};
+        Timer timer{"solve", false};
+        for (int i = 0; i < csr.get_n_nodes(); ++i)
+            if (solver.domain_size(csr.node(i)) > 1)
+                solver.step_wfc(csr.node(i));
+        timer.stop();
+        int empty = 0;
+        for (auto& n : g.nodes)
+            empty += n->domain.empty();
+        std::cout << "Sequential" << "\t" << n_nodes << "\t" << 1 << "\t" << 1 << "\t" << timer.elapsed_ms() << "\t"
+            << n_nodes / (timer.elapsed_ms() / 1000.0) << "\t" << 0 << "\t" << 0 << "\t" << empty << std::endl;
+    }
+
+    for (unsigned n_threads : {1u, 2u, 4u, std::max(1u, std::thread::hardware_concurrency())}) {
+        for (int max_part_nodes : {4096, 32768}) {
+            g.reset_domains(values);
+            ThreadPool pool{n_threads};
+            PartitionedSolveArgs args{};
+            args.max_part_nodes = max_part_nodes;
+            args.constraint_prop_solved = false;
+            Timer timer{"solve", false};
+            const auto stats = wfc_solve_partitioned(csr, patterns, 0, pool, args);
+            timer.stop();
+            std::cout << "Partitioned" << "\t" << n_nodes << "\t" << n_threads << "\t" << stats.n_parts << "\t" << timer.elapsed_ms() << "\t"
+                << n_nodes / (timer.elapsed_ms() / 1000.0) << "\t" << stats.n_halo_nodes << "\t" << stats.n_conflicts << "\t" << stats.n_empty << std::endl;
+        }
+    }
+}
+
+void perf_batch_solve() {
+    std::mt19937 pattern_gen{0};
+    const PatternMap patterns = make_random_patterns(64, 8, 3, pattern_gen);
+    const std::vector<Val> values = domain_from_patterns(patterns);
+    const auto table = std::make_shared<const PatternTable>(patterns);
+
+    ComponentGraph g{};
+    g.add_grid(48, 48);
+    g.reset_domains(values);
+    CSRGraph<DGraphNode> layout{g.graph};
+    std::vector<std::uint64_t> seeds(64);
+    std::iota(seeds.begin(), seeds.end(), 0);
+
+    std::cout << "Solver" << "\t" << "Runs" << "\t" << "Threads" << "\t" << "Time(ms)" << "\t" << "RunsPerSec" << "\t" << "MeanRun(ms)" << "\n";
+    {
+        // one solver per run, each compiling its own copy of the patterns and starting with an empty cache
+        Timer timer{"solve", false};
+        for (std::uint64_t seed : seeds) {
+            g.reset_domains(values);
+            std::mt19937 gen{(std::uint32_t)ev2::mix64(seed)};
+            BasicWFCSolver<CSRGraph<DGraphNode>> solver{&layout, patterns, gen, true, SolverValidMode::Correct, SolverDomainMode::Bitset};
+            solver.set_validity_cache_enabled(true);
+            for (int i = 0; i < layout.get_n_nodes(); ++i)
+                if (solver.domain_size(layout.node(i)) > 1)
+                    solver.step_wfc(layout.node(i));
+        }
+        timer.stop();
+        std::cout << "PerRunSolver" << "\t" << seeds.size() << "\t" << 1 << "\t" << timer.elapsed_ms() << "\t"
+            << seeds.size() / (timer.elapsed_ms() / 1000.0) << "\t" << timer.elapsed_ms() / seeds.size() << std::endl;
+    }
+    g.reset_domains(values);
+
+    for (unsigned n_threads : {1u, 2u, 4u, std::max(1u, std::thread::hardware_concurrency())}) {
+        ThreadPool pool{n_threads};
+        const auto result = wfc_solve_batch(layout, table, seeds, pool);
+        double run_ms = 0.0;
+        for (const auto& run : result.runs)
+            run_ms += run.solve_ms;
+        std::cout << "Batch" << "\t" << seeds.size() << "\t" << n_threads << "\t" << result.wall_ms << "\t"
+            << result.runs_per_second() << "\t" << run_ms / seeds.size() << std::endl;
+    }
+}
+
 int main(int argc, const char** argv) {
 #ifdef ENABLE_TESTS
     sparse_test_empty();
@@ -859,6 +3233,8 @@ int main(int argc, const char** argv) {
     sparse_test_remove2();
 
     sparse_directed_add();
+    sparse_adjacency_swap_remove();
+    csr_snapshot_matches_sparse();
 
     dense_test_empty();
     dense_test_add();
@@ -875,12 +3251,47 @@ int main(int argc, const char** argv) {
     dense_flow_soln_directional0();
     dense_flow_soln_directional1();
     dense_flow_soln_directional2();
+    flow_network_matches_reference();
+    dense_bfs_bit_packed();
 
     // patterns
     test_pattern_validity0();
     test_pattern_validity1();
     test_pattern_validity2();
     test_pattern_validity3();
+    test_pattern_validity_matches_max_flow();
+    test_pattern_validity_tiered();
+
+    // domains
+    test_domain_bits();
+    wfc_solver_grid_bitset_matches_vector();
+    wfc_solver_bitset_external_domain();
+    wfc_solver_validity_cache();
+    wfc_solver_stats();
+    wfc_solver_propagate_no_alloc();
+    test_pattern_table();
+    wfc_solver_weighted_pick();
+    wfc_solver_trail_rewind();
+    wfc_backtracking_solver();
+    wfc_solver_incremental_fixed_point();
+    wfc_solver_incremental_reset_supports();
+    wfc_solver_slots_bounded();
+    wfc_solver_parallel_deterministic();
+    wfc_solver_csr_snapshot();
+    wfc_solver_static_graph_types();
+    wfc_grid_solver_matches_node_grid();
+    wfc_voxel_solver_layout();
+    wfc_voxel_solver_matches_graph();
+    wfc_adjacency_tiles();
+    wfc_adjacency_supports_match_revise();
+    wfc_chunked_world();
+    wfc_partition_graph();
+    wfc_solver_partitioned_deterministic();
+    wfc_batch_solve_deterministic();
+
+    // containers
+    test_indexed_heap();
+    test_flat_hash_map();
 
     // wfc
     // wfc_solver_grid0();
@@ -901,6 +3312,48 @@ int main(int argc, const char** argv) {
         case '3':
             perf_exp(validity_timing_DR_1);
             break;
+        case '4':
+            perf_domain_mode();
+            break;
+        case '5':
+            perf_validity_tiered();
+            break;
+        case '6':
+            perf_backtracking();
+            break;
+        case '7':
+            perf_incremental();
+            break;
+        case '8':
+            perf_parallel();
+            break;
+        case '9':
+            perf_sparse_graph();
+            break;
+        case 'a':
+            perf_graph_dispatch();
+            break;
+        case 'b':
+            perf_max_flow();
+            break;
+        case 'c':
+            perf_grid_solver();
+            break;
+        case 'd':
+            perf_voxel_solver();
+            break;
+        case 'e':
+            perf_adjacency_model();
+            break;
+        case 'f':
+            perf_chunked_world();
+            break;
+        case 'g':
+            perf_partitioned_solve();
+            break;
+        case 'h':
+            perf_batch_solve();
+            break;
         default:
             break;
     }